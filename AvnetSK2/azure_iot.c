@@ -6,6 +6,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
 #include <time.h>
 
 // Azure IoT SDK
@@ -22,6 +25,7 @@
 #include "epoll_timerfd_utilities.h"
 #include "azure_iot.h"
 #include "azure_iot_dps.h"
+#include "azure_iot_transport.h"
 
 #define MODULE "[IOT] "
 #define MSEC_TO_NSEC(ms) (ms*1000*1000)
@@ -61,6 +65,62 @@ iothub_LL_callbacks_t lstIotHubCallbacks = {
 /// @brief    Message Id counter (for system property)
 static unsigned int uMessageId = 0;
 
+/// @brief    Slot of a message enqueued to the IoT Hub client and not confirmed yet
+typedef struct {
+    bool bInUse;
+    unsigned int uMessageId;
+    struct timespec tsEnqueued;
+    size_t nSize;
+    char strComponent[AZURE_IOT_COMPONENT_NAME_SIZE];
+} inflight_message_t;
+
+/// @brief    Pre-allocated in-flight table. The confirmation context is the message id, not a slot
+///           pointer, so a late confirmation of a timed out message cannot release a reused slot.
+static inflight_message_t aInFlightMessages[AZURE_IOT_MAX_INFLIGHT_MESSAGES];
+static size_t nInFlightMessages = 0;
+
+/// @brief    Reported property updates sent and not confirmed yet
+static size_t nPendingTwinReports = 0;
+
+/// @brief    Reported state update waiting for its confirmation callback. Like in-flight messages
+///           the SDK context is the report id, so late callbacks of a lost connection are ignored.
+typedef struct {
+    unsigned int uReportId;     ///< 0: slot unused
+    TwinReportConfirmationFnType fnConfirmation;
+    void* pContext;
+} twin_confirmation_t;
+
+static twin_confirmation_t aTwinConfirmations[AZURE_IOT_TWIN_CONFIRMATIONS];
+static unsigned int uTwinReportId = 0;
+
+/// @brief    Classes whose messages are held back instead of dropped (critical and response)
+#define PENDING_CLASSES (AZURE_IOT_PRIORITY_TELEMETRY)
+
+/// @brief    FIFO of held back messages of one class
+typedef struct {
+    IOTHUB_MESSAGE_HANDLE ahMessages[AZURE_IOT_PENDING_MESSAGES];
+    size_t nHead;
+    size_t nCount;
+} pending_messages_t;
+
+static pending_messages_t aPendingMessages[PENDING_CLASSES];
+static unsigned int anDroppedMessages[AZURE_IOT_PRIORITY_COUNT];
+
+/// @brief    Token bucket in token milliseconds: a message costs RATE_TOKEN, every elapsed
+///           millisecond adds nRateLimitPerHour. No limit while nRateLimitPerHour is 0.
+#define RATE_TOKEN (3600LL * 1000LL)
+static unsigned int nRateLimitPerHour = 0;
+static unsigned int nRateLimitBurst = 0;
+static long long nRateTokens = 0;
+static struct timespec tsRateRefill;
+
+/// @brief    Delivery statistics per component, fixed memory
+static delivery_stats_t aDeliveryStats[AZURE_IOT_LATENCY_COMPONENTS];
+static size_t nDeliveryStatsComponents = 0;
+
+static const char cstrDefaultComponent[] = "default";
+static const char cstrOtherComponents[] = "other";
+
 /// @brief IoT Hub Client Handle is kept in azure_iot_dps.c/_hub.c/_edge.c 
 IOTHUB_DEVICE_CLIENT_LL_HANDLE hIoTHubClient = NULL;
 
@@ -192,6 +252,15 @@ static void hubConnectionStatusChangedHandler(IOTHUB_CLIENT_CONNECTION_STATUS re
 
     if (!bIoTHubAuthenticated) {
         Log_Debug("[IoT] IoT Hub disconnected with %s\n", reasonString);
+        // confirmations of the previous connection will not arrive
+        nPendingTwinReports = 0;
+        for (size_t i = 0; i < AZURE_IOT_TWIN_CONFIRMATIONS; i++) {
+            twin_confirmation_t confirmation = aTwinConfirmations[i];
+            if (confirmation.uReportId != 0) {
+                aTwinConfirmations[i].uReportId = 0;
+                confirmation.fnConfirmation(0, confirmation.pContext);
+            }
+        }
     } else {
         Log_Debug("[IoT] IoT Hub authenticated (%s).\n", reasonString);
     }
@@ -236,7 +305,263 @@ IOTHUB_MESSAGE_HANDLE AzureIoT_CreateIoTHubMessage(const char* cstrMessage, cons
 }
 
 
+/**
+* @brief    Finds or adds the statistics entry of a component. Once the table is full, the last
+*           entry collects all further components.
+*/
+static delivery_stats_t *getDeliveryStats(const char *cstrComponent)
+{
+    if (cstrComponent[0] == '\0') {
+        cstrComponent = cstrDefaultComponent;
+    }
+    for (size_t i = 0; i < nDeliveryStatsComponents; i++) {
+        if (strcmp(aDeliveryStats[i].strComponent, cstrComponent) == 0) {
+            return &aDeliveryStats[i];
+        }
+    }
+
+    if (nDeliveryStatsComponents == AZURE_IOT_LATENCY_COMPONENTS) {
+        return &aDeliveryStats[AZURE_IOT_LATENCY_COMPONENTS - 1];
+    }
+
+    delivery_stats_t *pStats = &aDeliveryStats[nDeliveryStatsComponents++];
+    if (nDeliveryStatsComponents == AZURE_IOT_LATENCY_COMPONENTS) {
+        cstrComponent = cstrOtherComponents;
+    }
+    strncpy(pStats->strComponent, cstrComponent, sizeof(pStats->strComponent) - 1);
+    return pStats;
+}
+
+/**
+* @brief    Accounts the outcome of an in-flight message in the statistics of its component
+*/
+static void recordDelivery(const inflight_message_t *pSlot, IOTHUB_CLIENT_CONFIRMATION_RESULT result)
+{
+    delivery_stats_t *pStats = getDeliveryStats(pSlot->strComponent);
+
+    if (result == IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT) {
+        pStats->nTimeouts++;
+        return;
+    }
+    if (result != IOTHUB_CLIENT_CONFIRMATION_OK) {
+        pStats->nErrors++;
+        return;
+    }
+
+    struct timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+    unsigned int nLatencyMs = (unsigned int)((tsNow.tv_sec - pSlot->tsEnqueued.tv_sec) * 1000 
+        + (tsNow.tv_nsec - pSlot->tsEnqueued.tv_nsec) / 1000000);
+
+    unsigned int nBucket = 0;
+    unsigned int nBucketLimit = AZURE_IOT_LATENCY_BASE_MS;
+    while ((nLatencyMs >= nBucketLimit) && (nBucket < AZURE_IOT_LATENCY_BUCKETS - 1)) {
+        nBucketLimit <<= 1;
+        nBucket++;
+    }
+
+    pStats->nConfirmed++;
+    pStats->anLatencyBuckets[nBucket]++;
+    pStats->nTotalLatencyMs += nLatencyMs;
+    if (nLatencyMs > pStats->nMaxLatencyMs) {
+        pStats->nMaxLatencyMs = nLatencyMs;
+    }
+}
+
+/**
+* @brief    Releases in-flight slots of messages not confirmed within AZURE_IOT_INFLIGHT_TIMEOUT_SECONDS.
+*/
+static void expireInFlightMessages(const struct timespec *ptsNow)
+{
+    for (size_t i = 0; i < AZURE_IOT_MAX_INFLIGHT_MESSAGES; i++) {
+        inflight_message_t *pSlot = &aInFlightMessages[i];
+        if (pSlot->bInUse && (ptsNow->tv_sec - pSlot->tsEnqueued.tv_sec >= AZURE_IOT_INFLIGHT_TIMEOUT_SECONDS)) {
+            Log_Debug(MODULE "WARNING: message id '%u' not confirmed within %d seconds.\n", 
+                pSlot->uMessageId, AZURE_IOT_INFLIGHT_TIMEOUT_SECONDS);
+            recordDelivery(pSlot, IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT);
+            pSlot->bInUse = false;
+            nInFlightMessages--;
+        }
+    }
+}
+
+/**
+* @brief    Takes a free in-flight slot, expiring timed out messages if the table is full.
+* @return   free slot or NULL if all messages are still in flight
+*/
+static inflight_message_t *acquireInFlightSlot(const struct timespec *ptsNow)
+{
+    if (nInFlightMessages >= AZURE_IOT_MAX_INFLIGHT_MESSAGES) {
+        expireInFlightMessages(ptsNow);
+    }
+    for (size_t i = 0; i < AZURE_IOT_MAX_INFLIGHT_MESSAGES; i++) {
+        if (!aInFlightMessages[i].bInUse) {
+            return &aInFlightMessages[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+* @brief    Finds the in-flight slot of a message id
+* @return   slot or NULL if the message already timed out
+*/
+static inflight_message_t *findInFlightSlot(unsigned int uId)
+{
+    for (size_t i = 0; i < AZURE_IOT_MAX_INFLIGHT_MESSAGES; i++) {
+        if (aInFlightMessages[i].bInUse && (aInFlightMessages[i].uMessageId == uId)) {
+            return &aInFlightMessages[i];
+        }
+    }
+    return NULL;
+}
+
+
+/**
+* @brief    In-flight share of a message class, see AZURE_IOT_PRIORITY
+*/
+static size_t inFlightLimit(AZURE_IOT_PRIORITY priority)
+{
+    switch (priority) {
+    case AZURE_IOT_PRIORITY_CRITICAL:
+        return AZURE_IOT_MAX_INFLIGHT_MESSAGES;
+    case AZURE_IOT_PRIORITY_RESPONSE:
+        return AZURE_IOT_MAX_INFLIGHT_MESSAGES - AZURE_IOT_MAX_INFLIGHT_MESSAGES / 8;
+    case AZURE_IOT_PRIORITY_TELEMETRY:
+        return AZURE_IOT_MAX_INFLIGHT_MESSAGES - AZURE_IOT_MAX_INFLIGHT_MESSAGES / 4;
+    default:
+        return AZURE_IOT_MAX_INFLIGHT_MESSAGES / 2;
+    }
+}
+
+/**
+* @brief    True if the class still has room in the in-flight table, expiring timed out messages if not
+*/
+static bool hasInFlightRoom(AZURE_IOT_PRIORITY priority, const struct timespec *ptsNow)
+{
+    if (nInFlightMessages >= inFlightLimit(priority)) {
+        expireInFlightMessages(ptsNow);
+    }
+    return nInFlightMessages < inFlightLimit(priority);
+}
+
+/**
+* @brief    Adds the tokens earned since the last refill, capped at the bucket size
+*/
+static void refillRateTokens(const struct timespec *ptsNow)
+{
+    long long nElapsedMs = (long long)(ptsNow->tv_sec - tsRateRefill.tv_sec) * 1000
+        + (ptsNow->tv_nsec - tsRateRefill.tv_nsec) / (1000 * 1000);
+    if (nElapsedMs <= 0) {
+        return;
+    }
+
+    // advance by whole milliseconds only, the remainder counts towards the next refill
+    tsRateRefill.tv_sec += (time_t)(nElapsedMs / 1000);
+    tsRateRefill.tv_nsec += (long)(nElapsedMs % 1000) * 1000 * 1000;
+    if (tsRateRefill.tv_nsec >= 1000 * 1000 * 1000) {
+        tsRateRefill.tv_sec++;
+        tsRateRefill.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    nRateTokens += nElapsedMs * nRateLimitPerHour;
+    if (nRateTokens > (long long)nRateLimitBurst * RATE_TOKEN) {
+        nRateTokens = (long long)nRateLimitBurst * RATE_TOKEN;
+    }
+}
+
+/**
+* @brief    True if the token bucket admits a message of the class, see AzureIoT_SetRateLimit()
+*/
+static bool hasRateTokens(AZURE_IOT_PRIORITY priority, const struct timespec *ptsNow)
+{
+    if (nRateLimitPerHour == 0) {
+        return true;
+    }
+
+    refillRateTokens(ptsNow);
+    switch (priority) {
+    case AZURE_IOT_PRIORITY_CRITICAL:
+        return nRateTokens > -(long long)nRateLimitBurst * RATE_TOKEN;
+    case AZURE_IOT_PRIORITY_BULK:
+        return nRateTokens >= (long long)((nRateLimitBurst + 1) / 2) * RATE_TOKEN;
+    default:
+        return nRateTokens >= RATE_TOKEN;
+    }
+}
+
+/**
+* @brief    True if messages of this or a higher class are held back
+*/
+static bool isHeldBack(AZURE_IOT_PRIORITY priority)
+{
+    for (int nClass = AZURE_IOT_PRIORITY_CRITICAL; (nClass <= (int)priority) && (nClass < PENDING_CLASSES); nClass++) {
+        if (aPendingMessages[nClass].nCount > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* @brief    Hands the message over to the IoT Hub client and tracks it in the in-flight table.
+*           The caller checked for room, the message handle is destroyed.
+*/
+static IOTHUB_CLIENT_RESULT enqueueMessage(IOTHUB_MESSAGE_HANDLE hMessage, const struct timespec *ptsNow)
+{
+    inflight_message_t *pSlot = acquireInFlightSlot(ptsNow);
+    if (NULL == pSlot) {
+        Log_Debug(MODULE "WARNING: %d messages in flight, message dropped.\n", AZURE_IOT_MAX_INFLIGHT_MESSAGES);
+        IoTHubMessage_Destroy(hMessage);
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    // Set MessageId as running message count value. The SDK keeps its own copy of the string.
+    char strMessageId[16];
+    unsigned int uId = uMessageId++;
+    snprintf(strMessageId, sizeof(strMessageId), "%u", uId);
+    (void)IoTHubMessage_SetMessageId(hMessage, strMessageId);
+
+    const unsigned char *pbPayload = NULL;
+    size_t nPayloadSize = 0;
+    (void)IoTHubMessage_GetByteArray(hMessage, &pbPayload, &nPayloadSize);
+    const char *cstrComponent = IoTHubMessage_GetProperty(hMessage, "$.sub");
+
+    IOTHUB_CLIENT_RESULT result = pAzureIoTTransport->SendEventAsync(hIoTHubClient, hMessage, 
+        sendMessageConfirmationCallback, /*&callback_param*/ (void *)(uintptr_t)uId);
+
+    if ( IOTHUB_CLIENT_OK != result) {
+        Log_Debug(MODULE "ERROR: _LL_SendEvent returns %s\n",IOTHUB_CLIENT_RESULTStrings(result));
+    }
+    else {
+        pSlot->bInUse = true;
+        pSlot->uMessageId = uId;
+        pSlot->tsEnqueued = *ptsNow;
+        pSlot->nSize = nPayloadSize;
+        strncpy(pSlot->strComponent, (cstrComponent != NULL) ? cstrComponent : "", sizeof(pSlot->strComponent) - 1);
+        pSlot->strComponent[sizeof(pSlot->strComponent) - 1] = '\0';
+        nInFlightMessages++;
+        if (nRateLimitPerHour > 0) {
+            nRateTokens -= RATE_TOKEN;
+        }
+
+        Log_Debug(MODULE "IoTHubClient accepted message id '%s' with payload '%s'\n", 
+            IoTHubMessage_GetMessageId(hMessage), IoTHubMessage_GetString(hMessage));
+        AzureIoT_DPS_RequestDoWork();
+    }
+
+    IoTHubMessage_Destroy(hMessage);
+    return result;
+}
+
+
 IOTHUB_CLIENT_RESULT AzureIoT_SendIoTHubMessage(IOTHUB_MESSAGE_HANDLE hMessage)
+{
+    return AzureIoT_SendIoTHubMessageWithPriority(hMessage, AZURE_IOT_PRIORITY_TELEMETRY);
+}
+
+
+IOTHUB_CLIENT_RESULT AzureIoT_SendIoTHubMessageWithPriority(IOTHUB_MESSAGE_HANDLE hMessage, AZURE_IOT_PRIORITY priority)
 {
     if ( NULL == hIoTHubClient) {
         Log_Debug(cstrWarnNotInitialized);
@@ -247,26 +572,137 @@ IOTHUB_CLIENT_RESULT AzureIoT_SendIoTHubMessage(IOTHUB_MESSAGE_HANDLE hMessage)
         Log_Debug(cstrWarnNotInitialized);
         return IOTHUB_CLIENT_INVALID_ARG;
     }
+    if ((priority < AZURE_IOT_PRIORITY_CRITICAL) || (priority >= AZURE_IOT_PRIORITY_COUNT)) {
+        priority = AZURE_IOT_PRIORITY_BULK;
+    }
 
-    // Set MessageId as running message count value. Keep heap allocated buffer until confirmation!
-    #define MESSAGE_ID_SIZE  16
-    char *pszMessageId = (char *)malloc(MESSAGE_ID_SIZE);
-    snprintf(pszMessageId, MESSAGE_ID_SIZE, "%d", uMessageId++);
-    (void)IoTHubMessage_SetMessageId(hMessage, pszMessageId);
-    
-    IOTHUB_CLIENT_RESULT result = IoTHubDeviceClient_LL_SendEventAsync(hIoTHubClient, hMessage, 
-        sendMessageConfirmationCallback, /*&callback_param*/ pszMessageId);
+    struct timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
 
-    if ( IOTHUB_CLIENT_OK != result) {
-        Log_Debug(MODULE "ERROR: _LL_SendEvent returns %s\n",IOTHUB_CLIENT_RESULTStrings(result));
+    // backpressure: each class stays within its share of the AZURE_IOT_MAX_INFLIGHT_MESSAGES slots
+    // and of the token bucket, and waits for held back messages of higher classes
+    if (!isHeldBack(priority) && hasInFlightRoom(priority, &tsNow) && hasRateTokens(priority, &tsNow)) {
+        return enqueueMessage(hMessage, &tsNow);
     }
-    else {
-        Log_Debug(MODULE "IoTHubClient accepted message id '%s' with payload '%s'\n", 
-            IoTHubMessage_GetMessageId(hMessage), IoTHubMessage_GetString(hMessage));
+
+    if (priority < PENDING_CLASSES) {
+        pending_messages_t *pPending = &aPendingMessages[priority];
+        if (pPending->nCount < AZURE_IOT_PENDING_MESSAGES) {
+            pPending->ahMessages[(pPending->nHead + pPending->nCount) % AZURE_IOT_PENDING_MESSAGES] = hMessage;
+            pPending->nCount++;
+            Log_Debug(MODULE "INFO: %u messages in flight, %u tokens, message of class %d held back.\n",
+                (unsigned int)nInFlightMessages, AzureIoT_GetRateLimitTokens(), (int)priority);
+            return IOTHUB_CLIENT_OK;
+        }
     }
 
+    anDroppedMessages[priority]++;
+    if (priority != AZURE_IOT_PRIORITY_BULK) {
+        Log_Debug(MODULE "WARNING: %u messages in flight, %u tokens, message of class %d dropped.\n",
+            (unsigned int)nInFlightMessages, AzureIoT_GetRateLimitTokens(), (int)priority);
+    }
     IoTHubMessage_Destroy(hMessage);
-    return result;
+    return IOTHUB_CLIENT_ERROR;
+}
+
+
+void AzureIoT_DispatchPendingMessages(void)
+{
+    if (NULL == hIoTHubClient) {
+        return;
+    }
+
+    struct timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+
+    // a lost confirmation must not keep the fast DoWork cadence, nor wait for a full table to be counted
+    if (nInFlightMessages > 0) {
+        expireInFlightMessages(&tsNow);
+    }
+
+    // strictly in class order: a held back critical message blocks response messages
+    for (int nClass = AZURE_IOT_PRIORITY_CRITICAL; nClass < PENDING_CLASSES; nClass++) {
+        pending_messages_t *pPending = &aPendingMessages[nClass];
+        while (pPending->nCount > 0) {
+            if (!hasInFlightRoom((AZURE_IOT_PRIORITY)nClass, &tsNow) || !hasRateTokens((AZURE_IOT_PRIORITY)nClass, &tsNow)) {
+                return;
+            }
+            IOTHUB_MESSAGE_HANDLE hMessage = pPending->ahMessages[pPending->nHead];
+            pPending->nHead = (pPending->nHead + 1) % AZURE_IOT_PENDING_MESSAGES;
+            pPending->nCount--;
+            enqueueMessage(hMessage, &tsNow);
+        }
+    }
+}
+
+
+void AzureIoT_SetRateLimit(unsigned int nMessagesPerHour, unsigned int nBurst)
+{
+    nRateLimitPerHour = nMessagesPerHour;
+    nRateLimitBurst = (nBurst > 0) ? nBurst : 1;
+    nRateTokens = (long long)nRateLimitBurst * RATE_TOKEN;
+    clock_gettime(CLOCK_MONOTONIC, &tsRateRefill);
+    Log_Debug(MODULE "INFO: rate limit %u messages per hour, burst %u.\n", nMessagesPerHour, nRateLimitBurst);
+}
+
+
+unsigned int AzureIoT_GetRateLimitTokens(void)
+{
+    if (nRateLimitPerHour == 0) {
+        return UINT_MAX;
+    }
+
+    struct timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+    refillRateTokens(&tsNow);
+    return (nRateTokens > 0) ? (unsigned int)(nRateTokens / RATE_TOKEN) : 0;
+}
+
+
+unsigned int AzureIoT_GetDroppedMessageCount(AZURE_IOT_PRIORITY priority)
+{
+    return ((priority >= AZURE_IOT_PRIORITY_CRITICAL) && (priority < AZURE_IOT_PRIORITY_COUNT)) ? anDroppedMessages[priority] : 0;
+}
+
+
+size_t AzureIoT_GetInFlightMessageCount(void)
+{
+    return nInFlightMessages;
+}
+
+
+bool AzureIoT_IsWorkPending(void)
+{
+    if ((nInFlightMessages > 0) || (nPendingTwinReports > 0)) {
+        return true;
+    }
+
+    // held back messages only need the fast cadence once tokens are available again
+    if (isHeldBack(AZURE_IOT_PRIORITY_BULK) && (AzureIoT_GetRateLimitTokens() > 0)) {
+        return true;
+    }
+
+    IOTHUB_CLIENT_STATUS sendStatus = IOTHUB_CLIENT_SEND_STATUS_IDLE;
+    return (NULL != hIoTHubClient)
+        && (IOTHUB_CLIENT_OK == pAzureIoTTransport->GetSendStatus(hIoTHubClient, &sendStatus))
+        && (IOTHUB_CLIENT_SEND_STATUS_BUSY == sendStatus);
+}
+
+
+const delivery_stats_t *AzureIoT_GetDeliveryStatistics(size_t *pnComponents)
+{
+    if (pnComponents != NULL) {
+        *pnComponents = nDeliveryStatsComponents;
+    }
+    return aDeliveryStats;
+}
+
+
+void AzureIoT_ResetDeliveryStatistics(void)
+{
+    memset(aDeliveryStats, 0, sizeof(aDeliveryStats));
+    nDeliveryStatsComponents = 0;
+    memset(anDroppedMessages, 0, sizeof(anDroppedMessages));
 }
 
 
@@ -297,15 +733,20 @@ IOTHUB_CLIENT_RESULT AzureIoT_SendPlainTextMessage(const char *cstrMessage)
 */
 static void sendMessageConfirmationCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void* context)
 {
-    Log_Debug(MODULE "IoTHub confirmed message id '%s' with: %s\n", 
-        (char *) context, IOTHUB_CLIENT_CONFIRMATION_RESULTStrings(result));
+    unsigned int uId = (unsigned int)(uintptr_t)context;
+    Log_Debug(MODULE "IoTHub confirmed message id '%u' with: %s\n", 
+        uId, IOTHUB_CLIENT_CONFIRMATION_RESULTStrings(result));
 
     if (lstIoTClientCallbacks.MessageDeliveryConfirmationHandler) {
         lstIoTClientCallbacks.MessageDeliveryConfirmationHandler(result == IOTHUB_CLIENT_CONFIRMATION_OK);
     }
-    //cleanup heap memory for context
-    if (NULL != context){
-        free(context);
+
+    // release the in-flight slot (unless the message already timed out)
+    inflight_message_t *pSlot = findInFlightSlot(uId);
+    if (NULL != pSlot){
+        recordDelivery(pSlot, result);
+        pSlot->bInUse = false;
+        nInFlightMessages--;
     }
 }
 
@@ -349,7 +790,7 @@ void AzureIoT_SetMessageReceivedCallback(IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC ca
     lstIotHubCallbacks.MessageReceivedHandler = callback;
     if (NULL != hIoTHubClient)
     {
-        IoTHubDeviceClient_LL_SetMessageCallback(hIoTHubClient, lstIotHubCallbacks.MessageReceivedHandler, NULL);
+        pAzureIoTTransport->SetMessageCallback(hIoTHubClient, lstIotHubCallbacks.MessageReceivedHandler, NULL);
     }
 }
 
@@ -384,6 +825,17 @@ static void reportStatusCallback(int iStatus, void* pContextCallback)
 {
     Log_Debug(MODULE "Device Twin reported properties update result: HTTP status code %d\n",
         iStatus);
+    if (nPendingTwinReports > 0) {
+        nPendingTwinReports--;
+    }
+    unsigned int uReportId = (unsigned int)(uintptr_t)pContextCallback;
+    for (size_t i = 0; (uReportId != 0) && (i < AZURE_IOT_TWIN_CONFIRMATIONS); i++) {
+        if (aTwinConfirmations[i].uReportId == uReportId) {
+            aTwinConfirmations[i].uReportId = 0;
+            aTwinConfirmations[i].fnConfirmation(iStatus, aTwinConfirmations[i].pContext);
+            break;
+        }
+    }
     if (lstIoTClientCallbacks.DeviceTwinDeliveryConfirmationHandler)
         lstIoTClientCallbacks.DeviceTwinDeliveryConfirmationHandler(iStatus);
 }
@@ -392,6 +844,13 @@ static void reportStatusCallback(int iStatus, void* pContextCallback)
 IOTHUB_CLIENT_RESULT AzureIoT_TwinReportState(
     const char* pszProperties,
     size_t nPropertiesSize)
+{
+    return AzureIoT_TwinReportStateWithConfirmation(pszProperties, nPropertiesSize, NULL, NULL);
+}
+
+
+IOTHUB_CLIENT_RESULT AzureIoT_TwinReportStateWithConfirmation(const char* pszProperties, size_t nPropertiesSize,
+    TwinReportConfirmationFnType fnConfirmation, void* pContext)
 {
     if (hIoTHubClient == NULL) {
         Log_Debug(cstrWarnNotInitialized);
@@ -403,14 +862,40 @@ IOTHUB_CLIENT_RESULT AzureIoT_TwinReportState(
         return IOTHUB_CLIENT_OK;
     }
 
-    IOTHUB_CLIENT_RESULT result = IoTHubDeviceClient_LL_SendReportedState(hIoTHubClient, 
-            pszProperties, nPropertiesSize, reportStatusCallback, 0);
+    twin_confirmation_t *pConfirmation = NULL;
+    unsigned int uReportId = 0;
+    if (fnConfirmation != NULL) {
+        for (size_t i = 0; (pConfirmation == NULL) && (i < AZURE_IOT_TWIN_CONFIRMATIONS); i++) {
+            if (aTwinConfirmations[i].uReportId == 0) {
+                pConfirmation = &aTwinConfirmations[i];
+            }
+        }
+        if (pConfirmation == NULL) {
+            Log_Debug(MODULE "WARNING: %d reported properties updates waiting for confirmation.\n",
+                AZURE_IOT_TWIN_CONFIRMATIONS);
+            return IOTHUB_CLIENT_ERROR;
+        }
+        if (++uTwinReportId == 0) {
+            uTwinReportId = 1;
+        }
+        uReportId = uTwinReportId;
+    }
+
+    IOTHUB_CLIENT_RESULT result = pAzureIoTTransport->SendReportedState(hIoTHubClient, 
+            (const unsigned char*)pszProperties, nPropertiesSize, reportStatusCallback, (void*)(uintptr_t)uReportId);
     
     if (result != IOTHUB_CLIENT_OK) {
         Log_Debug("[IoT] ERROR: IOTHUB_CLIENT_RESULT %d with properties %s\n", result, pszProperties);
     }
     else {
         Log_Debug("[IoT] reported properties %s\n", pszProperties);
+        nPendingTwinReports++;
+        if (pConfirmation != NULL) {
+            pConfirmation->uReportId = uReportId;
+            pConfirmation->fnConfirmation = fnConfirmation;
+            pConfirmation->pContext = pContext;
+        }
+        AzureIoT_DPS_RequestDoWork();
     }
 
     return result;
@@ -427,6 +912,9 @@ static void deviceTwinUpdateCallback(DEVICE_TWIN_UPDATE_STATE updateState, const
         return;
     }
 
+    // the handler typically reports properties back
+    AzureIoT_DPS_RequestDoWork();
+
     char* strProperties = AzureIoT_GetStringFromPayload(payLoad, payLoadSize);
 
     // Call the provided string based Twin Device Update handler
@@ -444,7 +932,7 @@ void AzureIoT_SetDeviceTwinUpdateCallback(IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK cal
 {
     lstIotHubCallbacks.DeviceTwinUpdateHandler = callback;
     if (NULL != hIoTHubClient) {
-        IoTHubDeviceClient_LL_SetDeviceTwinCallback(hIoTHubClient, lstIotHubCallbacks.DeviceTwinUpdateHandler, NULL);
+        pAzureIoTTransport->SetDeviceTwinCallback(hIoTHubClient, lstIotHubCallbacks.DeviceTwinUpdateHandler, NULL);
     }
 }
 
@@ -491,12 +979,16 @@ static int directMethodCallback(const char* methodName, const unsigned char* pay
         return HTTP_NOT_FOUND;
     }
 
-    const char* strPayload = AzureIoT_GetStringFromPayload(payload, payloadSize);
+    // the SDK sends the response on the following DoWork calls
+    AzureIoT_DPS_RequestDoWork();
+
+    char* strPayload = AzureIoT_GetStringFromPayload(payload, payloadSize);
     char* strResponse = NULL;
     int result = lstIoTClientCallbacks.DirectMethodHandler(methodName, strPayload, &strResponse);
+    free(strPayload);
     if (NULL != strResponse) {
         *response = (unsigned char*) strResponse;
-        *responseSize = strlen(strResponse) - 1;
+        *responseSize = strlen(strResponse);
     }
     return result;
 }
@@ -512,7 +1004,7 @@ void AzureIoT_SetDirectMethodCallback(IOTHUB_CLIENT_DEVICE_METHOD_CALLBACK_ASYNC
 {
     lstIotHubCallbacks.DirectMethodHandler = callback;
     if (NULL != hIoTHubClient) {
-        IoTHubDeviceClient_LL_SetDeviceMethodCallback(hIoTHubClient, lstIotHubCallbacks.DirectMethodHandler, NULL);
+        pAzureIoTTransport->SetDeviceMethodCallback(hIoTHubClient, lstIotHubCallbacks.DirectMethodHandler, NULL);
     }
 }
 
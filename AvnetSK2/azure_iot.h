@@ -132,15 +132,148 @@ char * AzureIoT_GetStringFromPayload(const char* cstrPayload, size_t nPayloadSiz
  */
 IOTHUB_MESSAGE_HANDLE AzureIoT_CreateIoTHubMessage(const char* cstrMessage, const char *cstrContentType, const char * cstrContentEncoding);
 
+/// @brief capacity of the pre-allocated table of messages waiting for IoT Hub confirmation
+#ifndef AZURE_IOT_MAX_INFLIGHT_MESSAGES
+#define AZURE_IOT_MAX_INFLIGHT_MESSAGES (16)
+#endif
+
+/// @brief in-flight slots of messages not confirmed within this time are reused
+#ifndef AZURE_IOT_INFLIGHT_TIMEOUT_SECONDS
+#define AZURE_IOT_INFLIGHT_TIMEOUT_SECONDS (300)
+#endif
+
+/// @brief max length of the PnP component name ("$.sub") kept per in-flight message
+#define AZURE_IOT_COMPONENT_NAME_SIZE (32)
+
+/// @brief messages of the critical and response classes held back while their in-flight share is used up
+#ifndef AZURE_IOT_PENDING_MESSAGES
+#define AZURE_IOT_PENDING_MESSAGES (4)
+#endif
+
+/**
+ * @brief Outbound message classes. Each class may only use a share of the in-flight table, so lower
+ * classes can never fill the SDK queue in front of higher ones:
+ * critical and response all AZURE_IOT_MAX_INFLIGHT_MESSAGES (response leaves 1/8 to critical),
+ * telemetry 3/4 and bulk 1/2 of the table.
+ */
+typedef enum {
+    AZURE_IOT_PRIORITY_CRITICAL = 0,    ///< events and alarms, held back (never dropped) while the table is full
+    AZURE_IOT_PRIORITY_RESPONSE,        ///< messages answering a command or property update, held back like critical
+    AZURE_IOT_PRIORITY_TELEMETRY,       ///< live telemetry, dropped under pressure
+    AZURE_IOT_PRIORITY_BULK,            ///< store-and-forward backlog, refused under pressure (caller keeps it)
+    AZURE_IOT_PRIORITY_COUNT
+} AZURE_IOT_PRIORITY;
+
 /**
  * @brief Enqueues the IoT Hub message (will be sent to IoT Hub on next DoWork event)
  * The message will be assigned a running number as message id string that needs to
  * be confirmed by IoT Hub. See sendMessageConfirmationCallback()
+ * Id, enqueue time, component and size are tracked in a fixed in-flight table until
+ * confirmation or timeout. If the table is full the message is dropped (backpressure).
+ * The message handle is always destroyed.
+ * Same as AzureIoT_SendIoTHubMessageWithPriority() with AZURE_IOT_PRIORITY_TELEMETRY.
  * 
  * @param hMessage Message handle
+ * @return IOTHUB_CLIENT_ERROR if the message was dropped, AzureIoT_GetInFlightMessageCount() tells
+ *         whether AZURE_IOT_MAX_INFLIGHT_MESSAGES messages are in flight
  */
 IOTHUB_CLIENT_RESULT AzureIoT_SendIoTHubMessage(IOTHUB_MESSAGE_HANDLE hMessage);
 
+/**
+ * @brief Enqueues the IoT Hub message within the in-flight share of its class. Messages of lower classes
+ * are not enqueued while messages of a higher class are held back.
+ * Critical and response messages exceeding their share are held back (up to AZURE_IOT_PENDING_MESSAGES
+ * per class) and enqueued by AzureIoT_DispatchPendingMessages() first, others are dropped.
+ * The message handle is always taken over.
+ * 
+ * @param hMessage Message handle
+ * @param priority message class
+ * @return IOTHUB_CLIENT_OK if enqueued or held back, IOTHUB_CLIENT_ERROR if dropped (counted by
+ *         AzureIoT_GetDroppedMessageCount(), see also AzureIoT_GetInFlightMessageCount())
+ */
+IOTHUB_CLIENT_RESULT AzureIoT_SendIoTHubMessageWithPriority(IOTHUB_MESSAGE_HANDLE hMessage, AZURE_IOT_PRIORITY priority);
+
+/**
+ * @brief Releases in-flight slots of messages not confirmed within AZURE_IOT_INFLIGHT_TIMEOUT_SECONDS
+ * and enqueues held back critical and response messages as in-flight slots become free.
+ * Called after each DoWork.
+ */
+void AzureIoT_DispatchPendingMessages(void);
+
+/**
+ * @brief Limits outbound messages with a token bucket: nMessagesPerHour tokens are added per hour,
+ * at most nBurst are saved up. Every enqueued message takes a token. Without tokens critical
+ * messages may borrow up to nBurst tokens and are held back beyond that, response messages are
+ * held back, telemetry is dropped and bulk messages need half a bucket (are refused below).
+ * The bucket starts full.
+ * 
+ * @param nMessagesPerHour  sustained rate, 0 for no limit
+ * @param nBurst            bucket size, at least 1
+ */
+void AzureIoT_SetRateLimit(unsigned int nMessagesPerHour, unsigned int nBurst);
+
+/**
+ * @brief Whole tokens left in the bucket, UINT_MAX without rate limit. Producers aggregate or
+ * decimate samples while this is low instead of having them dropped.
+ */
+unsigned int AzureIoT_GetRateLimitTokens(void);
+
+/**
+ * @brief Number of messages of a class dropped because its in-flight share (or the token bucket,
+ * see AzureIoT_SetRateLimit()) was used up.
+ * Bulk messages are refused rather than lost, the count shows how often the backlog was held back.
+ */
+unsigned int AzureIoT_GetDroppedMessageCount(AZURE_IOT_PRIORITY priority);
+
+/**
+ * @brief Number of enqueued messages not yet confirmed by IoT Hub (and not timed out).
+ * Producers can hold data back while this is close to AZURE_IOT_MAX_INFLIGHT_MESSAGES.
+ */
+size_t AzureIoT_GetInFlightMessageCount(void);
+
+/**
+ * @brief True while the IoT Hub client has outbound work: queued events, unconfirmed messages,
+ * held back messages or unconfirmed twin reports. Used to keep DoWork at the fast cadence.
+ */
+bool AzureIoT_IsWorkPending(void);
+
+/// @brief number of log2 latency buckets: [0,64ms), [64,128ms), ... , [32.8s,65.5s), >= 65.5s
+#define AZURE_IOT_LATENCY_BUCKETS (12)
+
+/// @brief upper bound of the first latency bucket in milliseconds
+#define AZURE_IOT_LATENCY_BASE_MS (64)
+
+/// @brief number of components with delivery statistics, the last entry collects all further components
+#ifndef AZURE_IOT_LATENCY_COMPONENTS
+#define AZURE_IOT_LATENCY_COMPONENTS (8)
+#endif
+
+/// @brief delivery statistics of one PnP component ("default" for messages without "$.sub")
+typedef struct {
+    char strComponent[AZURE_IOT_COMPONENT_NAME_SIZE];
+    unsigned int nConfirmed;                ///< confirmed by IoT Hub
+    unsigned int nErrors;                   ///< failed or discarded on client destroy
+    unsigned int nTimeouts;                 ///< SDK message timeout or no confirmation within AZURE_IOT_INFLIGHT_TIMEOUT_SECONDS
+    unsigned int nMaxLatencyMs;
+    unsigned long long nTotalLatencyMs;     ///< sum over confirmed messages
+    unsigned int anLatencyBuckets[AZURE_IOT_LATENCY_BUCKETS];
+} delivery_stats_t;
+
+/**
+ * @brief Returns the delivery statistics collected between IoTHubDeviceClient_LL_SendEventAsync()
+ * and the confirmation callback, one entry per component.
+ * 
+ * @param pnComponents  OUT parameter: number of valid entries
+ * @return pointer to the statistics table (valid until AzureIoT_ResetDeliveryStatistics())
+ */
+const delivery_stats_t *AzureIoT_GetDeliveryStatistics(size_t *pnComponents);
+
+/**
+ * @brief Clears the delivery statistics and dropped message counts. Messages in flight are still
+ * counted on confirmation.
+ */
+void AzureIoT_ResetDeliveryStatistics(void);
+
 
 /** 
 * @brief    Creates and enqueues a plain text message to be delivered to the IoT Hub. The message is not actually
@@ -217,6 +350,33 @@ void AzureIoT_SetMessageConfirmationCallback(MessageDeliveryConfirmationFnType c
 */
 IOTHUB_CLIENT_RESULT AzureIoT_TwinReportState(const char* pszProperties, size_t nPropertiesSize);
 
+/// @brief capacity of the table of reported state updates waiting for their confirmation callback
+#ifndef AZURE_IOT_TWIN_CONFIRMATIONS
+#define AZURE_IOT_TWIN_CONFIRMATIONS (4)
+#endif
+
+/**
+* @brief    Type of the function callback invoked once IoT Hub answered a particular reported state update.
+*
+* @param    httpStatusCode  The HTTP status code returned by the IoT Hub, 0 if the connection was lost before.
+* @param    pContext        context passed to AzureIoT_TwinReportStateWithConfirmation()
+*/
+typedef void (*TwinReportConfirmationFnType)(int httpStatusCode, void* pContext);
+
+/**
+* @brief    Like AzureIoT_TwinReportState(), additionally invokes fnConfirmation exactly once with the
+*     result of this report (before the DeviceTwinDeliveryConfirmation callback).
+*
+* @param    pszProperties   Reported Properties as (json formatted) string
+* @param    nPropertiesSize Size of properties string
+* @param    fnConfirmation  callback, NULL for none
+* @param    pContext        passed to fnConfirmation
+* @return   IOTHUB_CLIENT_RESULT_OK if report successfully enqueued, IOTHUB_CLIENT_ERROR if
+*           AZURE_IOT_TWIN_CONFIRMATIONS reports are waiting for their confirmation already
+*/
+IOTHUB_CLIENT_RESULT AzureIoT_TwinReportStateWithConfirmation(const char* pszProperties, size_t nPropertiesSize,
+    TwinReportConfirmationFnType fnConfirmation, void* pContext);
+
 /**
 * @brief    Type of the function callback invoked whenever a Device Twin update from the IoT Hub is
 *           received.
@@ -214,4 +214,15 @@ IOTHUB_CLIENT_RESULT AzureIoTCentral_AckComponentPropertyChange( const char * cs
     }
 
     return result;
-}
\ No newline at end of file
+}
+
+
+void AzureIoTCentral_InternPropertyNames(void)
+{
+    static const char* const apszNames[] = { cstrValueProperty, cstrVersionProperty, cstrStatusProperty, cstrPnpComponentProperty };
+
+    if( json_add_interned_names( apszNames, sizeof(apszNames) / sizeof(*apszNames) ) != JSONSuccess )
+    {
+        Log_Debug( MODULE "WARNING: property names not interned\n" );
+    }
+}
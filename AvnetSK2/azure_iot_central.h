@@ -61,5 +61,11 @@ IOTHUB_CLIENT_RESULT AzureIoTCentral_AckPropertyChange( const char *cstrProperty
 IOTHUB_CLIENT_RESULT AzureIoTCentral_AckComponentPropertyChange( 
     const char * cstrComponentName, const char *cstrPropertyName, void *pValue, JSON_Value_Type jsonType, unsigned int nVersion, unsigned int nStatus );
 
+/**
+ * @brief Interns the property names used by the helpers above ("value", "av", "ac", "__t") in parson,
+ *   so every property json references them instead of allocating copies. Call once at startup.
+ */
+void AzureIoTCentral_InternPropertyNames(void);
+
 
 #endif // AZURE_IOT_CENTRAL_H
\ No newline at end of file
@@ -3,7 +3,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <azure_prov_client/iothub_security_factory.h>
 #include <azure_prov_client/prov_device_ll_client.h>
@@ -21,6 +25,8 @@
 
 #include "epoll_timerfd_utilities.h"
 #include "azure_iot_dps.h"
+#include "azure_iot_pnp.h"
+#include "azure_iot_transport.h"
 #define MODULE "[DPS] "
 
 /// @brief Enable IoT SDK tracing
@@ -73,6 +79,28 @@ static const char * cstrScopeId = NULL;
 /// IoT Hub Uri.
 static char strIotHubUri[MAX_HUB_URI_LENGTH]; 
 
+#define ASSIGNMENT_MAGIC    (0x4450)
+
+/// @brief DPS assignment as kept in RAM and storage. nHash covers everything behind it.
+typedef struct {
+    uint32_t nHash;
+    uint16_t nMagic;
+    uint16_t nUsable;       ///< 0 once the IoT Hub rejected the device
+    int64_t  tAssigned;
+    char     strScopeId[MAX_SCOPEID_LENGTH];
+    char     strDeviceId[MAX_DEVICEID_LENGTH];
+    char     strHubUri[MAX_HUB_URI_LENGTH];
+} dps_assignment_t;
+
+/// @brief last DPS assignment, kept after invalidation to detect a move to another IoT Hub
+static dps_assignment_t assignment;
+static bool bAssignmentKnown = false;
+static int fdAssignmentStorage = -1;
+static off_t nAssignmentStorageOffset = 0;
+
+/// @brief the IoT Hub client was created from the cached assignment and has not authenticated yet
+static bool bHubFromCache = false;
+
 /// @brief IoT Hub option to set device id
 static const char * OPTION_SET_DEVICE_ID = "SetDeviceId";
 
@@ -95,8 +123,19 @@ static void dpsTimeoutHandler(EventData* eventData);
 /// @brief EventData structure for DPS timeout timer
 static EventData evtDpsTimeoutTimer = { .eventHandler = &dpsTimeoutHandler, .fd = -1, .context=NULL };
 
-/// Azure IoT Hub connection polling period (100ms)
-static const struct timespec tsConnectionTimerPeriod = {0, 100*1000*1000};
+/// Azure IoT Hub connection polling period (100ms), also the DoWork period while work is pending
+#define CONNECTION_TIMER_PERIOD_MS (100)
+static const struct timespec tsConnectionTimerPeriod = {0, CONNECTION_TIMER_PERIOD_MS*1000*1000};
+/// @brief DoWork period limit while nothing is pending, doubled from tsConnectionTimerPeriod when idle.
+///     Must stay well below the MQTT keepalive, it also bounds the latency of incoming direct methods,
+///     twin updates and C2D messages.
+#ifndef AZURE_IOT_DOWORK_IDLE_PERIOD_MS
+#define AZURE_IOT_DOWORK_IDLE_PERIOD_MS (1000)
+#endif
+/// @brief current connection timer period in milliseconds
+static long nConnectionTimerPeriodMs = CONNECTION_TIMER_PERIOD_MS;
+/// @brief set by AzureIoT_DPS_RequestDoWork(), keeps the fast DoWork period for the next tick
+static bool bDoWorkRequested = false;
 /// @brief (Forward declared) connectionTimerHandler checks regularly for network and connection 
 ///     status and initiates DPS registration or IoT Hub connection
 /// @param eventData timer event data 
@@ -104,11 +143,50 @@ static void connectionTimerHandler(EventData* eventData);
 /// @brief EventData structure for connection timer handler
 static EventData evtConnectionTimer = { .eventHandler = &connectionTimerHandler, .fd = -1, .context=NULL };
 
-/// @brief In case of connection error, extend retry wait time
+/// @brief In case of connection error, extend retry wait time (without fast recovery)
 static const int iConnectionRetryMinWaitSeconds = 5;
 static const int iConnectionRetryMaxWaitSeconds = 240;
 static int iConnectionRetrySeconds = iConnectionRetryMinWaitSeconds;
 
+/// @brief see AzureIoT_DPS_SetFastRecovery()
+static bool bFastRecovery = true;
+
+/// @brief failure classes of fast recovery, each retried on its own schedule
+typedef enum {
+    RETRY_TRANSIENT = 0,    ///< network path lost (NO_NETWORK, COMMUNICATION_ERROR, NO_PING_RESPONSE, RETRY_EXPIRED)
+    RETRY_CREDENTIAL,       ///< IoT Hub rejects the credential (BAD_CREDENTIAL, EXPIRED_SAS_TOKEN)
+    RETRY_DISABLED,         ///< device disabled in the IoT Hub, only an operator fixes it
+    RETRY_SETUP,            ///< DPS registration or client setup failed
+    RETRY_CLASS_COUNT
+} RETRY_CLASS;
+
+static const char *cstrRetryClassNames[RETRY_CLASS_COUNT] = { "transient", "credential", "disabled", "setup" };
+
+/// @brief retry schedule of a failure class: the wait is drawn from [nMinMs, nBackoffMs], the backoff
+/// doubles from 2*nMinMs up to nMaxMs and starts over after a successful connect
+typedef struct {
+    unsigned int nMinMs;
+    unsigned int nMaxMs;
+    unsigned int nBackoffMs;
+} retry_schedule_t;
+
+static retry_schedule_t aRetrySchedules[RETRY_CLASS_COUNT] = {
+    [RETRY_TRANSIENT]  = { .nMinMs = 1000,  .nMaxMs = 60 * 1000 },
+    [RETRY_CREDENTIAL] = { .nMinMs = 5000,  .nMaxMs = 300 * 1000 },
+    [RETRY_DISABLED]   = { .nMinMs = 60 * 1000, .nMaxMs = 3600 * 1000 },
+    [RETRY_SETUP]      = { .nMinMs = 5000,  .nMaxMs = 240 * 1000 }
+};
+
+/// @brief class of the current failure, RETRY_SETUP unless the IoT Hub client reported a reason
+static RETRY_CLASS retryClass = RETRY_SETUP;
+/// @brief monotonic time of the next retry, 0 while none is scheduled
+static long long nRetryAtMs = 0;
+/// @brief monotonic deadline for a kept IoT Hub client to reconnect by itself, 0 if none
+static long long nReconnectDeadlineMs = 0;
+/// @brief monotonic time since the network is down while the IoT Hub client is kept, 0 if up
+static long long nNetworkLostAtMs = 0;
+static unsigned int nRetrySeed = 0;
+
 
 MU_DEFINE_ENUM_STRINGS_WITHOUT_INVALID(PROV_DEVICE_RESULT, PROV_DEVICE_RESULT_VALUE);
 MU_DEFINE_ENUM_STRINGS_WITHOUT_INVALID(PROV_DEVICE_REG_STATUS, PROV_DEVICE_REG_STATUS_VALUES);
@@ -138,8 +216,147 @@ static void periodicLogVarArgs(time_t *lastInvokedTime, time_t periodInSeconds,
 }
 
 
+/// @brief monotonic clock in milliseconds
+static long long nowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * @brief Maps the reason the IoT Hub client reported to the failure class retrying it
+ */
+static RETRY_CLASS classifyReason(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason)
+{
+    switch( reason )
+    {
+    case IOTHUB_CLIENT_CONNECTION_NO_NETWORK:
+    case IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR:
+    case IOTHUB_CLIENT_CONNECTION_NO_PING_RESPONSE:
+    case IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED:
+        return RETRY_TRANSIENT;
+    case IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL:
+    case IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN:
+        return RETRY_CREDENTIAL;
+    case IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED:
+        return RETRY_DISABLED;
+    default:
+        return RETRY_SETUP;
+    }
+}
+
+
+/**
+ * @brief Draws the wait before the next retry of a failure class and doubles its backoff. The wait
+ * is spread over [minimum, backoff] so a fleet that failed together does not retry in lockstep.
+ */
+static unsigned int nextRetryDelayMs(RETRY_CLASS retry)
+{
+    retry_schedule_t *pSchedule = &aRetrySchedules[retry];
+
+    if( nRetrySeed == 0 )
+    {
+        // boot times differ in the nanoseconds even across devices that came up together
+        struct timespec tsMonotonic, tsReal;
+        clock_gettime(CLOCK_MONOTONIC, &tsMonotonic);
+        clock_gettime(CLOCK_REALTIME, &tsReal);
+        nRetrySeed = ((unsigned int)tsMonotonic.tv_nsec * 2654435761u) ^ (unsigned int)tsReal.tv_nsec ^ (unsigned int)getpid() ^ 1u;
+    }
+    if( pSchedule->nBackoffMs < 2 * pSchedule->nMinMs )
+    {
+        pSchedule->nBackoffMs = 2 * pSchedule->nMinMs;
+    }
+
+    unsigned int nDelayMs = pSchedule->nMinMs + (unsigned int)rand_r(&nRetrySeed) % (pSchedule->nBackoffMs - pSchedule->nMinMs + 1);
+
+    pSchedule->nBackoffMs = (pSchedule->nBackoffMs > pSchedule->nMaxMs / 2) ? pSchedule->nMaxMs : 2 * pSchedule->nBackoffMs;
+    return nDelayMs;
+}
+
+
+/**
+ * @brief FNV-1a hash over the assignment behind nHash
+ */
+static uint32_t hashAssignment(const dps_assignment_t *pAssignment)
+{
+    const uint8_t *pb = (const uint8_t *)pAssignment + offsetof(dps_assignment_t, nMagic);
+    uint32_t nHash = 2166136261u;
+    for (size_t i = offsetof(dps_assignment_t, nMagic); i < sizeof(*pAssignment); i++) {
+        nHash ^= *pb++;
+        nHash *= 16777619u;
+    }
+    return nHash;
+}
+
+/**
+ * @brief Writes the assignment to the storage region
+ */
+static void saveAssignment(void)
+{
+    if (fdAssignmentStorage < 0) {
+        return;
+    }
+    assignment.nMagic = ASSIGNMENT_MAGIC;
+    assignment.nHash = hashAssignment(&assignment);
+    if ((lseek(fdAssignmentStorage, nAssignmentStorageOffset, SEEK_SET) < 0)
+        || (write(fdAssignmentStorage, &assignment, sizeof(assignment)) != (ssize_t)sizeof(assignment))) {
+        Log_Debug(MODULE "WARNING: cannot store the DPS assignment.\n");
+    }
+}
+
+/**
+ * @brief Checks whether the cached assignment may be used instead of DPS registration.
+ * A clock behind the assignment time (not synchronized yet) does not expire it.
+ */
+static bool isAssignmentUsable(void)
+{
+    if (!bAssignmentKnown || !assignment.nUsable || (cstrScopeId == NULL)
+        || (strncmp(assignment.strScopeId, cstrScopeId, sizeof(assignment.strScopeId)) != 0)) {
+        return false;
+    }
+
+    struct timespec tsNow;
+    timespec_get(&tsNow, TIME_UTC);
+    if ((tsNow.tv_sec > assignment.tAssigned)
+        && (tsNow.tv_sec - assignment.tAssigned > AZURE_IOT_DPS_ASSIGNMENT_MAX_AGE_SECONDS)) {
+        Log_Debug(MODULE "INFO: cached DPS assignment expired.\n");
+        return false;
+    }
+    return true;
+}
+
 /**
- * @brief Check networking and DAA status before connection
+ * @brief Stores a new DPS assignment, a move to another IoT Hub invalidates the reported properties
+ * accepted by the previous one.
+ */
+static void updateAssignment(const char *iothub_uri, const char *deviceId)
+{
+    bool bHubChanged = !bAssignmentKnown || (strcmp(assignment.strHubUri, iothub_uri) != 0);
+
+    memset(&assignment, 0, sizeof(assignment));
+    strncpy(assignment.strScopeId, cstrScopeId, sizeof(assignment.strScopeId) - 1);
+    if (deviceId != NULL) {
+        strncpy(assignment.strDeviceId, deviceId, sizeof(assignment.strDeviceId) - 1);
+    }
+    strcpy(assignment.strHubUri, iothub_uri);
+    struct timespec tsNow;
+    timespec_get(&tsNow, TIME_UTC);
+    assignment.tAssigned = tsNow.tv_sec;
+    assignment.nUsable = 1;
+    bAssignmentKnown = true;
+    saveAssignment();
+
+    if (bHubChanged) {
+        Log_Debug(MODULE "INFO: assigned to a new IoT Hub, reporting all properties again.\n");
+        AzureIoT_PnP_InvalidateReportedProperties();
+    }
+}
+
+
+/**
+ * @brief Check networking and, for transports provisioning through DPS, DAA status before connection
  * 
  * @return true     True if networking and DAA are ready
  */
@@ -160,6 +377,10 @@ static bool isNetworkReady(void)
         return false;
     }
 
+    if (!pAzureIoTTransport->bProvisioning) {
+        return true;
+    }
+
     // Verifies authentication is ready on device
     bool isDeviceAuthReady = false;
     if (Application_IsDeviceAuthReady(&isDeviceAuthReady) != 0) {
@@ -248,6 +469,7 @@ static void dpsRegisterDeviceCallback(PROV_DEVICE_RESULT registerResult, const c
         {
             strcpy( strIotHubUri, iothub_uri );
             Log_Debug(MODULE "INFO: DPS register device succeeded. IoT Hub is %s\n", iothub_uri);
+            updateAssignment( iothub_uri, deviceId );
             dpsRegisterStatus = AZURE_IOT_DPS_COMPLETED;
             return;
         } else {
@@ -272,8 +494,34 @@ static void hubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
     if( result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED ){
         hubConnectionStatus = AZURE_IOT_HUB_CONNECTED;
         iConnectionRetrySeconds = iConnectionRetryMinWaitSeconds;
+        for( int i = 0; i < RETRY_CLASS_COUNT; i++ )
+        {
+            aRetrySchedules[i].nBackoffMs = 0;
+        }
+        nReconnectDeadlineMs = 0;
+        bHubFromCache = false;
+    } else if( bFastRecovery && (classifyReason(reason) == RETRY_TRANSIENT) && (reason != IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED)
+               && ((hubConnectionStatus == AZURE_IOT_HUB_CONNECTED) || (nReconnectDeadlineMs != 0)) ) {
+        // the client reconnects by itself (see SetRetryPolicy), it is kept unless that takes too long
+        if( nReconnectDeadlineMs == 0 )
+        {
+            Log_Debug(MODULE "INFO: IoT Hub connection lost (%d), waiting for the client to reconnect.\n", (int)reason);
+            nReconnectDeadlineMs = nowMs() + AZURE_IOT_HUB_RECONNECT_TIMEOUT_SECONDS * 1000LL;
+        }
+        hubConnectionStatus = AZURE_IOT_HUB_AUTHENTICATING;
     } else {
         hubConnectionStatus = AZURE_IOT_HUB_FAILED;
+        retryClass = classifyReason(reason);
+        nReconnectDeadlineMs = 0;
+
+        // the IoT Hub rejects the device, or the cached one cannot be reached: ask DPS again
+        if( (reason == IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL)
+            || (reason == IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED)
+            || (bHubFromCache && (reason != IOTHUB_CLIENT_CONNECTION_NO_NETWORK)) )
+        {
+            AzureIoT_DPS_InvalidateAssignment();
+        }
+        bHubFromCache = false;
     }
 
     if( lstIotHubCallbacks.ConnectionStatusChangedHandler )
@@ -376,7 +624,7 @@ void  dpsCleanup( void )
 
 
 /**
- * @brief hubInitialize() initializes teh IoT Hub client and security factory and 
+ * @brief hubInitialize() creates the IoT Hub client through the transport and 
  * starts authentication with IoT Hub 
  * 
  * @return true on success
@@ -386,67 +634,54 @@ bool hubInitialize( void )
 {
     IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_INVALID_ARG;
 
-    if (IoTHub_Init() != 0) {
-        Log_Debug(MODULE "ERROR: failed initializing platform.\n");
-        return false;
-    }
-
-    // Set up auth type
-    int retError = iothub_security_init(IOTHUB_SECURITY_TYPE_X509);
-    if (retError != 0) {
-        Log_Debug("ERROR: iothub_security_init failed with error %d.\n", retError);
-        return false;
-    }
-
     // Create Azure Iot Hub client handle
     Log_Debug(MODULE "INFO: Connecting to IoT Hub %s\n", strIotHubUri);
-    hIoTHubClient = IoTHubDeviceClient_LL_CreateWithAzureSphereFromDeviceAuth(strIotHubUri, MQTT_Protocol);
+    hIoTHubClient = pAzureIoTTransport->Create(strIotHubUri);
     if (NULL ==  hIoTHubClient) 
     {
-        Log_Debug(MODULE "ERROR: _CreateWithAzureSphereFromDeviceAuth returned NULL.\n");
         goto cleanup;
     }
 
     // Use DAA cert when connecting - requires the "SetDeviceId" option to be set
     static const int deviceIdForDaaCertUsage = 1;
-    result = IoTHubDeviceClient_LL_SetOption( hIoTHubClient, OPTION_SET_DEVICE_ID, &deviceIdForDaaCertUsage);
+    result = pAzureIoTTransport->SetOption( hIoTHubClient, OPTION_SET_DEVICE_ID, &deviceIdForDaaCertUsage);
     CHECK_CLIENT_RESULT_AND_REPORT_ERROR( OPTION_SET_DEVICE_ID );
 
 
 #if defined(USE_AZURE_CLOUD_ECC_CERT)
-    result = IoTHubDeviceClient_LL_SetOption(hIoTHubClient, OPTION_TRUSTED_CERT cstrAzureIoTCertificates);
+    result = pAzureIoTTransport->SetOption(hIoTHubClient, OPTION_TRUSTED_CERT cstrAzureIoTCertificates);
     CHECK_CLIENT_RESULT_AND_REPORT_ERROR( OPTION_TRUSTED_CERT );
 #endif
 
-    result = IoTHubDeviceClient_LL_SetOption(hIoTHubClient, OPTION_LOG_TRACE, &bTraceOn);
+    result = pAzureIoTTransport->SetOption(hIoTHubClient, OPTION_LOG_TRACE, &bTraceOn);
     CHECK_CLIENT_RESULT_AND_REPORT_ERROR( OPTION_LOG_TRACE );
 
     static bool bUrlAutoEncodeDecode = true; 
-    result = IoTHubDeviceClient_LL_SetOption(hIoTHubClient, OPTION_AUTO_URL_ENCODE_DECODE, &bUrlAutoEncodeDecode);
+    result = pAzureIoTTransport->SetOption(hIoTHubClient, OPTION_AUTO_URL_ENCODE_DECODE, &bUrlAutoEncodeDecode);
     CHECK_CLIENT_RESULT_AND_REPORT_ERROR( OPTION_AUTO_URL_ENCODE_DECODE );
 
     // Sets Azure IoT PnP Model ID on IoT Hub Client
-    result = IoTHubDeviceClient_LL_SetOption(hIoTHubClient, OPTION_MODEL_ID, cstrPnPModelId);
+    result = pAzureIoTTransport->SetOption(hIoTHubClient, OPTION_MODEL_ID, cstrPnPModelId);
     CHECK_CLIENT_RESULT_AND_REPORT_ERROR( OPTION_MODEL_ID );
 
-    result = IoTHubDeviceClient_LL_SetOption(hIoTHubClient, OPTION_KEEP_ALIVE, &iKeepalivePeriodSeconds);
+    result = pAzureIoTTransport->SetOption(hIoTHubClient, OPTION_KEEP_ALIVE, &iKeepalivePeriodSeconds);
     CHECK_CLIENT_RESULT_AND_REPORT_ERROR( OPTION_KEEP_ALIVE );
 
-    result = IoTHubDeviceClient_LL_SetRetryPolicy(hIoTHubClient, IOTHUB_CLIENT_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER, 240);
+    result = pAzureIoTTransport->SetRetryPolicy(hIoTHubClient, IOTHUB_CLIENT_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER, AZURE_IOT_HUB_RECONNECT_TIMEOUT_SECONDS);
     CHECK_CLIENT_RESULT_AND_REPORT_ERROR( "retry policy ...EXPONENTIAL_BACKOFF_WITH_JITTER" );
 
     // Set callbacks for Message, MethodCall and Device Twin features.
-    result = IoTHubDeviceClient_LL_SetMessageCallback(hIoTHubClient, lstIotHubCallbacks.MessageReceivedHandler, NULL);
+    result = pAzureIoTTransport->SetMessageCallback(hIoTHubClient, lstIotHubCallbacks.MessageReceivedHandler, NULL);
     CHECK_CLIENT_RESULT_AND_REPORT_ERROR( "SetMessageCallback" );
 
-    result = IoTHubDeviceClient_LL_SetDeviceMethodCallback(hIoTHubClient, lstIotHubCallbacks.DirectMethodHandler, NULL);
+    result = pAzureIoTTransport->SetDeviceMethodCallback(hIoTHubClient, lstIotHubCallbacks.DirectMethodHandler, NULL);
     CHECK_CLIENT_RESULT_AND_REPORT_ERROR( "SetDeviceMethodCallback" );
 
-    result = IoTHubDeviceClient_LL_SetDeviceTwinCallback(hIoTHubClient, lstIotHubCallbacks.DeviceTwinUpdateHandler, NULL);
+    result = pAzureIoTTransport->SetDeviceTwinCallback(hIoTHubClient, lstIotHubCallbacks.DeviceTwinUpdateHandler, NULL);
     CHECK_CLIENT_RESULT_AND_REPORT_ERROR( "SetDeviceTwinCallback" );
 
     // Set callbacks for connection status related events.
-    result = IoTHubDeviceClient_LL_SetConnectionStatusCallback( hIoTHubClient, &hubConnectionStatusCallback, NULL);
+    result = pAzureIoTTransport->SetConnectionStatusCallback( hIoTHubClient, &hubConnectionStatusCallback, NULL);
     CHECK_CLIENT_RESULT_AND_REPORT_ERROR( "SetConnectionStatusCallback" );
 
     hubConnectionStatus = AZURE_IOT_HUB_AUTHENTICATING;
@@ -460,25 +695,87 @@ cleanup:
 
 
 
-/// @brief closes IoT Hub Device Client if active, de-initializes security factory and IoT Hub SDK 
+/// @brief closes IoT Hub Device Client if active, the transport de-initializes security factory and IoT Hub SDK 
 void hubCleanup( void )
 {
     Log_Debug(MODULE "INFO: IoT Hub client de-init.\n");
 
     if (hIoTHubClient != NULL) {
-        IoTHubDeviceClient_LL_Destroy(hIoTHubClient);
+        pAzureIoTTransport->Destroy(hIoTHubClient);
         hIoTHubClient = NULL;
     }
-    iothub_security_deinit();
-    IoTHub_Deinit();
+    nReconnectDeadlineMs = 0;
+}
+
+
+/**
+ * @brief Re-arms the connection timer if the period changes
+ * @param nPeriodMs new period in milliseconds
+ */
+static void setConnectionTimerPeriod(long nPeriodMs)
+{
+    if ((nPeriodMs == nConnectionTimerPeriodMs) || (evtConnectionTimer.fd < 0)) {
+        return;
+    }
+    nConnectionTimerPeriodMs = nPeriodMs;
+    struct timespec tsPeriod = { nPeriodMs / 1000, (nPeriodMs % 1000) * 1000 * 1000 };
+    SetTimerFdToPeriod(evtConnectionTimer.fd, &tsPeriod);
 }
 
+/**
+ * @brief Adapts the DoWork cadence after a DoWork call: the fast 100ms period while messages, twin reports
+ * or confirmations are outstanding or a callback ran (e.g. a direct method response may be pending),
+ * otherwise the period doubles up to AZURE_IOT_DOWORK_IDLE_PERIOD_MS.
+ */
+static void scheduleDoWork(void)
+{
+    long nPeriodMs = CONNECTION_TIMER_PERIOD_MS;
+
+    if (!bDoWorkRequested && !AzureIoT_IsWorkPending()) {
+        nPeriodMs = nConnectionTimerPeriodMs * 2;
+        if (nPeriodMs > AZURE_IOT_DOWORK_IDLE_PERIOD_MS) {
+            nPeriodMs = AZURE_IOT_DOWORK_IDLE_PERIOD_MS;
+        }
+    }
+    bDoWorkRequested = false;
+    setConnectionTimerPeriod(nPeriodMs);
+}
+
+/**
+ * @brief Connects straight to the IoT Hub of a usable cached assignment or of a transport without
+ * provisioning, otherwise starts DPS registration
+ */
+static void startConnection(void)
+{
+    if( !pAzureIoTTransport->bProvisioning )
+    {
+        snprintf( strIotHubUri, sizeof(strIotHubUri), "%s", pAzureIoTTransport->cstrName );
+        dpsRegisterStatus = AZURE_IOT_DPS_COMPLETED;
+        bHubFromCache = false;
+        hubInitialize();
+        return;
+    }
+
+    if( isAssignmentUsable() )
+    {
+        Log_Debug(MODULE "INFO: using cached DPS assignment to %s\n", assignment.strHubUri);
+        strcpy( strIotHubUri, assignment.strHubUri );
+        dpsRegisterStatus = AZURE_IOT_DPS_COMPLETED;
+        bHubFromCache = hubInitialize();
+        return;
+    }
+
+    bHubFromCache = false;
+    dpsRegisterDevice();
+}
 
 /**
  * @brief connectionTimerHandler() is the watchdog timer for the IoT Hub connection.
  * it runs on a 100ms period (per IoT Hub SDK recommendation), first checking on network connectivety,
  * then initiating DPS device registration and checking IoT Hub connection.
- * On connection failure it also handles the backoff schedule to reconnect via DPS to IoT Hub. 
+ * On connection failure it also handles the backoff schedule to reconnect via DPS to IoT Hub: with fast
+ * recovery per failure class with jitter (see nextRetryDelayMs()), otherwise doubling from 5s to 240s.
+ * While connected and idle the period backs off to AZURE_IOT_DOWORK_IDLE_PERIOD_MS (see scheduleDoWork()).
  * 
  * @param eventData 
  */
@@ -491,6 +788,28 @@ static void connectionTimerHandler(EventData *eventData)
     // If network not (yet or no longer) ready, de-initialize  
     if( !isNetworkReady() )
     {
+        // fast recovery keeps the IoT Hub client through a short network loss and pauses DoWork,
+        // the client picks up its connection again once the network is back
+        if( bFastRecovery && (hIoTHubClient != NULL)
+            && ((hubConnectionStatus == AZURE_IOT_HUB_CONNECTED) || (hubConnectionStatus == AZURE_IOT_HUB_AUTHENTICATING)) )
+        {
+            long long nNowMs = nowMs();
+            if( nNetworkLostAtMs == 0 )
+            {
+                Log_Debug(MODULE "INFO: network lost, keeping the IoT Hub client for %d s.\n", AZURE_IOT_NETWORK_LOSS_GRACE_SECONDS);
+                nNetworkLostAtMs = nNowMs;
+            }
+            if( nNowMs - nNetworkLostAtMs < AZURE_IOT_NETWORK_LOSS_GRACE_SECONDS * 1000LL )
+            {
+                setConnectionTimerPeriod(CONNECTION_TIMER_PERIOD_MS);
+                return;
+            }
+        }
+        nNetworkLostAtMs = 0;
+        // the connection starts over once the network is back, a pending retry is void
+        nRetryAtMs = 0;
+        retryClass = RETRY_SETUP;
+
         if( dpsRegisterStatus != AZURE_IOT_DPS_NOT_STARTED )
         {
             dpsCleanup();
@@ -503,10 +822,11 @@ static void connectionTimerHandler(EventData *eventData)
         }
         return;
     }
+    nNetworkLostAtMs = 0;
 
     if( dpsRegisterStatus==AZURE_IOT_DPS_NOT_STARTED )
     {
-        dpsRegisterDevice();
+        startConnection();
         return;
     }
 
@@ -517,38 +837,77 @@ static void connectionTimerHandler(EventData *eventData)
     if( (hubConnectionStatus == AZURE_IOT_HUB_CONNECTED)
         || (hubConnectionStatus == AZURE_IOT_HUB_AUTHENTICATING) )
     {
+        if( (nReconnectDeadlineMs != 0) && (nowMs() > nReconnectDeadlineMs) )
+        {
+            Log_Debug(MODULE "ERROR: IoT Hub client did not reconnect within %d s.\n", AZURE_IOT_HUB_RECONNECT_TIMEOUT_SECONDS);
+            hubConnectionStatus = AZURE_IOT_HUB_FAILED;
+            retryClass = RETRY_TRANSIENT;
+            nReconnectDeadlineMs = 0;
+            return;
+        }
+
         static time_t lastHubDoWorkLogged = 0;
         periodicLogVarArgs(&lastHubDoWorkLogged, 10,  MODULE "%s calls in progress...\n", __func__);
 
         // DoWork - send some of the buffered events to the IoT Hub, and receive some of the
         // buffered events from the IoT Hub.
-        IoTHubDeviceClient_LL_DoWork(hIoTHubClient);
+        pAzureIoTTransport->DoWork(hIoTHubClient);
+        // confirmations may have freed in-flight slots for held back critical messages
+        AzureIoT_DispatchPendingMessages();
+        scheduleDoWork();
         return;
     }
 
+    // connecting or retrying, keep the fast period
+    setConnectionTimerPeriod(CONNECTION_TIMER_PERIOD_MS);
+
     // in case anything failed
     if( (dpsRegisterStatus == AZURE_IOT_DPS_FAILED) 
         || (hubConnectionStatus == AZURE_IOT_HUB_FAILED) )
     {
-        static struct timespec tsLastRetry = {};
-        struct timespec tsNow;
-        timespec_get(&tsNow, TIME_UTC);
-        if( tsNow.tv_sec < tsLastRetry.tv_sec + iConnectionRetrySeconds )
+        if( bFastRecovery )
         {
-            return;
+            long long nNowMs = nowMs();
+            if( nRetryAtMs == 0 )
+            {
+                unsigned int nDelayMs = nextRetryDelayMs( retryClass );
+                Log_Debug(MODULE "INFO: %s failure, retry in %u ms.\n", cstrRetryClassNames[retryClass], nDelayMs);
+                nRetryAtMs = nNowMs + nDelayMs;
+            }
+            if( nNowMs < nRetryAtMs )
+            {
+                return;
+            }
+            nRetryAtMs = 0;
+            retryClass = RETRY_SETUP;
+        }
+        else
+        {
+            static struct timespec tsLastRetry = {};
+            struct timespec tsNow;
+            timespec_get(&tsNow, TIME_UTC);
+            if( tsNow.tv_sec < tsLastRetry.tv_sec + iConnectionRetrySeconds )
+            {
+                return;
+            }
+
+            tsLastRetry = tsNow;
+
+            iConnectionRetrySeconds *=  2;
+            if( iConnectionRetrySeconds > iConnectionRetryMaxWaitSeconds )
+            {
+                iConnectionRetrySeconds = iConnectionRetryMaxWaitSeconds;
+            }
         }
 
-        tsLastRetry = tsNow;
-
-        iConnectionRetrySeconds *=  2;
-        if( iConnectionRetrySeconds > iConnectionRetryMaxWaitSeconds )
+        // a failed IoT Hub client is replaced, its resources are released first
+        if( hIoTHubClient != NULL )
         {
-            iConnectionRetrySeconds = iConnectionRetryMaxWaitSeconds;
+            hubCleanup();
         }
-        
         dpsRegisterStatus=AZURE_IOT_DPS_NOT_STARTED;
         hubConnectionStatus = AZURE_IOT_HUB_DISCONNECTED;
-        dpsRegisterDevice();
+        startConnection();
     }
 }
 
@@ -601,17 +960,78 @@ void AzureIoT_DPS_DeInitialize( void )
     dpsCleanup();
 }
 
+bool AzureIoT_DPS_InitializeAssignmentStorage(int fdStorage, off_t nOffset, size_t nSize)
+{
+    fdAssignmentStorage = -1;
+    if( fdStorage < 0 )
+    {
+        return false;
+    }
+    if( nSize < sizeof(assignment) )
+    {
+        Log_Debug(MODULE "WARNING: DPS assignment storage needs %u bytes.\n", (unsigned int)sizeof(assignment));
+        return false;
+    }
+    fdAssignmentStorage = fdStorage;
+    nAssignmentStorageOffset = nOffset;
+
+    static dps_assignment_t stored;
+    if( (lseek(fdStorage, nOffset, SEEK_SET) < 0)
+        || (read(fdStorage, &stored, sizeof(stored)) != (ssize_t)sizeof(stored))
+        || (stored.nMagic != ASSIGNMENT_MAGIC) || (stored.nHash != hashAssignment(&stored)) )
+    {
+        Log_Debug(MODULE "INFO: no DPS assignment stored.\n");
+        return false;
+    }
+    stored.strScopeId[sizeof(stored.strScopeId) - 1] = '\0';
+    stored.strDeviceId[sizeof(stored.strDeviceId) - 1] = '\0';
+    stored.strHubUri[sizeof(stored.strHubUri) - 1] = '\0';
+    assignment = stored;
+    bAssignmentKnown = true;
+
+    bool bUsable = isAssignmentUsable();
+    Log_Debug(MODULE "INFO: stored DPS assignment to %s (%s).\n", assignment.strHubUri, bUsable ? "usable" : "not usable");
+    return bUsable;
+}
+
+void AzureIoT_DPS_InvalidateAssignment( void )
+{
+    if( bAssignmentKnown && assignment.nUsable )
+    {
+        Log_Debug(MODULE "INFO: cached DPS assignment invalidated.\n");
+        assignment.nUsable = 0;
+        saveAssignment();
+    }
+}
+
+void AzureIoT_DPS_SetFastRecovery( bool bEnable )
+{
+    bFastRecovery = bEnable;
+}
+
 int AzureIoT_DPS_StartConnection( void )
 {
     dpsRegisterStatus = AZURE_IOT_DPS_NOT_STARTED;
     if( evtConnectionTimer.fd > 0)
     {
+        nConnectionTimerPeriodMs = CONNECTION_TIMER_PERIOD_MS;
         return SetTimerFdToPeriod( evtConnectionTimer.fd, &tsConnectionTimerPeriod);
     }
 
     return 0;
 }
 
+void AzureIoT_DPS_RequestDoWork( void )
+{
+    bDoWorkRequested = true;
+
+    // leave a running fast timer alone, re-arming it on every request would postpone DoWork
+    if( hubConnectionStatus == AZURE_IOT_HUB_CONNECTED )
+    {
+        setConnectionTimerPeriod(CONNECTION_TIMER_PERIOD_MS);
+    }
+}
+
 void AzureIoT_DPS_SetScopeID(const char* cstrId)
 {
     cstrScopeId = NULL;
@@ -633,6 +1053,18 @@ void AzureIoT_DPS_SetScopeID(const char* cstrId)
 void AzureIoT_DPS_Options(int argc, char *argv[])
 {
     static const char cszScopeIdParam[] = "--ScopeId";
+#if defined(USE_AZURE_IOT_LOCAL_TRANSPORT)
+    static const char cszLocalTransportParam[] = "--LocalTransport";
+    for(int i=0; i<argc-1; i++)
+    {
+        if( strncmp(argv[i],cszLocalTransportParam, sizeof(cszLocalTransportParam)) == 0 )
+        {
+            AzureIoT_LocalTransport_SetAddress( argv[i+1] );
+            AzureIoT_SetTransport( &AzureIoT_LocalTransport );
+            return;
+        }
+    }
+#endif
     for(int i=0; i<argc-1; i++)
     {
         if( strncmp(argv[i],cszScopeIdParam, sizeof(cszScopeIdParam)) == 0 )
@@ -9,10 +9,28 @@
 #define _AZURE_IOT_DPS_H_
 
 #include <stdbool.h>
+#include <sys/types.h>
 #include "azure_iot.h"
 
 #define MAX_HUB_URI_LENGTH (512)
 #define MAX_SCOPEID_LENGTH (32)
+#define MAX_DEVICEID_LENGTH (128)
+
+/// @brief a cached DPS assignment older than this is refreshed by DPS registration
+#ifndef AZURE_IOT_DPS_ASSIGNMENT_MAX_AGE_SECONDS
+#define AZURE_IOT_DPS_ASSIGNMENT_MAX_AGE_SECONDS (7 * 24 * 60 * 60)
+#endif
+
+/// @brief fast recovery: a kept IoT Hub client that lost its connection gets this long to reconnect
+/// by itself (also the SDK retry policy timeout) before it is replaced
+#ifndef AZURE_IOT_HUB_RECONNECT_TIMEOUT_SECONDS
+#define AZURE_IOT_HUB_RECONNECT_TIMEOUT_SECONDS (240)
+#endif
+
+/// @brief fast recovery: the IoT Hub client is kept while the network is down for up to this long
+#ifndef AZURE_IOT_NETWORK_LOSS_GRACE_SECONDS
+#define AZURE_IOT_NETWORK_LOSS_GRACE_SECONDS (120)
+#endif
 
 typedef enum  {
     AZURE_IOT_DPS_COMPLETED=0,
@@ -59,6 +77,49 @@ void AzureIoT_DPS_DeInitialize( void );
  */
 int AzureIoT_DPS_StartConnection(void );
 
+/**
+ * @brief Requests IoT Hub DoWork at the fast cadence, called whenever a message, twin report or
+ * method response is handed to the IoT Hub client. While idle DoWork backs off to
+ * AZURE_IOT_DOWORK_IDLE_PERIOD_MS.
+ */
+void AzureIoT_DPS_RequestDoWork( void );
+
+/**
+ * @brief Keeps the IoT Hub and device id assigned by DPS in a storage region. While the assignment is
+ * usable (same Scope Id, younger than AZURE_IOT_DPS_ASSIGNMENT_MAX_AGE_SECONDS) connects go straight
+ * to the IoT Hub. DPS registration runs again once the IoT Hub rejects the device (bad credential,
+ * disabled) or cannot be reached before the first authentication. A new assignment to another
+ * IoT Hub invalidates the reported properties cache (see AzureIoT_PnP_InvalidateReportedProperties()).
+ * Call before AzureIoT_DPS_StartConnection().
+ *
+ * @param fdStorage     read/write file descriptor (e.g. Storage_OpenMutableFile()), -1 for RAM only
+ * @param nOffset       start of the region in the file
+ * @param nSize         size of the region, about 700 bytes
+ * @return true if a usable assignment was restored
+ */
+bool AzureIoT_DPS_InitializeAssignmentStorage(int fdStorage, off_t nOffset, size_t nSize);
+
+/**
+ * @brief Marks the cached assignment unusable, the next connect registers with DPS again
+ */
+void AzureIoT_DPS_InvalidateAssignment( void );
+
+/**
+ * @brief Fast recovery (default on) keeps the IoT Hub client through transient losses: a network
+ * flicker shorter than AZURE_IOT_NETWORK_LOSS_GRACE_SECONDS only pauses DoWork, and a connection
+ * lost for NO_NETWORK, COMMUNICATION_ERROR or NO_PING_RESPONSE is left to the client's own reconnect
+ * for up to AZURE_IOT_HUB_RECONNECT_TIMEOUT_SECONDS. Failures that replace the client are classified
+ * by IOTHUB_CLIENT_CONNECTION_STATUS_REASON (transient 1s..60s, credential 5s..5min, disabled
+ * 1min..1h, DPS/setup 5s..240s) and retried on the backoff of their class with jitter.
+ * Off restores tearing down both clients on any loss and retrying after 5s doubling up to 240s.
+ * In the fleet simulator the kept client is the local transport, its reconnect is the stand-in backoff
+ * of AZURE_IOT_LOCAL_RECONNECT_MIN_MS..AZURE_IOT_LOCAL_RECONNECT_MAX_MS (1s..30s) with jitter, not the SDK
+ * retry policy, so its fast recovery figures do not show how the SDK client reconnects.
+ *
+ * @param bEnable   true for fast recovery
+ */
+void AzureIoT_DPS_SetFastRecovery( bool bEnable );
+
 /**
 * @brief    Sets the DPS Scope ID.
 *
@@ -68,7 +129,8 @@ void AzureIoT_DPS_SetScopeID(const char* cstrID);
 
 
 /**
- * @brief reads "--ScopeId" from command line
+ * @brief reads "--ScopeId" from command line. Host builds with USE_AZURE_IOT_LOCAL_TRANSPORT also take
+ *        "--LocalTransport <address>" to connect to a local stand-in instead (see AzureIoT_LocalTransport_SetAddress())
  * 
  * @param argc  main() command line argument count 
  * @param argv  main() command line arguments
@@ -1,9 +1,11 @@
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <applibs/log.h>
 
 #include "parson.h"
 #include "azure_iot.h"
+#include "azure_iot_dps.h"
 #include "azure_iot_json.h"
 
 #define MODULE "[JSON] "
@@ -11,23 +13,233 @@
 /// @brief    Pointer to array of MethodRegistration records. Last array record needs to have NULL, NULL as end marker
 static MethodRegistration* pRegisteredMethods = NULL;
 
+/// @brief    Slot of the open addressing hash index over pRegisteredMethods
+typedef struct MethodIndexEntryTag {
+    uint32_t nHash;
+    const MethodRegistration* pMethod;
+} MethodIndexEntry;
+
+/// @brief    Hash index built on registration, size is a power of 2 and at least twice the method count
+static MethodIndexEntry* pMethodIndex = NULL;
+static size_t nMethodIndexMask = 0;
+
 /// @brief Device twin update handler. See @see JsonTwinUpdateFnType
 static JsonTwinUpdateFnType fnJsonTwinUpdateHandler = NULL;
 
 /// @brief message received handler. See @see JsonMessageReceivedFnType
 static JsonMessageReceivedFnType fnJsonMessageReceivedHandler = NULL;
 
+/// @brief Desired property subscription with the path pre-split into segments
+typedef struct TwinSubscriptionTag {
+    const char* cstrPath;
+    JSON_Value_Type propertyType;
+    JsonTwinPropertyFnType fnHandler;
+    size_t nSegments;
+    const char* apSegment[AZURE_IOT_JSON_MAX_TWIN_PATH_DEPTH];
+    size_t anSegmentLength[AZURE_IOT_JSON_MAX_TWIN_PATH_DEPTH];
+} TwinSubscription;
+
+static TwinSubscription aTwinSubscriptions[AZURE_IOT_JSON_MAX_TWIN_SUBSCRIPTIONS];
+_Static_assert(AZURE_IOT_JSON_MAX_TWIN_SUBSCRIPTIONS <= 32, "candidate subscriptions are a uint32_t bit mask");
+static size_t nTwinSubscriptions = 0;
+
+/// @brief Desired property value picked by the selective twin parse, dispatched once "$version" is known
+typedef struct TwinSelectedValueTag {
+    JSON_Value* jsonValue;
+    size_t nDepth;              ///< path segment index of the value
+    uint32_t nSubscriptions;    ///< subscriptions ending at this value
+    uint32_t nChildCandidates;  ///< subscriptions continuing below this value
+} TwinSelectedValue;
+
+/// @brief State of the selective twin parse, callbacks arrive in document order
+typedef struct TwinSelectStateTag {
+    size_t nDesiredDepth;       ///< 1 inside "desired" of a full twin, 0 for a desired properties patch
+    uint32_t anCandidates[AZURE_IOT_JSON_MAX_TWIN_PATH_DEPTH];
+    TwinSelectedValue pending;  ///< match of the last key, completed by the value callback
+    unsigned int nVersion;
+    size_t nValues;
+    TwinSelectedValue aValues[AZURE_IOT_JSON_MAX_TWIN_SUBSCRIPTIONS];
+} TwinSelectState;
+
+static TwinSelectState twinSelect;
+
+/// @brief pooled buffer for single pass serialization of outgoing payloads
+static char abPayloadBuffer[AZURE_IOT_JSON_PAYLOAD_SIZE];
+
+/**
+* @brief    Checks the type of a subscribed desired property and calls its handler
+*/
+static void dispatchTwinProperty(const TwinSubscription* pSub, const JSON_Value* jsonValue, unsigned int nVersion)
+{
+    if ((pSub->propertyType != JSONError) && (json_value_get_type(jsonValue) != pSub->propertyType)) {
+        Log_Debug( MODULE "WARNING: desired property '%s' has unexpected type %d\n", pSub->cstrPath, json_value_get_type(jsonValue));
+        return;
+    }
+    pSub->fnHandler(pSub->cstrPath, jsonValue, nVersion);
+}
+
+/**
+* @brief    Walks the members of one level of the desired properties. Only subscriptions in the
+*           nCandidates bit mask (those whose path matched so far) are compared and only objects
+*           with a matching subscription are descended into.
+*/
+static void dispatchTwinSubscriptions(const JSON_Object* jsonObject, size_t nDepth, uint32_t nCandidates, unsigned int nVersion)
+{
+    size_t nCount = json_object_get_count(jsonObject);
+    for (size_t nMember = 0; (nMember < nCount) && (nCandidates != 0); nMember++) {
+        const char* cstrName = json_object_get_name(jsonObject, nMember);
+        size_t nNameLength = strlen(cstrName);
+        uint32_t nChildCandidates = 0;
+
+        for (size_t nSub = 0; nSub < nTwinSubscriptions; nSub++) {
+            const TwinSubscription* pSub = &aTwinSubscriptions[nSub];
+            if (((nCandidates & (1u << nSub)) == 0) ||
+                (pSub->anSegmentLength[nDepth] != nNameLength) ||
+                (memcmp(pSub->apSegment[nDepth], cstrName, nNameLength) != 0)) {
+                continue;
+            }
+            if (pSub->nSegments > nDepth + 1) {
+                nChildCandidates |= (1u << nSub);
+                continue;
+            }
+
+            dispatchTwinProperty(pSub, json_object_get_value_at(jsonObject, nMember), nVersion);
+        }
+
+        if (nChildCandidates != 0) {
+            const JSON_Object* jsonChild = json_value_get_object(json_object_get_value_at(jsonObject, nMember));
+            if (jsonChild != NULL) {
+                dispatchTwinSubscriptions(jsonChild, nDepth + 1, nChildCandidates, nVersion);
+            }
+        }
+    }
+}
+
+/**
+* @brief    Selective twin parse: decides per member whether it is on a subscribed path.
+*           Everything else (e.g. "reported" and "$metadata") is skipped without allocating.
+*/
+static JSON_Select_Action twinSelectKey(void* pContext, size_t nDepth, const char* pKey, size_t nKeyLength)
+{
+    TwinSelectState* pState = (TwinSelectState*)pContext;
+
+    if (nDepth == 0) {
+        // a full twin has the desired properties below "desired", a patch has them at the root
+        pState->nDesiredDepth = ((nKeyLength == 7) && (memcmp(pKey, "desired", 7) == 0)) ? 1 : 0;
+        if (pState->nDesiredDepth == 1) {
+            return JSONSelectDescend;
+        }
+    }
+
+    size_t nSegment = nDepth - pState->nDesiredDepth;
+    if ((nSegment == 0) && (nKeyLength == 8) && (memcmp(pKey, "$version", 8) == 0)) {
+        pState->pending.nSubscriptions = 0;
+        pState->pending.nChildCandidates = 0;
+        return JSONSelectValue;
+    }
+
+    uint32_t nCandidates = (nSegment == 0) ?
+        ((nTwinSubscriptions < 32) ? ((1u << nTwinSubscriptions) - 1) : UINT32_MAX) : pState->anCandidates[nSegment];
+    pState->pending.nDepth = nSegment;
+    pState->pending.nSubscriptions = 0;
+    pState->pending.nChildCandidates = 0;
+    for (size_t nSub = 0; nSub < nTwinSubscriptions; nSub++) {
+        const TwinSubscription* pSub = &aTwinSubscriptions[nSub];
+        if (((nCandidates & (1u << nSub)) == 0) ||
+            (pSub->anSegmentLength[nSegment] != nKeyLength) ||
+            (memcmp(pSub->apSegment[nSegment], pKey, nKeyLength) != 0)) {
+            continue;
+        }
+        if (pSub->nSegments > nSegment + 1) {
+            pState->pending.nChildCandidates |= (1u << nSub);
+        } else {
+            pState->pending.nSubscriptions |= (1u << nSub);
+        }
+    }
+
+    if (pState->pending.nSubscriptions != 0) {
+        return JSONSelectValue;
+    }
+    if (pState->pending.nChildCandidates != 0) {
+        pState->anCandidates[nSegment + 1] = pState->pending.nChildCandidates;
+        return JSONSelectDescend;
+    }
+    return JSONSelectSkip;
+}
+
+/**
+* @brief    Selective twin parse: keeps "$version" and the values of subscribed properties
+*/
+static void twinSelectValue(void* pContext, size_t nDepth, const char* pKey, size_t nKeyLength, JSON_Value* jsonValue)
+{
+    TwinSelectState* pState = (TwinSelectState*)pContext;
+
+    if ((pState->pending.nSubscriptions == 0) && (pState->pending.nChildCandidates == 0)) {
+        pState->nVersion = (unsigned int)json_value_get_number(jsonValue);
+        json_value_free(jsonValue);
+        return;
+    }
+    if (pState->nValues >= AZURE_IOT_JSON_MAX_TWIN_SUBSCRIPTIONS) {
+        Log_Debug( MODULE "WARNING: too many desired property matches, '%.*s' dropped\n", (int)nKeyLength, pKey);
+        json_value_free(jsonValue);
+        return;
+    }
+    pState->pending.jsonValue = jsonValue;
+    pState->aValues[pState->nValues++] = pState->pending;
+}
+
+/**
+* @brief    Dispatches subscribed desired properties without building the twin document.
+*           Only the values of subscribed paths (and "$version") are allocated.
+*/
+static void selectTwinSubscriptions(const unsigned char* pbPayload, size_t nPayloadSize)
+{
+    memset(&twinSelect, 0, sizeof(twinSelect));
+
+    JSON_Status status = json_parse_buffer_select((const char*)pbPayload, nPayloadSize, &twinSelectKey, &twinSelectValue, &twinSelect);
+    if (status != JSONSuccess) {
+        Log_Debug( MODULE "ERROR: invalid device twin json\n");
+    }
+
+    for (size_t nValue = 0; nValue < twinSelect.nValues; nValue++) {
+        const TwinSelectedValue* pValue = &twinSelect.aValues[nValue];
+        if (status == JSONSuccess) {
+            for (size_t nSub = 0; nSub < nTwinSubscriptions; nSub++) {
+                if ((pValue->nSubscriptions & (1u << nSub)) != 0) {
+                    dispatchTwinProperty(&aTwinSubscriptions[nSub], pValue->jsonValue, twinSelect.nVersion);
+                }
+            }
+            // a subscribed path that is also the prefix of a longer one was parsed as a whole
+            const JSON_Object* jsonObject = json_value_get_object(pValue->jsonValue);
+            if ((pValue->nChildCandidates != 0) && (jsonObject != NULL)) {
+                dispatchTwinSubscriptions(jsonObject, pValue->nDepth + 1, pValue->nChildCandidates, twinSelect.nVersion);
+            }
+        }
+        json_value_free(pValue->jsonValue);
+    }
+}
+
 /**
 * @brief    Internal Callback: invoked when a Device Twin update is received from IoT Hub.
 */
 static void jsonDeviceTwinUpdateCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payLoad,
                          size_t payLoadSize, void *userContextCallback)
 {
-    if (fnJsonTwinUpdateHandler == NULL) {
+    if ((fnJsonTwinUpdateHandler == NULL) && (nTwinSubscriptions == 0)) {
         Log_Debug( MODULE "WARNING: Received device twin update but no handler available.");
         return;
     }
 
+    // the handlers typically report properties back
+    AzureIoT_DPS_RequestDoWork();
+
+    // Without a handler for the whole document, only subscribed properties are extracted
+    if (fnJsonTwinUpdateHandler == NULL) {
+        Log_Debug( MODULE "INFO: Device twin update received (%u bytes)\n", (unsigned int)payLoadSize);
+        selectTwinSubscriptions(payLoad, payLoadSize);
+        return;
+    }
+
     JSON_Value* jsonRootValue = AzureIoTJson_FromPayload(payLoad, payLoadSize);
     if (jsonRootValue == NULL) {
         return;
@@ -39,14 +251,100 @@ static void jsonDeviceTwinUpdateCallback(DEVICE_TWIN_UPDATE_STATE updateState, c
     if (jsonDesiredProperties == NULL) {
         jsonDesiredProperties = jsonRootObject;
     }
+    // Dispatch subscribed properties in one walk over the desired properties
+    if (nTwinSubscriptions > 0) {
+        unsigned int nVersion = (unsigned int)json_object_get_number(jsonDesiredProperties, "$version");
+        uint32_t nCandidates = (nTwinSubscriptions < 32) ? ((1u << nTwinSubscriptions) - 1) : UINT32_MAX;
+        dispatchTwinSubscriptions(jsonDesiredProperties, 0, nCandidates, nVersion);
+    }
+
     // Call the provided Twin Device callback
-    fnJsonTwinUpdateHandler(jsonDesiredProperties);
+    if (fnJsonTwinUpdateHandler != NULL) {
+        fnJsonTwinUpdateHandler(jsonDesiredProperties);
+    }
 
     json_value_free(jsonRootValue);
 }
 
 /**
-* @brief    Internal Callback: Loops through list and calls method handler with json args
+* @brief    FNV-1a hash of the full method name (e.g. "component*command")
+*/
+static uint32_t hashMethodName(const char* cstrMethodName)
+{
+    uint32_t nHash = 2166136261u;
+    while (*cstrMethodName != '\0') {
+        nHash ^= (unsigned char)*cstrMethodName++;
+        nHash *= 16777619u;
+    }
+    return nHash;
+}
+
+/**
+* @brief    Builds the hash index over the registered methods. Duplicate names keep the first entry.
+*/
+static void buildMethodIndex(const MethodRegistration* methods)
+{
+    free(pMethodIndex);
+    pMethodIndex = NULL;
+    nMethodIndexMask = 0;
+
+    size_t nCount = 0;
+    while ((methods != NULL) && (methods[nCount].MethodName != NULL) && (methods[nCount].MethodHandler != NULL)) {
+        nCount++;
+    }
+    if (nCount == 0) {
+        return;
+    }
+
+    size_t nSlots = 4;
+    while (nSlots < 2 * nCount) {
+        nSlots <<= 1;
+    }
+    if ((pMethodIndex = (MethodIndexEntry*)calloc(nSlots, sizeof(MethodIndexEntry))) == NULL) {
+        Log_Debug( MODULE "ERROR: not enough memory.\n");
+        abort();
+    }
+    nMethodIndexMask = nSlots - 1;
+
+    for (const MethodRegistration* pMethod = methods; pMethod < methods + nCount; pMethod++) {
+        uint32_t nHash = hashMethodName(pMethod->MethodName);
+        size_t nSlot = nHash & nMethodIndexMask;
+        while (pMethodIndex[nSlot].pMethod != NULL) {
+            if ((pMethodIndex[nSlot].nHash == nHash) && (strcmp(pMethodIndex[nSlot].pMethod->MethodName, pMethod->MethodName) == 0)) {
+                Log_Debug( MODULE "WARNING: Method '%s' registered twice, ignoring duplicate\n", pMethod->MethodName);
+                break;
+            }
+            nSlot = (nSlot + 1) & nMethodIndexMask;
+        }
+        if (pMethodIndex[nSlot].pMethod == NULL) {
+            pMethodIndex[nSlot].nHash = nHash;
+            pMethodIndex[nSlot].pMethod = pMethod;
+        }
+    }
+}
+
+/**
+* @brief    Looks up a method by its full name, O(1) independent of the number of registered methods
+* @return   registration or NULL if not found
+*/
+static const MethodRegistration* findMethod(const char* cstrMethodName)
+{
+    if (pMethodIndex == NULL) {
+        return NULL;
+    }
+    uint32_t nHash = hashMethodName(cstrMethodName);
+    size_t nSlot = nHash & nMethodIndexMask;
+    while (pMethodIndex[nSlot].pMethod != NULL) {
+        if ((pMethodIndex[nSlot].nHash == nHash) && (strcmp(pMethodIndex[nSlot].pMethod->MethodName, cstrMethodName) == 0)) {
+            return pMethodIndex[nSlot].pMethod;
+        }
+        nSlot = (nSlot + 1) & nMethodIndexMask;
+    }
+    return NULL;
+}
+
+/**
+* @brief    Internal Callback: Looks up the method in the hash index and calls method handler with json args
 */
 static int jsonDirectMethodCallback(const char* methodName, const unsigned char* payload, size_t payloadSize,
     unsigned char** response, size_t* responseSize,
@@ -54,32 +352,28 @@ static int jsonDirectMethodCallback(const char* methodName, const unsigned char*
 {
     Log_Debug("[IoT] Trying to invoke method %s\n", methodName);
 
+    // the SDK sends the response on the following DoWork calls
+    AzureIoT_DPS_RequestDoWork();
+
     *responseSize = 0;
     *response = NULL;
     int result = HTTP_NOT_FOUND;
 
- 
-    MethodRegistration* pMethod = pRegisteredMethods;
-    size_t nSize = strlen(methodName);
-
-    while ((pMethod->MethodName != NULL) && (pMethod->MethodHandler != NULL))
-    {
-        if (strncmp(methodName, pMethod->MethodName, nSize) == 0) {
-            JSON_Value* jsonParameters = AzureIoTJson_FromPayload(payload, payloadSize);
-            JSON_Value* jsonResponse = NULL;
+    const MethodRegistration* pMethod = findMethod(methodName);
+    if (pMethod != NULL) {
+        JSON_Value* jsonParameters = AzureIoTJson_FromPayload(payload, payloadSize);
+        JSON_Value* jsonResponse = NULL;
 
-            result = pMethod->MethodHandler(jsonParameters, &jsonResponse);
-            if (jsonParameters != NULL) {
-                json_value_free(jsonParameters);
-            }
-            if (jsonResponse != NULL) {
-                AzureIoTJson_ToPayload(jsonResponse, (char**)response, responseSize);
-                Log_Debug(MODULE "Command Response HTTP: %d '%s' (%d bytes)\n", result, *response, *responseSize);
-                json_value_free(jsonResponse);
-            }
-            return result;
+        result = pMethod->MethodHandler(jsonParameters, &jsonResponse);
+        if (jsonParameters != NULL) {
+            json_value_free(jsonParameters);
+        }
+        if (jsonResponse != NULL) {
+            AzureIoTJson_ToPayload(jsonResponse, (char**)response, responseSize);
+            Log_Debug(MODULE "Command Response HTTP: %d '%s' (%d bytes)\n", result, *response, *responseSize);
+            json_value_free(jsonResponse);
         }
-        pMethod++;
+        return result;
     }
 
     Log_Debug("[IoT] WARNING: Method '%s' not found\n", methodName);
@@ -127,20 +421,24 @@ static IOTHUBMESSAGE_DISPOSITION_RESULT jsonMessageReceivedCallback(IOTHUB_MESSA
 
 JSON_Value* AzureIoTJson_FromPayload(const unsigned char* pbPayload, size_t nPayloadSize)
 {
-    char* pszPayloadString = malloc(nPayloadSize + 1); // +1 to store null char at the end.
-    if (pszPayloadString == NULL) {
-        Log_Debug( MODULE "ERROR: Not enough memory\n");
-        abort();
-    }
-    memcpy(pszPayloadString, pbPayload, nPayloadSize);
-    pszPayloadString[nPayloadSize] = '\0'; // Null terminated string.
+    // payload is not NULL terminated: log and parse it in place instead of copying
+    Log_Debug( MODULE "Payload received %.*s\n", (int)nPayloadSize, (const char*)pbPayload);
 
-    Log_Debug( MODULE "Payload received %s\n",pszPayloadString);
+    return json_parse_buffer((const char*)pbPayload, nPayloadSize);
+}
 
-    JSON_Value* jsonRootValue = json_parse_string(pszPayloadString);
-    free(pszPayloadString);
+const char* AzureIoTJson_ToPooledPayload(const JSON_Value* jsonValue, size_t* pnPayloadSize)
+{
+    JSON_Writer writer;
+    json_writer_init(&writer, abPayloadBuffer, sizeof(abPayloadBuffer));
+    json_writer_value(&writer, jsonValue);
+    return json_writer_finish(&writer, pnPayloadSize);
+}
 
-    return jsonRootValue;
+JSON_Writer* AzureIoTJson_InitWriter(JSON_Writer* pWriter, char* pBuffer, size_t nBufferSize)
+{
+    json_writer_init(pWriter, pBuffer, nBufferSize);
+    return pWriter;
 }
 
 IOTHUB_CLIENT_RESULT AzureIoTJson_ToPayload(const JSON_Value* jsonValue, char** ppbResponse, size_t* pnResponseSize)
@@ -149,37 +447,55 @@ IOTHUB_CLIENT_RESULT AzureIoTJson_ToPayload(const JSON_Value* jsonValue, char**
         return IOTHUB_CLIENT_INVALID_ARG;
     }
 
-    char* pszPayload = NULL;
-    size_t nPayloadSize = 0;
-
-    if ((jsonValue == NULL) || ((nPayloadSize = json_serialization_size(jsonValue)) == 0)) {
-        *ppbResponse = NULL;
-        *pnResponseSize = 0;
+    *ppbResponse = NULL;
+    *pnResponseSize = 0;
+    if (jsonValue == NULL) {
         return IOTHUB_CLIENT_INVALID_ARG; // nothing to report
     }
 
-    if ((pszPayload = (char*)malloc(nPayloadSize)) == NULL) {
-        Log_Debug( MODULE "ERROR: not enough memory.\n");
-        abort();
-    }
-
-    if (json_serialize_to_buffer(jsonValue, pszPayload, nPayloadSize) == JSONFailure) {
-        Log_Debug( MODULE "ERROR: Invalid json\n");
-        free(pszPayload);
-        return IOTHUB_CLIENT_INVALID_ARG;
+    char* pszPayload = NULL;
+    size_t nPayloadSize = 0;
+    const char* pszPooledPayload = AzureIoTJson_ToPooledPayload(jsonValue, &nPayloadSize);
+    if (pszPooledPayload != NULL) {
+        // single pass: serialized into pool, just copy to heap (incl. NULL terminator)
+        if ((pszPayload = (char*)malloc(nPayloadSize + 1)) == NULL) {
+            Log_Debug( MODULE "ERROR: not enough memory.\n");
+            abort();
+        }
+        memcpy(pszPayload, pszPooledPayload, nPayloadSize + 1);
+    } else {
+        // payload exceeds pool: fall back to sizing pass plus serialization
+        if ((nPayloadSize = json_serialization_size(jsonValue)) == 0) {
+            return IOTHUB_CLIENT_INVALID_ARG;
+        }
+        if ((pszPayload = (char*)malloc(nPayloadSize)) == NULL) {
+            Log_Debug( MODULE "ERROR: not enough memory.\n");
+            abort();
+        }
+        if (json_serialize_to_buffer(jsonValue, pszPayload, nPayloadSize) == JSONFailure) {
+            Log_Debug( MODULE "ERROR: Invalid json\n");
+            free(pszPayload);
+            return IOTHUB_CLIENT_INVALID_ARG;
+        }
+        nPayloadSize--;
     }
 
     //Log_Debug(MODULE "Payload to transmit %s\n", pszPayload);
 
     // exclude NULL terminator in responseSize as some json de-serializers don't like trailling NULL character
-    *pnResponseSize = nPayloadSize-1; 
-    *ppbResponse = (unsigned char *)pszPayload;
+    *pnResponseSize = nPayloadSize; 
+    *ppbResponse = pszPayload;
     return IOTHUB_CLIENT_OK;
 }
 
 
 IOTHUB_CLIENT_RESULT AzureIoTJson_SendMessage(const JSON_Value* jsonPayload)
 {
+    const char* pszPooledPayload = AzureIoTJson_ToPooledPayload(jsonPayload, NULL);
+    if (pszPooledPayload != NULL) {
+        return AzureIoT_SendMessageWithContentType(pszPooledPayload, ContentType.Application_JSON, ContentEncoding.UTF_8);
+    }
+
     char* pszPayload = 0;
     size_t nPayloadSize = 0;
     IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_ERROR;
@@ -191,10 +507,26 @@ IOTHUB_CLIENT_RESULT AzureIoTJson_SendMessage(const JSON_Value* jsonPayload)
 }
 
 
+IOTHUB_CLIENT_RESULT AzureIoTJson_SendMessageFromWriter(JSON_Writer* pWriter)
+{
+    const char* pszPayload = json_writer_finish(pWriter, NULL);
+    if (pszPayload == NULL) {
+        Log_Debug( MODULE "ERROR: incomplete json or payload buffer too small\n");
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    return AzureIoT_SendMessageWithContentType(pszPayload, ContentType.Application_JSON, ContentEncoding.UTF_8);
+}
+
+
 IOTHUB_CLIENT_RESULT AzureIoTJson_TwinReportState(const JSON_Value* jsonState)
 {
-    char* pszPayload = 0;
     size_t nPayloadSize = 0;
+    const char* pszPooledPayload = AzureIoTJson_ToPooledPayload(jsonState, &nPayloadSize);
+    if (pszPooledPayload != NULL) {
+        return AzureIoT_TwinReportState(pszPooledPayload, nPayloadSize);
+    }
+
+    char* pszPayload = 0;
     IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_ERROR;
     if (IOTHUB_CLIENT_OK == AzureIoTJson_ToPayload(jsonState, &pszPayload, &nPayloadSize)) {
         result = AzureIoT_TwinReportState(pszPayload, nPayloadSize);
@@ -203,16 +535,66 @@ IOTHUB_CLIENT_RESULT AzureIoTJson_TwinReportState(const JSON_Value* jsonState)
     return result;
 }
 
+
+IOTHUB_CLIENT_RESULT AzureIoTJson_TwinReportStateFromWriter(JSON_Writer* pWriter)
+{
+    size_t nPayloadSize = 0;
+    const char* pszPayload = json_writer_finish(pWriter, &nPayloadSize);
+    if (pszPayload == NULL) {
+        Log_Debug( MODULE "ERROR: incomplete json or payload buffer too small\n");
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    return AzureIoT_TwinReportState(pszPayload, nPayloadSize);
+}
+
 void AzureIoTJson_SetDeviceTwinUpdateHandler(JsonTwinUpdateFnType handler)
 {
     fnJsonTwinUpdateHandler = handler;
     AzureIoT_SetDeviceTwinUpdateCallback( &jsonDeviceTwinUpdateCallback );
 }
 
+bool AzureIoTJson_SubscribeTwinProperty(const char* cstrPropertyPath, JSON_Value_Type propertyType, JsonTwinPropertyFnType handler)
+{
+    if ((cstrPropertyPath == NULL) || (handler == NULL)) {
+        return false;
+    }
+    if (nTwinSubscriptions >= AZURE_IOT_JSON_MAX_TWIN_SUBSCRIPTIONS) {
+        Log_Debug( MODULE "ERROR: too many twin subscriptions, '%s' not subscribed\n", cstrPropertyPath);
+        return false;
+    }
+
+    TwinSubscription* pSub = &aTwinSubscriptions[nTwinSubscriptions];
+    pSub->nSegments = 0;
+    const char* pSegment = cstrPropertyPath;
+    while (true) {
+        const char* pDot = strchr(pSegment, '.');
+        size_t nLength = (pDot != NULL) ? (size_t)(pDot - pSegment) : strlen(pSegment);
+        if ((nLength == 0) || (pSub->nSegments >= AZURE_IOT_JSON_MAX_TWIN_PATH_DEPTH)) {
+            Log_Debug( MODULE "ERROR: invalid twin property path '%s'\n", cstrPropertyPath);
+            return false;
+        }
+        pSub->apSegment[pSub->nSegments] = pSegment;
+        pSub->anSegmentLength[pSub->nSegments] = nLength;
+        pSub->nSegments++;
+        if (pDot == NULL) {
+            break;
+        }
+        pSegment = pDot + 1;
+    }
+    pSub->cstrPath = cstrPropertyPath;
+    pSub->propertyType = propertyType;
+    pSub->fnHandler = handler;
+    nTwinSubscriptions++;
+
+    AzureIoT_SetDeviceTwinUpdateCallback( &jsonDeviceTwinUpdateCallback );
+    return true;
+}
+
 
 void AzureIoTJson_RegisterDirectMethodHandlers(const MethodRegistration* methods)
 {
     pRegisteredMethods = (MethodRegistration*)methods;
+    buildMethodIndex(methods);
     AzureIoT_SetDirectMethodCallback( &jsonDirectMethodCallback );
 }
 
@@ -221,3 +603,43 @@ void AzureIoTJson_SetMessageReceivedHandler(JsonMessageReceivedFnType handler)
     fnJsonMessageReceivedHandler = handler;
     AzureIoT_SetMessageReceivedCallback( &jsonMessageReceivedCallback );
 }
+
+
+JSON_Value* AzureIoTJson_GetDeliveryStatistics(void)
+{
+    JSON_Value* jsonRoot = json_value_init_object();
+    JSON_Object* jsonRootObject = json_value_get_object(jsonRoot);
+    json_object_set_number(jsonRootObject, "inFlight", (double)AzureIoT_GetInFlightMessageCount());
+
+    // messages dropped (bulk: refused) per class because the in-flight share was used up
+    static const char* acstrClasses[AZURE_IOT_PRIORITY_COUNT] = { "critical", "response", "telemetry", "bulk" };
+    JSON_Value* jsonDropped = json_value_init_object();
+    for (int nClass = 0; nClass < AZURE_IOT_PRIORITY_COUNT; nClass++) {
+        json_object_set_number(json_value_get_object(jsonDropped), acstrClasses[nClass],
+            AzureIoT_GetDroppedMessageCount((AZURE_IOT_PRIORITY)nClass));
+    }
+    json_object_set_value(jsonRootObject, "dropped", jsonDropped);
+
+    size_t nComponents = 0;
+    const delivery_stats_t* aStats = AzureIoT_GetDeliveryStatistics(&nComponents);
+    for (size_t i = 0; i < nComponents; i++) {
+        const delivery_stats_t* pStats = &aStats[i];
+        JSON_Value* jsonComponent = json_value_init_object();
+        JSON_Object* jsonComponentObject = json_value_get_object(jsonComponent);
+        JSON_Value* jsonHistogram = json_value_init_array();
+        JSON_Array* jsonHistogramArray = json_value_get_array(jsonHistogram);
+
+        json_object_set_number(jsonComponentObject, "confirmed", pStats->nConfirmed);
+        json_object_set_number(jsonComponentObject, "errors", pStats->nErrors);
+        json_object_set_number(jsonComponentObject, "timeouts", pStats->nTimeouts);
+        json_object_set_number(jsonComponentObject, "avgMs", 
+            (pStats->nConfirmed > 0) ? (double)(pStats->nTotalLatencyMs / pStats->nConfirmed) : 0);
+        json_object_set_number(jsonComponentObject, "maxMs", pStats->nMaxLatencyMs);
+        for (size_t nBucket = 0; nBucket < AZURE_IOT_LATENCY_BUCKETS; nBucket++) {
+            json_array_append_number(jsonHistogramArray, pStats->anLatencyBuckets[nBucket]);
+        }
+        json_object_set_value(jsonComponentObject, "histogram", jsonHistogram);
+        json_object_set_value(jsonRootObject, pStats->strComponent, jsonComponent);
+    }
+    return jsonRoot;
+}
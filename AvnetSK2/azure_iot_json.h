@@ -27,6 +27,33 @@ JSON_Value* AzureIoTJson_FromPayload(const unsigned char* pbPayload, size_t nPay
 */
 IOTHUB_CLIENT_RESULT AzureIoTJson_ToPayload(const JSON_Value* jsonValue, char** ppbResponse, size_t* pnResponseSize);
 
+/// @brief size of the pooled payload buffer used for single pass serialization
+#ifndef AZURE_IOT_JSON_PAYLOAD_SIZE
+#define AZURE_IOT_JSON_PAYLOAD_SIZE (2048)
+#endif
+
+/**
+* @brief    Serializes json value in a single pass into the pooled payload buffer.
+*           The buffer is only valid until the next AzureIoTJson_* call, so hand it 
+*           to the IoT Hub SDK (which copies) straight away.
+*
+* @param    jsonValue           json payload
+* @param    pnPayloadSize       OUT parameter (optional): size excluding NULL terminator
+* @return   pointer to zero terminated payload or NULL if jsonValue is invalid or doesn't fit
+*/
+const char* AzureIoTJson_ToPooledPayload(const JSON_Value* jsonValue, size_t* pnPayloadSize);
+
+/**
+* @brief    Initializes a streaming writer on a caller provided buffer. Use the json_writer_* 
+*           functions to write the payload without building a JSON_Value tree.
+*
+* @param    pWriter         writer to initialize
+* @param    pBuffer         caller provided payload buffer
+* @param    nBufferSize     size of payload buffer
+* @return   pWriter for convenience
+*/
+JSON_Writer* AzureIoTJson_InitWriter(JSON_Writer* pWriter, char* pBuffer, size_t nBufferSize);
+
 /** 
 *  @brief   Creates and enqueues a json message to be delivered the IoT Hub. The message is not actually
 *           sent immediately, but it is sent on the next invocation of AzureIoT_DoPeriodicTasks().
@@ -36,6 +63,14 @@ IOTHUB_CLIENT_RESULT AzureIoTJson_ToPayload(const JSON_Value* jsonValue, char**
 */
 IOTHUB_CLIENT_RESULT AzureIoTJson_SendMessage(const JSON_Value* jsonPayload);
 
+/** 
+*  @brief   Creates and enqueues a json message written with a streaming writer. 
+* 
+* @param    pWriter     Writer holding a complete json payload
+* @return   IOTHUB_CLIENT_RESULT IOTHUB_CLIENT_OK on success
+*/
+IOTHUB_CLIENT_RESULT AzureIoTJson_SendMessageFromWriter(JSON_Writer* pWriter);
+
 
 /**
 * @brief    Creates and enqueues IoT Hub Device Twin reported properties. 
@@ -47,6 +82,15 @@ IOTHUB_CLIENT_RESULT AzureIoTJson_SendMessage(const JSON_Value* jsonPayload);
 */
 IOTHUB_CLIENT_RESULT AzureIoTJson_TwinReportState(const JSON_Value* jsonState);
 
+/**
+* @brief    Creates and enqueues IoT Hub Device Twin reported properties written with
+*           a streaming writer.
+* 
+* @param    pWriter     Writer holding complete reported properties json
+* @return   IOTHUB_CLIENT_RESULT_OK if report successfully enqueued
+*/
+IOTHUB_CLIENT_RESULT AzureIoTJson_TwinReportStateFromWriter(JSON_Writer* pWriter);
+
 /**
 * @brief    Type of the function callback invoked whenever a Device Twin update from the IoT Hub is
 *           received.
@@ -64,6 +108,40 @@ typedef void (*JsonTwinUpdateFnType)(const JSON_Object *desiredProperties);
 */
 void AzureIoTJson_SetDeviceTwinUpdateHandler(JsonTwinUpdateFnType handler);
 
+/// @brief max. number of desired property subscriptions, at most 32 (bit mask of candidates per tree level)
+#ifndef AZURE_IOT_JSON_MAX_TWIN_SUBSCRIPTIONS
+#define AZURE_IOT_JSON_MAX_TWIN_SUBSCRIPTIONS (32)
+#endif
+
+/// @brief max. number of segments of a subscribed property path ("component.property" has 2)
+#ifndef AZURE_IOT_JSON_MAX_TWIN_PATH_DEPTH
+#define AZURE_IOT_JSON_MAX_TWIN_PATH_DEPTH (4)
+#endif
+
+/**
+* @brief    Type of the function callback invoked for a subscribed desired property.
+*
+* @param    cstrPropertyPath    The subscribed dotted path, e.g. "rgbLed.blinkRateProperty"
+* @param    jsonValue           The desired value (already checked against the subscribed type)
+* @param    nVersion            The "$version" of the desired properties document
+*/
+typedef void (*JsonTwinPropertyFnType)(const char* cstrPropertyPath, const JSON_Value* jsonValue, unsigned int nVersion);
+
+/**
+* @brief    Subscribes a handler to a desired property. Subscribe once at startup; on every Device Twin
+*           update the desired properties are walked once and only subscribed paths are dispatched.
+*           Works alongside @see AzureIoTJson_SetDeviceTwinUpdateHandler which is called afterwards.
+*           Without such a handler no tree is built: "reported", "$metadata" and unsubscribed
+*           properties are skipped while parsing and only subscribed values are allocated.
+*
+* @param    cstrPropertyPath    Dotted path below "desired", e.g. "rgbLed.blinkRateProperty".
+*                               The string must stay valid while subscribed.
+* @param    propertyType        Expected JSON type, JSONError accepts any type
+* @param    handler             The callback function invoked with the value and "$version"
+* @return   true if subscribed, false if the table is full or the path is invalid
+*/
+bool AzureIoTJson_SubscribeTwinProperty(const char* cstrPropertyPath, JSON_Value_Type propertyType, JsonTwinPropertyFnType handler);
+
 
 /**
 * @brief    Type of the direct method callback invoked.
@@ -85,6 +163,8 @@ typedef struct MethodRegistrationTag {
 
 /**
 * @brief    Registers an array of Direct Method handlers. Overwrites @see AzureIoT_SetDirectMethodCallback
+*           A hash index over the full method names ("component*command") is built here, so dispatch
+*           is O(1) and only exact names match. The array must stay valid while registered.
 *
 * @param    methods     List of MethodRegistration entries (ended by NULL,NULL)
 */
@@ -105,5 +185,16 @@ typedef HTTP_STATUS_CODE(*JsonMessageReceivedFnType)(JSON_Value* jsonValue);
  */
 void AzureIoTJson_SetMessageReceivedHandler(JsonMessageReceivedFnType handler);
 
+/**
+* @brief    Creates a json object with the message delivery statistics of azure_iot.c:
+*           { "inFlight": 2, "dropped": { "critical": 0, "response": 0, "telemetry": 3, "bulk": 12 },
+*             "lsm6dso": { "confirmed": 10, "errors": 0, "timeouts": 1, "avgMs": 180,
+*             "maxMs": 950, "histogram": [0,2,5,3,...] }, ... }
+*           histogram counts confirmed messages in log2 buckets, see AZURE_IOT_LATENCY_BUCKETS.
+*
+* @returns  JSON_Value owned by the caller
+*/
+JSON_Value* AzureIoTJson_GetDeliveryStatistics(void);
+
 
 #endif
\ No newline at end of file
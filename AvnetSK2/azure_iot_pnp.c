@@ -1,7 +1,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 // Azure IoT SDK
 #include <azureiot/iothub_device_client_ll.h>
@@ -21,13 +25,93 @@
 const char cstrPnpComponentProperty[4] = "__t";
 const char cstrPnPComponentValue[2] = "c";
 
+/// @brief keys of a batched telemetry entry {"component":"...","telemetry":{...}}
+static const char cstrPnPBatchComponent[] = "component";
+static const char cstrPnPBatchTelemetry[] = "telemetry";
+
+/// @brief message property with the original capture time of store-and-forward telemetry
+static const char cstrPnPCreationTimeProperty[] = "iothub-creation-time-utc";
+
+/// @brief message property with the number of entries, replaces "$.sub" on batched messages
+static const char cstrPnPBatchProperty[] = "batch";
+
+/// @brief telemetry batch "[entry,entry,..." (closing "]" is added on flush)
+static char abBatchBuffer[AZURE_IOT_PNP_BATCH_SIZE];
+static size_t nBatchUsed = 0;
+static unsigned int nBatchEntries = 0;
+
+/// @brief batch size cap, 0 disables batching
+static size_t nBatchMaxSize = 0;
+static unsigned int nBatchWindowSeconds = 0;
+
+/// @brief largest entry since configuration, used to send a batch before the next entry overflows it
+static size_t nBatchMaxEntrySize = 0;
+
+static pnp_batch_stats_t statsBatch = {};
+
+static const char * const acstrFlushReasons[AZURE_IOT_PNP_FLUSH_REASON_COUNT] = { "full", "deadline", "request" };
+
+/// @brief time the first entry of the pending batch was added
+static struct timespec tsBatchStart;
+
+/// @brief    Reported property in the cache. Only hashes of the values sent and accepted are kept.
+typedef struct {
+    char strComponent[AZURE_IOT_COMPONENT_NAME_SIZE];   ///< empty: slot unused
+    char strProperty[AZURE_IOT_PNP_PROPERTY_NAME_SIZE];
+    char strValue[AZURE_IOT_PNP_REPORTED_VALUE_SIZE];   ///< latest value, serialized
+    size_t nValueSize;
+    uint32_t nValueHash;
+    bool bDirty;                ///< latest value neither accepted nor on the way
+    unsigned int uSentReport;   ///< patch carrying nSentHash, 0 if none is on the way
+    uint32_t nSentHash;
+    bool bAccepted;             ///< nAcceptedHash is valid
+    uint32_t nAcceptedHash;
+} pnp_reported_property_t;
+
+static pnp_reported_property_t aReportedProperties[AZURE_IOT_PNP_REPORTED_PROPERTIES];
+static unsigned int nDirtyProperties = 0;
+static unsigned int nReportWindowSeconds = 0;
+static unsigned int uReportSequence = 0;
+
+/// @brief time the oldest dirty property was changed
+static struct timespec tsReportStart;
+
+#define REPORTED_STORAGE_MAGIC  (0x5250)
+#define REPORTED_STORAGE_HEADER (8)
+
+/// @brief accepted state of one cached property as kept in storage
+typedef struct {
+    char strComponent[AZURE_IOT_COMPONENT_NAME_SIZE];
+    char strProperty[AZURE_IOT_PNP_PROPERTY_NAME_SIZE];
+    uint32_t nAcceptedHash;
+} reported_storage_entry_t;
+
+/// @brief storage record, written up to the used entries. nHash covers nCount and the entries.
+typedef struct {
+    uint32_t nHash;
+    uint16_t nMagic;
+    uint16_t nCount;
+    reported_storage_entry_t aEntries[AZURE_IOT_PNP_REPORTED_PROPERTIES];
+} reported_storage_t;
+
+_Static_assert(offsetof(reported_storage_t, aEntries) == REPORTED_STORAGE_HEADER, "unexpected reported_storage_t padding");
+
+static int fdReportedStorage = -1;
+static off_t nReportedStorageOffset = 0;
+
+/// @brief merged patch, sized for all cached properties dirty at once plus worst case key escaping reserve
+static char abReportBuffer[AZURE_IOT_PNP_REPORTED_PROPERTIES * (AZURE_IOT_COMPONENT_NAME_SIZE
+    + AZURE_IOT_PNP_PROPERTY_NAME_SIZE + AZURE_IOT_PNP_REPORTED_VALUE_SIZE + 16) + 256];
+
 
 /**
  * @brief hIoTHubClient is defined in azure_iot.c
  * 
  */
 extern IOTHUB_DEVICE_CLIENT_LL_HANDLE hIoTHubClient; 
-extern char strPnPModelId[MAX_MODELID_LENGTH];
+
+/// @brief Model Id set by AzureIoT_PnP_SetModelId()
+char strPnPModelId[MAX_MODELID_LENGTH];
 
 /** 
 * @brief    Creates and enqueues a plain text message to be delivered to the IoT Hub. The message is not actually
@@ -39,6 +123,18 @@ extern char strPnPModelId[MAX_MODELID_LENGTH];
 * @param    cstrPnPComponent    The component name in the DTDL schema
 */
 IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendMessage(const char* cstrMessage, const char * cstrPnPComponent)
+{
+    return AzureIoT_PnP_SendMessageWithCreationTime(cstrMessage, cstrPnPComponent, 0);
+}
+
+
+IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendMessageWithCreationTime(const char* cstrMessage, const char * cstrPnPComponent, time_t tCreation)
+{
+    return AzureIoT_PnP_SendPriorityMessage(cstrMessage, cstrPnPComponent, tCreation, AZURE_IOT_PRIORITY_TELEMETRY);
+}
+
+
+IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendPriorityMessage(const char* cstrMessage, const char * cstrPnPComponent, time_t tCreation, AZURE_IOT_PRIORITY priority)
 {
     IOTHUB_MESSAGE_HANDLE hIoTHubMessage = NULL;
     hIoTHubMessage = AzureIoT_CreateIoTHubMessage(cstrMessage, ContentType.Application_JSON, ContentEncoding.UTF_8);
@@ -47,6 +143,15 @@ IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendMessage(const char* cstrMessage, const cha
         return IOTHUB_CLIENT_ERROR;
     }
 
+    if( 0 != tCreation ){
+        // IoT Hub and IoT Central use "iothub-creation-time-utc" as timestamp of the telemetry
+        char strCreationTime[32];
+        struct tm tmCreation;
+        gmtime_r(&tCreation, &tmCreation);
+        strftime(strCreationTime, sizeof(strCreationTime), "%Y-%m-%dT%H:%M:%SZ", &tmCreation);
+        IoTHubMessage_SetProperty(hIoTHubMessage, cstrPnPCreationTimeProperty, strCreationTime);
+    }
+
     //// Add custom properties to message, i.e. for IoT Hub Message Routing
     //(void)IoTHubMessage_SetProperty(messageHandle, "MyProperty", "MyValue");
 
@@ -56,7 +161,7 @@ IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendMessage(const char* cstrMessage, const cha
         IoTHubMessage_SetProperty(hIoTHubMessage, "$.sub", cstrPnPComponent);
     }
 
-    return AzureIoT_SendIoTHubMessage(hIoTHubMessage);
+    return AzureIoT_SendIoTHubMessageWithPriority(hIoTHubMessage, priority);
 }
 
 
@@ -69,19 +174,205 @@ IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendMessage(const char* cstrMessage, const cha
 */
 IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendJsonMessage(JSON_Value* jsonPayload, const char * cstrPnPComponent)
 {
-    char* pszMessagePayload = 0;
+    // serialize into the pooled payload buffer, the SDK copies the message on creation
+    const char* pszMessagePayload = AzureIoTJson_ToPooledPayload(jsonPayload, NULL);
+    if (pszMessagePayload != NULL) {
+        return AzureIoT_PnP_SendMessage(pszMessagePayload, cstrPnPComponent);
+    }
+
+    char* pszHeapPayload = 0;
     size_t nMessageSize = 0;
     IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_ERROR;
-    if (AzureIoTJson_ToPayload(jsonPayload, &pszMessagePayload, &nMessageSize) == IOTHUB_CLIENT_OK) {
-        if (pszMessagePayload != NULL) {
-            result = AzureIoT_PnP_SendMessage(pszMessagePayload, cstrPnPComponent);
-            free(pszMessagePayload);
+    if (AzureIoTJson_ToPayload(jsonPayload, &pszHeapPayload, &nMessageSize) == IOTHUB_CLIENT_OK) {
+        if (pszHeapPayload != NULL) {
+            result = AzureIoT_PnP_SendMessage(pszHeapPayload, cstrPnPComponent);
+            free(pszHeapPayload);
         }
     }
     return result;
 }
 
 
+IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendMessageFromWriter(JSON_Writer* pWriter, const char * cstrPnPComponent, AZURE_IOT_PRIORITY priority)
+{
+    const char* pszMessagePayload = json_writer_finish(pWriter, NULL);
+    if (pszMessagePayload == NULL) {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    return AzureIoT_PnP_SendPriorityMessage(pszMessagePayload, cstrPnPComponent, 0, priority);
+}
+
+
+/**
+* @brief    Closes the array envelope and enqueues the pending batch as one message. Out of send tokens
+*           the batch goes as bulk class, which is refused instead of dropped. A batch that is not
+*           enqueued stays pending, later entries are appended behind it.
+* @param    reason      flush reason for the statistics
+*/
+static IOTHUB_CLIENT_RESULT flushBatch(AZURE_IOT_PNP_FLUSH_REASON reason)
+{
+    if (nBatchEntries == 0) {
+        return IOTHUB_CLIENT_OK;
+    }
+
+    char strEntries[12];
+    snprintf(strEntries, sizeof(strEntries), "%u", nBatchEntries);
+    abBatchBuffer[nBatchUsed] = ']';
+    abBatchBuffer[nBatchUsed + 1] = '\0';
+    size_t nPayloadSize = nBatchUsed + 1;
+
+    // the SDK copies the payload, so the batch buffer can be reused right away
+    IOTHUB_MESSAGE_HANDLE hIoTHubMessage = AzureIoT_CreateIoTHubMessage(abBatchBuffer, ContentType.Application_JSON, ContentEncoding.UTF_8);
+    if (NULL == hIoTHubMessage)
+    {
+        return IOTHUB_CLIENT_ERROR;
+    }
+    IoTHubMessage_SetProperty(hIoTHubMessage, cstrPnPBatchProperty, strEntries);
+
+    AZURE_IOT_PRIORITY priority = (AzureIoT_GetRateLimitTokens() == 0) ? AZURE_IOT_PRIORITY_BULK : AZURE_IOT_PRIORITY_TELEMETRY;
+    IOTHUB_CLIENT_RESULT result = AzureIoT_SendIoTHubMessageWithPriority(hIoTHubMessage, priority);
+    if (result != IOTHUB_CLIENT_OK) {
+        Log_Debug(MODULE "batch of %u entries kept pending (%s).\n", nBatchEntries, acstrFlushReasons[reason]);
+        return result;
+    }
+
+    statsBatch.nMessages++;
+    statsBatch.nEntries += nBatchEntries;
+    statsBatch.anFlushes[reason]++;
+    statsBatch.nPayloadBytes += nPayloadSize;
+    statsBatch.nCapacityBytes += nBatchMaxSize;
+    statsBatch.nLastFillPercent = (unsigned int)((nPayloadSize * 100) / nBatchMaxSize);
+
+    Log_Debug(MODULE "sent batch of %u entries (%u bytes, %u%% full, %s).\n", nBatchEntries,
+        (unsigned int)nPayloadSize, statsBatch.nLastFillPercent, acstrFlushReasons[reason]);
+    nBatchUsed = 0;
+    nBatchEntries = 0;
+    return result;
+}
+
+
+void AzureIoT_PnP_SetBatching(unsigned int nWindowSeconds, size_t nMaxBatchSize)
+{
+    if (flushBatch(AZURE_IOT_PNP_FLUSH_REQUEST) != IOTHUB_CLIENT_OK) {
+        Log_Debug(MODULE "WARNING: pending batch of %u entries discarded by the new settings.\n", nBatchEntries);
+        nBatchUsed = 0;
+        nBatchEntries = 0;
+    }
+
+    if (nMaxBatchSize > sizeof(abBatchBuffer)) {
+        nMaxBatchSize = sizeof(abBatchBuffer);
+    }
+    nBatchWindowSeconds = nWindowSeconds;
+    nBatchMaxSize = nMaxBatchSize;
+    nBatchMaxEntrySize = 0;
+}
+
+
+/**
+* @brief    Serializes one entry straight into the batch buffer, keeping room for the closing "]"
+*           and the NULL terminator. On failure the pending batch is left untouched.
+* @return   true if the entry fits into the size cap
+*/
+static bool appendBatchEntry(JSON_Value* jsonPayload, const char * cstrPnPComponent)
+{
+    size_t nOffset = nBatchUsed + 1;    // behind the leading "[" or ","
+    size_t nEntrySize = 0;
+    JSON_Writer writer;
+
+    if (nOffset + 1 >= nBatchMaxSize) {
+        return false;
+    }
+
+    json_writer_init(&writer, abBatchBuffer + nOffset, nBatchMaxSize - nOffset - 1);
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, cstrPnPBatchComponent);
+    json_writer_string(&writer, cstrPnPComponent);
+    json_writer_key(&writer, cstrPnPBatchTelemetry);
+    json_writer_value(&writer, jsonPayload);
+    json_writer_end_object(&writer);
+    if (json_writer_finish(&writer, &nEntrySize) == NULL) {
+        return false;
+    }
+
+    if (nBatchEntries == 0) {
+        abBatchBuffer[nBatchUsed] = '[';
+        clock_gettime(CLOCK_MONOTONIC, &tsBatchStart);
+    } else {
+        abBatchBuffer[nBatchUsed] = ',';
+    }
+    nBatchUsed = nOffset + nEntrySize;
+    nBatchEntries++;
+    if (nEntrySize > nBatchMaxEntrySize) {
+        nBatchMaxEntrySize = nEntrySize;
+    }
+    return true;
+}
+
+
+IOTHUB_CLIENT_RESULT AzureIoT_PnP_BatchJsonMessage(JSON_Value* jsonPayload, const char * cstrPnPComponent)
+{
+    if ((nBatchMaxSize == 0) || (jsonPayload == NULL) || (cstrPnPComponent == NULL)) {
+        return AzureIoT_PnP_SendJsonMessage(jsonPayload, cstrPnPComponent);
+    }
+
+    if (!appendBatchEntry(jsonPayload, cstrPnPComponent)) {
+        if (nBatchEntries == 0) {
+            // payload exceeds the size cap on its own
+            return AzureIoT_PnP_SendJsonMessage(jsonPayload, cstrPnPComponent);
+        }
+        // size cap reached: send the pending batch and start a new one. A full batch that cannot be
+        // sent is kept, the caller keeps this payload (e.g. in the telemetry queue)
+        IOTHUB_CLIENT_RESULT result = flushBatch(AZURE_IOT_PNP_FLUSH_FULL);
+        if (result != IOTHUB_CLIENT_OK) {
+            return result;
+        }
+        if (!appendBatchEntry(jsonPayload, cstrPnPComponent)) {
+            return AzureIoT_PnP_SendJsonMessage(jsonPayload, cstrPnPComponent);
+        }
+    }
+
+    // send right away if an entry as large as the largest so far would not fit anymore,
+    // this saves serializing the next payload twice (room for "," + entry + "]" + NULL)
+    // the entry is in the batch either way, a batch that cannot be sent yet stays pending
+    if (nBatchUsed + nBatchMaxEntrySize + 3 > nBatchMaxSize) {
+        (void)flushBatch(AZURE_IOT_PNP_FLUSH_FULL);
+    }
+    return IOTHUB_CLIENT_OK;
+}
+
+
+IOTHUB_CLIENT_RESULT AzureIoT_PnP_FlushBatch(void)
+{
+    return flushBatch(AZURE_IOT_PNP_FLUSH_REQUEST);
+}
+
+
+void AzureIoT_PnP_DoBatchTasks(void)
+{
+    if (nBatchEntries == 0) {
+        return;
+    }
+
+    struct timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+    if (tsNow.tv_sec >= tsBatchStart.tv_sec + (time_t)nBatchWindowSeconds) {
+        // out of send tokens: keep aggregating until the batch is full instead of having it dropped
+        if (AzureIoT_GetRateLimitTokens() == 0) {
+            return;
+        }
+        flushBatch(AZURE_IOT_PNP_FLUSH_DEADLINE);
+    }
+}
+
+
+void AzureIoT_PnP_GetBatchStatistics(pnp_batch_stats_t *pStats)
+{
+    if (pStats != NULL) {
+        *pStats = statsBatch;
+    }
+}
+
+
 /**
 *  @brief   With Azure IoT PnP, components need to be published alike
 * "componentname" : { 
@@ -112,6 +403,225 @@ JSON_Value * AzureIoT_PnP_CreateComponentPropertyJson(JSON_Value* jsonRoot, cons
     return jsonRoot;
 }
 
+/**
+* @brief    FNV-1a hash of a serialized property value
+*/
+static uint32_t hashReportedValue(const char* pValue, size_t nSize)
+{
+    uint32_t nHash = 2166136261u;
+    for (size_t i = 0; i < nSize; i++) {
+        nHash ^= (uint8_t)pValue[i];
+        nHash *= 16777619u;
+    }
+    return nHash;
+}
+
+
+/**
+* @brief    Sets the dirty flag of a cached property, the first dirty property starts the report window
+*/
+static void setReportedPropertyDirty(pnp_reported_property_t *pProperty, bool bDirty)
+{
+    if (pProperty->bDirty == bDirty) {
+        return;
+    }
+    pProperty->bDirty = bDirty;
+    if (!bDirty) {
+        nDirtyProperties--;
+    } else if (nDirtyProperties++ == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &tsReportStart);
+    }
+}
+
+
+/**
+* @brief    Updates the cached value of a component property and marks it dirty if it is neither
+*           accepted by IoT Hub nor on the way there.
+* @return   false if the property does not fit into the cache
+*/
+static bool cacheReportedProperty(const char * cstrPnPComponent, const char * cstrProperty, const JSON_Value* jsonValue)
+{
+    char strValue[AZURE_IOT_PNP_REPORTED_VALUE_SIZE];
+    size_t nValueSize = 0;
+    JSON_Writer writer;
+
+    if ((strlen(cstrPnPComponent) >= AZURE_IOT_COMPONENT_NAME_SIZE) ||
+        (strlen(cstrProperty) >= AZURE_IOT_PNP_PROPERTY_NAME_SIZE)) {
+        return false;
+    }
+    json_writer_init(&writer, strValue, sizeof(strValue));
+    json_writer_value(&writer, jsonValue);
+    if (json_writer_finish(&writer, &nValueSize) == NULL) {
+        return false;
+    }
+
+    pnp_reported_property_t *pProperty = NULL;
+    pnp_reported_property_t *pUnused = NULL;
+    for (size_t i = 0; (pProperty == NULL) && (i < AZURE_IOT_PNP_REPORTED_PROPERTIES); i++) {
+        pnp_reported_property_t *pCandidate = &aReportedProperties[i];
+        if (pCandidate->strComponent[0] == '\0') {
+            if (pUnused == NULL) {
+                pUnused = pCandidate;
+            }
+        } else if ((strcmp(pCandidate->strComponent, cstrPnPComponent) == 0) &&
+                   (strcmp(pCandidate->strProperty, cstrProperty) == 0)) {
+            pProperty = pCandidate;
+        }
+    }
+    if (pProperty == NULL) {
+        if (pUnused == NULL) {
+            return false;
+        }
+        pProperty = pUnused;
+        memset(pProperty, 0, sizeof(*pProperty));
+        strcpy(pProperty->strComponent, cstrPnPComponent);
+        strcpy(pProperty->strProperty, cstrProperty);
+    }
+
+    memcpy(pProperty->strValue, strValue, nValueSize + 1);
+    pProperty->nValueSize = nValueSize;
+    pProperty->nValueHash = hashReportedValue(strValue, nValueSize);
+
+    // compare with the value on the way, or else the one accepted last
+    if (pProperty->uSentReport != 0) {
+        setReportedPropertyDirty(pProperty, pProperty->nValueHash != pProperty->nSentHash);
+    } else {
+        setReportedPropertyDirty(pProperty, !pProperty->bAccepted || (pProperty->nValueHash != pProperty->nAcceptedHash));
+    }
+    return true;
+}
+
+
+/**
+* @brief    Writes the accepted state of all cached properties to the storage region
+*/
+static void saveReportedProperties(void)
+{
+    static reported_storage_t record;
+
+    if (fdReportedStorage < 0) {
+        return;
+    }
+    memset(&record, 0, sizeof(record));
+    for (size_t i = 0; i < AZURE_IOT_PNP_REPORTED_PROPERTIES; i++) {
+        const pnp_reported_property_t *pProperty = &aReportedProperties[i];
+        if ((pProperty->strComponent[0] != '\0') && pProperty->bAccepted) {
+            reported_storage_entry_t *pEntry = &record.aEntries[record.nCount++];
+            strcpy(pEntry->strComponent, pProperty->strComponent);
+            strcpy(pEntry->strProperty, pProperty->strProperty);
+            pEntry->nAcceptedHash = pProperty->nAcceptedHash;
+        }
+    }
+    size_t nSize = REPORTED_STORAGE_HEADER + record.nCount * sizeof(reported_storage_entry_t);
+    record.nMagic = REPORTED_STORAGE_MAGIC;
+    record.nHash = hashReportedValue((const char*)&record.nCount, nSize - offsetof(reported_storage_t, nCount));
+
+    if ((lseek(fdReportedStorage, nReportedStorageOffset, SEEK_SET) < 0)
+        || (write(fdReportedStorage, &record, nSize) != (ssize_t)nSize)) {
+        Log_Debug(MODULE "WARNING: cannot store the reported properties state.\n");
+    }
+}
+
+
+/**
+* @brief    Confirmation of a merged patch: accepted values are skipped from now on, values of
+*           failed or lost patches are reported again.
+*/
+static void reportedPropertiesConfirmation(int httpStatusCode, void* pContext)
+{
+    unsigned int uReport = (unsigned int)(uintptr_t)pContext;
+    bool bAccepted = (httpStatusCode >= 200) && (httpStatusCode < 300);
+    bool bChanged = false;
+
+    for (size_t i = 0; i < AZURE_IOT_PNP_REPORTED_PROPERTIES; i++) {
+        pnp_reported_property_t *pProperty = &aReportedProperties[i];
+        if ((pProperty->strComponent[0] == '\0') || (pProperty->uSentReport != uReport)) {
+            continue;
+        }
+        pProperty->uSentReport = 0;
+        if (bAccepted) {
+            bChanged |= !pProperty->bAccepted || (pProperty->nAcceptedHash != pProperty->nSentHash);
+            pProperty->bAccepted = true;
+            pProperty->nAcceptedHash = pProperty->nSentHash;
+        } else if (!pProperty->bAccepted || (pProperty->nValueHash != pProperty->nAcceptedHash)) {
+            setReportedPropertyDirty(pProperty, true);
+        }
+    }
+    if (!bAccepted) {
+        Log_Debug(MODULE "reported properties patch %u failed (%d), %u properties dirty.\n",
+            uReport, httpStatusCode, nDirtyProperties);
+    } else if (bChanged) {
+        saveReportedProperties();
+    }
+}
+
+
+IOTHUB_CLIENT_RESULT AzureIoT_PnP_FlushReportedProperties(void)
+{
+    if (nDirtyProperties == 0) {
+        return IOTHUB_CLIENT_OK;
+    }
+
+    // { "component": { "__t": "c", "property": value, ... }, ... }
+    JSON_Writer writer;
+    size_t nPayloadSize = 0;
+    json_writer_init(&writer, abReportBuffer, sizeof(abReportBuffer));
+    json_writer_begin_object(&writer);
+    for (size_t i = 0; i < AZURE_IOT_PNP_REPORTED_PROPERTIES; i++) {
+        const pnp_reported_property_t *pFirst = &aReportedProperties[i];
+        if (!pFirst->bDirty) {
+            continue;
+        }
+        // a component is written with its first dirty property
+        bool bWritten = false;
+        for (size_t j = 0; !bWritten && (j < i); j++) {
+            bWritten = aReportedProperties[j].bDirty && (strcmp(aReportedProperties[j].strComponent, pFirst->strComponent) == 0);
+        }
+        if (bWritten) {
+            continue;
+        }
+        json_writer_key(&writer, pFirst->strComponent);
+        json_writer_begin_object(&writer);
+        json_writer_key(&writer, cstrPnpComponentProperty);
+        json_writer_string(&writer, cstrPnPComponentValue);
+        for (size_t j = i; j < AZURE_IOT_PNP_REPORTED_PROPERTIES; j++) {
+            const pnp_reported_property_t *pProperty = &aReportedProperties[j];
+            if (pProperty->bDirty && (strcmp(pProperty->strComponent, pFirst->strComponent) == 0)) {
+                json_writer_key(&writer, pProperty->strProperty);
+                json_writer_raw(&writer, pProperty->strValue, pProperty->nValueSize);
+            }
+        }
+        json_writer_end_object(&writer);
+    }
+    json_writer_end_object(&writer);
+    if (json_writer_finish(&writer, &nPayloadSize) == NULL) {
+        Log_Debug(MODULE "ERROR: reported properties patch exceeds %u bytes.\n", (unsigned int)sizeof(abReportBuffer));
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    if (++uReportSequence == 0) {
+        uReportSequence = 1;
+    }
+    IOTHUB_CLIENT_RESULT result = AzureIoT_TwinReportStateWithConfirmation(abReportBuffer, nPayloadSize,
+        reportedPropertiesConfirmation, (void*)(uintptr_t)uReportSequence);
+    if (result != IOTHUB_CLIENT_OK) {
+        // stay dirty, retried by AzureIoT_PnP_DoReportTasks()
+        return result;
+    }
+
+    Log_Debug(MODULE "reported %u properties in patch %u.\n", nDirtyProperties, uReportSequence);
+    for (size_t i = 0; i < AZURE_IOT_PNP_REPORTED_PROPERTIES; i++) {
+        pnp_reported_property_t *pProperty = &aReportedProperties[i];
+        if (pProperty->bDirty) {
+            pProperty->uSentReport = uReportSequence;
+            pProperty->nSentHash = pProperty->nValueHash;
+            setReportedPropertyDirty(pProperty, false);
+        }
+    }
+    return result;
+}
+
+
 /**
 *  @brief   With Azure IoT PnP, components need to be published alike
 * "componentname" : { 
@@ -124,14 +634,143 @@ JSON_Value * AzureIoT_PnP_CreateComponentPropertyJson(JSON_Value* jsonRoot, cons
 */
 IOTHUB_CLIENT_RESULT AzureIoT_PnP_ReportComponentProperty(const char * cstrPnPComponent, JSON_Value* jsonProperties)
 {
-    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_ERROR;
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+    JSON_Object *jsonObject = json_value_get_object( jsonProperties );
 
-    JSON_Value  *jsonRootValue = AzureIoT_PnP_CreateComponentPropertyJson( NULL, cstrPnPComponent, jsonProperties);
-    result = AzureIoTJson_TwinReportState( jsonRootValue );
-    json_value_free( jsonRootValue );
+    if ((cstrPnPComponent == NULL) || (jsonObject == NULL)) {
+        json_value_free( jsonProperties );
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    // properties not fitting the cache are reported right away
+    JSON_Value *jsonUncached = NULL;
+    for (size_t i = 0; i < json_object_get_count( jsonObject ); i++) {
+        const char *cstrProperty = json_object_get_name( jsonObject, i );
+        JSON_Value *jsonValue = json_object_get_value_at( jsonObject, i );
+        if ((strcmp(cstrProperty, cstrPnpComponentProperty) == 0) ||
+            cacheReportedProperty(cstrPnPComponent, cstrProperty, jsonValue)) {
+            continue;
+        }
+        if (jsonUncached == NULL) {
+            jsonUncached = json_value_init_object();
+        }
+        json_object_set_value( json_value_get_object( jsonUncached ), cstrProperty, json_value_deep_copy( jsonValue ) );
+    }
+    json_value_free( jsonProperties );
+
+    if (jsonUncached != NULL) {
+        JSON_Value  *jsonRootValue = AzureIoT_PnP_CreateComponentPropertyJson( NULL, cstrPnPComponent, jsonUncached);
+        result = AzureIoTJson_TwinReportState( jsonRootValue );
+        json_value_free( jsonRootValue );
+    }
+
+    if (nReportWindowSeconds == 0) {
+        IOTHUB_CLIENT_RESULT resultFlush = AzureIoT_PnP_FlushReportedProperties();
+        if (result == IOTHUB_CLIENT_OK) {
+            result = resultFlush;
+        }
+    }
     return result;
 }
 
+
+size_t AzureIoT_PnP_InitializeReportedStorage(int fdStorage, off_t nOffset, size_t nSize)
+{
+    static reported_storage_t record;
+
+    fdReportedStorage = -1;
+    if (fdStorage < 0) {
+        return 0;
+    }
+    if (nSize < sizeof(record)) {
+        Log_Debug(MODULE "WARNING: reported properties storage needs %u bytes.\n", (unsigned int)sizeof(record));
+        return 0;
+    }
+    fdReportedStorage = fdStorage;
+    nReportedStorageOffset = nOffset;
+
+    // a short read of a fresh file leaves nMagic 0
+    memset(&record, 0, sizeof(record));
+    if ((lseek(fdStorage, nOffset, SEEK_SET) < 0) || (read(fdStorage, &record, sizeof(record)) < REPORTED_STORAGE_HEADER)
+        || (record.nMagic != REPORTED_STORAGE_MAGIC) || (record.nCount > AZURE_IOT_PNP_REPORTED_PROPERTIES)
+        || (record.nHash != hashReportedValue((const char*)&record.nCount,
+                REPORTED_STORAGE_HEADER + record.nCount * sizeof(reported_storage_entry_t) - offsetof(reported_storage_t, nCount)))) {
+        Log_Debug(MODULE "no reported properties state stored.\n");
+        return 0;
+    }
+
+    size_t nRestored = 0;
+    for (size_t i = 0; i < record.nCount; i++) {
+        reported_storage_entry_t *pEntry = &record.aEntries[i];
+        pEntry->strComponent[sizeof(pEntry->strComponent) - 1] = '\0';
+        pEntry->strProperty[sizeof(pEntry->strProperty) - 1] = '\0';
+        bool bCached = (pEntry->strComponent[0] == '\0');
+        pnp_reported_property_t *pUnused = NULL;
+        for (size_t j = 0; !bCached && (j < AZURE_IOT_PNP_REPORTED_PROPERTIES); j++) {
+            pnp_reported_property_t *pProperty = &aReportedProperties[j];
+            if (pProperty->strComponent[0] == '\0') {
+                if (pUnused == NULL) {
+                    pUnused = pProperty;
+                }
+            } else {
+                bCached = (strcmp(pProperty->strComponent, pEntry->strComponent) == 0) &&
+                          (strcmp(pProperty->strProperty, pEntry->strProperty) == 0);
+            }
+        }
+        // properties reported before storage was initialized keep their state
+        if (!bCached && (pUnused != NULL)) {
+            strcpy(pUnused->strComponent, pEntry->strComponent);
+            strcpy(pUnused->strProperty, pEntry->strProperty);
+            pUnused->bAccepted = true;
+            pUnused->nAcceptedHash = pEntry->nAcceptedHash;
+            nRestored++;
+        }
+    }
+    Log_Debug(MODULE "restored %u accepted reported properties.\n", (unsigned int)nRestored);
+    return nRestored;
+}
+
+
+void AzureIoT_PnP_InvalidateReportedProperties(void)
+{
+    for (size_t i = 0; i < AZURE_IOT_PNP_REPORTED_PROPERTIES; i++) {
+        pnp_reported_property_t *pProperty = &aReportedProperties[i];
+        if (pProperty->strComponent[0] == '\0') {
+            continue;
+        }
+        if (pProperty->nValueSize == 0) {
+            // restored from storage and not reported since, there is nothing to send
+            memset(pProperty, 0, sizeof(*pProperty));
+            continue;
+        }
+        pProperty->bAccepted = false;
+        pProperty->uSentReport = 0;
+        setReportedPropertyDirty(pProperty, true);
+    }
+    saveReportedProperties();
+}
+
+
+void AzureIoT_PnP_SetReportWindow(unsigned int nWindowSeconds)
+{
+    AzureIoT_PnP_FlushReportedProperties();
+    nReportWindowSeconds = nWindowSeconds;
+}
+
+
+void AzureIoT_PnP_DoReportTasks(void)
+{
+    if ((nDirtyProperties == 0) || (hIoTHubClient == NULL)) {
+        return;
+    }
+
+    struct timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+    if (tsNow.tv_sec >= tsReportStart.tv_sec + (time_t)nReportWindowSeconds) {
+        AzureIoT_PnP_FlushReportedProperties();
+    }
+}
+
 /*
 * @brief    Sets the Azure IoT PnP Model Id.
 *
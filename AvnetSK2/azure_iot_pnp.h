@@ -10,7 +10,10 @@
  * 
  */ 
 
+#include <time.h>
+#include <sys/types.h>
 #include "parson.h"
+#include "azure_iot.h"
 
 const char cstrPnpComponentProperty[4];
 const char cstrPnPComponentValue[2];
@@ -24,6 +27,25 @@ const char cstrPnPComponentValue[2];
 */
 IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendMessage(const char* cstrMessage, const char * cstrPnPComponent);
 
+/** 
+* @brief    Like AzureIoT_PnP_SendMessage(), for telemetry captured earlier (e.g. while offline).
+*           The capture time is sent as "iothub-creation-time-utc" message property.
+* @param    cstrMessage         The payload of the message to send.
+* @param    cstrPnPComponent    The component name in the DTDL schema
+* @param    tCreation           capture time, 0 to omit the property
+*/
+IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendMessageWithCreationTime(const char* cstrMessage, const char * cstrPnPComponent, time_t tCreation);
+
+/** 
+* @brief    Like AzureIoT_PnP_SendMessageWithCreationTime(), enqueued within the in-flight share of a
+*           message class (see AZURE_IOT_PRIORITY and AzureIoT_SendIoTHubMessageWithPriority()).
+* @param    cstrMessage         The payload of the message to send.
+* @param    cstrPnPComponent    The component name in the DTDL schema
+* @param    tCreation           capture time, 0 to omit the property
+* @param    priority            message class
+*/
+IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendPriorityMessage(const char* cstrMessage, const char * cstrPnPComponent, time_t tCreation, AZURE_IOT_PRIORITY priority);
+
 /** 
 *  @brief   Creates and enqueues a json message to be delivered the IoT Hub. The message is not actually
 *           sent immediately, but it is sent on the next invocation of AzureIoT_DoPeriodicTasks().
@@ -33,6 +55,97 @@ IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendMessage(const char* cstrMessage, const cha
 */
 IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendJsonMessage(JSON_Value* jsonPayload, const char * cstrPnPComponent);
 
+/** 
+*  @brief   Enqueues the json document streamed into a writer (see AzureIoTJson_InitWriter) as
+*           message of a PnP component. No JSON_Value tree is needed.
+* 
+* @param    pWriter             writer holding one complete json value
+* @param    cstrPnPComponent    The component name in the DTDL schema
+* @param    priority            message class, e.g. AZURE_IOT_PRIORITY_CRITICAL for events
+*/
+IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendMessageFromWriter(JSON_Writer* pWriter, const char * cstrPnPComponent, AZURE_IOT_PRIORITY priority);
+
+/// @brief size of the static telemetry batch buffer, upper bound for the batch size cap
+#ifndef AZURE_IOT_PNP_BATCH_SIZE
+#define AZURE_IOT_PNP_BATCH_SIZE (4096)
+#endif
+
+/// @brief IoT Hub meters messages in 4 KB units including message properties. The default
+/// packing budget stays just below one unit.
+#ifndef AZURE_IOT_PNP_PACK_BUDGET
+#define AZURE_IOT_PNP_PACK_BUDGET (4096 - 256)
+#endif
+
+/// @brief reason a telemetry batch was sent
+typedef enum {
+    AZURE_IOT_PNP_FLUSH_FULL = 0,       ///< next entry would (probably) exceed the size cap
+    AZURE_IOT_PNP_FLUSH_DEADLINE,       ///< oldest entry reached the batch window
+    AZURE_IOT_PNP_FLUSH_REQUEST,        ///< AzureIoT_PnP_FlushBatch() or reconfiguration
+    AZURE_IOT_PNP_FLUSH_REASON_COUNT
+} AZURE_IOT_PNP_FLUSH_REASON;
+
+/// @brief telemetry batching counters since start
+typedef struct {
+    unsigned int nMessages;                                 ///< batched messages sent
+    unsigned int nEntries;                                  ///< component payloads in these messages
+    unsigned int anFlushes[AZURE_IOT_PNP_FLUSH_REASON_COUNT];  ///< messages per flush reason
+    unsigned long long nPayloadBytes;                       ///< payload bytes of batched messages
+    unsigned long long nCapacityBytes;                      ///< sum of the size caps of these messages
+    unsigned int nLastFillPercent;                          ///< fill ratio of the last message
+} pnp_batch_stats_t;
+
+/**
+* @brief    Configures telemetry batching. Component payloads passed to AzureIoT_PnP_BatchJsonMessage()
+*           are collected in one message until the window expires or the size cap is reached:
+*           [ {"component":"lsm6dso","telemetry":{...}}, {"component":"lps22hh","telemetry":{...}} ]
+*           Batched messages carry a "batch" property with the number of entries instead of "$.sub".
+*           A batch is sent as soon as the largest entry seen so far would no longer fit, so with
+*           nMaxBatchSize = AZURE_IOT_PNP_PACK_BUDGET messages are packed close to 4 KB metering units
+*           and nWindowSeconds bounds the latency.
+* @note     A pending batch is flushed before the settings change.
+*
+* @param    nWindowSeconds      max age of the oldest entry (CLOCK_MONOTONIC), checked by AzureIoT_PnP_DoBatchTasks().
+*                               0 flushes on every AzureIoT_PnP_DoBatchTasks() call, packing is then
+*                               limited to the payloads added between two calls.
+* @param    nMaxBatchSize       size cap of a batched message in bytes (limited to AZURE_IOT_PNP_BATCH_SIZE),
+*                               0 disables batching: every payload is sent as its own message.
+*/
+void AzureIoT_PnP_SetBatching(unsigned int nWindowSeconds, size_t nMaxBatchSize);
+
+/** 
+*  @brief   Adds a json payload of a PnP component to the telemetry batch. The payload is serialized
+*           immediately, so the JSON_Value may be released right after the call. A full batch is 
+*           flushed first, a payload exceeding the size cap on its own is sent as single message.
+*           Without batching configured this is the same as AzureIoT_PnP_SendJsonMessage().
+*           Out of send tokens a full batch is not dropped but kept pending; the payload is then
+*           refused and the caller keeps it (e.g. in the telemetry queue).
+* @return   IOTHUB_CLIENT_OK if the payload was batched or sent
+* 
+* @param    jsonPayload         The json payload of the component telemetry
+* @param    cstrPnPComponent    The component name in the DTDL schema
+*/
+IOTHUB_CLIENT_RESULT AzureIoT_PnP_BatchJsonMessage(JSON_Value* jsonPayload, const char * cstrPnPComponent);
+
+/** 
+*  @brief   Enqueues the pending telemetry batch as one IoT Hub message.
+* @return   IOTHUB_CLIENT_OK if the batch was sent or is empty
+*/
+IOTHUB_CLIENT_RESULT AzureIoT_PnP_FlushBatch(void);
+
+/** 
+*  @brief   Flushes the telemetry batch once its window has expired. Call after each telemetry cycle
+*           and from a periodic timer, so the window is kept between telemetry cycles.
+*           While the rate limit has no tokens left (AzureIoT_GetRateLimitTokens()) the batch keeps
+*           aggregating until it is full.
+*/
+void AzureIoT_PnP_DoBatchTasks(void);
+
+/** 
+*  @brief   Copies the batching counters. The average fill ratio is nPayloadBytes / nCapacityBytes.
+* @param    pStats      OUT parameter: counters since start
+*/
+void AzureIoT_PnP_GetBatchStatistics(pnp_batch_stats_t *pStats);
+
 /**
 *  @brief   With Azure IoT PnP, components need to be published alike
 * "componentname" : { 
@@ -47,18 +160,77 @@ IOTHUB_CLIENT_RESULT AzureIoT_PnP_SendJsonMessage(JSON_Value* jsonPayload, const
 JSON_Value * AzureIoT_PnP_CreateComponentPropertyJson(JSON_Value* jsonRoot, const char * cstrPnPComponent, JSON_Value* jsonProperties);
 
 
+/// @brief capacity of the reported properties cache (component and property pairs)
+#ifndef AZURE_IOT_PNP_REPORTED_PROPERTIES
+#define AZURE_IOT_PNP_REPORTED_PROPERTIES (16)
+#endif
+
+/// @brief max length of a cached property name
+#define AZURE_IOT_PNP_PROPERTY_NAME_SIZE (32)
+
+/// @brief max size of a cached property value once serialized, larger values are reported uncached
+#ifndef AZURE_IOT_PNP_REPORTED_VALUE_SIZE
+#define AZURE_IOT_PNP_REPORTED_VALUE_SIZE (64)
+#endif
+
 /**
 *  @brief   With Azure IoT PnP, components need to be published alike
 * "componentname" : { 
 *    "__t" : "c", 
 *    #component properties 
 * }
+*           The properties pass a cache: values equal to the last value accepted by IoT Hub (or on
+*           the way there) are skipped, changed values are marked dirty and reported with all other
+*           dirty properties in one merged patch, see AzureIoT_PnP_SetReportWindow(). Patches that
+*           fail or are lost on disconnect mark their values dirty again.
+*           Properties not fitting the cache are reported right away.
 *
 * @param    cstrPnPComponent    The component name in the DTDL schema
-* @param    jsonProperties         The json payload of the reported properties
+* @param    jsonProperties         The json payload of the reported properties (released here)
+* @returns  IOTHUB_CLIENT_OK if the properties were cached or reported
 */
 IOTHUB_CLIENT_RESULT AzureIoT_PnP_ReportComponentProperty(const char * cstrPnPComponent, JSON_Value* jsonProperties);
 
+/**
+*  @brief   Configures how long dirty reported properties are collected before they are sent as
+*           one merged patch. Dirty properties are flushed before the setting changes.
+*
+* @param    nWindowSeconds      max age of the oldest dirty property (CLOCK_MONOTONIC), checked by AzureIoT_PnP_DoReportTasks().
+*                               0 (default) sends the patch from AzureIoT_PnP_ReportComponentProperty() already.
+*/
+void AzureIoT_PnP_SetReportWindow(unsigned int nWindowSeconds);
+
+/**
+*  @brief   Sends all dirty reported properties as one patch.
+* @return   IOTHUB_CLIENT_OK if the patch was enqueued or nothing is dirty
+*/
+IOTHUB_CLIENT_RESULT AzureIoT_PnP_FlushReportedProperties(void);
+
+/**
+*  @brief   Flushes dirty reported properties once the report window has expired, also retries
+*           patches failed before. Call periodically, does nothing while disconnected.
+*/
+void AzureIoT_PnP_DoReportTasks(void);
+
+/**
+*  @brief   Keeps the accepted state of the reported properties cache (component, property and value hash)
+*           in a storage region and restores it, so properties unchanged since before a restart are not
+*           reported again. The record is rewritten whenever IoT Hub accepted a changed value and carries
+*           a hash over its content, a torn or foreign record is ignored.
+*
+* @param    fdStorage       read/write file descriptor (e.g. Storage_OpenMutableFile()), -1 for RAM only
+* @param    nOffset         start of the region in the file
+* @param    nSize           size of the region, needs about 70 bytes per cached property
+* @return   number of properties restored
+*/
+size_t AzureIoT_PnP_InitializeReportedStorage(int fdStorage, off_t nOffset, size_t nSize);
+
+/**
+*  @brief   Forgets which values IoT Hub accepted, e.g. when the device was assigned to another hub.
+*           All cached properties are dirty again and the stored record is cleared.
+*/
+void AzureIoT_PnP_InvalidateReportedProperties(void);
+
 /**
 * @brief    Sets the Azure IoT PnP Model Id.
 *
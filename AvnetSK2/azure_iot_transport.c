@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+// Azure IoT SDK
+#include <azureiot/iothub_device_client_ll.h>
+#include <azureiot/iothubtransportmqtt.h>
+#include <azureiot/iothub.h>
+#include <azureiot/azure_sphere_provisioning.h>
+#include <azure_prov_client/iothub_security_factory.h>
+
+#include <applibs/log.h>
+#include "azure_iot_transport.h"
+
+#define MODULE "[Transport] "
+
+/**
+* @brief    Initializes the SDK platform and the device certificate security before creating the client
+*/
+static IOTHUB_DEVICE_CLIENT_LL_HANDLE sdkCreate(const char *cstrHubUri)
+{
+    if (IoTHub_Init() != 0) {
+        Log_Debug(MODULE "ERROR: failed initializing platform.\n");
+        return NULL;
+    }
+
+    // Set up auth type
+    int retError = iothub_security_init(IOTHUB_SECURITY_TYPE_X509);
+    if (retError != 0) {
+        Log_Debug(MODULE "ERROR: iothub_security_init failed with error %d.\n", retError);
+        IoTHub_Deinit();
+        return NULL;
+    }
+
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient = IoTHubDeviceClient_LL_CreateWithAzureSphereFromDeviceAuth(cstrHubUri, MQTT_Protocol);
+    if (hClient == NULL) {
+        Log_Debug(MODULE "ERROR: _CreateWithAzureSphereFromDeviceAuth returned NULL.\n");
+        iothub_security_deinit();
+        IoTHub_Deinit();
+    }
+    return hClient;
+}
+
+static void sdkDestroy(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient)
+{
+    if (hClient == NULL) {
+        return;
+    }
+    IoTHubDeviceClient_LL_Destroy(hClient);
+    iothub_security_deinit();
+    IoTHub_Deinit();
+}
+
+const azure_iot_transport_t AzureIoT_SdkTransport = {
+    .cstrName = "Azure IoT SDK",
+    .bProvisioning = true,
+    .Create = sdkCreate,
+    .Destroy = sdkDestroy,
+    .DoWork = IoTHubDeviceClient_LL_DoWork,
+    .SetOption = IoTHubDeviceClient_LL_SetOption,
+    .SetRetryPolicy = IoTHubDeviceClient_LL_SetRetryPolicy,
+    .SetConnectionStatusCallback = IoTHubDeviceClient_LL_SetConnectionStatusCallback,
+    .SetMessageCallback = IoTHubDeviceClient_LL_SetMessageCallback,
+    .SetDeviceMethodCallback = IoTHubDeviceClient_LL_SetDeviceMethodCallback,
+    .SetDeviceTwinCallback = IoTHubDeviceClient_LL_SetDeviceTwinCallback,
+    .SendEventAsync = IoTHubDeviceClient_LL_SendEventAsync,
+    .SendReportedState = IoTHubDeviceClient_LL_SendReportedState,
+    .GetSendStatus = IoTHubDeviceClient_LL_GetSendStatus
+};
+
+const azure_iot_transport_t *pAzureIoTTransport = &AzureIoT_SdkTransport;
+
+void AzureIoT_SetTransport(const azure_iot_transport_t *pTransport)
+{
+    pAzureIoTTransport = (pTransport != NULL) ? pTransport : &AzureIoT_SdkTransport;
+    Log_Debug(MODULE "using %s transport.\n", pAzureIoTTransport->cstrName);
+}
@@ -0,0 +1,98 @@
+/**
+* @file azure_iot_transport.h
+* @brief Backend of the IoT Hub client used by azure_iot.c and azure_iot_dps.c. The Azure IoT SDK
+*   backend is the default, the local backend stands in for the IoT Hub on a Linux box: messages,
+*   reported properties and method responses are written as text lines to a file or a Unix socket,
+*   twin updates, direct methods and cloud-to-device messages are read from the socket. This allows
+*   benchmarking the message pipeline end to end without network. The local backend is a host build
+*   option (USE_AZURE_IOT_LOCAL_TRANSPORT, see simulator/CMakeLists.txt) and not part of the device image.
+*/
+#pragma once
+#ifndef _AZURE_IOT_TRANSPORT_H_
+#define _AZURE_IOT_TRANSPORT_H_
+
+#include <stdbool.h>
+#include <azureiot/iothub_device_client_ll.h>
+
+/**
+* @brief    IoT Hub client operations, named and typed after the IoTHubDeviceClient_LL_* functions.
+*/
+typedef struct {
+    const char *cstrName;
+    bool bProvisioning;     ///< the IoT Hub address is assigned by DPS, false: connect right away
+
+    /// @brief initializes the backend and creates the client, NULL on failure
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE (*Create)(const char *cstrHubUri);
+    /// @brief destroys the client (if any) and releases the backend
+    void (*Destroy)(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient);
+    void (*DoWork)(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient);
+
+    IOTHUB_CLIENT_RESULT (*SetOption)(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, const char *cstrName, const void *pValue);
+    IOTHUB_CLIENT_RESULT (*SetRetryPolicy)(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_CLIENT_RETRY_POLICY policy, size_t nTimeoutSeconds);
+    IOTHUB_CLIENT_RESULT (*SetConnectionStatusCallback)(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK callback, void *pContext);
+    IOTHUB_CLIENT_RESULT (*SetMessageCallback)(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC callback, void *pContext);
+    IOTHUB_CLIENT_RESULT (*SetDeviceMethodCallback)(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_CLIENT_DEVICE_METHOD_CALLBACK_ASYNC callback, void *pContext);
+    IOTHUB_CLIENT_RESULT (*SetDeviceTwinCallback)(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK callback, void *pContext);
+
+    IOTHUB_CLIENT_RESULT (*SendEventAsync)(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_MESSAGE_HANDLE hMessage, IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK callback, void *pContext);
+    IOTHUB_CLIENT_RESULT (*SendReportedState)(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, const unsigned char *pbReportedState, size_t nSize, IOTHUB_CLIENT_REPORTED_STATE_CALLBACK callback, void *pContext);
+    IOTHUB_CLIENT_RESULT (*GetSendStatus)(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_CLIENT_STATUS *pStatus);
+} azure_iot_transport_t;
+
+/// @brief Azure IoT SDK over MQTT with the Azure Sphere device certificate (default)
+extern const azure_iot_transport_t AzureIoT_SdkTransport;
+
+/// @brief backend in use, never NULL
+extern const azure_iot_transport_t *pAzureIoTTransport;
+
+/**
+* @brief    Selects the backend. Call before AzureIoT_DPS_StartConnection().
+* @param    pTransport  backend, NULL for AzureIoT_SdkTransport
+*/
+void AzureIoT_SetTransport(const azure_iot_transport_t *pTransport);
+
+#if defined(USE_AZURE_IOT_LOCAL_TRANSPORT)
+/// @brief local stand-in, see AzureIoT_LocalTransport_SetAddress()
+extern const azure_iot_transport_t AzureIoT_LocalTransport;
+
+/// @brief local backend: max length of a line read from the socket (twin patch, method payload)
+#ifndef AZURE_IOT_LOCAL_LINE_SIZE
+#define AZURE_IOT_LOCAL_LINE_SIZE (4096)
+#endif
+
+/// @brief local backend: messages and reported states waiting to be written and confirmed by DoWork
+#ifndef AZURE_IOT_LOCAL_CONFIRMATIONS
+#define AZURE_IOT_LOCAL_CONFIRMATIONS (64)
+#endif
+
+/// @brief local backend: reconnect backoff after the socket was lost, like the SDK's
+/// IOTHUB_CLIENT_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER policy
+#ifndef AZURE_IOT_LOCAL_RECONNECT_MIN_MS
+#define AZURE_IOT_LOCAL_RECONNECT_MIN_MS (1000)
+#endif
+#ifndef AZURE_IOT_LOCAL_RECONNECT_MAX_MS
+#define AZURE_IOT_LOCAL_RECONNECT_MAX_MS (30000)
+#endif
+
+/**
+* @brief    Sets where the local backend connects to, e.g. "unix:/tmp/iothub.sock" or "/tmp/iothub.log".
+*           A file only receives output. A Unix stream socket carries output and input lines:
+*           out: "message <messageId> <component|-> <payload>"
+*                "reported <payload>"
+*                "method <requestId> <status> <payload>"     (direct method response)
+*           in:  "twin <json>"                  partial desired properties update
+*                "twin-complete <json>"         complete twin {"desired":{...},"reported":{...}}
+*                "method <requestId> <name> <json>"
+*                "c2d <payload>"
+*                "disconnect"                   reports NO_NETWORK and closes the connection
+*                "reject [disabled]"            reports BAD_CREDENTIAL (DEVICE_DISABLED) and closes the
+*                                               connection for good, the client has to be replaced
+*           Like the SDK client, messages and reported states are only written by DoWork and then
+*           confirmed. A lost socket connection is reported as NO_NETWORK and reconnected by DoWork
+*           with jittered exponential backoff; sends are held meanwhile.
+* @param    cstrAddress     address string, must stay valid
+*/
+void AzureIoT_LocalTransport_SetAddress(const char *cstrAddress);
+#endif
+
+#endif
@@ -0,0 +1,553 @@
+/**
+* @brief Local stand-in for the IoT Hub, see AzureIoT_LocalTransport_SetAddress() for the line protocol.
+*   Meant for benchmarks on a Linux box: the client behaves like an IoT Hub that confirms everything
+*   on the next DoWork, so throughput is bound by the device side only. When the stand-in drops the
+*   socket, DoWork reconnects like the SDK client does on its own.
+*   Only built for the host with USE_AZURE_IOT_LOCAL_TRANSPORT.
+*/
+#if defined(USE_AZURE_IOT_LOCAL_TRANSPORT)
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <azureiot/iothub_device_client_ll.h>
+
+#include <applibs/log.h>
+#include "azure_iot_transport.h"
+
+#define MODULE "[Local] "
+
+static const char cstrUnixPrefix[] = "unix:";
+
+/// @brief message or reported state waiting for the next DoWork
+typedef struct {
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK fnMessage;   ///< NULL for a reported state
+    IOTHUB_CLIENT_REPORTED_STATE_CALLBACK fnReported;
+    void *pContext;
+    char *pLine;                ///< output line including '\n'
+    size_t nLineSize;
+} local_confirmation_t;
+
+typedef struct {
+    int fd;                     ///< -1 while a lost socket waits for reconnect
+    bool bOpen;
+    bool bSocket;
+    bool bAuthenticated;
+    bool bDiscardLine;          ///< rest of an overlong input line is skipped
+    IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK fnConnectionStatus;
+    void *pConnectionStatusContext;
+    IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC fnMessage;
+    void *pMessageContext;
+    IOTHUB_CLIENT_DEVICE_METHOD_CALLBACK_ASYNC fnMethod;
+    void *pMethodContext;
+    IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK fnTwin;
+    void *pTwinContext;
+    local_confirmation_t aConfirmations[AZURE_IOT_LOCAL_CONFIRMATIONS];
+    size_t nConfirmations;
+    size_t nWritten;            ///< the first nWritten confirmations went out
+    long long nReconnectAtMs;
+    unsigned int nReconnectBackoffMs;
+    unsigned int nRandomSeed;
+    char abLine[AZURE_IOT_LOCAL_LINE_SIZE];
+    size_t nLineUsed;
+} local_client_t;
+
+/// @brief single client, the handle points here
+static local_client_t localClient = { .fd = -1 };
+
+static const char *cstrLocalAddress = NULL;
+
+
+void AzureIoT_LocalTransport_SetAddress(const char *cstrAddress)
+{
+    cstrLocalAddress = cstrAddress;
+}
+
+
+static local_client_t *getClient(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient)
+{
+    return ((hClient == (IOTHUB_DEVICE_CLIENT_LL_HANDLE)&localClient) && localClient.bOpen) ? &localClient : NULL;
+}
+
+
+static long long nowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+* @brief    Connects the Unix stream socket of the address
+* @return   socket, -1 on failure
+*/
+static int connectSocket(const char *cstrPath)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(cstrPath) >= sizeof(addr.sun_path)) {
+        Log_Debug(MODULE "ERROR: socket path too long.\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, cstrPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((fd >= 0) && (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+
+static IOTHUB_DEVICE_CLIENT_LL_HANDLE localCreate(const char *cstrHubUri)
+{
+    if (cstrLocalAddress == NULL) {
+        Log_Debug(MODULE "ERROR: no local address set.\n");
+        return NULL;
+    }
+    if (localClient.bOpen) {
+        Log_Debug(MODULE "ERROR: local client exists already.\n");
+        return NULL;
+    }
+
+    memset(&localClient, 0, sizeof(localClient));
+    if (strncmp(cstrLocalAddress, cstrUnixPrefix, sizeof(cstrUnixPrefix) - 1) == 0) {
+        localClient.fd = connectSocket(cstrLocalAddress + sizeof(cstrUnixPrefix) - 1);
+        localClient.bSocket = true;
+    } else {
+        localClient.fd = open(cstrLocalAddress, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    }
+
+    if (localClient.fd < 0) {
+        Log_Debug(MODULE "ERROR: cannot open %s: %s (%d).\n", cstrLocalAddress, strerror(errno), errno);
+        return NULL;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    localClient.nRandomSeed = (unsigned int)ts.tv_nsec ^ ((unsigned int)getpid() << 16);
+    localClient.bOpen = true;
+    Log_Debug(MODULE "INFO: connected to %s\n", cstrLocalAddress);
+    return (IOTHUB_DEVICE_CLIENT_LL_HANDLE)&localClient;
+}
+
+
+/**
+* @brief    Confirms the first nCount pending messages and reported states, new ones sent from the
+*           callbacks wait for the next DoWork
+*/
+static void confirmPending(local_client_t *pClient, size_t nCount, IOTHUB_CLIENT_CONFIRMATION_RESULT result, int iReportedStatus)
+{
+    local_confirmation_t aConfirmations[AZURE_IOT_LOCAL_CONFIRMATIONS];
+
+    memcpy(aConfirmations, pClient->aConfirmations, nCount * sizeof(*aConfirmations));
+    pClient->nConfirmations -= nCount;
+    pClient->nWritten = (pClient->nWritten > nCount) ? pClient->nWritten - nCount : 0;
+    memmove(pClient->aConfirmations, pClient->aConfirmations + nCount, pClient->nConfirmations * sizeof(*aConfirmations));
+    for (size_t i = 0; i < nCount; i++) {
+        free(aConfirmations[i].pLine);
+        if (aConfirmations[i].fnMessage != NULL) {
+            aConfirmations[i].fnMessage(result, aConfirmations[i].pContext);
+        } else if (aConfirmations[i].fnReported != NULL) {
+            aConfirmations[i].fnReported(iReportedStatus, aConfirmations[i].pContext);
+        }
+    }
+}
+
+
+static void localDestroy(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient)
+{
+    local_client_t *pClient = getClient(hClient);
+    if (pClient == NULL) {
+        return;
+    }
+    confirmPending(pClient, pClient->nConfirmations, IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY, 0);
+    if (pClient->fd >= 0) {
+        close(pClient->fd);
+    }
+    pClient->fd = -1;
+    pClient->bOpen = false;
+}
+
+
+/**
+* @brief    Writes one output line "<cstrType> <prefix><payload>\n" right away, used from DoWork
+*/
+static bool writeLine(local_client_t *pClient, const char *cstrType, const char *cstrPrefix, const unsigned char *pbPayload, size_t nSize)
+{
+    if (dprintf(pClient->fd, "%s %s%.*s\n", cstrType, cstrPrefix, (int)nSize, (const char *)pbPayload) < 0) {
+        Log_Debug(MODULE "ERROR: write failed: %s (%d).\n", strerror(errno), errno);
+        return false;
+    }
+    return true;
+}
+
+
+/**
+* @brief    Closes the socket connection. After a loss (NO_NETWORK) DoWork reconnects after the jittered
+*           backoff, a rejected client stays closed like the SDK client does.
+*/
+static void closeConnection(local_client_t *pClient, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason)
+{
+    if (reason == IOTHUB_CLIENT_CONNECTION_NO_NETWORK) {
+        if (pClient->nReconnectBackoffMs == 0) {
+            pClient->nReconnectBackoffMs = AZURE_IOT_LOCAL_RECONNECT_MIN_MS;
+        }
+        unsigned int nDelayMs = pClient->nReconnectBackoffMs / 2 + (unsigned int)rand_r(&pClient->nRandomSeed) % (pClient->nReconnectBackoffMs / 2 + 1);
+        pClient->nReconnectAtMs = nowMs() + nDelayMs;
+        Log_Debug(MODULE "INFO: disconnected, reconnect in %u ms.\n", nDelayMs);
+    } else {
+        pClient->nReconnectAtMs = LLONG_MAX;
+        Log_Debug(MODULE "INFO: rejected.\n");
+    }
+
+    close(pClient->fd);
+    pClient->fd = -1;
+    pClient->bAuthenticated = false;
+    pClient->nLineUsed = 0;
+    pClient->bDiscardLine = false;
+    if (pClient->fnConnectionStatus != NULL) {
+        pClient->fnConnectionStatus(IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED, reason, pClient->pConnectionStatusContext);
+    }
+}
+
+
+/**
+* @brief    Splits the next space separated token off a line
+* @return   the token, NULL if there is none
+*/
+static char *nextToken(char **ppLine)
+{
+    char *pToken = *ppLine;
+    if ((pToken == NULL) || (*pToken == '\0')) {
+        return NULL;
+    }
+    char *pSpace = strchr(pToken, ' ');
+    if (pSpace != NULL) {
+        *pSpace = '\0';
+        *ppLine = pSpace + 1;
+    } else {
+        *ppLine = pToken + strlen(pToken);
+    }
+    return pToken;
+}
+
+
+/**
+* @brief    Dispatches one input line to the registered callbacks
+*/
+static void dispatchLine(local_client_t *pClient, char *pLine)
+{
+    char *pRest = pLine;
+    const char *cstrType = nextToken(&pRest);
+
+    if (cstrType == NULL) {
+        return;
+    }
+    if ((strcmp(cstrType, "twin") == 0) || (strcmp(cstrType, "twin-complete") == 0)) {
+        if (pClient->fnTwin != NULL) {
+            pClient->fnTwin((cstrType[4] == '\0') ? DEVICE_TWIN_UPDATE_PARTIAL : DEVICE_TWIN_UPDATE_COMPLETE,
+                (const unsigned char *)pRest, strlen(pRest), pClient->pTwinContext);
+        }
+    } else if (strcmp(cstrType, "method") == 0) {
+        const char *cstrRequestId = nextToken(&pRest);
+        const char *cstrMethod = nextToken(&pRest);
+        unsigned char *pbResponse = NULL;
+        size_t nResponseSize = 0;
+        int iStatus = 404;
+        if ((cstrRequestId == NULL) || (cstrMethod == NULL)) {
+            Log_Debug(MODULE "WARNING: malformed method line.\n");
+            return;
+        }
+        if (pClient->fnMethod != NULL) {
+            iStatus = pClient->fnMethod(cstrMethod, (const unsigned char *)pRest, strlen(pRest),
+                &pbResponse, &nResponseSize, pClient->pMethodContext);
+        }
+        char strPrefix[64];
+        snprintf(strPrefix, sizeof(strPrefix), "%s %d ", cstrRequestId, iStatus);
+        writeLine(pClient, "method", strPrefix, (pbResponse != NULL) ? pbResponse : (const unsigned char *)"", nResponseSize);
+        free(pbResponse);
+    } else if (strcmp(cstrType, "c2d") == 0) {
+        IOTHUB_MESSAGE_HANDLE hMessage = IoTHubMessage_CreateFromByteArray((const unsigned char *)pRest, strlen(pRest));
+        if ((hMessage != NULL) && (pClient->fnMessage != NULL)) {
+            pClient->fnMessage(hMessage, pClient->pMessageContext);
+        }
+        IoTHubMessage_Destroy(hMessage);
+    } else if (strcmp(cstrType, "disconnect") == 0) {
+        closeConnection(pClient, IOTHUB_CLIENT_CONNECTION_NO_NETWORK);
+    } else if (strcmp(cstrType, "reject") == 0) {
+        closeConnection(pClient, (strcmp(pRest, "disabled") == 0) ? IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED
+            : IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL);
+    } else {
+        Log_Debug(MODULE "WARNING: unknown input '%s'.\n", cstrType);
+    }
+}
+
+
+/**
+* @brief    Reads the available input without blocking and dispatches complete lines
+*/
+static void readInput(local_client_t *pClient)
+{
+    while (pClient->bSocket && (pClient->fd >= 0)) {
+        ssize_t nRead = recv(pClient->fd, pClient->abLine + pClient->nLineUsed,
+            sizeof(pClient->abLine) - 1 - pClient->nLineUsed, MSG_DONTWAIT);
+        if (nRead == 0) {
+            closeConnection(pClient, IOTHUB_CLIENT_CONNECTION_NO_NETWORK);
+            return;
+        }
+        if (nRead < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                closeConnection(pClient, IOTHUB_CLIENT_CONNECTION_NO_NETWORK);
+            }
+            return;
+        }
+        pClient->nLineUsed += (size_t)nRead;
+
+        char *pLine = pClient->abLine;
+        char *pEnd = NULL;
+        while ((pEnd = memchr(pLine, '\n', pClient->nLineUsed - (size_t)(pLine - pClient->abLine))) != NULL) {
+            *pEnd = '\0';
+            if (!pClient->bDiscardLine) {
+                dispatchLine(pClient, pLine);
+                if (pClient->fd < 0) {
+                    return;
+                }
+            }
+            pClient->bDiscardLine = false;
+            pLine = pEnd + 1;
+        }
+        pClient->nLineUsed -= (size_t)(pLine - pClient->abLine);
+        memmove(pClient->abLine, pLine, pClient->nLineUsed);
+
+        if (pClient->nLineUsed == sizeof(pClient->abLine) - 1) {
+            Log_Debug(MODULE "WARNING: input line exceeds %u bytes, skipped.\n", (unsigned int)sizeof(pClient->abLine));
+            pClient->bDiscardLine = true;
+            pClient->nLineUsed = 0;
+        }
+    }
+}
+
+
+/**
+* @brief    Writes the pending lines not written yet
+*/
+static void writePending(local_client_t *pClient)
+{
+    while ((pClient->fd >= 0) && (pClient->nWritten < pClient->nConfirmations)) {
+        const local_confirmation_t *pConfirmation = &pClient->aConfirmations[pClient->nWritten];
+        size_t nOffset = 0;
+        while (nOffset < pConfirmation->nLineSize) {
+            ssize_t nSent = write(pClient->fd, pConfirmation->pLine + nOffset, pConfirmation->nLineSize - nOffset);
+            if (nSent <= 0) {
+                Log_Debug(MODULE "ERROR: write failed: %s (%d).\n", strerror(errno), errno);
+                if (pClient->bSocket) {
+                    closeConnection(pClient, IOTHUB_CLIENT_CONNECTION_NO_NETWORK);
+                }
+                return;
+            }
+            nOffset += (size_t)nSent;
+        }
+        pClient->nWritten++;
+    }
+}
+
+
+static void localDoWork(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient)
+{
+    local_client_t *pClient = getClient(hClient);
+    if (pClient == NULL) {
+        return;
+    }
+
+    if (pClient->fd < 0) {
+        if (nowMs() < pClient->nReconnectAtMs) {
+            return;
+        }
+        pClient->fd = connectSocket(cstrLocalAddress + sizeof(cstrUnixPrefix) - 1);
+        if (pClient->fd < 0) {
+            pClient->nReconnectBackoffMs *= 2;
+            if (pClient->nReconnectBackoffMs > AZURE_IOT_LOCAL_RECONNECT_MAX_MS) {
+                pClient->nReconnectBackoffMs = AZURE_IOT_LOCAL_RECONNECT_MAX_MS;
+            }
+            pClient->nReconnectAtMs = nowMs() + pClient->nReconnectBackoffMs / 2
+                + (unsigned int)rand_r(&pClient->nRandomSeed) % (pClient->nReconnectBackoffMs / 2 + 1);
+            return;
+        }
+        Log_Debug(MODULE "INFO: reconnected to %s\n", cstrLocalAddress);
+        pClient->nReconnectBackoffMs = 0;
+    }
+
+    if (!pClient->bAuthenticated) {
+        pClient->bAuthenticated = true;
+        if (pClient->fnConnectionStatus != NULL) {
+            pClient->fnConnectionStatus(IOTHUB_CLIENT_CONNECTION_AUTHENTICATED, IOTHUB_CLIENT_CONNECTION_OK,
+                pClient->pConnectionStatusContext);
+        }
+    }
+    writePending(pClient);
+    confirmPending(pClient, pClient->nWritten, IOTHUB_CLIENT_CONFIRMATION_OK, 204);
+    readInput(pClient);
+}
+
+
+static IOTHUB_CLIENT_RESULT localSetOption(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, const char *cstrName, const void *pValue)
+{
+    return (getClient(hClient) != NULL) ? IOTHUB_CLIENT_OK : IOTHUB_CLIENT_INVALID_ARG;
+}
+
+
+static IOTHUB_CLIENT_RESULT localSetRetryPolicy(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_CLIENT_RETRY_POLICY policy, size_t nTimeoutSeconds)
+{
+    return (getClient(hClient) != NULL) ? IOTHUB_CLIENT_OK : IOTHUB_CLIENT_INVALID_ARG;
+}
+
+
+static IOTHUB_CLIENT_RESULT localSetConnectionStatusCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK callback, void *pContext)
+{
+    local_client_t *pClient = getClient(hClient);
+    if (pClient == NULL) {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    pClient->fnConnectionStatus = callback;
+    pClient->pConnectionStatusContext = pContext;
+    return IOTHUB_CLIENT_OK;
+}
+
+
+static IOTHUB_CLIENT_RESULT localSetMessageCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC callback, void *pContext)
+{
+    local_client_t *pClient = getClient(hClient);
+    if (pClient == NULL) {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    pClient->fnMessage = callback;
+    pClient->pMessageContext = pContext;
+    return IOTHUB_CLIENT_OK;
+}
+
+
+static IOTHUB_CLIENT_RESULT localSetDeviceMethodCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_CLIENT_DEVICE_METHOD_CALLBACK_ASYNC callback, void *pContext)
+{
+    local_client_t *pClient = getClient(hClient);
+    if (pClient == NULL) {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    pClient->fnMethod = callback;
+    pClient->pMethodContext = pContext;
+    return IOTHUB_CLIENT_OK;
+}
+
+
+static IOTHUB_CLIENT_RESULT localSetDeviceTwinCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK callback, void *pContext)
+{
+    local_client_t *pClient = getClient(hClient);
+    if (pClient == NULL) {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    pClient->fnTwin = callback;
+    pClient->pTwinContext = pContext;
+    return IOTHUB_CLIENT_OK;
+}
+
+
+/**
+* @brief    Queues the line "<cstrType> <prefix><payload>\n" and its confirmation for the next DoWork
+*/
+static IOTHUB_CLIENT_RESULT queueLine(local_client_t *pClient, const char *cstrType, const char *cstrPrefix,
+    const unsigned char *pbPayload, size_t nSize, IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK fnMessage,
+    IOTHUB_CLIENT_REPORTED_STATE_CALLBACK fnReported, void *pContext)
+{
+    if (pClient->nConfirmations >= AZURE_IOT_LOCAL_CONFIRMATIONS) {
+        Log_Debug(MODULE "ERROR: %u confirmations pending.\n", AZURE_IOT_LOCAL_CONFIRMATIONS);
+        return IOTHUB_CLIENT_ERROR;
+    }
+    size_t nTypeSize = strlen(cstrType);
+    size_t nPrefixSize = strlen(cstrPrefix);
+    size_t nLineSize = nTypeSize + 1 + nPrefixSize + nSize + 1;
+    char *pLine = malloc(nLineSize);
+    if (pLine == NULL) {
+        return IOTHUB_CLIENT_ERROR;
+    }
+    memcpy(pLine, cstrType, nTypeSize);
+    pLine[nTypeSize] = ' ';
+    memcpy(pLine + nTypeSize + 1, cstrPrefix, nPrefixSize);
+    memcpy(pLine + nTypeSize + 1 + nPrefixSize, pbPayload, nSize);
+    pLine[nLineSize - 1] = '\n';
+    local_confirmation_t *pConfirmation = &pClient->aConfirmations[pClient->nConfirmations++];
+    pConfirmation->fnMessage = fnMessage;
+    pConfirmation->fnReported = fnReported;
+    pConfirmation->pContext = pContext;
+    pConfirmation->pLine = pLine;
+    pConfirmation->nLineSize = nLineSize;
+    return IOTHUB_CLIENT_OK;
+}
+
+
+static IOTHUB_CLIENT_RESULT localSendEventAsync(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_MESSAGE_HANDLE hMessage, IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK callback, void *pContext)
+{
+    local_client_t *pClient = getClient(hClient);
+    const unsigned char *pbPayload = NULL;
+    size_t nSize = 0;
+
+    if ((pClient == NULL) || (IoTHubMessage_GetByteArray(hMessage, &pbPayload, &nSize) != IOTHUB_MESSAGE_OK)) {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    const char *cstrMessageId = IoTHubMessage_GetMessageId(hMessage);
+    const char *cstrComponent = IoTHubMessage_GetProperty(hMessage, "$.sub");
+    char strPrefix[128];
+    snprintf(strPrefix, sizeof(strPrefix), "%s %s ", (cstrMessageId != NULL) ? cstrMessageId : "-",
+        (cstrComponent != NULL) ? cstrComponent : "-");
+
+    return queueLine(pClient, "message", strPrefix, pbPayload, nSize, callback, NULL, pContext);
+}
+
+
+static IOTHUB_CLIENT_RESULT localSendReportedState(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, const unsigned char *pbReportedState, size_t nSize, IOTHUB_CLIENT_REPORTED_STATE_CALLBACK callback, void *pContext)
+{
+    local_client_t *pClient = getClient(hClient);
+    if ((pClient == NULL) || (pbReportedState == NULL)) {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    return queueLine(pClient, "reported", "", pbReportedState, nSize, NULL, callback, pContext);
+}
+
+
+static IOTHUB_CLIENT_RESULT localGetSendStatus(IOTHUB_DEVICE_CLIENT_LL_HANDLE hClient, IOTHUB_CLIENT_STATUS *pStatus)
+{
+    local_client_t *pClient = getClient(hClient);
+    if ((pClient == NULL) || (pStatus == NULL)) {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    *pStatus = (pClient->nConfirmations > 0) ? IOTHUB_CLIENT_SEND_STATUS_BUSY : IOTHUB_CLIENT_SEND_STATUS_IDLE;
+    return IOTHUB_CLIENT_OK;
+}
+
+
+const azure_iot_transport_t AzureIoT_LocalTransport = {
+    .cstrName = "local",
+    .bProvisioning = false,
+    .Create = localCreate,
+    .Destroy = localDestroy,
+    .DoWork = localDoWork,
+    .SetOption = localSetOption,
+    .SetRetryPolicy = localSetRetryPolicy,
+    .SetConnectionStatusCallback = localSetConnectionStatusCallback,
+    .SetMessageCallback = localSetMessageCallback,
+    .SetDeviceMethodCallback = localSetDeviceMethodCallback,
+    .SetDeviceTwinCallback = localSetDeviceTwinCallback,
+    .SendEventAsync = localSendEventAsync,
+    .SendReportedState = localSendReportedState,
+    .GetSendStatus = localGetSendStatus
+};
+
+#endif
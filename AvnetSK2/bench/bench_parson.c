@@ -0,0 +1,172 @@
+/**
+* @brief Host benchmark of the parson copy on device twin documents: throughput of json_parse_string()
+*   and of the in-place json_parse_buffer() the twin callback uses, per document and per number.
+*
+*   bench_parson [-i iterations] [twin.json ...]
+*
+*   Without files the documents of the twins directory are used. bench_parson_strtod is the same
+*   benchmark with PARSON_FAST_NUMBERS=0, every number goes through strtod(); the "compare" target
+*   of CMakeLists.txt runs both.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <fcntl.h>
+
+#include <applibs/storage.h>
+
+#include "parson.h"
+
+#ifndef BENCH_TWIN_DIR
+#define BENCH_TWIN_DIR "twins"
+#endif
+
+#ifndef PARSON_FAST_NUMBERS
+#define PARSON_FAST_NUMBERS 1
+#endif
+
+static const char *acstrDefaultTwins[] = {
+    BENCH_TWIN_DIR "/full_twin.json",
+    BENCH_TWIN_DIR "/desired_patch.json",
+    BENCH_TWIN_DIR "/telemetry.json",
+    BENCH_TWIN_DIR "/numbers.json"
+};
+
+/// @brief host replacement of the image package access of json_parse_file()
+int Storage_OpenFileInImagePackage(const char *relativePath)
+{
+    return open(relativePath, O_RDONLY);
+}
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/// @brief reads a whole file into a '\0' terminated buffer, NULL on failure
+static char *readFile(const char *cstrPath, size_t *pnSize)
+{
+    FILE *pFile = fopen(cstrPath, "rb");
+    char *pszContent = NULL;
+    long nSize = 0;
+
+    if ((pFile == NULL) || (fseek(pFile, 0, SEEK_END) != 0) || ((nSize = ftell(pFile)) < 0)) {
+        if (pFile != NULL) {
+            fclose(pFile);
+        }
+        return NULL;
+    }
+    rewind(pFile);
+    pszContent = malloc((size_t)nSize + 1);
+    if ((pszContent != NULL) && (fread(pszContent, 1, (size_t)nSize, pFile) != (size_t)nSize)) {
+        free(pszContent);
+        pszContent = NULL;
+    }
+    fclose(pFile);
+    if (pszContent != NULL) {
+        pszContent[nSize] = '\0';
+        *pnSize = (size_t)nSize;
+    }
+    return pszContent;
+}
+
+/// @brief counts the numbers of a parsed document
+static size_t countNumbers(const JSON_Value *jsonValue)
+{
+    size_t nNumbers = 0;
+
+    switch (json_value_get_type(jsonValue)) {
+    case JSONNumber:
+        return 1;
+    case JSONObject:
+        for (size_t i = 0; i < json_object_get_count(json_value_get_object(jsonValue)); i++) {
+            nNumbers += countNumbers(json_object_get_value_at(json_value_get_object(jsonValue), i));
+        }
+        break;
+    case JSONArray:
+        for (size_t i = 0; i < json_array_get_count(json_value_get_array(jsonValue)); i++) {
+            nNumbers += countNumbers(json_array_get_value(json_value_get_array(jsonValue), i));
+        }
+        break;
+    default:
+        break;
+    }
+    return nNumbers;
+}
+
+static void printResult(const char *cstrMode, size_t nSize, size_t nNumbers, double fSeconds)
+{
+    printf("  %-18s %9.0f ns/doc  %7.1f MB/s  %6.1f ns/number\n", cstrMode, fSeconds * 1e9,
+        (double)nSize / fSeconds / 1e6, fSeconds * 1e9 / (double)(nNumbers ? nNumbers : 1));
+}
+
+static int benchTwin(const char *cstrPath, unsigned int nIterations)
+{
+    size_t nSize = 0;
+    char *pszTwin = readFile(cstrPath, &nSize);
+    if (pszTwin == NULL) {
+        fprintf(stderr, "cannot read %s\n", cstrPath);
+        return -1;
+    }
+
+    JSON_Value *jsonRoot = json_parse_string(pszTwin);
+    if (jsonRoot == NULL) {
+        fprintf(stderr, "%s is not valid JSON\n", cstrPath);
+        free(pszTwin);
+        return -1;
+    }
+    size_t nNumbers = countNumbers(jsonRoot);
+    json_value_free(jsonRoot);
+    printf("%s: %zu bytes, %zu numbers\n", cstrPath, nSize, nNumbers);
+
+    double fStart = nowSeconds();
+    for (unsigned int i = 0; i < nIterations; i++) {
+        json_value_free(json_parse_string(pszTwin));
+    }
+    printResult("json_parse_string", nSize, nNumbers, (nowSeconds() - fStart) / nIterations);
+
+    // the twin callback hands over the payload with its size only, as here
+    fStart = nowSeconds();
+    for (unsigned int i = 0; i < nIterations; i++) {
+        json_value_free(json_parse_buffer(pszTwin, nSize));
+    }
+    printResult("json_parse_buffer", nSize, nNumbers, (nowSeconds() - fStart) / nIterations);
+
+    free(pszTwin);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int nIterations = 20000;
+    int iOption;
+    int iResult = EXIT_SUCCESS;
+
+    while ((iOption = getopt(argc, argv, "i:")) != -1) {
+        switch (iOption) {
+        case 'i': nIterations = (unsigned int)strtoul(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "usage: %s [-i iterations] [twin.json ...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (nIterations == 0) {
+        return EXIT_FAILURE;
+    }
+    printf("numbers parsed by %s\n", PARSON_FAST_NUMBERS ? "the exact fast path, strtod() otherwise" : "strtod() only");
+
+    if (optind == argc) {
+        for (size_t i = 0; i < sizeof(acstrDefaultTwins) / sizeof(acstrDefaultTwins[0]); i++) {
+            iResult |= (benchTwin(acstrDefaultTwins[i], nIterations) != 0);
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        iResult |= (benchTwin(argv[i], nIterations) != 0);
+    }
+    return iResult;
+}
@@ -0,0 +1,274 @@
+/**
+* @brief Host test of the telemetry store-and-forward queue on a Linux file standing in for the
+*   mutable storage: recovery after restart, partial drain, ring overflow, a corrupt slot, RAM only
+*   operation and a refusing send function.
+*
+*   test_telemetry_queue [-v]
+*
+*   -v prints the log of telemetry_queue.c. Returns EXIT_FAILURE if a check fails.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+
+#include "telemetry_queue.h"
+
+/// @brief queue region of the storage file, after a gap like the layout in main.c
+#define TEST_QUEUE_OFFSET (4096)
+#define TEST_QUEUE_SLOTS  (16)
+
+static bool bVerbose = false;
+static unsigned int nChecks = 0;
+static unsigned int nFailures = 0;
+
+/// @brief records handed to the send function, in order
+static char astrSent[64][32];
+static size_t nSent = 0;
+/// @brief the send function refuses once nSent reaches this
+static size_t nSendLimit = SIZE_MAX;
+
+#define CHECK(condition) check((condition), #condition, __func__, __LINE__)
+
+static void check(bool bCondition, const char *cstrCondition, const char *cstrTest, int nLine)
+{
+    nChecks++;
+    if (!bCondition) {
+        nFailures++;
+        printf("  FAILED %s:%d: %s\n", cstrTest, nLine, cstrCondition);
+    }
+}
+
+/// @brief host replacement of the applibs log
+int Log_Debug(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int nResult = Log_DebugVarArgs(fmt, args);
+    va_end(args);
+    return nResult;
+}
+
+int Log_DebugVarArgs(const char *fmt, va_list args)
+{
+    return bVerbose ? vfprintf(stderr, fmt, args) : 0;
+}
+
+static bool sendRecord(const char *cstrComponent, const char *pszPayload, time_t tCapture)
+{
+    if (nSent >= nSendLimit) {
+        return false;
+    }
+    snprintf(astrSent[nSent % 64], sizeof(astrSent[0]), "%s %s %lld", cstrComponent, pszPayload, (long long)tCapture);
+    nSent++;
+    return true;
+}
+
+/// @brief pushes records {"n":nFirst} .. {"n":nFirst + nCount - 1} captured at time nFirst + i
+static void pushRecords(unsigned int nFirst, unsigned int nCount)
+{
+    for (unsigned int i = nFirst; i < nFirst + nCount; i++) {
+        char strPayload[32];
+        int nSize = snprintf(strPayload, sizeof(strPayload), "{\"n\":%u}", i);
+        TelemetryQueue_Push("lps22hh", strPayload, (size_t)nSize, (time_t)i);
+    }
+}
+
+/// @brief true if the sent record nIndex is record n
+static bool sentRecordIs(size_t nIndex, unsigned int n)
+{
+    char strExpected[32];
+    snprintf(strExpected, sizeof(strExpected), "lps22hh {\"n\":%u} %u", n, n);
+    return (nIndex < nSent) && (strcmp(astrSent[nIndex % 64], strExpected) == 0);
+}
+
+static void resetSent(void)
+{
+    nSent = 0;
+    nSendLimit = SIZE_MAX;
+}
+
+/// @brief a fresh storage file, zero filled up to the queue region like a new mutable storage
+static int createStorage(void)
+{
+    char strPath[] = "/tmp/telemetry_queue_XXXXXX";
+    int fd = mkstemp(strPath);
+    if (fd >= 0) {
+        unlink(strPath);
+        if (ftruncate(fd, TEST_QUEUE_OFFSET) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    return fd;
+}
+
+static size_t initialize(int fd)
+{
+    return TelemetryQueue_Initialize(fd, TEST_QUEUE_OFFSET, TEST_QUEUE_SLOTS * TELEMETRY_QUEUE_SLOT_SIZE);
+}
+
+static void testRamOnly(void)
+{
+    resetSent();
+    CHECK(TelemetryQueue_Initialize(-1, 0, 0) == 0);
+    pushRecords(0, TELEMETRY_QUEUE_RAM_RECORDS + 2);
+    CHECK(TelemetryQueue_GetCount() == TELEMETRY_QUEUE_RAM_RECORDS);
+    CHECK(TelemetryQueue_GetDroppedCount() == 2);
+
+    CHECK(TelemetryQueue_Drain(SIZE_MAX, &sendRecord) == TELEMETRY_QUEUE_RAM_RECORDS);
+    CHECK(sentRecordIs(0, 2));
+    CHECK(sentRecordIs(TELEMETRY_QUEUE_RAM_RECORDS - 1, TELEMETRY_QUEUE_RAM_RECORDS + 1));
+    CHECK(TelemetryQueue_GetCount() == 0);
+}
+
+static void testRecoveryAfterRestart(void)
+{
+    int fd = createStorage();
+    CHECK(fd >= 0);
+    resetSent();
+    CHECK(initialize(fd) == 0);
+
+    // spills the oldest records to storage while pushing, the rest on flush (application exit)
+    pushRecords(0, 12);
+    CHECK(TelemetryQueue_GetCount() == 12);
+    TelemetryQueue_Flush();
+
+    CHECK(initialize(fd) == 12);
+    CHECK(TelemetryQueue_GetCount() == 12);
+    CHECK(TelemetryQueue_Drain(SIZE_MAX, &sendRecord) == 12);
+    CHECK(sentRecordIs(0, 0));
+    CHECK(sentRecordIs(11, 11));
+
+    // nothing is delivered twice after the next restart
+    CHECK(initialize(fd) == 0);
+    CHECK(TelemetryQueue_GetCount() == 0);
+    close(fd);
+}
+
+static void testPartialDrain(void)
+{
+    int fd = createStorage();
+    CHECK(fd >= 0);
+    resetSent();
+    initialize(fd);
+    pushRecords(0, 10);
+    TelemetryQueue_Flush();
+
+    CHECK(TelemetryQueue_Drain(4, &sendRecord) == 4);
+    CHECK(TelemetryQueue_GetCount() == 6);
+
+    // consumed records stay consumed after a restart, the drain continues with record 4
+    CHECK(initialize(fd) == 6);
+    resetSent();
+    CHECK(TelemetryQueue_Drain(SIZE_MAX, &sendRecord) == 6);
+    CHECK(sentRecordIs(0, 4));
+    CHECK(sentRecordIs(5, 9));
+
+    // new records continue the ring behind the recovered ones
+    pushRecords(100, 2);
+    TelemetryQueue_Flush();
+    CHECK(initialize(fd) == 2);
+    resetSent();
+    CHECK(TelemetryQueue_Drain(SIZE_MAX, &sendRecord) == 2);
+    CHECK(sentRecordIs(0, 100));
+    close(fd);
+}
+
+static void testRingOverflow(void)
+{
+    int fd = createStorage();
+    CHECK(fd >= 0);
+    resetSent();
+    initialize(fd);
+
+    // twice the ring: the oldest stored records are overwritten
+    pushRecords(0, 2 * TEST_QUEUE_SLOTS);
+    TelemetryQueue_Flush();
+    CHECK(TelemetryQueue_GetCount() == TEST_QUEUE_SLOTS);
+    CHECK(TelemetryQueue_GetDroppedCount() == TEST_QUEUE_SLOTS);
+
+    CHECK(initialize(fd) == TEST_QUEUE_SLOTS);
+    CHECK(TelemetryQueue_Drain(SIZE_MAX, &sendRecord) == TEST_QUEUE_SLOTS);
+    CHECK(sentRecordIs(0, TEST_QUEUE_SLOTS));
+    CHECK(sentRecordIs(TEST_QUEUE_SLOTS - 1, 2 * TEST_QUEUE_SLOTS - 1));
+    close(fd);
+}
+
+static void testCorruptSlot(void)
+{
+    int fd = createStorage();
+    CHECK(fd >= 0);
+    resetSent();
+    initialize(fd);
+    pushRecords(0, 5);
+    TelemetryQueue_Flush();
+
+    // flip a payload byte of the third slot, its CRC no longer matches
+    char c = 0;
+    off_t nPosition = TEST_QUEUE_OFFSET + 2 * TELEMETRY_QUEUE_SLOT_SIZE + 24 + 8;
+    CHECK(pread(fd, &c, 1, nPosition) == 1);
+    c ^= 0x01;
+    CHECK(pwrite(fd, &c, 1, nPosition) == 1);
+
+    CHECK(initialize(fd) == 4);
+    CHECK(TelemetryQueue_Drain(SIZE_MAX, &sendRecord) == 4);
+    CHECK(sentRecordIs(0, 0));
+    CHECK(sentRecordIs(1, 1));
+    CHECK(sentRecordIs(2, 3));
+    CHECK(sentRecordIs(3, 4));
+    CHECK(TelemetryQueue_GetCount() == 0);
+    close(fd);
+}
+
+static void testRefusedRecordStaysQueued(void)
+{
+    int fd = createStorage();
+    CHECK(fd >= 0);
+    resetSent();
+    initialize(fd);
+    pushRecords(0, 3);
+    TelemetryQueue_Flush();
+    pushRecords(3, 2);
+
+    nSendLimit = 2;
+    CHECK(TelemetryQueue_Drain(SIZE_MAX, &sendRecord) == 2);
+    CHECK(TelemetryQueue_GetCount() == 3);
+
+    nSendLimit = SIZE_MAX;
+    CHECK(TelemetryQueue_Drain(SIZE_MAX, &sendRecord) == 3);
+    CHECK(sentRecordIs(2, 2));
+    CHECK(sentRecordIs(4, 4));
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    bVerbose = (argc > 1) && (strcmp(argv[1], "-v") == 0);
+
+    static const struct {
+        const char *cstrName;
+        void (*fnTest)(void);
+    } aTests[] = {
+        { "RAM only", testRamOnly },
+        { "recovery after restart", testRecoveryAfterRestart },
+        { "partial drain", testPartialDrain },
+        { "ring overflow", testRingOverflow },
+        { "corrupt slot", testCorruptSlot },
+        { "refused record stays queued", testRefusedRecordStaysQueued }
+    };
+
+    for (size_t i = 0; i < sizeof(aTests) / sizeof(aTests[0]); i++) {
+        unsigned int nFailuresBefore = nFailures;
+        aTests[i].fnTest();
+        printf("%-30s %s\n", aTests[i].cstrName, (nFailures == nFailuresBefore) ? "ok" : "FAILED");
+    }
+    printf("%u checks, %u failed\n", nChecks, nFailures);
+    return (nFailures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -29,6 +29,8 @@
  *   will set the color of blinking LED 1 to red.
  * - Invoking the method named "DeviceHealth*resetMethod" with a payload containing '{"resetTimer":5}'
  *   will arm a reset-timer to reboot the device after # seconds.
+ * - Invoking the method named "DeviceHealth*deliveryStatsMethod" returns message delivery latency
+ *   histograms per component, a payload containing '{"reset":true}' clears them afterwards.
  *
  * Device Twin related notes:
  * - Setting blinkRateProperty in the Device Twin to a value from 0 to 2 causes the sample to
@@ -37,6 +39,9 @@
  *   the device twin on the IoT hub with the new value for blinkRateProperty.
  * - Pressing button A causes the sample to report the blink rate to the device
  *   twin on the IoT Hub.
+ * - Setting deviceHealth.messageRateLimit to n limits outbound messages to n per hour (bursts of 20,
+ *   0 = no limit). Running short of the rate, telemetry is aggregated into fuller batches and
+ *   sampled less often, button events may borrow ahead.
  *
  * This sample uses the API for the following Azure Sphere application libraries:
  * - i2c (serial port for BME280 sensor);
@@ -52,6 +57,7 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <time.h>
@@ -66,6 +72,7 @@
 #include <applibs/wificonfig.h>
 #include <applibs/powermanagement.h>
 #include <applibs/applications.h>
+#include <applibs/storage.h>
 
 // include the appropriate AVNET Starter Kit revision header file. 
 // The #defines have the same names on both but content differes on some (i.e. GPIO port settings for named LEDs)
@@ -86,6 +93,8 @@
 #include "azure_iot_json.h"
 #include "azure_iot_pnp.h"
 #include "azure_iot_central.h"
+#include "json_arena.h"
+#include "telemetry_queue.h"
 
 
 
@@ -114,11 +123,36 @@ static int fdUserLedBlinkTimer = -1;
 static int fdAppStatusLedFlashTimer = -1;
 static int fdTelemetryTimer = -1;
 static int fdResetTimer = -1;
+static int fdQueueDrainTimer = -1;
+static int fdMutableStorage = -1;
 static int fdSensorI2c = -1;
 
 /// @brief tsTelemetryInterval is set to send teleletry every 30 seconds
 static const struct timespec tsTelemetryInterval = {30, 0};
 
+/// @brief telemetry batching is off: IoT Central maps each component message by its "$.sub" property,
+/// it cannot read the batch envelope (see README "Telemetry batching"). With custom message routing,
+/// e.g. nTelemetryBatchMaxSize = AZURE_IOT_PNP_PACK_BUDGET coalesces the components into one message.
+/// A window of 0 seconds sends the batch at the end of every telemetry cycle, so packing toward
+/// nTelemetryBatchMaxSize is inactive. A window of several telemetry intervals packs more cycles.
+static const unsigned int nTelemetryBatchWindowSeconds = 0;
+static const size_t nTelemetryBatchMaxSize = 0;
+
+/// @brief changed reported properties (orientation, blink rate) are merged into one twin patch per window
+static const unsigned int nReportWindowSeconds = 10;
+
+/// @brief mutable storage layout: the first 4 KB are kept for small records, the telemetry queue follows
+#define STORAGE_REPORTED_OFFSET (0)
+#define STORAGE_REPORTED_SIZE (2048)
+#define STORAGE_DPS_OFFSET (2048)
+#define STORAGE_DPS_SIZE (2048)
+#define STORAGE_QUEUE_OFFSET (4096)
+#define STORAGE_QUEUE_SIZE (56 * 1024)
+
+/// @brief telemetry queued while offline is drained with at most nQueueDrainRecords per interval
+static const struct timespec tsQueueDrainInterval = {1, 0};
+static const size_t nQueueDrainRecords = 2;
+
 /// @brief default tsResetDelay is set to reboot after 5 second (overridden by resetTimer property)
 static struct timespec tsResetDelay = { 5, 0 };
 
@@ -151,7 +185,6 @@ static const char cstrColorProperty[] = "color";
 static const char cstrBlinkRateProperty[] = "blinkRateProperty";
 static const char cstrBlinkRatePropertyPath[] = "rgbLed.blinkRateProperty";
 
-static const char cstrSysVersionProperty[] = "$version";
 //static const char cstrStatusComplete[] = "complete";
 
 /// @brief Azure IoT PnP component "dtmi:azsphere:SphereTTT:lps22hh;1"  
@@ -202,22 +235,59 @@ static const char cstrDevHealthUserMemoryUsed[] ="userMemoryUsed";
 static const char cstrResetTimerProperty[] = "resetTimer";
 static const char cstrResetMethodName[] = "deviceHealth*resetMethod";
 static const char cstrResetResponseMsg[] = "Reset in %d seconds";
+static const char cstrDeliveryStatsMethodName[] = "deviceHealth*deliveryStatsMethod";
+static const char cstrDeliveryStatsProperty[] = "deliveryStats";
+static const char cstrDeliveryStatsResetProperty[] = "reset";
+static const char cstrMessageRateLimitProperty[] = "messageRateLimit";
+static const char cstrMessageRateLimitPropertyPath[] = "deviceHealth.messageRateLimit";
 
 static size_t nLastTotalMemoryUsed = 0;
 static size_t nLastUserMemoryUsed = 0;
 
+/// @brief message delivery statistics are sent as deviceHealth telemetry every n-th telemetry cycle
+static const unsigned int nDeliveryStatsCycles = 10;
+static unsigned int nTelemetryCycle = 0;
+
+/// @brief outbound messages per hour (0 = no limit) and burst of the token bucket in azure_iot.c,
+///        the rate is overridden per device by the desired property deviceHealth.messageRateLimit
+static unsigned int nMessageRateLimit = 0;
+static const unsigned int nMessageRateBurst = 20;
+static size_t nMessageRateLimitVersion = 0;
+
+/// @brief adaptive sampling: while the rate limit runs out of tokens only every n-th telemetry
+///        cycle is sampled, n doubles up to nMaxTelemetryDecimation and halves as tokens recover
+static const unsigned int nMaxTelemetryDecimation = 16;
+static unsigned int nTelemetryDecimation = 1;
+static unsigned int nDecimationCycle = 0;
+
 // method response messages
 static const char cstrBadDataResponseMsg[] = "Request does not contain identifiable data.";
 
+/// @brief json keys used in every telemetry and report cycle. They are interned in parson, so 
+///        json objects reference them instead of allocating a copy per key.
+static const char* const apszInternedPropertyNames[] = {
+    cstrButtonsComponent, cstrRgbledComponent, cstrColorProperty, cstrBlinkRateProperty,
+    cstrLPS22HHComponent, cstrSuccessProperty, cstrMessageProperty, cstrTemperatureProperty, cstrPressureProperty,
+    cstrLSM6DSOComponent, cstrOrientationProperty, cstrGyroObject, cstrAccelerationObject,
+    cstrXProperty, cstrYProperty, cstrZProperty,
+    cstrDevInfoComponent, cstrDevInfoManufacturerProperty, cstrDevInfoModelProperty, cstrDevInfoSWVersionProperty,
+    cstrDevInfoOSNameProperty, cstrDevInfoProcArchProperty, cstrDevInfoProcMfgrProperty,
+    cstrDevInfoStorageProperty, cstrDevInfoMemoryProperty,
+    cstrDevHealthComponent, cstrDevHealthTotalMemoryUsed, cstrDevHealthUserMemoryUsed, cstrResetTimerProperty,
+    cstrDeliveryStatsProperty, cstrMessageRateLimitProperty
+};
+
 
 // forward declarations for method handlers
 static HTTP_STATUS_CODE SetColorMethod(JSON_Value* jsonParameters, JSON_Value** jsonResponseAddress);
 static HTTP_STATUS_CODE ResetMethod(JSON_Value* jsonParameters, JSON_Value** jsonResponseAddress);
+static HTTP_STATUS_CODE DeliveryStatsMethod(JSON_Value* jsonParameters, JSON_Value** jsonResponseAddress);
 
 // list of method registrations
 static const MethodRegistration clstDirectMethods[] = {
     {.MethodName = cstrSetColorMethodName, .MethodHandler = &SetColorMethod},
     {.MethodName = cstrResetMethodName, .MethodHandler = &ResetMethod},
+    {.MethodName = cstrDeliveryStatsMethodName, .MethodHandler = &DeliveryStatsMethod},
     {.MethodName = NULL, .MethodHandler = NULL}
 };
 
@@ -243,6 +313,7 @@ static void UserLedUpdateHandler(EventData* eventData);
 static void AppStatusLedUpdateHandler(EventData* eventData);
 static void TelemetryTimerHandler(EventData* eventData);
 static void ResetTimerHandler(EventData* eventData);
+static void QueueDrainTimerHandler(EventData* eventData);
 
 // event handler data structures. Only the event handler field needs to be populated.
 static EventData evtdataButtonPollTimer = { .eventHandler = &ButtonPollTimerHandler };
@@ -250,6 +321,7 @@ static EventData evtdataUserLedUpdate = { .eventHandler = &UserLedUpdateHandler
 static EventData evtdataAppStatusLedUpdate = { .eventHandler = &AppStatusLedUpdateHandler };
 static EventData evtdataTelemetryTimer = { .eventHandler = &TelemetryTimerHandler };
 static EventData evtdataResetTimer = { .eventHandler = &ResetTimerHandler };
+static EventData evtdataQueueDrainTimer = { .eventHandler = &QueueDrainTimerHandler };
 
 
 // forward declarations for close handlers
@@ -410,167 +482,204 @@ static size_t SetLedRate(size_t nValue)
 /// @param pstrMessageevent message
 static void SendEventMessage(const char * cstrComponent, const char * cstrEvent, const char * cstrMessage)
 {
+    // stream { "<event>" : "<message>" } directly into the payload, no JSON tree needed
+    char abPayload[256];
+    JSON_Writer writer;
+    AzureIoTJson_InitWriter(&writer, abPayload, sizeof(abPayload));
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, cstrEvent);
+    json_writer_string(&writer, cstrMessage);
+    json_writer_end_object(&writer);
+
 	if (connectedToIoTHub) {
 		Log_Debug("[Send] Component '%s' event '%s' is '%s'\n", cstrComponent, cstrEvent, cstrMessage);
 
-        JSON_Value  *jsonRootValue = json_value_init_object();
-        JSON_Object *jsonRootObject = json_value_get_object( jsonRootValue );
-
-        json_object_set_string(jsonRootObject, cstrEvent, cstrMessage);
-
 		// Send a message
-		AzureIoT_PnP_SendJsonMessage(jsonRootValue, cstrComponent);
-
-        json_value_free(jsonRootValue);
+		AzureIoT_PnP_SendMessageFromWriter(&writer, cstrComponent, AZURE_IOT_PRIORITY_CRITICAL);
 
 		// Set the send/receive AppStatusLed to blink once immediately to indicate 
 		// the message has been queued.
 		BlinkAppStatusLedOnce(RgbLedUtility_Colors_Green);
 	}
 	else {
-		Log_Debug("[Send] not connected to IoT Central: no event sent.\n");
+		Log_Debug("[Send] not connected to IoT Central: event queued.\n");
+        size_t nPayloadSize = 0;
+        const char *pszPayload = json_writer_finish(&writer, &nPayloadSize);
+        if (pszPayload != NULL) {
+            TelemetryQueue_Push(cstrComponent, pszPayload, nPayloadSize, time(NULL));
+        }
 		BlinkAppStatusLedOnce(RgbLedUtility_Colors_Red);
 	}
 }
 
-/// @brief Sends a telemetry message to Azure IoT Central.
+/// @brief Batches a component telemetry payload, or queues it with its capture time while
+/// not connected to IoT Central or while it is refused (e.g. out of send tokens).
+static void SendComponentTelemetry(JSON_Value * jsonPayload, const char * cstrComponent)
+{
+    if (connectedToIoTHub && (AzureIoT_PnP_BatchJsonMessage(jsonPayload, cstrComponent) == IOTHUB_CLIENT_OK)) {
+        return;
+    }
+
+    size_t nPayloadSize = 0;
+    const char *pszPayload = AzureIoTJson_ToPooledPayload(jsonPayload, &nPayloadSize);
+    if (pszPayload != NULL) {
+        TelemetryQueue_Push(cstrComponent, pszPayload, nPayloadSize, time(NULL));
+    }
+}
+
+/// @brief Sends a telemetry message to Azure IoT Central, or queues it while not connected.
+/// All JSON trees are built in one arena scope and released together by JsonArena_End().
 /// 
 static void SendTelemetryMessage(void)
 {
     JSON_Value * jsonRootValue;
     JSON_Object * jsonRootObject;
 
-    if (connectedToIoTHub) {
-        jsonRootValue = json_value_init_object();
-        jsonRootObject = json_value_get_object( jsonRootValue );
-        vector3d_t vector;
-        bool bHasData = false;
+    JsonArena_Begin();
 
-        if( Sensors_GetAcceleration( &vector ) )
-        {
-            JSON_Value *jsonObjValue = NULL;
-            JSON_Object *jsonObj = NULL;
-            const char *cstrOrientation = Sensors_GetOrientation(&vector);
-
-            if( (cstrOrientation != strLastOrientation) || 
-                true
-            )
-            {
-                // update "orientation" property
-                jsonObjValue = json_value_init_object();
-                jsonObj = json_value_get_object( jsonObjValue );
-                
-                json_object_set_string( jsonObj, cstrOrientationProperty, cstrOrientation); 
-                AzureIoT_PnP_ReportComponentProperty( cstrLSM6DSOComponent, jsonObjValue );
+    jsonRootValue = json_value_init_object();
+    jsonRootObject = json_value_get_object( jsonRootValue );
+    vector3d_t vector;
+    bool bHasData = false;
 
-                strLastOrientation = cstrOrientation;
-            }
+    if( Sensors_GetAcceleration( &vector ) )
+    {
+        JSON_Value *jsonObjValue = NULL;
+        JSON_Object *jsonObj = NULL;
+        const char *cstrOrientation = Sensors_GetOrientation(&vector);
 
-            // create payload for "acceleration" telemetry
+        if( (cstrOrientation != strLastOrientation) || 
+            true
+        )
+        {
+            // update "orientation" property
             jsonObjValue = json_value_init_object();
             jsonObj = json_value_get_object( jsonObjValue );
+            
+            json_object_set_string( jsonObj, cstrOrientationProperty, cstrOrientation); 
+            // unchanged values are skipped by the reported properties cache, changes made offline are kept
+            AzureIoT_PnP_ReportComponentProperty( cstrLSM6DSOComponent, jsonObjValue );
 
-            json_object_set_number(jsonObj, cstrXProperty, vector.x);
-            json_object_set_number(jsonObj, cstrYProperty, vector.y);
-            json_object_set_number(jsonObj, cstrZProperty, vector.z);
-            json_object_set_value( jsonRootObject, cstrAccelerationObject, jsonObjValue );
-            bHasData = true;
+            strLastOrientation = cstrOrientation;
         }
 
+        // create payload for "acceleration" telemetry
+        jsonObjValue = json_value_init_object();
+        jsonObj = json_value_get_object( jsonObjValue );
 
-        if( Sensors_GetGyro( &vector ) )
-        {
-            //[TODO] omit Gyro data until we calibrate the gyro first. lsm6dso sends strange values...
-            // JSON_Value *jsonObjValue = json_value_init_object();
-            // JSON_Object *jsonObj = json_value_get_object( jsonObjValue );
+        json_object_set_number(jsonObj, cstrXProperty, vector.x);
+        json_object_set_number(jsonObj, cstrYProperty, vector.y);
+        json_object_set_number(jsonObj, cstrZProperty, vector.z);
+        json_object_set_value( jsonRootObject, cstrAccelerationObject, jsonObjValue );
+        bHasData = true;
+    }
 
-            // json_object_set_number(jsonObj, cstrXProperty, vector.x);
-            // json_object_set_number(jsonObj, cstrYProperty, vector.y);
-            // json_object_set_number(jsonObj, cstrZProperty, vector.z);
 
-            // json_object_set_value( jsonRootObject, cstrGyroObject, jsonObjValue );
-            // bHasData = true;
-        }
+    if( Sensors_GetGyro( &vector ) )
+    {
+        //[TODO] omit Gyro data until we calibrate the gyro first. lsm6dso sends strange values...
+        // JSON_Value *jsonObjValue = json_value_init_object();
+        // JSON_Object *jsonObj = json_value_get_object( jsonObjValue );
 
-        if( bHasData )
-        {
-            AzureIoT_PnP_SendJsonMessage(jsonRootValue, cstrLSM6DSOComponent);
-        }
-        json_value_free( jsonRootValue );
+        // json_object_set_number(jsonObj, cstrXProperty, vector.x);
+        // json_object_set_number(jsonObj, cstrYProperty, vector.y);
+        // json_object_set_number(jsonObj, cstrZProperty, vector.z);
 
-        // reading lps22hh resets the lsm6dso accelerometer! Reading temperature after acceleration.
-        envdata_t dataset;
-        if( Sensors_GetEnvironmentData( &dataset ) ){
-            jsonRootValue = json_value_init_object();
-            jsonRootObject = json_value_get_object( jsonRootValue );
+        // json_object_set_value( jsonRootObject, cstrGyroObject, jsonObjValue );
+        // bHasData = true;
+    }
 
-            Log_Debug( "[Send] Temperature: %.2f °C, Pressure: %.2f hPa\n", dataset.fTemperature, dataset.fPressure_hPa);
+    if( bHasData )
+    {
+        SendComponentTelemetry(jsonRootValue, cstrLSM6DSOComponent);
+    }
 
-            json_object_set_number(jsonRootObject, cstrTemperatureProperty, dataset.fTemperature);
-            json_object_set_number(jsonRootObject, cstrPressureProperty, dataset.fPressure_hPa);
-            
-            AzureIoT_PnP_SendJsonMessage(jsonRootValue, cstrLPS22HHComponent);
+    // reading lps22hh resets the lsm6dso accelerometer! Reading temperature after acceleration.
+    envdata_t dataset;
+    if( Sensors_GetEnvironmentData( &dataset ) ){
+        jsonRootValue = json_value_init_object();
+        jsonRootObject = json_value_get_object( jsonRootValue );
 
-            json_value_free( jsonRootValue );
-        }
+        Log_Debug( "[Send] Temperature: %.2f °C, Pressure: %.2f hPa\n", dataset.fTemperature, dataset.fPressure_hPa);
+
+        json_object_set_number(jsonRootObject, cstrTemperatureProperty, dataset.fTemperature);
+        json_object_set_number(jsonRootObject, cstrPressureProperty, dataset.fPressure_hPa);
+        
+        SendComponentTelemetry(jsonRootValue, cstrLPS22HHComponent);
+    }
 
 #ifdef BME280		
-        jsonRootValue = json_value_init_object();
-        jsonRootObject = json_value_get_object( jsonRootValue );
+    jsonRootValue = json_value_init_object();
+    jsonRootObject = json_value_get_object( jsonRootValue );
 
-		bme280_data_t bmeData;
-		if (BME280_GetSensorData(&bmeData) == 0)
-		{
-			Log_Debug("[Send] Component '%s': Temperature: %.2f, Pressure: %.2f, Humidity: %.2f\n", cstrBME280Component, bmeData.temperature, bmeData.pressure, bmeData.humidity);
+	bme280_data_t bmeData;
+	if (BME280_GetSensorData(&bmeData) == 0)
+	{
+		Log_Debug("[Send] Component '%s': Temperature: %.2f, Pressure: %.2f, Humidity: %.2f\n", cstrBME280Component, bmeData.temperature, bmeData.pressure, bmeData.humidity);
 
-            json_object_set_number(jsonRootObject, cstrTemperatureProperty, bmeData.temperature);
-            json_object_set_number(jsonRootObject, cstrPressureProperty, bmeData.pressure);
-            json_object_set_number(jsonRootObject, cstrHumidityProperty, bmeData.humidity);
-            
-		}
-        json_value_free( jsonRootValue );
+        json_object_set_number(jsonRootObject, cstrTemperatureProperty, bmeData.temperature);
+        json_object_set_number(jsonRootObject, cstrPressureProperty, bmeData.pressure);
+        json_object_set_number(jsonRootObject, cstrHumidityProperty, bmeData.humidity);
+        
+	}
 #endif
 
 #ifdef BMP280		
+    jsonRootValue = json_value_init_object();
+    jsonRootObject = json_value_get_object( jsonRootValue );
+	bmp280_data_t bmpData;
+
+	if (BMP280_GetSensorData(&bmpData) == 0)
+	{
+		Log_Debug("[Send] Component '%s' Temperature: %.2f, Pressure: %.2f\n", cstrBMP280Component, bmpData.temperature, bmpData.pressure);
+
+        json_object_set_number(jsonRootObject, cstrTemperatureProperty, bmpData.temperature);
+        json_object_set_number(jsonRootObject, cstrPressureProperty, bmpData.pressure);
+        
+        SendComponentTelemetry(jsonRootValue, cstrBMP280Component);
+    }
+#endif
+
+
+    size_t nTotalMemUsed = Applications_GetTotalMemoryUsageInKB();
+    size_t nUserMemUsed = Applications_GetUserModeMemoryUsageInKB();
+    if( (nLastTotalMemoryUsed != nTotalMemUsed) || (nLastUserMemoryUsed != nUserMemUsed) ){
+		Log_Debug("[Send] Component:'%s' TotalMemoryUsed: %d, UserMemoryUsed: %d\n", cstrDevHealthComponent, nTotalMemUsed, nUserMemUsed);
+        
+        nLastTotalMemoryUsed = nTotalMemUsed;
+        nLastUserMemoryUsed = nUserMemUsed;
+
         jsonRootValue = json_value_init_object();
         jsonRootObject = json_value_get_object( jsonRootValue );
-		bmp280_data_t bmpData;
 
-		if (BMP280_GetSensorData(&bmpData) == 0)
-		{
-			Log_Debug("[Send] Component '%s' Temperature: %.2f, Pressure: %.2f\n", cstrBMP280Component, bmpData.temperature, bmpData.pressure);
+        json_object_set_number(jsonRootObject, cstrDevHealthTotalMemoryUsed, nTotalMemUsed);
+        json_object_set_number(jsonRootObject, cstrDevHealthUserMemoryUsed, nUserMemUsed);
 
-            json_object_set_number(jsonRootObject, cstrTemperatureProperty, bmpData.temperature);
-            json_object_set_number(jsonRootObject, cstrPressureProperty, bmpData.pressure);
-            
-            AzureIoT_PnP_SendJsonMessage(jsonRootValue, cstrBMP280Component);
-        }
-        json_value_free( jsonRootValue );
-#endif
+        SendComponentTelemetry(jsonRootValue, cstrDevHealthComponent);
+    }
 
+    // message delivery latency and outcome per component
+    if( connectedToIoTHub && (++nTelemetryCycle >= nDeliveryStatsCycles) )
+    {
+        nTelemetryCycle = 0;
+        jsonRootValue = json_value_init_object();
+        jsonRootObject = json_value_get_object( jsonRootValue );
 
-        size_t nTotalMemUsed = Applications_GetTotalMemoryUsageInKB();
-        size_t nUserMemUsed = Applications_GetUserModeMemoryUsageInKB();
-        if( (nLastTotalMemoryUsed != nTotalMemUsed) || (nLastUserMemoryUsed != nUserMemUsed) ){
-			Log_Debug("[Send] Component:'%s' TotalMemoryUsed: %d, UserMemoryUsed: %d\n", cstrDevHealthComponent, nTotalMemUsed, nUserMemUsed);
-            
-            nLastTotalMemoryUsed = nTotalMemUsed;
-            nLastUserMemoryUsed = nUserMemUsed;
+        json_object_set_value(jsonRootObject, cstrDeliveryStatsProperty, AzureIoTJson_GetDeliveryStatistics());
 
-            jsonRootValue = json_value_init_object();
-            jsonRootObject = json_value_get_object( jsonRootValue );
+        AzureIoT_PnP_BatchJsonMessage(jsonRootValue, cstrDevHealthComponent);
+    }
 
-            json_object_set_number(jsonRootObject, cstrDevHealthTotalMemoryUsed, nTotalMemUsed);
-            json_object_set_number(jsonRootObject, cstrDevHealthUserMemoryUsed, nUserMemUsed);
-    
-            AzureIoT_PnP_SendJsonMessage(jsonRootValue, cstrDevHealthComponent);
-            json_value_free(jsonRootValue);
-        }
+    // send the coalesced components once the batch window expired
+    AzureIoT_PnP_DoBatchTasks();
 
-	    BlinkAppStatusLedOnce( RgbLedUtility_Colors_Green );
+    // releases all JSON trees of this telemetry cycle at once
+    JsonArena_End();
 
+    if (connectedToIoTHub) {
+	    BlinkAppStatusLedOnce( RgbLedUtility_Colors_Green );
     } else {
-		Log_Debug("[Send] not connected to IoT Central: no telemtry sent.\n");
+		Log_Debug("[Send] not connected to IoT Central: %u telemetry records queued.\n", (unsigned int)TelemetryQueue_GetCount());
 		BlinkAppStatusLedOnce(RgbLedUtility_Colors_Red);
 	}
 }
@@ -584,32 +693,58 @@ static void MessageReceived(const char *payload)
 }
 
 ///  @brief 
-///     Device Twin update callback function, called when an update is received from the Azure IoT
-///     Hub.
+///     Desired property handler for "rgbLed.blinkRateProperty", subscribed at startup and called
+///     when a Device Twin update from the Azure IoT Hub contains the property.
 /// 
-/// @param desiredPropertiesThe JSON root object containing the desired Device Twin
-/// properties received from the Azure IoT Hub.
-static void DeviceTwinUpdate(const JSON_Object *desiredProperties)
+/// @param cstrPropertyPath subscribed property path
+/// @param jsonValue        desired blink rate, any other type than JSONNumber is rejected
+/// @param nVersion         "$version" of the desired properties
+static void BlinkRatePropertyUpdate(const char* cstrPropertyPath, const JSON_Value* jsonValue, unsigned int nVersion)
 {
-	if (json_object_dothas_value_of_type(desiredProperties, cstrBlinkRatePropertyPath, JSONNumber))
-	{
-		double fDesiredBlinkRate = json_object_dotget_number(desiredProperties, cstrBlinkRatePropertyPath);
-        nBlinkrateVersion = (unsigned int)json_object_get_number(desiredProperties, cstrSysVersionProperty);
+	if (json_value_get_type(jsonValue) != JSONNumber) {
+		Log_Debug( "[DeviceTwinUpdate] received update with incorrect data:\n");
+		BlinkAppStatusLedOnce(RgbLedUtility_Colors_Red);
+		return;
+	}
 
-		Log_Debug("[DeviceTwinUpdate] Received desired value %f for blinkRateProperty.\n", fDesiredBlinkRate);
+	double fDesiredBlinkRate = json_value_get_number(jsonValue);
+    nBlinkrateVersion = nVersion;
 
-		double fActualBlinkRate = (double) SetLedRate( (size_t) fDesiredBlinkRate );
-        
-        unsigned int nStatus = (fActualBlinkRate == fDesiredBlinkRate) ? HTTP_OK : HTTP_BAD_REQUEST;
+	Log_Debug("[DeviceTwinUpdate] Received desired value %f for blinkRateProperty.\n", fDesiredBlinkRate);
 
-        // Acknowlede receipt of property back to Azure IoT Central 
-        AzureIoTCentral_AckComponentPropertyChange( cstrRgbledComponent, cstrBlinkRateProperty, &fActualBlinkRate, JSONNumber, nBlinkrateVersion, nStatus);
+	double fActualBlinkRate = (double) SetLedRate( (size_t) fDesiredBlinkRate );
+    
+    unsigned int nStatus = (fActualBlinkRate == fDesiredBlinkRate) ? HTTP_OK : HTTP_BAD_REQUEST;
 
-		BlinkAppStatusLedOnce(RgbLedUtility_Colors_Blue);
-	} else {
-		Log_Debug( "[DeviceTwinUpdate] received update with incorrect data:\n");
-		BlinkAppStatusLedOnce(RgbLedUtility_Colors_Red);
-	}
+    // Acknowlede receipt of property back to Azure IoT Central 
+    AzureIoTCentral_AckComponentPropertyChange( cstrRgbledComponent, cstrBlinkRateProperty, &fActualBlinkRate, JSONNumber, nBlinkrateVersion, nStatus);
+
+	BlinkAppStatusLedOnce(RgbLedUtility_Colors_Blue);
+}
+
+
+///  @brief 
+///     Desired property handler for "deviceHealth.messageRateLimit" (messages per hour, 0 = no limit).
+/// 
+/// @param cstrPropertyPath subscribed property path
+/// @param jsonValue        desired rate (JSONNumber)
+/// @param nVersion         "$version" of the desired properties
+static void MessageRateLimitPropertyUpdate(const char* cstrPropertyPath, const JSON_Value* jsonValue, unsigned int nVersion)
+{
+    double fDesiredRate = json_value_get_number(jsonValue);
+    nMessageRateLimitVersion = nVersion;
+
+    Log_Debug("[DeviceTwinUpdate] Received desired value %f for messageRateLimit.\n", fDesiredRate);
+
+    unsigned int nStatus = HTTP_BAD_REQUEST;
+    if ((fDesiredRate >= 0) && (fDesiredRate <= UINT_MAX)) {
+        nMessageRateLimit = (unsigned int)fDesiredRate;
+        AzureIoT_SetRateLimit(nMessageRateLimit, nMessageRateBurst);
+        nStatus = HTTP_OK;
+    }
+    double fActualRate = (double)nMessageRateLimit;
+
+    AzureIoTCentral_AckComponentPropertyChange( cstrDevHealthComponent, cstrMessageRateLimitProperty, &fActualRate, JSONNumber, nMessageRateLimitVersion, nStatus);
 }
 
 
@@ -706,13 +841,35 @@ static HTTP_STATUS_CODE ResetMethod(JSON_Value* jsonParameters, JSON_Value** jso
     return result;
 }
 
+/// @brief 
+/// deliveryStats-Method returns the message delivery statistics, { "reset": true } clears them afterwards
+///
+/// @param jsonParametersjson message payload
+/// @param jsonResponseAddressaddress of response message payload
+/// @returns HTTP status return value.
+static HTTP_STATUS_CODE DeliveryStatsMethod(JSON_Value* jsonParameters, JSON_Value** jsonResponseAddress)
+{
+    Log_Debug("[DeliveryStatsMethod]: Invoked.\n");
+
+    *jsonResponseAddress = AzureIoTJson_GetDeliveryStatistics();
+
+    if (jsonParameters != NULL) {
+        JSON_Object* jsonRootObject = json_value_get_object(jsonParameters);
+        if (json_object_get_boolean(jsonRootObject, cstrDeliveryStatsResetProperty) == 1) {
+            Log_Debug("[DeliveryStatsMethod]: statistics reset.\n");
+            AzureIoT_ResetDeliveryStatistics();
+        }
+    }
+
+    return HTTP_OK;
+}
+
 static void ReportAllProperties(void)
 {
-    JSON_Value* jsonRoot = json_value_init_object();
     JSON_Value* jsonValue = NULL;
-    JSON_Value* jsonComponentValue = NULL;
     JSON_Object *jsonObject = NULL;
 
+    // all properties pass the reported properties cache, only values not accepted yet are sent
     jsonValue = json_value_init_object();
     jsonObject = json_value_get_object( jsonValue );
     json_object_set_string(jsonObject, cstrDevInfoManufacturerProperty, cstrDevInfoManufacturerValue);
@@ -724,24 +881,25 @@ static void ReportAllProperties(void)
     json_object_set_number(jsonObject, cstrDevInfoStorageProperty, (double) ciDevInfoStorageValue);
     json_object_set_number(jsonObject, cstrDevInfoMemoryProperty, (double) ciDevInfoMemoryValue);
     
-    AzureIoT_PnP_CreateComponentPropertyJson( jsonRoot, cstrDevInfoComponent, jsonValue);
+    AzureIoT_PnP_ReportComponentProperty( cstrDevInfoComponent, jsonValue);
 
 
     jsonValue = json_value_init_object();
-    jsonObject = json_value_get_object( jsonComponentValue );
+    jsonObject = json_value_get_object( jsonValue );
     json_object_set_number(jsonObject, cstrBlinkRateProperty, (double) nBlinkRateValue);
 
-    AzureIoT_PnP_CreateComponentPropertyJson( jsonRoot, cstrRgbledComponent, jsonValue);
-
-    jsonValue = json_value_init_object();
-    jsonObject = json_value_get_object( jsonComponentValue );
-    json_object_set_string(jsonObject, cstrOrientationProperty, strLastOrientation);
+    AzureIoT_PnP_ReportComponentProperty( cstrRgbledComponent, jsonValue);
 
-    AzureIoT_PnP_CreateComponentPropertyJson( jsonRoot, cstrLSM6DSOComponent, jsonValue);
+    if (strLastOrientation != NULL) {
+        jsonValue = json_value_init_object();
+        jsonObject = json_value_get_object( jsonValue );
+        json_object_set_string(jsonObject, cstrOrientationProperty, strLastOrientation);
 
-    AzureIoTJson_TwinReportState(jsonRoot);
+        AzureIoT_PnP_ReportComponentProperty( cstrLSM6DSOComponent, jsonValue);
+    }
 
-    json_value_free(jsonRoot);
+    // the diff is sent right away instead of waiting for the report window
+    AzureIoT_PnP_FlushReportedProperties();
 }
 
 ///  @brief 
@@ -772,8 +930,7 @@ static void IoTHubConnectionStatusChanged(bool connected, const char *statusText
     }
     else {
         Log_Debug("[IoTHubConnectionStatusChanged]: Disconnected.\n");
-        // switch off telemetry timer as we are disconnected
-        SetTimerFdToPeriod(fdTelemetryTimer, &tsNullInterval);
+        // telemetry timer keeps running, readings are queued until reconnected
         // save reason for disconnect event
         pstrConnectionStatus = statusText;
     }
@@ -870,18 +1027,22 @@ void ButtonPollTimerHandler(EventData *eventData)
 
     NetworkLedUpdateHandler();
 
+    // send the merged patch of changed reported properties once the report window expired
+    AzureIoT_PnP_DoReportTasks();
+    // the batch window may expire between telemetry cycles, e.g. with long send intervals
+    AzureIoT_PnP_DoBatchTasks();
     // If the button A is pressed, change the LED blink interval, update the Device Twin and send a buttonA event message.
     static GPIO_Value_Type blinkButtonState;
     if (IsButtonPressed(fdBlinkRateButtonGpio, &blinkButtonState)) {
         SetLedRate( nBlinkRateValue + 1 );
 
-        if (connectedToIoTHub) {
-            JSON_Value * jsonValue = json_value_init_object();
-            JSON_Object * jsonObject = json_value_get_object( jsonValue );
-            json_object_set_number(jsonObject, cstrBlinkRateProperty, (double) nBlinkRateValue);
+        JSON_Value * jsonValue = json_value_init_object();
+        JSON_Object * jsonObject = json_value_get_object( jsonValue );
+        json_object_set_number(jsonObject, cstrBlinkRateProperty, (double) nBlinkRateValue);
 
-            AzureIoT_PnP_ReportComponentProperty( cstrRgbledComponent, jsonValue);
+        AzureIoT_PnP_ReportComponentProperty( cstrRgbledComponent, jsonValue);
 
+        if (connectedToIoTHub) {
             SendEventMessage(cstrButtonsComponent, cstrEvtButtonA, cstrMsgPressed);
         }
         else {
@@ -913,9 +1074,53 @@ void TelemetryTimerHandler(EventData *eventData)
 		return;
 	}
 
+    // adaptive sampling: decimate while the rate limit is out of tokens, recover once half the burst is back
+    if (connectedToIoTHub) {
+        unsigned int nTokens = AzureIoT_GetRateLimitTokens();
+        if ((nTokens == 0) && (nTelemetryDecimation < nMaxTelemetryDecimation)) {
+            nTelemetryDecimation *= 2;
+            Log_Debug("[Telemetry] rate limited, sampling every %u cycles.\n", nTelemetryDecimation);
+        } else if ((nTokens > nMessageRateBurst / 2) && (nTelemetryDecimation > 1)) {
+            nTelemetryDecimation /= 2;
+        }
+    }
+    if (++nDecimationCycle < nTelemetryDecimation) {
+        return;
+    }
+    nDecimationCycle = 0;
+
 	SendTelemetryMessage();
 }
 
+///  @brief 
+///     Sends a queued telemetry record with its capture time.
+/// 
+static bool SendQueuedTelemetry(const char *cstrComponent, const char *pszPayload, time_t tCapture)
+{
+    return AzureIoT_PnP_SendPriorityMessage(pszPayload, cstrComponent, tCapture, AZURE_IOT_PRIORITY_BULK) == IOTHUB_CLIENT_OK;
+}
+
+///  @brief 
+///     Handle queue drain timer event: forwards telemetry captured while offline at a limited rate.
+/// 
+static void QueueDrainTimerHandler(EventData *eventData)
+{
+	if (ConsumeTimerFdEvent(eventData->fd) != 0) {
+		terminationRequired = true;
+		return;
+	}
+
+    // the backlog is sent as bulk class: it is refused (and stays queued) while live telemetry
+    // and events use the in-flight table
+    if (!connectedToIoTHub) {
+        return;
+    }
+    if (TelemetryQueue_GetCount() > 0) {
+        size_t nSent = TelemetryQueue_Drain(nQueueDrainRecords, &SendQueuedTelemetry);
+        Log_Debug("[QueueDrain] %u records sent, %u remaining.\n", (unsigned int)nSent, (unsigned int)TelemetryQueue_GetCount());
+    }
+}
+
 // forward declaration to allow reset function to gracefuly close all connections
 void ClosePeripheralsAndHandlers(void);
 int InitPeripheralsAndHandlers(void);
@@ -956,6 +1161,32 @@ int InitPeripheralsAndHandlers()
     // Set parson library json float serialisation format
     json_set_float_serialization_format( cstrJsonFloatFormat );
 
+    // Intern the json property names, objects share them instead of copying every key
+    json_add_interned_names( apszInternedPropertyNames, sizeof(apszInternedPropertyNames) / sizeof(*apszInternedPropertyNames) );
+    AzureIoTCentral_InternPropertyNames();
+
+    // Coalesce the telemetry components into batched messages
+    AzureIoT_PnP_SetBatching( nTelemetryBatchWindowSeconds, nTelemetryBatchMaxSize );
+
+    // Coalesce changed reported properties into one twin patch per window
+    AzureIoT_PnP_SetReportWindow( nReportWindowSeconds );
+
+    // Keep the message count per device predictable, tokens running low degrade telemetry to aggregation and decimation
+    AzureIoT_SetRateLimit( nMessageRateLimit, nMessageRateBurst );
+
+    // Recover telemetry queued before the last shutdown, falls back to RAM only without mutable storage
+    fdMutableStorage = Storage_OpenMutableFile();
+    if (fdMutableStorage < 0) {
+        Log_Debug("WARNING: cannot open mutable storage: %s (%d).\n", strerror(errno), errno);
+    }
+    TelemetryQueue_Initialize( fdMutableStorage, STORAGE_QUEUE_OFFSET, STORAGE_QUEUE_SIZE );
+
+    // Reported properties accepted before the restart are not reported again on connect
+    AzureIoT_PnP_InitializeReportedStorage( fdMutableStorage, STORAGE_REPORTED_OFFSET, STORAGE_REPORTED_SIZE );
+
+    // Warm restarts connect straight to the IoT Hub assigned by DPS before
+    AzureIoT_DPS_InitializeAssignmentStorage( fdMutableStorage, STORAGE_DPS_OFFSET, STORAGE_DPS_SIZE );
+
     // Open button A
     Log_Debug("INFO: Opening AVNET_MT3620_SK_USER_BUTTON_A.\n");
     if (!OpenGpioFdAsInput(AVNET_MT3620_SK_USER_BUTTON_A, &fdBlinkRateButtonGpio)) {
@@ -1031,7 +1262,9 @@ int InitPeripheralsAndHandlers()
 
     // Set Azure IoT client related callbacks
     AzureIoT_SetMessageReceivedHandler( &MessageReceived );
-    AzureIoTJson_SetDeviceTwinUpdateHandler( &DeviceTwinUpdate );
+    // any type, so that invalid data is signaled by BlinkRatePropertyUpdate()
+    AzureIoTJson_SubscribeTwinProperty( cstrBlinkRatePropertyPath, JSONError, &BlinkRatePropertyUpdate );
+    AzureIoTJson_SubscribeTwinProperty( cstrMessageRateLimitPropertyPath, JSONNumber, &MessageRateLimitPropertyUpdate );
     AzureIoTJson_RegisterDirectMethodHandlers( &clstDirectMethods[0] );
     AzureIoT_SetConnectionStatusCallback( &IoTHubConnectionStatusChanged );
 
@@ -1061,13 +1294,20 @@ int InitPeripheralsAndHandlers()
     }
 
 
-	// Set up a timer for telemetry intervals
-	fdTelemetryTimer = CreateTimerFdAndAddToEpoll(fdEpoll, &tsNullInterval,
+	// Set up a timer for telemetry intervals, running while offline to fill the store-and-forward queue
+	fdTelemetryTimer = CreateTimerFdAndAddToEpoll(fdEpoll, &tsTelemetryInterval,
 		&evtdataTelemetryTimer, EPOLLIN);
 	if (fdTelemetryTimer < 0) {
 		return -1;
 	}
 
+    // Set up a timer draining the store-and-forward queue
+    fdQueueDrainTimer = CreateTimerFdAndAddToEpoll(fdEpoll, &tsQueueDrainInterval,
+        &evtdataQueueDrainTimer, EPOLLIN);
+    if (fdQueueDrainTimer < 0) {
+        return -1;
+    }
+
     // Set up a dis-armed timer for the reset interval
     fdResetTimer = CreateTimerFdAndAddToEpoll(fdEpoll, &tsNullInterval,
         &evtdataResetTimer, EPOLLIN);
@@ -1087,7 +1327,12 @@ void ClosePeripheralsAndHandlers(void)
 {
     Log_Debug("INFO: Closing GPIOs and Azure IoT client.\n");
 
+    // Keep queued telemetry for the next start
+    TelemetryQueue_Flush();
+    CloseFdAndPrintError(fdMutableStorage, "MutableStorage");
+
     // Close timer file descriptors
+    CloseFdAndPrintError(fdQueueDrainTimer, "QueueDrainTimer");
     CloseFdAndPrintError(fdResetTimer, "ResetTimer");
     CloseFdAndPrintError(fdTelemetryTimer, "TelemetryTimer");
     CloseFdAndPrintError(fdButtonPollTimer, "ButtonPollTimer");
@@ -46,8 +46,14 @@
 #include <ctype.h>
 #include <math.h>
 #include <errno.h>
+#include <stdint.h>
 // [JSchwert] Added applibs/storage to get Image Package file operations
 #include <applibs/storage.h>
+// [JSchwert] NEON is used to scan strings 16 bytes at a time, other targets use a portable fallback
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PARSON_USE_NEON
+#endif
 
 /* Apparently sscanf is not implemented in some "standard" libraries, so don't use it, if you
  * don't have to. */
@@ -73,9 +79,14 @@
 #define PARSON_NUM_BUF_SIZE 64 /* double printed with "%1.17g" shouldn't be longer than 25 bytes so let's be paranoid and use 64 */
 #endif
 
+/* [JSchwert] 0 parses every number with strtod(), to compare with the exact fast path (bench/CMakeLists.txt) */
+#ifndef PARSON_FAST_NUMBERS
+#define PARSON_FAST_NUMBERS 1
+#endif
+
 #define SIZEOF_TOKEN(a)       (sizeof(a) - 1)
 #define SKIP_CHAR(str)        ((*str)++)
-#define SKIP_WHITESPACES(str) while (isspace((unsigned char)(**str))) { SKIP_CHAR(str); }
+#define SKIP_WHITESPACES(str) while (isspace((unsigned char)PEEK_CHAR(str))) { SKIP_CHAR(str); }
 #define MAX(a, b)             ((a) > (b) ? (a) : (b))
 
 #undef malloc
@@ -96,6 +107,32 @@ static int parson_escape_slashes = 1;
 
 static char *parson_float_format = NULL;
 
+/* [JSchwert] precision N if parson_float_format is "%.Nf" (fast formatter), -1 otherwise */
+static int parson_float_fixed_precision = -1;
+
+/* [JSchwert] Begin: interned key names */
+/* registered names are copied into pools that are never freed, keys pointing into a pool are shared */
+typedef struct json_intern_pool {
+    struct json_intern_pool *next;
+    size_t size;
+} JSON_Intern_Pool;
+
+static JSON_Intern_Pool *parson_intern_pools = NULL;
+static const char **parson_intern_table = NULL; /* open addressing, power of 2 size */
+static size_t parson_intern_capacity = 0;
+static size_t parson_intern_count = 0;
+/* [JSchwert] End */
+
+/* [JSchwert] Begin: length bounded parsing (json_parse_buffer) */
+/* end of the buffer parsed by json_parse_buffer(), NULL while parsing '\0' terminated strings */
+static const char *parson_parse_end = NULL;
+
+/* current parser character, the end of a bounded buffer reads as '\0' */
+#define PEEK_CHAR(str)        ((parson_parse_end != NULL && *(str) >= parson_parse_end) ? '\0' : **(str))
+/* number of characters left in a bounded buffer */
+#define REMAINING(ptr)        ((parson_parse_end != NULL) ? (size_t)(parson_parse_end - (ptr)) : (size_t)-1)
+/* [JSchwert] End */
+
 #define IS_CONT(b) (((unsigned char)(b) & 0xC0) == 0x80) /* is utf-8 continuation byte */
 
 typedef int parson_bool_t;
@@ -148,11 +185,18 @@ static char * read_file(const char *filename);
 static void   remove_comments(char *string, const char *start_token, const char *end_token);
 static char * parson_strndup(const char *string, size_t n);
 static char * parson_strdup(const char *string);
+static const char * intern_lookup(const char *string, size_t n, unsigned long hash);
+static parson_bool_t is_interned(const char *string);
+static char * key_dup(const char *name, size_t name_len, unsigned long hash);
+static void   key_free(char *name);
+static void   intern_insert(const char *name);
 static int    hex_char_to_int(char c);
 static JSON_Status parse_utf16_hex(const char *string, unsigned int *result);
 static int         num_bytes_in_utf8_sequence(unsigned char c);
 static JSON_Status   verify_utf8_sequence(const unsigned char *string, int *len);
 static parson_bool_t is_valid_utf8(const char *string, size_t string_len);
+static size_t        scan_ascii(const char *string, size_t len);
+static size_t        scan_plain_chars(const char *string, size_t len, char stop_char);
 static parson_bool_t is_decimal(const char *string, size_t length);
 static unsigned long hash_string(const char *string, size_t n);
 
@@ -183,17 +227,27 @@ static JSON_Status   skip_quotes(const char **string);
 static JSON_Status   parse_utf16(const char **unprocessed, char **processed);
 static char *        process_string(const char *input, size_t input_len, size_t *output_len);
 static char *        get_quoted_string(const char **string, size_t *output_string_len);
+static char *        get_quoted_key(const char **string, size_t *output_string_len);
 static JSON_Value *  parse_object_value(const char **string, size_t nesting);
 static JSON_Value *  parse_array_value(const char **string, size_t nesting);
 static JSON_Value *  parse_string_value(const char **string);
 static JSON_Value *  parse_boolean_value(const char **string);
+static size_t        parse_number_fast(const char *string, size_t max_len, double *out_number);
+static JSON_Status   parse_number(const char **string, double *out_number);
 static JSON_Value *  parse_number_value(const char **string);
 static JSON_Value *  parse_null_value(const char **string);
 static JSON_Value *  parse_value(const char **string, size_t nesting);
+static JSON_Status   skip_token(const char **string, const char *token);
+static JSON_Status   skip_string(const char **string);
+static JSON_Status   skip_value(const char **string, size_t nesting);
+static JSON_Status   select_object(const char **string, size_t depth, JSON_Select_Key_Function key_function,
+                                   JSON_Select_Value_Function value_function, void *context);
 
 /* Serialization */
 static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, parson_bool_t is_pretty, char *num_buf);
 static int json_serialize_string(const char *string, size_t len, char *buf);
+static int serialize_fixed_number(double num, int precision, char *buf);
+static int serialize_number(double num, char *buf);
 static int append_indent(char *buf, int level);
 static int append_string(char *buf, const char *string);
 
@@ -290,6 +344,56 @@ static char * parson_strdup(const char *string) {
     return parson_strndup(string, strlen(string));
 }
 
+/* [JSchwert] Begin: interned key names */
+static const char * intern_lookup(const char *string, size_t n, unsigned long hash) {
+    size_t i = 0;
+    const char *name = NULL;
+    if (parson_intern_count == 0) {
+        return NULL;
+    }
+    for (i = hash & (parson_intern_capacity - 1); parson_intern_table[i] != NULL; i = (i + 1) & (parson_intern_capacity - 1)) {
+        name = parson_intern_table[i];
+        if (strncmp(name, string, n) == 0 && strlen(name) == n) {
+            return name;
+        }
+    }
+    return NULL;
+}
+
+static parson_bool_t is_interned(const char *string) {
+    const JSON_Intern_Pool *pool = NULL;
+    for (pool = parson_intern_pools; pool != NULL; pool = pool->next) {
+        if (string >= (const char*)(pool + 1) && string < (const char*)(pool + 1) + pool->size) {
+            return PARSON_TRUE;
+        }
+    }
+    return PARSON_FALSE;
+}
+
+/* copies an object key, unless it is interned */
+static char * key_dup(const char *name, size_t name_len, unsigned long hash) {
+    const char *interned = intern_lookup(name, name_len, hash);
+    if (interned != NULL) {
+        return (char*)interned;
+    }
+    return parson_strndup(name, name_len);
+}
+
+static void key_free(char *name) {
+    if (name != NULL && !is_interned(name)) {
+        parson_free(name);
+    }
+}
+
+static void intern_insert(const char *name) {
+    size_t i = hash_string(name, strlen(name)) & (parson_intern_capacity - 1);
+    while (parson_intern_table[i] != NULL) {
+        i = (i + 1) & (parson_intern_capacity - 1);
+    }
+    parson_intern_table[i] = name;
+}
+/* [JSchwert] End */
+
 static int hex_char_to_int(char c) {
     if (c >= '0' && c <= '9') {
         return c - '0';
@@ -303,6 +407,9 @@ static int hex_char_to_int(char c) {
 
 static JSON_Status parse_utf16_hex(const char *s, unsigned int *result) {
     int x1, x2, x3, x4;
+    if (REMAINING(s) < 4) {
+        return JSONFailure;
+    }
     if (s[0] == '\0' || s[1] == '\0' || s[2] == '\0' || s[3] == '\0') {
         return JSONFailure;
     }
@@ -374,10 +481,102 @@ static JSON_Status verify_utf8_sequence(const unsigned char *string, int *len) {
     return JSONSuccess;
 }
 
+/* [JSchwert] Begin: block scanning of strings, 16 bytes per step */
+#define SCAN_BLOCK_SIZE 16
+#define SCAN_MIN_LENGTH 32 /* shorter strings are cheaper to handle byte by byte */
+
+#ifndef PARSON_USE_NEON
+#define SWAR_ONES  0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+/* nonzero if any byte of x is zero / less than n (n <= 128) */
+#define SWAR_HAS_ZERO(x)    (((x) - SWAR_ONES) & ~(x) & SWAR_HIGHS)
+#define SWAR_HAS_LESS(x, n) (((x) - SWAR_ONES * (n)) & ~(x) & SWAR_HIGHS)
+
+static uint64_t load_u64(const char *string) {
+    uint64_t x = 0;
+    memcpy(&x, string, sizeof(x));
+    return x;
+}
+
+/* nonzero if one of the 8 bytes is a control character, '\"', '\\' or stop_char */
+static uint64_t swar_has_special(uint64_t x, uint64_t stop_pattern) {
+    return SWAR_HAS_LESS(x, 0x20) |
+           SWAR_HAS_ZERO(x ^ (SWAR_ONES * '\"')) |
+           SWAR_HAS_ZERO(x ^ (SWAR_ONES * '\\')) |
+           SWAR_HAS_ZERO(x ^ stop_pattern);
+}
+#endif
+
+/* Returns the number of leading bytes below 0x80 */
+static size_t scan_ascii(const char *string, size_t len) {
+    size_t i = 0;
+#ifdef PARSON_USE_NEON
+    for (; i + SCAN_BLOCK_SIZE <= len; i += SCAN_BLOCK_SIZE) {
+        uint8x16_t block = vld1q_u8((const uint8_t*)string + i);
+        uint8x8_t folded = vorr_u8(vget_low_u8(block), vget_high_u8(block));
+        if ((vget_lane_u64(vreinterpret_u64_u8(folded), 0) & 0x8080808080808080ULL) != 0) {
+            break;
+        }
+    }
+#else
+    for (; i + SCAN_BLOCK_SIZE <= len; i += SCAN_BLOCK_SIZE) {
+        if (((load_u64(string + i) | load_u64(string + i + 8)) & SWAR_HIGHS) != 0) {
+            break;
+        }
+    }
+#endif
+    while (i < len && (unsigned char)string[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+/* Returns the number of leading bytes that are neither control characters, '\"', '\\' nor
+   stop_char, i.e. bytes that can be copied as they are when parsing or serializing strings */
+static size_t scan_plain_chars(const char *string, size_t len, char stop_char) {
+    size_t i = 0;
+    unsigned char c = 0;
+#ifdef PARSON_USE_NEON
+    const uint8x16_t control = vdupq_n_u8(0x20);
+    const uint8x16_t quote = vdupq_n_u8('\"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t stop = vdupq_n_u8((uint8_t)stop_char);
+    for (; i + SCAN_BLOCK_SIZE <= len; i += SCAN_BLOCK_SIZE) {
+        uint8x16_t block = vld1q_u8((const uint8_t*)string + i);
+        uint8x16_t special = vorrq_u8(vorrq_u8(vcltq_u8(block, control), vceqq_u8(block, quote)),
+                                      vorrq_u8(vceqq_u8(block, backslash), vceqq_u8(block, stop)));
+        uint8x8_t folded = vorr_u8(vget_low_u8(special), vget_high_u8(special));
+        if (vget_lane_u64(vreinterpret_u64_u8(folded), 0) != 0) {
+            break;
+        }
+    }
+#else
+    const uint64_t stop_pattern = SWAR_ONES * (unsigned char)stop_char;
+    for (; i + SCAN_BLOCK_SIZE <= len; i += SCAN_BLOCK_SIZE) {
+        if (swar_has_special(load_u64(string + i), stop_pattern) ||
+            swar_has_special(load_u64(string + i + 8), stop_pattern)) {
+            break;
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        c = (unsigned char)string[i];
+        if (c < 0x20 || c == '\"' || c == '\\' || c == (unsigned char)stop_char) {
+            break;
+        }
+    }
+    return i;
+}
+/* [JSchwert] End */
+
 static int is_valid_utf8(const char *string, size_t string_len) {
     int len = 0;
     const char *string_end =  string + string_len;
     while (string < string_end) {
+        string += scan_ascii(string, (size_t)(string_end - string)); /* [JSchwert] skip ASCII runs */
+        if (string >= string_end) {
+            break;
+        }
         if (verify_utf8_sequence((const unsigned char*)string, &len) != JSONSuccess) {
             return PARSON_FALSE;
         }
@@ -483,7 +682,7 @@ static void json_object_deinit(JSON_Object *object, parson_bool_t free_keys, par
     unsigned int i = 0;
     for (i = 0; i < object->count; i++) {
         if (free_keys) {
-            parson_free(object->names[i]);
+            key_free(object->names[i]);
         }
         if (free_values) {
             json_value_free(object->values[i]);
@@ -652,7 +851,7 @@ static JSON_Status json_object_remove_internal(JSON_Object *object, const char *
         val = NULL;
     }
 
-    parson_free(object->names[item_ix]);
+    key_free(object->names[item_ix]);
     last_item_ix = object->count - 1;
     if (item_ix < last_item_ix) {
         object->names[item_ix] = object->names[last_item_ix];
@@ -770,16 +969,20 @@ static JSON_Value * json_value_init_string_no_copy(char *string, size_t length)
 
 /* Parser */
 static JSON_Status skip_quotes(const char **string) {
-    if (**string != '\"') {
+    if (PEEK_CHAR(string) != '\"') {
         return JSONFailure;
     }
     SKIP_CHAR(string);
-    while (**string != '\"') {
-        if (**string == '\0') {
+    if (parson_parse_end != NULL) {
+        /* [JSchwert] skip up to the first escape in blocks, this may only look ahead within a bounded buffer */
+        *string += scan_plain_chars(*string, REMAINING(*string), '\"');
+    }
+    while (PEEK_CHAR(string) != '\"') {
+        if (PEEK_CHAR(string) == '\0') {
             return JSONFailure;
-        } else if (**string == '\\') {
+        } else if (PEEK_CHAR(string) == '\\') {
             SKIP_CHAR(string);
-            if (**string == '\0') {
+            if (PEEK_CHAR(string) == '\0') {
                 return JSONFailure;
             }
         }
@@ -841,13 +1044,20 @@ Example: "\u006Corem ipsum" -> lorem ipsum */
 static char* process_string(const char *input, size_t input_len, size_t *output_len) {
     const char *input_ptr = input;
     size_t initial_size = (input_len + 1) * sizeof(char);
-    size_t final_size = 0;
+    size_t final_size = 0, run = 0;
     char *output = NULL, *output_ptr = NULL, *resized_output = NULL;
     output = (char*)parson_malloc(initial_size);
     if (output == NULL) {
         goto error;
     }
     output_ptr = output;
+    if (input_len >= SCAN_MIN_LENGTH) {
+        /* [JSchwert] copy everything up to the first escape in one go */
+        run = scan_plain_chars(input, input_len, '\\');
+        memcpy(output_ptr, input_ptr, run);
+        output_ptr += run;
+        input_ptr += run;
+    }
     while ((*input_ptr != '\0') && (size_t)(input_ptr - input) < input_len) {
         if (*input_ptr == '\\') {
             input_ptr++;
@@ -906,12 +1116,34 @@ static char * get_quoted_string(const char **string, size_t *output_string_len)
     return process_string(string_start + 1, input_string_len, output_string_len);
 }
 
+/* [JSchwert] Like get_quoted_string, but returns the interned name for keys without escapes */
+static char * get_quoted_key(const char **string, size_t *output_string_len) {
+    const char *string_start = *string;
+    const char *interned = NULL;
+    size_t input_string_len = 0;
+    if (parson_intern_count == 0) {
+        return get_quoted_string(string, output_string_len);
+    }
+    if (skip_quotes(string) != JSONSuccess) {
+        return NULL;
+    }
+    input_string_len = *string - string_start - 2; /* length without quotes */
+    if (memchr(string_start + 1, '\\', input_string_len) == NULL) {
+        interned = intern_lookup(string_start + 1, input_string_len, hash_string(string_start + 1, input_string_len));
+        if (interned != NULL) {
+            *output_string_len = input_string_len;
+            return (char*)interned;
+        }
+    }
+    return process_string(string_start + 1, input_string_len, output_string_len);
+}
+
 static JSON_Value * parse_value(const char **string, size_t nesting) {
     if (nesting > MAX_NESTING) {
         return NULL;
     }
     SKIP_WHITESPACES(string);
-    switch (**string) {
+    switch (PEEK_CHAR(string)) {
         case '{':
             return parse_object_value(string, nesting + 1);
         case '[':
@@ -931,6 +1163,176 @@ static JSON_Value * parse_value(const char **string, size_t nesting) {
     }
 }
 
+/* [JSchwert] Begin: selective parsing */
+static JSON_Status skip_token(const char **string, const char *token) {
+    size_t token_len = strlen(token);
+    if (REMAINING(*string) < token_len || strncmp(*string, token, token_len) != 0) {
+        return JSONFailure;
+    }
+    *string += token_len;
+    return JSONSuccess;
+}
+
+/* Skips a quoted string and checks its escapes and characters like process_string, without allocating */
+static JSON_Status skip_string(const char **string) {
+    const char *input = *string + 1;
+    const char *input_ptr = input;
+    char utf8_buf[4];
+    char *utf8_ptr = NULL;
+    size_t input_len = 0;
+    if (skip_quotes(string) != JSONSuccess) {
+        return JSONFailure;
+    }
+    input_len = *string - input - 1; /* length without quotes */
+    while ((*input_ptr != '\0') && (size_t)(input_ptr - input) < input_len) {
+        if (*input_ptr == '\\') {
+            input_ptr++;
+            if (*input_ptr == 'u') {
+                utf8_ptr = utf8_buf;
+                if (parse_utf16(&input_ptr, &utf8_ptr) != JSONSuccess) {
+                    return JSONFailure;
+                }
+            } else if (*input_ptr == '\0' || strchr("\"\\/bfnrt", *input_ptr) == NULL) {
+                return JSONFailure;
+            }
+        } else if ((unsigned char)*input_ptr < 0x20) {
+            return JSONFailure;
+        }
+        input_ptr++;
+    }
+    return JSONSuccess;
+}
+
+/* Validates and skips a value without allocating */
+static JSON_Status skip_value(const char **string, size_t nesting) {
+    char closing = '\0';
+    double number = 0;
+    if (nesting > MAX_NESTING) {
+        return JSONFailure;
+    }
+    SKIP_WHITESPACES(string);
+    switch (PEEK_CHAR(string)) {
+        case '{': case '[':
+            closing = (PEEK_CHAR(string) == '{') ? '}' : ']';
+            SKIP_CHAR(string);
+            SKIP_WHITESPACES(string);
+            if (PEEK_CHAR(string) == closing) {
+                SKIP_CHAR(string);
+                return JSONSuccess;
+            }
+            while (PEEK_CHAR(string) != '\0') {
+                if (closing == '}') {
+                    if (skip_string(string) != JSONSuccess) {
+                        return JSONFailure;
+                    }
+                    SKIP_WHITESPACES(string);
+                    if (PEEK_CHAR(string) != ':') {
+                        return JSONFailure;
+                    }
+                    SKIP_CHAR(string);
+                }
+                if (skip_value(string, nesting + 1) != JSONSuccess) {
+                    return JSONFailure;
+                }
+                SKIP_WHITESPACES(string);
+                if (PEEK_CHAR(string) != ',') {
+                    break;
+                }
+                SKIP_CHAR(string);
+                SKIP_WHITESPACES(string);
+            }
+            if (PEEK_CHAR(string) != closing) {
+                return JSONFailure;
+            }
+            SKIP_CHAR(string);
+            return JSONSuccess;
+        case '\"':
+            return skip_string(string);
+        case 't':
+            return skip_token(string, "true");
+        case 'f':
+            return skip_token(string, "false");
+        case 'n':
+            return skip_token(string, "null");
+        case '-':
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            return parse_number(string, &number);
+        default:
+            return JSONFailure;
+    }
+}
+
+/* Reports the members of an object to key_function and skips, descends into or parses their values */
+static JSON_Status select_object(const char **string, size_t depth, JSON_Select_Key_Function key_function,
+                                 JSON_Select_Value_Function value_function, void *context) {
+    JSON_Status status = JSONFailure;
+    JSON_Select_Action action = JSONSelectSkip;
+    JSON_Value *value = NULL;
+    const char *key = NULL;
+    char *unescaped_key = NULL;
+    size_t key_len = 0;
+    if (depth > MAX_NESTING || PEEK_CHAR(string) != '{') {
+        return JSONFailure;
+    }
+    SKIP_CHAR(string);
+    SKIP_WHITESPACES(string);
+    if (PEEK_CHAR(string) == '}') { /* empty object */
+        SKIP_CHAR(string);
+        return JSONSuccess;
+    }
+    while (PEEK_CHAR(string) != '\0') {
+        key = *string + 1;
+        if (skip_quotes(string) != JSONSuccess) {
+            return JSONFailure;
+        }
+        key_len = (size_t)(*string - key) - 1;
+        if (memchr(key, '\\', key_len) != NULL) { /* only escaped keys need a copy */
+            unescaped_key = process_string(key, key_len, &key_len);
+            if (unescaped_key == NULL) {
+                return JSONFailure;
+            }
+            key = unescaped_key;
+        }
+        SKIP_WHITESPACES(string);
+        if (PEEK_CHAR(string) != ':') {
+            parson_free(unescaped_key);
+            return JSONFailure;
+        }
+        SKIP_CHAR(string);
+        SKIP_WHITESPACES(string);
+        action = key_function(context, depth, key, key_len);
+        if (action == JSONSelectDescend && PEEK_CHAR(string) == '{') {
+            status = select_object(string, depth + 1, key_function, value_function, context);
+        } else if (action == JSONSelectValue) {
+            value = parse_value(string, depth + 1);
+            status = (value != NULL) ? JSONSuccess : JSONFailure;
+            if (value != NULL) {
+                value_function(context, depth, key, key_len, value);
+            }
+        } else {
+            status = skip_value(string, depth + 1);
+        }
+        parson_free(unescaped_key);
+        unescaped_key = NULL;
+        if (status != JSONSuccess) {
+            return JSONFailure;
+        }
+        SKIP_WHITESPACES(string);
+        if (PEEK_CHAR(string) != ',') {
+            break;
+        }
+        SKIP_CHAR(string);
+        SKIP_WHITESPACES(string);
+    }
+    if (PEEK_CHAR(string) != '}') {
+        return JSONFailure;
+    }
+    SKIP_CHAR(string);
+    return JSONSuccess;
+}
+/* [JSchwert] End */
+
 static JSON_Value * parse_object_value(const char **string, size_t nesting) {
     JSON_Status status = JSONFailure;
     JSON_Value *output_value = NULL, *new_value = NULL;
@@ -941,59 +1343,59 @@ static JSON_Value * parse_object_value(const char **string, size_t nesting) {
     if (output_value == NULL) {
         return NULL;
     }
-    if (**string != '{') {
+    if (PEEK_CHAR(string) != '{') {
         json_value_free(output_value);
         return NULL;
     }
     output_object = json_value_get_object(output_value);
     SKIP_CHAR(string);
     SKIP_WHITESPACES(string);
-    if (**string == '}') { /* empty object */
+    if (PEEK_CHAR(string) == '}') { /* empty object */
         SKIP_CHAR(string);
         return output_value;
     }
-    while (**string != '\0') {
+    while (PEEK_CHAR(string) != '\0') {
         size_t key_len = 0;
-        new_key = get_quoted_string(string, &key_len);
+        new_key = get_quoted_key(string, &key_len);
         /* We do not support key names with embedded \0 chars */
         if (!new_key) {
             json_value_free(output_value);
             return NULL;
         }
         if (key_len != strlen(new_key)) {
-            parson_free(new_key);
+            key_free(new_key);
             json_value_free(output_value);
             return NULL;
         }
         SKIP_WHITESPACES(string);
-        if (**string != ':') {
-            parson_free(new_key);
+        if (PEEK_CHAR(string) != ':') {
+            key_free(new_key);
             json_value_free(output_value);
             return NULL;
         }
         SKIP_CHAR(string);
         new_value = parse_value(string, nesting);
         if (new_value == NULL) {
-            parson_free(new_key);
+            key_free(new_key);
             json_value_free(output_value);
             return NULL;
         }
         status = json_object_add(output_object, new_key, new_value);
         if (status != JSONSuccess) {
-            parson_free(new_key);
+            key_free(new_key);
             json_value_free(new_value);
             json_value_free(output_value);
             return NULL;
         }
         SKIP_WHITESPACES(string);
-        if (**string != ',') {
+        if (PEEK_CHAR(string) != ',') {
             break;
         }
         SKIP_CHAR(string);
         SKIP_WHITESPACES(string);
     }
     SKIP_WHITESPACES(string);
-    if (**string != '}') {
+    if (PEEK_CHAR(string) != '}') {
         json_value_free(output_value);
         return NULL;
     }
@@ -1008,18 +1410,18 @@ static JSON_Value * parse_array_value(const char **string, size_t nesting) {
     if (output_value == NULL) {
         return NULL;
     }
-    if (**string != '[') {
+    if (PEEK_CHAR(string) != '[') {
         json_value_free(output_value);
         return NULL;
     }
     output_array = json_value_get_array(output_value);
     SKIP_CHAR(string);
     SKIP_WHITESPACES(string);
-    if (**string == ']') { /* empty array */
+    if (PEEK_CHAR(string) == ']') { /* empty array */
         SKIP_CHAR(string);
         return output_value;
     }
-    while (**string != '\0') {
+    while (PEEK_CHAR(string) != '\0') {
         new_array_value = parse_value(string, nesting);
         if (new_array_value == NULL) {
             json_value_free(output_value);
@@ -1031,14 +1433,14 @@ static JSON_Value * parse_array_value(const char **string, size_t nesting) {
             return NULL;
         }
         SKIP_WHITESPACES(string);
-        if (**string != ',') {
+        if (PEEK_CHAR(string) != ',') {
             break;
         }
         SKIP_CHAR(string);
         SKIP_WHITESPACES(string);
     }
     SKIP_WHITESPACES(string);
-    if (**string != ']' || /* Trim array after parsing is over */
+    if (PEEK_CHAR(string) != ']' || /* Trim array after parsing is over */
         json_array_resize(output_array, json_array_get_count(output_array)) != JSONSuccess) {
             json_value_free(output_value);
             return NULL;
@@ -1065,34 +1467,170 @@ static JSON_Value * parse_string_value(const char **string) {
 static JSON_Value * parse_boolean_value(const char **string) {
     size_t true_token_size = SIZEOF_TOKEN("true");
     size_t false_token_size = SIZEOF_TOKEN("false");
-    if (strncmp("true", *string, true_token_size) == 0) {
+    if (REMAINING(*string) >= true_token_size && strncmp("true", *string, true_token_size) == 0) {
         *string += true_token_size;
         return json_value_init_boolean(1);
-    } else if (strncmp("false", *string, false_token_size) == 0) {
+    } else if (REMAINING(*string) >= false_token_size && strncmp("false", *string, false_token_size) == 0) {
         *string += false_token_size;
         return json_value_init_boolean(0);
     }
     return NULL;
 }
 
-static JSON_Value * parse_number_value(const char **string) {
+/* [JSchwert] Begin: exact fast path for plain integers and short decimals */
+static const double pow10_exact[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Parses a strict JSON number into mantissa * 10^exponent. If the mantissa fits into 53 bits and
+   10^|exponent| is exactly representable, a single multiplication or division gives the correctly
+   rounded result (Clinger's fast path), identical to strtod(). Returns the number of characters
+   consumed, or 0 if strtod() has to handle the number. */
+static size_t parse_number_fast(const char *string, size_t max_len, double *out_number) {
+    size_t i = 0, fraction_start = 0;
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0, exp_value = 0, exp_negative = 0, negative = 0;
+    double number = 0;
+    if (i < max_len && string[i] == '-') {
+        negative = 1;
+        i++;
+    }
+    if (i >= max_len || string[i] < '0' || string[i] > '9') {
+        return 0;
+    }
+    if (string[i] == '0') {
+        i++;
+        /* is_decimal() rejects a leading "0" that is not followed by '.', e.g. "0e5" */
+        if (i < max_len && (string[i] == 'e' || string[i] == 'E')) {
+            return 0;
+        }
+    } else {
+        while (i < max_len && string[i] >= '0' && string[i] <= '9') {
+            if (digits >= 19) {
+                return 0;
+            }
+            mantissa = mantissa * 10 + (uint64_t)(string[i] - '0');
+            digits++;
+            i++;
+        }
+    }
+    if (i < max_len && string[i] == '.') {
+        i++;
+        fraction_start = i;
+        while (i < max_len && string[i] >= '0' && string[i] <= '9') {
+            if (mantissa != 0 || string[i] != '0') {
+                if (digits >= 19) {
+                    return 0;
+                }
+                mantissa = mantissa * 10 + (uint64_t)(string[i] - '0');
+                digits++;
+            }
+            exponent--;
+            i++;
+        }
+        if (i == fraction_start) {
+            return 0;
+        }
+    }
+    if (i < max_len && (string[i] == 'e' || string[i] == 'E')) {
+        i++;
+        if (i < max_len && (string[i] == '+' || string[i] == '-')) {
+            exp_negative = string[i] == '-';
+            i++;
+        }
+        if (i >= max_len || string[i] < '0' || string[i] > '9') {
+            return 0;
+        }
+        while (i < max_len && string[i] >= '0' && string[i] <= '9') {
+            if (exp_value > 1000) {
+                return 0;
+            }
+            exp_value = exp_value * 10 + (string[i] - '0');
+            i++;
+        }
+        exponent += exp_negative ? -exp_value : exp_value;
+    }
+    /* anything strtod() would read further (hex, leading zeros, "1.") goes the slow way */
+    if (i < max_len && (isalnum((unsigned char)string[i]) || string[i] == '.' ||
+                        string[i] == '+' || string[i] == '-')) {
+        return 0;
+    }
+    if (mantissa > (1ULL << 53)) {
+        return 0;
+    }
+    if (mantissa != 0) {
+        if (exponent < -22 || exponent > 22) {
+            return 0;
+        }
+        number = (double)mantissa;
+        number = (exponent < 0) ? number / pow10_exact[-exponent] : number * pow10_exact[exponent];
+    }
+    *out_number = negative ? -number : number;
+    return i;
+}
+/* [JSchwert] End */
+
+/* [JSchwert] Parses a number without allocating a value, shared by parse_number_value and skip_value */
+static JSON_Status parse_number(const char **string, double *out_number) {
     char *end;
     double number = 0;
+    const char *number_string = *string;
+    char num_buf[PARSON_NUM_BUF_SIZE];
+    char *copy = NULL;
+    parson_bool_t decimal = PARSON_FALSE;
+    int number_errno = 0;
+    size_t fast_len = PARSON_FAST_NUMBERS ? parse_number_fast(*string, REMAINING(*string), &number) : 0;
+    if (fast_len > 0) {
+        *string += fast_len;
+        *out_number = number;
+        return JSONSuccess;
+    }
+    if (parson_parse_end != NULL) {
+        /* [JSchwert] strtod() needs a terminated string. Copy every character it could read (digits,
+           sign, '.', exponent, hex, inf/nan), so strtod() and is_decimal() see what they see in a string */
+        size_t len = 0;
+        while (len < REMAINING(*string) && (*string)[len] != '\0' &&
+               (isalnum((unsigned char)(*string)[len]) || strchr("+-._()", (*string)[len]) != NULL)) {
+            len++;
+        }
+        copy = (len < sizeof(num_buf)) ? num_buf : (char *)parson_malloc(len + 1);
+        if (copy == NULL) {
+            return JSONFailure;
+        }
+        memcpy(copy, *string, len);
+        copy[len] = '\0';
+        number_string = copy;
+    }
     errno = 0;
-    number = strtod(*string, &end);
-    if (errno == ERANGE && (number <= -HUGE_VAL || number >= HUGE_VAL)) {
-        return NULL;
+    number = strtod(number_string, &end);
+    number_errno = errno;
+    decimal = is_decimal(number_string, end - number_string);
+    if (copy != NULL && copy != num_buf) {
+        parson_free(copy);
     }
-    if ((errno && errno != ERANGE) || !is_decimal(*string, end - *string)) {
+    if (number_errno == ERANGE && (number <= -HUGE_VAL || number >= HUGE_VAL)) {
+        return JSONFailure;
+    }
+    if ((number_errno && number_errno != ERANGE) || !decimal) {
+        return JSONFailure;
+    }
+    *string += end - number_string;
+    *out_number = number;
+    return JSONSuccess;
+}
+
+static JSON_Value * parse_number_value(const char **string) {
+    double number = 0;
+    if (parse_number(string, &number) != JSONSuccess) {
         return NULL;
     }
-    *string = end;
     return json_value_init_number(number);
 }
 
 static JSON_Value * parse_null_value(const char **string) {
     size_t token_size = SIZEOF_TOKEN("null");
-    if (strncmp("null", *string, token_size) == 0) {
+    if (REMAINING(*string) >= token_size && strncmp("null", *string, token_size) == 0) {
         *string += token_size;
         return json_value_init_null();
     }
@@ -1230,11 +1768,7 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             if (buf != NULL) {
                 num_buf = buf;
             }
-            if (parson_float_format) {
-                written = sprintf(num_buf, parson_float_format, num);
-            } else {
-                written = sprintf(num_buf, PARSON_DEFAULT_FLOAT_FORMAT, num);
-            }
+            written = serialize_number(num, num_buf);
             if (written < 0) {
                 return -1;
             }
@@ -1254,11 +1788,24 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
 }
 
 static int json_serialize_string(const char *string, size_t len, char *buf) {
-    size_t i = 0;
+    size_t i = 0, run = 0;
     char c = '\0';
     int written = -1, written_total = 0;
     APPEND_STRING("\"");
     for (i = 0; i < len; i++) {
+        /* [JSchwert] copy runs that need no escaping in one go */
+        run = scan_plain_chars(string + i, len - i, '/');
+        if (run > 0) {
+            if (buf != NULL) {
+                memcpy(buf, string + i, run);
+                buf += run;
+            }
+            written_total += (int)run;
+            i += run;
+            if (i >= len) {
+                break;
+            }
+        }
         c = string[i];
         switch (c) {
             case '\"': APPEND_STRING("\\\""); break;
@@ -1320,6 +1867,94 @@ static int json_serialize_string(const char *string, size_t len, char *buf) {
     return written_total;
 }
 
+/* [JSchwert] Begin: fast fixed precision number formatting */
+static const uint64_t pow10_table[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL
+};
+
+/* Formats num like sprintf("%.<precision>f") for precision 0..9, returns -1 if the value is out of
+   range for the fast path. The double is split into mantissa * 2^-shift and mantissa * 10^precision
+   is rounded half to even on the exact binary value, like printf does. */
+static int serialize_fixed_number(double num, int precision, char *buf) {
+    uint64_t bits = 0, mantissa = 0, scaled = 0, rem = 0, half = 0, frac = 0, pow10 = 0;
+    int exponent = 0, shift = 0, written = 0, i = 0;
+    char digits[24];
+    int num_digits = 0;
+    memcpy(&bits, &num, sizeof(bits));
+    exponent = (int)((bits >> 52) & 0x7FF);
+    mantissa = bits & ((1ULL << 52) - 1);
+    if (exponent == 0x7FF) {
+        return -1; /* inf or nan */
+    }
+    if (exponent == 0) {
+        exponent = 1; /* subnormal */
+    } else {
+        mantissa |= (1ULL << 52);
+    }
+    shift = 1075 - exponent; /* |num| = mantissa * 2^-shift */
+    if (shift <= 0) {
+        return -1; /* |num| >= 2^52 */
+    }
+    while (mantissa != 0 && (mantissa & 1) == 0 && shift > 0) {
+        mantissa >>= 1;
+        shift--;
+    }
+    pow10 = pow10_table[precision];
+    if (mantissa > UINT64_MAX / pow10) {
+        return -1;
+    }
+    scaled = mantissa * pow10;
+    if (shift >= 65) {
+        scaled = 0; /* < 2^64 / 2^65, rounds to zero */
+    } else if (shift == 64) {
+        scaled = (scaled > (1ULL << 63)) ? 1 : 0; /* exact half rounds to even 0 */
+    } else if (shift > 0) {
+        rem = scaled & ((1ULL << shift) - 1);
+        half = 1ULL << (shift - 1);
+        scaled >>= shift;
+        if (rem > half || (rem == half && (scaled & 1))) {
+            scaled++;
+        }
+    }
+    if (bits >> 63) {
+        buf[written++] = '-';
+    }
+    frac = scaled % pow10;
+    scaled /= pow10;
+    do {
+        digits[num_digits++] = (char)('0' + (scaled % 10));
+        scaled /= 10;
+    } while (scaled != 0);
+    while (num_digits > 0) {
+        buf[written++] = digits[--num_digits];
+    }
+    if (precision > 0) {
+        buf[written++] = '.';
+        for (i = precision - 1; i >= 0; i--) {
+            buf[written + i] = (char)('0' + (frac % 10));
+            frac /= 10;
+        }
+        written += precision;
+    }
+    buf[written] = '\0';
+    return written;
+}
+
+static int serialize_number(double num, char *buf) {
+    int written = -1;
+    if (parson_float_fixed_precision >= 0) {
+        written = serialize_fixed_number(num, parson_float_fixed_precision, buf);
+        if (written >= 0) {
+            return written;
+        }
+    }
+    if (parson_float_format) {
+        return sprintf(buf, parson_float_format, num);
+    }
+    return sprintf(buf, PARSON_DEFAULT_FLOAT_FORMAT, num);
+}
+/* [JSchwert] End */
+
 static int append_indent(char *buf, int level) {
     int i;
     int written = -1, written_total = 0;
@@ -1363,15 +1998,60 @@ JSON_Value * json_parse_file_with_comments(const char *filename) {
 }
 
 JSON_Value * json_parse_string(const char *string) {
+    JSON_Value *result = NULL;
+    const char *previous_end = NULL;
     if (string == NULL) {
         return NULL;
     }
     if (string[0] == '\xEF' && string[1] == '\xBB' && string[2] == '\xBF') {
         string = string + 3; /* Support for UTF-8 BOM */
     }
-    return parse_value((const char**)&string, 0);
+    /* [JSchwert] null terminated, even if called from a json_parse_buffer_select() callback */
+    previous_end = parson_parse_end;
+    parson_parse_end = NULL;
+    result = parse_value((const char**)&string, 0);
+    parson_parse_end = previous_end;
+    return result;
+}
+
+/* [JSchwert] Begin: length bounded parsing */
+JSON_Value * json_parse_buffer(const char *buffer, size_t buffer_len) {
+    JSON_Value *result = NULL;
+    const char *previous_end = NULL;
+    if (buffer == NULL) {
+        return NULL;
+    }
+    if (buffer_len >= 3 && buffer[0] == '\xEF' && buffer[1] == '\xBB' && buffer[2] == '\xBF') {
+        buffer = buffer + 3; /* Support for UTF-8 BOM */
+        buffer_len -= 3;
+    }
+    previous_end = parson_parse_end; /* callbacks of json_parse_buffer_select() may parse as well */
+    parson_parse_end = buffer + buffer_len;
+    result = parse_value(&buffer, 0);
+    parson_parse_end = previous_end;
+    return result;
 }
 
+JSON_Status json_parse_buffer_select(const char *buffer, size_t buffer_len, JSON_Select_Key_Function key_function,
+                                     JSON_Select_Value_Function value_function, void *context) {
+    JSON_Status status = JSONFailure;
+    const char *previous_end = NULL;
+    if (buffer == NULL || key_function == NULL || value_function == NULL) {
+        return JSONFailure;
+    }
+    if (buffer_len >= 3 && buffer[0] == '\xEF' && buffer[1] == '\xBB' && buffer[2] == '\xBF') {
+        buffer = buffer + 3; /* Support for UTF-8 BOM */
+        buffer_len -= 3;
+    }
+    previous_end = parson_parse_end;
+    parson_parse_end = buffer + buffer_len;
+    SKIP_WHITESPACES(&buffer);
+    status = select_object(&buffer, 0, key_function, value_function, context);
+    parson_parse_end = previous_end;
+    return status;
+}
+/* [JSchwert] End */
+
 JSON_Value * json_parse_string_with_comments(const char *string) {
     JSON_Value *result = NULL;
     char *string_mutable_copy = NULL, *string_mutable_copy_ptr = NULL;
@@ -1736,7 +2416,7 @@ JSON_Value * json_value_deep_copy(const JSON_Value *value) {
                     json_value_free(return_value);
                     return NULL;
                 }
-                key_copy = parson_strdup(temp_key);
+                key_copy = is_interned(temp_key) ? (char*)temp_key : parson_strdup(temp_key);
                 if (!key_copy) {
                     json_value_free(temp_value_copy);
                     json_value_free(return_value);
@@ -1744,7 +2424,7 @@ JSON_Value * json_value_deep_copy(const JSON_Value *value) {
                 }
                 res = json_object_add(temp_object_copy, key_copy, temp_value_copy);
                 if (res != JSONSuccess) {
-                    parson_free(key_copy);
+                    key_free(key_copy);
                     json_value_free(temp_value_copy);
                     json_value_free(return_value);
                     return NULL;
@@ -1858,6 +2538,296 @@ void json_free_serialized_string(char *string) {
     parson_free(string);
 }
 
+/* [JSchwert] Begin: streaming serialization */
+#define WRITER_BIT(level) (1ULL << (level))
+
+static JSON_Status writer_fail(JSON_Writer *writer) {
+    writer->failed = PARSON_TRUE;
+    return JSONFailure;
+}
+
+/* keeps one byte spare for the terminating null character written by sprintf and json_writer_finish */
+static parson_bool_t writer_has_room(const JSON_Writer *writer, size_t needed) {
+    return (writer->len < writer->size) && (needed < writer->size - writer->len);
+}
+
+static JSON_Status writer_append(JSON_Writer *writer, const char *string, size_t len) {
+    if (!writer_has_room(writer, len)) {
+        return writer_fail(writer);
+    }
+    memcpy(writer->buf + writer->len, string, len);
+    writer->len += len;
+    return JSONSuccess;
+}
+
+/* validates the position of a new value and emits the ',' separator if needed */
+static JSON_Status writer_begin_value(JSON_Writer *writer) {
+    if (writer == NULL || writer->failed) {
+        return JSONFailure;
+    }
+    if (writer->depth == 0 && (writer->needs_comma & WRITER_BIT(0))) {
+        return writer_fail(writer); /* only one top level value */
+    }
+    if ((writer->in_object & WRITER_BIT(writer->depth)) && !writer->after_key) {
+        return writer_fail(writer); /* object members need a key */
+    }
+    if (!writer->after_key && (writer->needs_comma & WRITER_BIT(writer->depth))) {
+        if (writer_append(writer, ",", 1) != JSONSuccess) {
+            return JSONFailure;
+        }
+    }
+    writer->after_key = PARSON_FALSE;
+    return JSONSuccess;
+}
+
+static void writer_end_value(JSON_Writer *writer) {
+    writer->needs_comma |= WRITER_BIT(writer->depth);
+}
+
+static JSON_Status writer_serialize_string(JSON_Writer *writer, const char *string, size_t len) {
+    int written = -1;
+    /* worst case every character is escaped as \u00XX, plus quotes */
+    if (len > (writer->size / 6) || !writer_has_room(writer, (len * 6) + 2)) {
+        written = json_serialize_string(string, len, NULL);
+        if (written < 0 || !writer_has_room(writer, (size_t)written)) {
+            return writer_fail(writer);
+        }
+    }
+    written = json_serialize_string(string, len, writer->buf + writer->len);
+    if (written < 0) {
+        return writer_fail(writer);
+    }
+    writer->len += (size_t)written;
+    return JSONSuccess;
+}
+
+static JSON_Status writer_open(JSON_Writer *writer, const char *token, parson_bool_t is_object) {
+    if (writer_begin_value(writer) != JSONSuccess) {
+        return JSONFailure;
+    }
+    if ((writer->depth + 1) >= PARSON_WRITER_MAX_NESTING) {
+        return writer_fail(writer);
+    }
+    if (writer_append(writer, token, 1) != JSONSuccess) {
+        return JSONFailure;
+    }
+    writer->depth++;
+    writer->needs_comma &= ~WRITER_BIT(writer->depth);
+    if (is_object) {
+        writer->in_object |= WRITER_BIT(writer->depth);
+    } else {
+        writer->in_object &= ~WRITER_BIT(writer->depth);
+    }
+    return JSONSuccess;
+}
+
+static JSON_Status writer_close(JSON_Writer *writer, const char *token, parson_bool_t is_object) {
+    parson_bool_t in_object = PARSON_FALSE;
+    if (writer == NULL || writer->failed) {
+        return JSONFailure;
+    }
+    in_object = (writer->in_object & WRITER_BIT(writer->depth)) ? PARSON_TRUE : PARSON_FALSE;
+    if (writer->depth == 0 || writer->after_key || in_object != is_object) {
+        return writer_fail(writer);
+    }
+    if (writer_append(writer, token, 1) != JSONSuccess) {
+        return JSONFailure;
+    }
+    writer->depth--;
+    writer_end_value(writer);
+    return JSONSuccess;
+}
+
+void json_writer_init(JSON_Writer *writer, char *buf, size_t buf_size_in_bytes) {
+    if (writer == NULL) {
+        return;
+    }
+    memset(writer, 0, sizeof(JSON_Writer));
+    writer->buf = buf;
+    writer->size = buf_size_in_bytes;
+    writer->failed = (buf == NULL || buf_size_in_bytes == 0) ? PARSON_TRUE : PARSON_FALSE;
+}
+
+JSON_Status json_writer_begin_object(JSON_Writer *writer) {
+    return writer_open(writer, "{", PARSON_TRUE);
+}
+
+JSON_Status json_writer_end_object(JSON_Writer *writer) {
+    return writer_close(writer, "}", PARSON_TRUE);
+}
+
+JSON_Status json_writer_begin_array(JSON_Writer *writer) {
+    return writer_open(writer, "[", PARSON_FALSE);
+}
+
+JSON_Status json_writer_end_array(JSON_Writer *writer) {
+    return writer_close(writer, "]", PARSON_FALSE);
+}
+
+JSON_Status json_writer_key(JSON_Writer *writer, const char *name) {
+    if (writer == NULL || writer->failed) {
+        return JSONFailure;
+    }
+    if (name == NULL || writer->after_key || !(writer->in_object & WRITER_BIT(writer->depth))) {
+        return writer_fail(writer);
+    }
+    if (writer->needs_comma & WRITER_BIT(writer->depth)) {
+        if (writer_append(writer, ",", 1) != JSONSuccess) {
+            return JSONFailure;
+        }
+    }
+    /* We do not support key names with embedded \0 chars */
+    if (writer_serialize_string(writer, name, strlen(name)) != JSONSuccess) {
+        return JSONFailure;
+    }
+    if (writer_append(writer, ":", 1) != JSONSuccess) {
+        return JSONFailure;
+    }
+    writer->after_key = PARSON_TRUE;
+    return JSONSuccess;
+}
+
+JSON_Status json_writer_string(JSON_Writer *writer, const char *string) {
+    if (string == NULL) {
+        return writer == NULL ? JSONFailure : writer_fail(writer);
+    }
+    return json_writer_string_with_len(writer, string, strlen(string));
+}
+
+JSON_Status json_writer_string_with_len(JSON_Writer *writer, const char *string, size_t len) {
+    if (string == NULL || !is_valid_utf8(string, len)) {
+        return writer == NULL ? JSONFailure : writer_fail(writer);
+    }
+    if (writer_begin_value(writer) != JSONSuccess) {
+        return JSONFailure;
+    }
+    if (writer_serialize_string(writer, string, len) != JSONSuccess) {
+        return JSONFailure;
+    }
+    writer_end_value(writer);
+    return JSONSuccess;
+}
+
+JSON_Status json_writer_number(JSON_Writer *writer, double number) {
+    char num_buf[PARSON_NUM_BUF_SIZE];
+    char *num_ptr = NULL;
+    int written = -1;
+    if (IS_NUMBER_INVALID(number)) {
+        return writer == NULL ? JSONFailure : writer_fail(writer);
+    }
+    if (writer_begin_value(writer) != JSONSuccess) {
+        return JSONFailure;
+    }
+    num_ptr = writer_has_room(writer, PARSON_NUM_BUF_SIZE) ? (writer->buf + writer->len) : num_buf;
+    written = serialize_number(number, num_ptr);
+    if (written < 0) {
+        return writer_fail(writer);
+    }
+    if (num_ptr == num_buf) {
+        if (writer_append(writer, num_buf, (size_t)written) != JSONSuccess) {
+            return JSONFailure;
+        }
+    } else {
+        writer->len += (size_t)written;
+    }
+    writer_end_value(writer);
+    return JSONSuccess;
+}
+
+JSON_Status json_writer_boolean(JSON_Writer *writer, int boolean) {
+    if (writer_begin_value(writer) != JSONSuccess) {
+        return JSONFailure;
+    }
+    if ((boolean ? writer_append(writer, "true", 4) : writer_append(writer, "false", 5)) != JSONSuccess) {
+        return JSONFailure;
+    }
+    writer_end_value(writer);
+    return JSONSuccess;
+}
+
+JSON_Status json_writer_null(JSON_Writer *writer) {
+    if (writer_begin_value(writer) != JSONSuccess) {
+        return JSONFailure;
+    }
+    if (writer_append(writer, "null", 4) != JSONSuccess) {
+        return JSONFailure;
+    }
+    writer_end_value(writer);
+    return JSONSuccess;
+}
+
+JSON_Status json_writer_value(JSON_Writer *writer, const JSON_Value *value) {
+    JSON_Object *object = NULL;
+    JSON_Array *array = NULL;
+    size_t i = 0, count = 0;
+    switch (json_value_get_type(value)) {
+        case JSONObject:
+            object = json_value_get_object(value);
+            count = json_object_get_count(object);
+            if (json_writer_begin_object(writer) != JSONSuccess) {
+                return JSONFailure;
+            }
+            for (i = 0; i < count; i++) {
+                if (json_writer_key(writer, json_object_get_name(object, i)) != JSONSuccess
+                    || json_writer_value(writer, json_object_get_value_at(object, i)) != JSONSuccess) {
+                    return JSONFailure;
+                }
+            }
+            return json_writer_end_object(writer);
+        case JSONArray:
+            array = json_value_get_array(value);
+            count = json_array_get_count(array);
+            if (json_writer_begin_array(writer) != JSONSuccess) {
+                return JSONFailure;
+            }
+            for (i = 0; i < count; i++) {
+                if (json_writer_value(writer, json_array_get_value(array, i)) != JSONSuccess) {
+                    return JSONFailure;
+                }
+            }
+            return json_writer_end_array(writer);
+        case JSONString:
+            return json_writer_string_with_len(writer, json_value_get_string(value), json_value_get_string_len(value));
+        case JSONNumber:
+            return json_writer_number(writer, json_value_get_number(value));
+        case JSONBoolean:
+            return json_writer_boolean(writer, json_value_get_boolean(value));
+        case JSONNull:
+            return json_writer_null(writer);
+        default:
+            return writer == NULL ? JSONFailure : writer_fail(writer);
+    }
+}
+
+JSON_Status json_writer_raw(JSON_Writer *writer, const char *json, size_t len) {
+    if (json == NULL || len == 0) {
+        return writer == NULL ? JSONFailure : writer_fail(writer);
+    }
+    if (writer_begin_value(writer) != JSONSuccess) {
+        return JSONFailure;
+    }
+    if (writer_append(writer, json, len) != JSONSuccess) {
+        return JSONFailure;
+    }
+    writer_end_value(writer);
+    return JSONSuccess;
+}
+
+const char * json_writer_finish(JSON_Writer *writer, size_t *out_len) {
+    if (writer == NULL || writer->failed || writer->depth != 0 || writer->after_key
+        || !(writer->needs_comma & WRITER_BIT(0))) {
+        return NULL;
+    }
+    writer->buf[writer->len] = '\0';
+    if (out_len != NULL) {
+        *out_len = writer->len;
+    }
+    return writer->buf;
+}
+
+#undef WRITER_BIT
+/* [JSchwert] End */
+
 JSON_Status json_array_remove(JSON_Array *array, size_t ix) {
     size_t to_move_bytes = 0;
     if (array == NULL || ix >= json_array_get_count(array)) {
@@ -2048,7 +3018,7 @@ JSON_Status json_object_set_value(JSON_Object *object, const char *name, JSON_Va
         }
         cell_ix = json_object_get_cell_ix(object, name, strlen(name), hash, &found);
     }
-    key_copy = parson_strdup(name);
+    key_copy = key_dup(name, strlen(name), hash);
     if (!key_copy) {
         return JSONFailure;
     }
@@ -2142,7 +3112,7 @@ JSON_Status json_object_dotset_value(JSON_Object *object, const char *name, JSON
         json_value_free(new_value);
         return JSONFailure;
     }
-    name_copy = parson_strndup(name, name_len);
+    name_copy = key_dup(name, name_len, hash_string(name, name_len));
     if (!name_copy) {
         json_object_dotremove_internal(new_object, dot_pos + 1, 0);
         json_value_free(new_value);
@@ -2150,7 +3120,7 @@ JSON_Status json_object_dotset_value(JSON_Object *object, const char *name, JSON
     }
     status = json_object_add(object, name_copy, new_value);
     if (status != JSONSuccess) {
-        parson_free(name_copy);
+        key_free(name_copy);
         json_object_dotremove_internal(new_object, dot_pos + 1, 0);
         json_value_free(new_value);
         return JSONFailure;
@@ -2232,7 +3202,7 @@ JSON_Status json_object_clear(JSON_Object *object) {
         return JSONFailure;
     }
     for (i = 0; i < json_object_get_count(object); i++) {
-        parson_free(object->names[i]);
+        key_free(object->names[i]);
         json_value_free(object->values[i]);
     }
     object->count = 0;
@@ -2405,9 +3375,69 @@ void json_set_float_serialization_format(const char *format) {
     if (parson_float_format) {
         parson_free(parson_float_format);
     }
+    parson_float_fixed_precision = -1;
     if (!format) {
         parson_float_format = NULL;
         return;
     }
     parson_float_format = parson_strdup(format);
+    /* [JSchwert] "%.Nf" with N in 0..9 uses the fast fixed precision formatter */
+    if (parson_float_format != NULL && strlen(format) == 4 && format[0] == '%' && format[1] == '.' &&
+        format[2] >= '0' && format[2] <= '9' && format[3] == 'f') {
+        parson_float_fixed_precision = format[2] - '0';
+    }
+}
+
+/* [JSchwert] Begin: interned key names */
+JSON_Status json_add_interned_names(const char * const *names, size_t count) {
+    JSON_Intern_Pool *pool = NULL;
+    const char **table = NULL, **old_table = parson_intern_table;
+    size_t capacity = MAX(parson_intern_capacity, STARTING_CAPACITY), old_capacity = parson_intern_capacity;
+    size_t size = 0, len = 0, i = 0;
+    char *chars = NULL;
+    if (names == NULL) {
+        return JSONFailure;
+    }
+    for (i = 0; i < count; i++) {
+        if (names[i] == NULL) {
+            return JSONFailure;
+        }
+        size += strlen(names[i]) + 1;
+    }
+    while (capacity < 2 * (parson_intern_count + count)) {
+        capacity *= 2;
+    }
+    /* pools live until the program ends, so they don't come from parson_malloc (e.g. an arena) */
+    pool = (JSON_Intern_Pool*)malloc(sizeof(JSON_Intern_Pool) + size);
+    table = (const char**)calloc(capacity, sizeof(*table));
+    if (pool == NULL || table == NULL) {
+        free(pool);
+        free(table);
+        return JSONFailure;
+    }
+    parson_intern_table = table;
+    parson_intern_capacity = capacity;
+    for (i = 0; i < old_capacity; i++) {
+        if (old_table[i] != NULL) {
+            intern_insert(old_table[i]);
+        }
+    }
+    free(old_table);
+
+    chars = (char*)(pool + 1);
+    for (i = 0; i < count; i++) {
+        len = strlen(names[i]);
+        if (intern_lookup(names[i], len, hash_string(names[i], len)) != NULL) {
+            continue; /* already interned */
+        }
+        memcpy(chars, names[i], len + 1);
+        intern_insert(chars);
+        parson_intern_count++;
+        chars += len + 1;
+    }
+    pool->size = (size_t)(chars - (char*)(pool + 1));
+    pool->next = parson_intern_pools;
+    parson_intern_pools = pool;
+    return JSONSuccess;
 }
+/* [JSchwert] End */
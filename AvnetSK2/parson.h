@@ -80,6 +80,12 @@ void json_set_escape_slashes(int escape_slashes);
    If format is null then the default format is used. */
 void json_set_float_serialization_format(const char *format);
 
+/* [JSchwert] Registers object key names to be interned: keys equal to a registered name
+   reference one shared copy instead of being duplicated into every object. Other keys are
+   allocated as usual. May be called several times (e.g. once per module), preferably at startup.
+   Interned names are kept until the program ends and don't use the parson allocation functions. */
+JSON_Status json_add_interned_names(const char * const *names, size_t count);
+
 /* Parses first JSON value in a file, returns NULL in case of error */
 JSON_Value * json_parse_file(const char *filename);
 
@@ -94,6 +100,29 @@ JSON_Value * json_parse_string(const char *string);
     returns NULL in case of error */
 JSON_Value * json_parse_string_with_comments(const char *string);
 
+/* [JSchwert] Parses first JSON value in a buffer of given length which doesn't need to be
+   null terminated (e.g. IoT Hub payloads). The buffer is parsed in place without copying. */
+JSON_Value * json_parse_buffer(const char *buffer, size_t buffer_len);
+
+/* [JSchwert] Selective (SAX style) parsing of a buffer whose root is an object, without building
+   a tree. For every object member key_function decides what happens with the member's value:
+   JSONSelectSkip skips it without allocating, JSONSelectDescend reports the members of an object
+   value with depth + 1 (other values are skipped) and JSONSelectValue parses the value and hands
+   it to value_function, which takes ownership and has to json_value_free() it.
+   key is not null terminated. Returns JSONFailure if the buffer is not valid JSON, callbacks
+   for members before the error have been invoked already. */
+typedef enum json_select_action {
+    JSONSelectSkip     = 0,
+    JSONSelectDescend  = 1,
+    JSONSelectValue    = 2
+} JSON_Select_Action;
+
+typedef JSON_Select_Action (*JSON_Select_Key_Function)(void *context, size_t depth, const char *key, size_t key_len);
+typedef void (*JSON_Select_Value_Function)(void *context, size_t depth, const char *key, size_t key_len, JSON_Value *value);
+
+JSON_Status json_parse_buffer_select(const char *buffer, size_t buffer_len, JSON_Select_Key_Function key_function,
+                                     JSON_Select_Value_Function value_function, void *context);
+
 /* Serialization */
 size_t      json_serialization_size(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
@@ -108,6 +137,41 @@ char *      json_serialize_to_string_pretty(const JSON_Value *value);
 
 void        json_free_serialized_string(char *string); /* frees string from json_serialize_to_string and json_serialize_to_string_pretty */
 
+/* [JSchwert] Streaming serialization
+   Writes JSON in a single pass directly into a caller provided buffer, without building a
+   JSON_Value tree and without the size-then-serialize double pass. Output is identical to
+   json_serialize_to_buffer (same float format and escaping). Once the buffer is exhausted
+   or calls are unbalanced the writer fails and all further calls return JSONFailure. */
+#define PARSON_WRITER_MAX_NESTING 64
+
+typedef struct json_writer_t {
+    char              *buf;
+    size_t             size;
+    size_t             len;
+    unsigned int       depth;
+    unsigned long long needs_comma; /* one bit per nesting level */
+    unsigned long long in_object;   /* one bit per nesting level */
+    int                after_key;
+    int                failed;
+} JSON_Writer;
+
+void        json_writer_init(JSON_Writer *writer, char *buf, size_t buf_size_in_bytes);
+JSON_Status json_writer_begin_object(JSON_Writer *writer);
+JSON_Status json_writer_end_object(JSON_Writer *writer);
+JSON_Status json_writer_begin_array(JSON_Writer *writer);
+JSON_Status json_writer_end_array(JSON_Writer *writer);
+JSON_Status json_writer_key(JSON_Writer *writer, const char *name);
+JSON_Status json_writer_string(JSON_Writer *writer, const char *string);
+JSON_Status json_writer_string_with_len(JSON_Writer *writer, const char *string, size_t len);
+JSON_Status json_writer_number(JSON_Writer *writer, double number);
+JSON_Status json_writer_boolean(JSON_Writer *writer, int boolean);
+JSON_Status json_writer_null(JSON_Writer *writer);
+JSON_Status json_writer_value(JSON_Writer *writer, const JSON_Value *value); /* serializes a (sub)tree */
+JSON_Status json_writer_raw(JSON_Writer *writer, const char *json, size_t len); /* appends one value serialized before, not validated */
+/* Null terminates the output and returns the buffer, or NULL if the writer failed or is not at top level.
+   out_len (optional) receives the length excluding the null character. */
+const char * json_writer_finish(JSON_Writer *writer, size_t *out_len);
+
 /* Comparing */
 int  json_value_equals(const JSON_Value *a, const JSON_Value *b);
 
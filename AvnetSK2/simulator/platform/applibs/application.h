@@ -0,0 +1,7 @@
+/**
+* @brief Linux replacement of the Azure Sphere applibs application for the simulator, see sim_platform.c
+*/
+#pragma once
+#include <stdbool.h>
+
+int Application_IsDeviceAuthReady(bool *outIsReady);
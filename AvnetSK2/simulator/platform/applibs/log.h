@@ -0,0 +1,8 @@
+/**
+* @brief Linux replacement of the Azure Sphere applibs logging for the simulator, see sim_platform.c
+*/
+#pragma once
+#include <stdarg.h>
+
+int Log_Debug(const char *fmt, ...);
+int Log_DebugVarArgs(const char *fmt, va_list args);
@@ -0,0 +1,6 @@
+/**
+* @brief Linux replacement of the Azure Sphere applibs storage for the simulator, see sim_platform.c
+*/
+#pragma once
+
+int Storage_OpenFileInImagePackage(const char *relativePath);
@@ -0,0 +1,9 @@
+/**
+* @brief Linux replacement of the Azure Sphere device authentication for the simulator. There is no
+*   device certificate on Linux, the SDK transport cannot connect, see sim_platform.c
+*/
+#pragma once
+#include <azureiot/iothub_device_client_ll.h>
+
+IOTHUB_DEVICE_CLIENT_LL_HANDLE IoTHubDeviceClient_LL_CreateWithAzureSphereFromDeviceAuth(const char *iothubUri,
+    IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol);
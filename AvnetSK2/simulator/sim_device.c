@@ -0,0 +1,202 @@
+/**
+* @brief One simulated device: the telemetry, twin and direct method handling of main.c on synthetic
+*   sensor values, connected through the local transport to the stand-in IoT Hub.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <applibs/log.h>
+#include "../epoll_timerfd_utilities.h"
+#include "../parson.h"
+#include "../json_arena.h"
+#include "../azure_iot.h"
+#include "../azure_iot_dps.h"
+#include "../azure_iot_json.h"
+#include "../azure_iot_pnp.h"
+#include "../azure_iot_central.h"
+#include "../azure_iot_transport.h"
+#include "simulator.h"
+
+#define MODULE "[SimDevice] "
+
+// same model and component names as main.c, so twin patches and methods are interchangeable
+static const char cstrPnPModelId[] = "dtmi:azsphere:SphereTTT:AVNETSK;1";
+static const char cstrRgbledComponent[] = "rgbLed";
+static const char cstrBlinkRateProperty[] = "blinkRateProperty";
+static const char cstrBlinkRatePropertyPath[] = "rgbLed.blinkRateProperty";
+static const char cstrLSM6DSOComponent[] = "lsm6dso";
+static const char cstrLPS22HHComponent[] = "lps22hh";
+static const char cstrTemperatureProperty[] = "temperature";
+static const char cstrPressureProperty[] = "pressure";
+static const char cstrDevInfoComponent[] = "deviceInformation";
+static const char cstrDevInfoManufacturerProperty[] = "manufacturer";
+static const char cstrDevInfoModelProperty[] = "model";
+static const char cstrDeliveryStatsMethodName[] = "deviceHealth*deliveryStatsMethod";
+
+static unsigned int nDeviceIndex = 0;
+static unsigned int nTelemetryCycle = 0;
+static bool bConnected = false;
+static sim_device_result_t result;
+
+static void TelemetryTimerHandler(EventData *eventData);
+static void EndTimerHandler(EventData *eventData);
+static EventData evtdataTelemetryTimer = { .eventHandler = &TelemetryTimerHandler };
+static EventData evtdataEndTimer = { .eventHandler = &EndTimerHandler };
+static volatile bool bTerminate = false;
+
+
+/// @brief Telemetry of main.c with synthetic readings: acceleration and pressure/temperature,
+/// batched into one message per cycle
+static void TelemetryTimerHandler(EventData *eventData)
+{
+    if (ConsumeTimerFdEvent(eventData->fd) != 0) {
+        return;
+    }
+    if (!bConnected) {
+        return;
+    }
+
+    double fPhase = (double)(nTelemetryCycle++ + nDeviceIndex) * 0.1;
+    JsonArena_Begin();
+
+    JSON_Value *jsonValue = json_value_init_object();
+    JSON_Object *jsonObject = json_value_get_object(jsonValue);
+    json_object_dotset_number(jsonObject, "acceleration.x", sin(fPhase));
+    json_object_dotset_number(jsonObject, "acceleration.y", cos(fPhase));
+    json_object_dotset_number(jsonObject, "acceleration.z", 9.81);
+    AzureIoT_PnP_BatchJsonMessage(jsonValue, cstrLSM6DSOComponent);
+
+    jsonValue = json_value_init_object();
+    jsonObject = json_value_get_object(jsonValue);
+    json_object_set_number(jsonObject, cstrTemperatureProperty, 21.0 + sin(fPhase));
+    json_object_set_number(jsonObject, cstrPressureProperty, 1013.25 + cos(fPhase));
+    AzureIoT_PnP_BatchJsonMessage(jsonValue, cstrLPS22HHComponent);
+
+    // releases both payloads, the batch keeps serialized copies
+    JsonArena_End();
+    AzureIoT_PnP_DoBatchTasks();
+    AzureIoT_PnP_DoReportTasks();
+}
+
+static void EndTimerHandler(EventData *eventData)
+{
+    bTerminate = true;
+}
+
+static void BlinkRatePropertyUpdate(const char *cstrPropertyPath, const JSON_Value *jsonValue, unsigned int nVersion)
+{
+    double fBlinkRate = json_value_get_number(jsonValue);
+    AzureIoTCentral_AckComponentPropertyChange(cstrRgbledComponent, cstrBlinkRateProperty, &fBlinkRate, JSONNumber, nVersion, HTTP_OK);
+}
+
+static HTTP_STATUS_CODE DeliveryStatsMethod(JSON_Value *jsonParameters, JSON_Value **jsonResponseAddress)
+{
+    *jsonResponseAddress = AzureIoTJson_GetDeliveryStatistics();
+    return HTTP_OK;
+}
+
+static const MethodRegistration clstDirectMethods[] = {
+    {.MethodName = cstrDeliveryStatsMethodName, .MethodHandler = &DeliveryStatsMethod},
+    {.MethodName = NULL, .MethodHandler = NULL}
+};
+
+/// @brief like main.c: reports the device information once connected, the reported
+/// properties cache skips it on reconnects
+static void ConnectionStatusChanged(bool connected, const char *statusText)
+{
+    bConnected = connected;
+    if (!connected) {
+        return;
+    }
+    result.nConnects++;
+
+    JSON_Value *jsonValue = json_value_init_object();
+    JSON_Object *jsonObject = json_value_get_object(jsonValue);
+    json_object_set_string(jsonObject, cstrDevInfoManufacturerProperty, "AVNET");
+    json_object_set_string(jsonObject, cstrDevInfoModelProperty, "simulated");
+    AzureIoT_PnP_ReportComponentProperty(cstrDevInfoComponent, jsonValue);
+    AzureIoT_PnP_FlushReportedProperties();
+}
+
+static void MessageConfirmed(bool delivered)
+{
+    if (delivered) {
+        result.nConfirmed++;
+    }
+}
+
+/// @brief private memory of this process from /proc/self/smaps_rollup in kB
+static size_t getPrivateKb(void)
+{
+    FILE *pFile = fopen("/proc/self/smaps_rollup", "r");
+    char strLine[128];
+    size_t nTotalKb = 0;
+    if (pFile == NULL) {
+        return 0;
+    }
+    while (fgets(strLine, sizeof(strLine), pFile) != NULL) {
+        size_t nKb = 0;
+        if ((sscanf(strLine, "Private_Clean: %zu kB", &nKb) == 1) || (sscanf(strLine, "Private_Dirty: %zu kB", &nKb) == 1)) {
+            nTotalKb += nKb;
+        }
+    }
+    fclose(pFile);
+    return nTotalKb;
+}
+
+int SimDevice_Run(unsigned int nDevice, const sim_options_t *pOptions, int fdResult)
+{
+    nDeviceIndex = nDevice;
+    result.nDevice = nDevice;
+
+    json_set_float_serialization_format("%.2f");
+    AzureIoTCentral_InternPropertyNames();
+    AzureIoT_PnP_SetBatching(0, AZURE_IOT_PNP_PACK_BUDGET);
+
+    static char strAddress[128];
+    snprintf(strAddress, sizeof(strAddress), "unix:%s", pOptions->cstrSocketPath);
+    AzureIoT_LocalTransport_SetAddress(strAddress);
+    AzureIoT_SetTransport(&AzureIoT_LocalTransport);
+
+    int fdEpoll = CreateEpollFd();
+    if ((fdEpoll < 0) || (AzureIoT_DPS_Initialize(fdEpoll, cstrPnPModelId) < 0)) {
+        return EXIT_FAILURE;
+    }
+    AzureIoTJson_SubscribeTwinProperty(cstrBlinkRatePropertyPath, JSONNumber, &BlinkRatePropertyUpdate);
+    AzureIoTJson_RegisterDirectMethodHandlers(&clstDirectMethods[0]);
+    AzureIoT_SetConnectionStatusCallback(&ConnectionStatusChanged);
+    AzureIoT_SetMessageConfirmationCallback(&MessageConfirmed);
+    AzureIoT_DPS_SetFastRecovery(pOptions->bFastRecovery);
+    AzureIoT_DPS_StartConnection();
+
+    // devices are spread over the telemetry period instead of sending in lockstep
+    const struct timespec tsPeriod = { pOptions->nTelemetryPeriodMs / 1000, (pOptions->nTelemetryPeriodMs % 1000) * 1000000L };
+    long long nPhaseNs = (long long)pOptions->nTelemetryPeriodMs * 1000000LL * nDevice / pOptions->nDevices;
+    const struct timespec tsPhase = { nPhaseNs / 1000000000LL, nPhaseNs % 1000000000LL + 1 };
+    int fdTelemetryTimer = CreateTimerFdAndAddToEpoll(fdEpoll, &tsPeriod, &evtdataTelemetryTimer, EPOLLIN);
+    const struct timespec tsEnd = { pOptions->nDurationSeconds, 0 };
+    int fdEndTimer = CreateTimerFdAndAddToEpoll(fdEpoll, &tsEnd, &evtdataEndTimer, EPOLLIN);
+    if ((fdTelemetryTimer < 0) || (fdEndTimer < 0)) {
+        return EXIT_FAILURE;
+    }
+    const struct itimerspec itsTelemetry = { .it_value = tsPhase, .it_interval = tsPeriod };
+    timerfd_settime(fdTelemetryTimer, 0, &itsTelemetry, NULL);
+
+    while (!bTerminate) {
+        WaitForEventAndCallHandler(fdEpoll);
+    }
+
+    struct mallinfo2 heap = mallinfo2();
+    result.nHeapBytes = heap.uordblks;
+    result.nPrivateKb = getPrivateKb();
+    if (write(fdResult, &result, sizeof(result)) != sizeof(result)) {
+        Log_Debug(MODULE "ERROR: cannot write result of device %u.\n", nDevice);
+    }
+    return EXIT_SUCCESS;
+}
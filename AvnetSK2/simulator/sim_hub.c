@@ -0,0 +1,650 @@
+/**
+* @brief Stand-in IoT Hub of the simulator. Speaks the line protocol of the local transport
+*   (see AzureIoT_LocalTransport_SetAddress()) and accounts every line under the IoT Hub MQTT topic
+*   it stands for. Plays the failure script and measures for every failure how long each device
+*   takes from its end to the next telemetry message.
+*   This is not MQTT: the SDK MQTT client, its keep-alive and retry policy are not part of the measurements.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <applibs/log.h>
+#include "../epoll_timerfd_utilities.h"
+#include "../azure_iot_transport.h"
+#include "simulator.h"
+
+#define MODULE "[SimHub] "
+
+/// @brief time the devices get after the duration to deliver their results
+#define SIM_HUB_GRACE_MS (3000)
+
+/// @brief IoT Hub MQTT topics the line protocol maps to
+typedef enum {
+    HUB_TOPIC_EVENTS = 0,       ///< device -> hub "message"
+    HUB_TOPIC_REPORTED,         ///< device -> hub "reported"
+    HUB_TOPIC_METHOD_RESPONSE,  ///< device -> hub "method"
+    HUB_TOPIC_DESIRED,          ///< hub -> device "twin"
+    HUB_TOPIC_METHOD_REQUEST,   ///< hub -> device "method"
+    HUB_TOPIC_COUNT
+} HUB_TOPIC;
+
+static const char *const acstrTopicNames[HUB_TOPIC_COUNT] = {
+    "devices/{id}/messages/events/",
+    "$iothub/twin/PATCH/properties/reported/",
+    "$iothub/methods/res/{status}/",
+    "$iothub/twin/PATCH/properties/desired/",
+    "$iothub/methods/POST/{name}/"
+};
+
+typedef struct {
+    unsigned long long nMessages;
+    unsigned long long nBytes;
+} hub_topic_stats_t;
+
+/// @brief growing sample list for percentiles
+typedef struct {
+    long long *anValues;
+    size_t nCount;
+    size_t nCapacity;
+} hub_samples_t;
+
+typedef struct {
+    EventData evt;                  ///< context points to the hub_device_t
+    char abLine[2 * AZURE_IOT_LOCAL_LINE_SIZE];
+    size_t nLineUsed;
+    bool bDiscardLine;
+} hub_connection_t;
+
+/// @brief one failure of the script while and after it is played
+typedef struct {
+    long long nStartMs;             ///< 0 before it started
+    long long nEndMs;               ///< 0 before it ended
+    unsigned int nAffected;         ///< devices waiting for recovery at the end
+    unsigned int nUnrecovered;      ///< devices still waiting at the next failure or the end of the run
+    unsigned int nAccepted;         ///< connections accepted from the start until the next failure
+    hub_samples_t recoverySamples;  ///< end -> next telemetry message per device, censored for the unrecovered
+    hub_samples_t acceptSamples;    ///< accept times, for the peak reconnect rate
+} hub_event_t;
+
+typedef struct {
+    unsigned int nDevice;
+    hub_connection_t *pConnection;  ///< NULL while disconnected
+    long long nConnectedMs;         ///< first connection after start, -1 before
+    int iRecoveringEvent;           ///< failure this device did not recover from yet, -1 none
+    long long nTwinSentMs;          ///< pending twin patch, 0 none
+    long long nMethodSentMs;        ///< pending method request, 0 none
+    unsigned int nMethodRequest;
+} hub_device_t;
+
+static const sim_options_t *pSimOptions = NULL;
+static const pid_t *apidSimDevices = NULL;
+static hub_device_t *aDevices = NULL;
+static int fdHubEpoll = -1;
+static int fdHubListen = -1;
+static long long nStartMs = 0;
+static hub_event_t aEvents[SIM_MAX_EVENTS];
+static unsigned int nEventsStarted = 0;
+static bool bEventActive = false;
+static long long nNextFanOutMs = 0;
+static unsigned int nFanOutVersion = 0;
+static unsigned int nFanOuts = 0;
+static unsigned int nFanOutMissed = 0;
+static unsigned int nTwinsSent = 0;
+static unsigned int nMethodsSent = 0;
+static unsigned int nAccepted = 0;
+static unsigned int nWriteFailures = 0;
+
+static hub_topic_stats_t aTopicStats[HUB_TOPIC_COUNT];
+static unsigned int *anEventsPerSecond = NULL;
+static size_t nEventSeconds = 0;
+static hub_samples_t connectSamples, twinSamples, methodSamples;
+
+static sim_device_result_t *aResults = NULL;
+static size_t nResults = 0;
+static size_t nResultBytes = 0;
+
+static void listenHandler(EventData *eventData);
+static void connectionHandler(EventData *eventData);
+static void resultHandler(EventData *eventData);
+static void tickHandler(EventData *eventData);
+static EventData evtdataListen = { .eventHandler = &listenHandler };
+static EventData evtdataResult = { .eventHandler = &resultHandler };
+static EventData evtdataTick = { .eventHandler = &tickHandler };
+
+
+long long Sim_NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void addSample(hub_samples_t *pSamples, long long nValue)
+{
+    if (pSamples->nCount == pSamples->nCapacity) {
+        size_t nCapacity = (pSamples->nCapacity == 0) ? 256 : (2 * pSamples->nCapacity);
+        long long *anValues = realloc(pSamples->anValues, nCapacity * sizeof(*anValues));
+        if (anValues == NULL) {
+            return;
+        }
+        pSamples->anValues = anValues;
+        pSamples->nCapacity = nCapacity;
+    }
+    pSamples->anValues[pSamples->nCount++] = nValue;
+}
+
+static int compareSamples(const void *pLeft, const void *pRight)
+{
+    long long nLeft = *(const long long *)pLeft;
+    long long nRight = *(const long long *)pRight;
+    return (nLeft > nRight) - (nLeft < nRight);
+}
+
+static long long percentile(const hub_samples_t *pSamples, unsigned int nPercent)
+{
+    if (pSamples->nCount == 0) {
+        return 0;
+    }
+    return pSamples->anValues[(pSamples->nCount - 1) * nPercent / 100];
+}
+
+static void printSamples(const char *cstrName, hub_samples_t *pSamples, unsigned int nExpected)
+{
+    if (pSamples->nCount > 0) {
+        qsort(pSamples->anValues, pSamples->nCount, sizeof(*pSamples->anValues), compareSamples);
+    }
+    printf("  %-22s %6zu/%-6u median %6lld ms  p95 %6lld ms  max %6lld ms\n", cstrName, pSamples->nCount, nExpected,
+        percentile(pSamples, 50), percentile(pSamples, 95), percentile(pSamples, 100));
+}
+
+/// @brief highest number of samples within any one second window, samples must be sorted
+static size_t peakPerSecond(const hub_samples_t *pSamples)
+{
+    size_t nPeak = 0;
+    for (size_t nFirst = 0, nLast = 0; nLast < pSamples->nCount; nLast++) {
+        while (pSamples->anValues[nLast] - pSamples->anValues[nFirst] >= 1000) {
+            nFirst++;
+        }
+        if (nLast - nFirst + 1 > nPeak) {
+            nPeak = nLast - nFirst + 1;
+        }
+    }
+    return nPeak;
+}
+
+
+static void countTopic(HUB_TOPIC topic, size_t nBytes)
+{
+    aTopicStats[topic].nMessages++;
+    aTopicStats[topic].nBytes += nBytes;
+}
+
+/// @brief writes a hub -> device line without blocking the hub on a slow device
+static bool sendLine(hub_device_t *pDevice, HUB_TOPIC topic, const char *cstrLine, size_t nSize)
+{
+    if ((pDevice->pConnection == NULL)
+        || (send(pDevice->pConnection->evt.fd, cstrLine, nSize, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)nSize)) {
+        nWriteFailures++;
+        return false;
+    }
+    if (topic < HUB_TOPIC_COUNT) {
+        countTopic(topic, nSize);
+    }
+    return true;
+}
+
+static void closeConnection(hub_device_t *pDevice)
+{
+    hub_connection_t *pConnection = pDevice->pConnection;
+    if (pConnection == NULL) {
+        return;
+    }
+    UnregisterEventHandlerFromEpoll(fdHubEpoll, pConnection->evt.fd);
+    close(pConnection->evt.fd);
+    free(pConnection);
+    pDevice->pConnection = NULL;
+}
+
+static hub_device_t *findDevice(pid_t pid)
+{
+    for (unsigned int i = 0; i < pSimOptions->nDevices; i++) {
+        if (apidSimDevices[i] == pid) {
+            return &aDevices[i];
+        }
+    }
+    return NULL;
+}
+
+
+static void listenHandler(EventData *eventData)
+{
+    int fdConnection;
+    while ((fdConnection = accept4(eventData->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        struct ucred credentials;
+        socklen_t nSize = sizeof(credentials);
+        hub_device_t *pDevice = NULL;
+        if (getsockopt(fdConnection, SOL_SOCKET, SO_PEERCRED, &credentials, &nSize) == 0) {
+            pDevice = findDevice(credentials.pid);
+        }
+        hub_connection_t *pConnection = (pDevice != NULL) ? calloc(1, sizeof(*pConnection)) : NULL;
+        if (pConnection == NULL) {
+            Log_Debug(MODULE "WARNING: connection of unknown process refused.\n");
+            close(fdConnection);
+            continue;
+        }
+
+        // a device reconnecting replaces its previous connection
+        closeConnection(pDevice);
+        pConnection->evt.eventHandler = &connectionHandler;
+        pConnection->evt.fd = fdConnection;
+        pConnection->evt.context = pDevice;
+        if (RegisterEventHandlerToEpoll(fdHubEpoll, fdConnection, &pConnection->evt, EPOLLIN) != 0) {
+            close(fdConnection);
+            free(pConnection);
+            continue;
+        }
+        pDevice->pConnection = pConnection;
+        nAccepted++;
+
+        long long nNowMs = Sim_NowMs();
+        if (pDevice->nConnectedMs < 0) {
+            pDevice->nConnectedMs = nNowMs;
+            addSample(&connectSamples, nNowMs - nStartMs);
+        } else if (nEventsStarted > 0) {
+            hub_event_t *pEvent = &aEvents[nEventsStarted - 1];
+            pEvent->nAccepted++;
+            addSample(&pEvent->acceptSamples, nNowMs);
+            if (bEventActive && (pSimOptions->aEvents[nEventsStarted - 1].event == SIM_EVENT_REJECT)) {
+                static const char cstrReject[] = "reject\n";
+                sendLine(pDevice, HUB_TOPIC_COUNT, cstrReject, sizeof(cstrReject) - 1);
+                closeConnection(pDevice);
+            }
+        }
+    }
+}
+
+
+/**
+* @brief    Accounts one device -> hub line, completes pending fan-out round trips
+*/
+static void dispatchLine(hub_device_t *pDevice, const char *cstrLine, size_t nSize)
+{
+    long long nNowMs = Sim_NowMs();
+
+    if (strncmp(cstrLine, "message ", 8) == 0) {
+        countTopic(HUB_TOPIC_EVENTS, nSize);
+        if (pDevice->iRecoveringEvent >= 0) {
+            hub_event_t *pEvent = &aEvents[pDevice->iRecoveringEvent];
+            addSample(&pEvent->recoverySamples, nNowMs - pEvent->nEndMs);
+            pDevice->iRecoveringEvent = -1;
+        }
+        size_t nSecond = (size_t)((nNowMs - nStartMs) / 1000);
+        if (nSecond < nEventSeconds) {
+            anEventsPerSecond[nSecond]++;
+        }
+    } else if (strncmp(cstrLine, "reported ", 9) == 0) {
+        countTopic(HUB_TOPIC_REPORTED, nSize);
+        if ((pDevice->nTwinSentMs != 0) && (strstr(cstrLine, "blinkRateProperty") != NULL)) {
+            addSample(&twinSamples, nNowMs - pDevice->nTwinSentMs);
+            pDevice->nTwinSentMs = 0;
+        }
+    } else if (strncmp(cstrLine, "method ", 7) == 0) {
+        countTopic(HUB_TOPIC_METHOD_RESPONSE, nSize);
+        if ((pDevice->nMethodSentMs != 0) && (strtoul(cstrLine + 7, NULL, 10) == pDevice->nMethodRequest)) {
+            addSample(&methodSamples, nNowMs - pDevice->nMethodSentMs);
+            pDevice->nMethodSentMs = 0;
+        }
+    } else {
+        Log_Debug(MODULE "WARNING: unknown line from device %u.\n", pDevice->nDevice);
+    }
+}
+
+static void connectionHandler(EventData *eventData)
+{
+    hub_device_t *pDevice = eventData->context;
+    hub_connection_t *pConnection = pDevice->pConnection;
+
+    while (pConnection != NULL) {
+        ssize_t nRead = recv(eventData->fd, pConnection->abLine + pConnection->nLineUsed,
+            sizeof(pConnection->abLine) - pConnection->nLineUsed, 0);
+        if ((nRead == 0) || ((nRead < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+            closeConnection(pDevice);
+            return;
+        }
+        if (nRead < 0) {
+            return;
+        }
+        pConnection->nLineUsed += (size_t)nRead;
+
+        char *pLine = pConnection->abLine;
+        char *pEnd = NULL;
+        while ((pEnd = memchr(pLine, '\n', pConnection->nLineUsed - (size_t)(pLine - pConnection->abLine))) != NULL) {
+            if (!pConnection->bDiscardLine) {
+                *pEnd = '\0';
+                dispatchLine(pDevice, pLine, (size_t)(pEnd - pLine) + 1);
+            }
+            pConnection->bDiscardLine = false;
+            pLine = pEnd + 1;
+        }
+        pConnection->nLineUsed -= (size_t)(pLine - pConnection->abLine);
+        memmove(pConnection->abLine, pLine, pConnection->nLineUsed);
+        if (pConnection->nLineUsed == sizeof(pConnection->abLine)) {
+            pConnection->bDiscardLine = true;
+            pConnection->nLineUsed = 0;
+        }
+    }
+}
+
+
+static void resultHandler(EventData *eventData)
+{
+    ssize_t nRead = read(eventData->fd, (char *)aResults + nResultBytes,
+        pSimOptions->nDevices * sizeof(*aResults) - nResultBytes);
+    if (nRead <= 0) {
+        UnregisterEventHandlerFromEpoll(fdHubEpoll, eventData->fd);
+        return;
+    }
+    nResultBytes += (size_t)nRead;
+    nResults = nResultBytes / sizeof(*aResults);
+}
+
+
+/// @brief sends a twin patch and a direct method request to every connected device
+static void fanOut(void)
+{
+    char strLine[256];
+    nFanOutVersion++;
+    nFanOuts++;
+    long long nNowMs = Sim_NowMs();
+
+    for (unsigned int i = 0; i < pSimOptions->nDevices; i++) {
+        hub_device_t *pDevice = &aDevices[i];
+        if ((pDevice->nTwinSentMs != 0) || (pDevice->nMethodSentMs != 0)) {
+            nFanOutMissed++;
+        }
+        pDevice->nTwinSentMs = 0;
+        pDevice->nMethodSentMs = 0;
+        if (pDevice->pConnection == NULL) {
+            continue;
+        }
+        int nSize = snprintf(strLine, sizeof(strLine),
+            "twin {\"rgbLed\":{\"__t\":\"c\",\"blinkRateProperty\":%u},\"$version\":%u}\n", nFanOutVersion % 3, nFanOutVersion + 1);
+        if (sendLine(pDevice, HUB_TOPIC_DESIRED, strLine, (size_t)nSize)) {
+            pDevice->nTwinSentMs = nNowMs;
+            nTwinsSent++;
+        }
+        pDevice->nMethodRequest = nFanOutVersion;
+        nSize = snprintf(strLine, sizeof(strLine), "method %u deviceHealth*deliveryStatsMethod {}\n", pDevice->nMethodRequest);
+        if (sendLine(pDevice, HUB_TOPIC_METHOD_REQUEST, strLine, (size_t)nSize)) {
+            pDevice->nMethodSentMs = nNowMs;
+            nMethodsSent++;
+        }
+    }
+}
+
+/// @brief devices that did not recover until nAtMs count with the time until then
+static void censorRecoveries(long long nAtMs)
+{
+    for (unsigned int i = 0; i < pSimOptions->nDevices; i++) {
+        if (aDevices[i].iRecoveringEvent >= 0) {
+            hub_event_t *pEvent = &aEvents[aDevices[i].iRecoveringEvent];
+            addSample(&pEvent->recoverySamples, nAtMs - pEvent->nEndMs);
+            pEvent->nUnrecovered++;
+            aDevices[i].iRecoveringEvent = -1;
+        }
+    }
+}
+
+/// @brief starts the next failure of the script
+static void startEvent(void)
+{
+    static const char cstrDisconnect[] = "disconnect\n";
+    static const char cstrReject[] = "reject\n";
+    const sim_event_t *pScript = &pSimOptions->aEvents[nEventsStarted];
+
+    censorRecoveries(Sim_NowMs());
+    switch (pScript->event) {
+    case SIM_EVENT_OUTAGE:
+        for (unsigned int i = 0; i < pSimOptions->nDevices; i++) {
+            sendLine(&aDevices[i], HUB_TOPIC_COUNT, cstrDisconnect, sizeof(cstrDisconnect) - 1);
+            closeConnection(&aDevices[i]);
+        }
+        UnregisterEventHandlerFromEpoll(fdHubEpoll, fdHubListen);
+        close(fdHubListen);
+        unlink(pSimOptions->cstrSocketPath);
+        fdHubListen = -1;
+        break;
+    case SIM_EVENT_DROP:
+        for (unsigned int i = 0; i < pSimOptions->nDevices; i++) {
+            closeConnection(&aDevices[i]);
+        }
+        break;
+    case SIM_EVENT_NETLOSS:
+        *pbSimNetworkDown = true;
+        break;
+    case SIM_EVENT_REJECT:
+        for (unsigned int i = 0; i < pSimOptions->nDevices; i++) {
+            sendLine(&aDevices[i], HUB_TOPIC_COUNT, cstrReject, sizeof(cstrReject) - 1);
+            closeConnection(&aDevices[i]);
+        }
+        break;
+    default:
+        break;
+    }
+    aEvents[nEventsStarted++].nStartMs = Sim_NowMs();
+    bEventActive = true;
+    Log_Debug(MODULE "INFO: %s started.\n", acstrSimEventNames[pScript->event]);
+}
+
+/// @brief ends the running failure, from now on every device is waiting for recovery
+static void endEvent(void)
+{
+    const sim_event_t *pScript = &pSimOptions->aEvents[nEventsStarted - 1];
+    hub_event_t *pEvent = &aEvents[nEventsStarted - 1];
+
+    if (pScript->event == SIM_EVENT_OUTAGE) {
+        fdHubListen = SimHub_Listen(pSimOptions->cstrSocketPath);
+        if ((fdHubListen < 0) || (RegisterEventHandlerToEpoll(fdHubEpoll, fdHubListen, &evtdataListen, EPOLLIN) != 0)) {
+            Log_Debug(MODULE "ERROR: cannot listen again after the outage.\n");
+        }
+    } else if (pScript->event == SIM_EVENT_NETLOSS) {
+        *pbSimNetworkDown = false;
+    }
+    pEvent->nEndMs = Sim_NowMs();
+    for (unsigned int i = 0; i < pSimOptions->nDevices; i++) {
+        if (aDevices[i].nConnectedMs >= 0) {
+            aDevices[i].iRecoveringEvent = (int)(nEventsStarted - 1);
+            pEvent->nAffected++;
+        }
+    }
+    bEventActive = false;
+    Log_Debug(MODULE "INFO: %s ended.\n", acstrSimEventNames[pScript->event]);
+}
+
+static void tickHandler(EventData *eventData)
+{
+    if (ConsumeTimerFdEvent(eventData->fd) != 0) {
+        return;
+    }
+    long long nElapsedMs = Sim_NowMs() - nStartMs;
+
+    if (!bEventActive && (nEventsStarted < pSimOptions->nEvents) && (nElapsedMs < (long long)pSimOptions->nDurationSeconds * 1000)
+        && (nElapsedMs >= (long long)pSimOptions->aEvents[nEventsStarted].nAtSeconds * 1000)) {
+        startEvent();
+    }
+    if (bEventActive) {
+        const sim_event_t *pScript = &pSimOptions->aEvents[nEventsStarted - 1];
+        if (nElapsedMs >= (long long)(pScript->nAtSeconds + pScript->nLengthSeconds) * 1000) {
+            endEvent();
+        }
+    }
+    if ((pSimOptions->nFanOutPeriodSeconds > 0) && !bEventActive && (nElapsedMs >= nNextFanOutMs)
+        && (nElapsedMs + 5000 < (long long)pSimOptions->nDurationSeconds * 1000)) {
+        fanOut();
+        nNextFanOutMs = nElapsedMs + (long long)pSimOptions->nFanOutPeriodSeconds * 1000;
+    }
+}
+
+
+int SimHub_Listen(const char *cstrSocketPath)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(cstrSocketPath) >= sizeof(addr.sun_path)) {
+        Log_Debug(MODULE "ERROR: socket path too long.\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, cstrSocketPath);
+    unlink(cstrSocketPath);
+
+    int fdListen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if ((fdListen < 0) || (bind(fdListen, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(fdListen, SOMAXCONN) != 0)) {
+        Log_Debug(MODULE "ERROR: cannot listen on %s: %s (%d).\n", cstrSocketPath, strerror(errno), errno);
+        if (fdListen >= 0) {
+            close(fdListen);
+        }
+        return -1;
+    }
+    return fdListen;
+}
+
+
+/**
+* @brief    Prints per failure the time from its end to the next telemetry message of each device and
+*           the connections it cost, then the mean time to recover over all failures
+*/
+static void printRecovery(void)
+{
+    long long nTotalMs = 0;
+    size_t nTotalSamples = 0;
+    unsigned int nTotalUnrecovered = 0;
+
+    if (nEventsStarted == 0) {
+        return;
+    }
+    printf("recovery with %s, end of failure -> next telemetry message:\n",
+        pSimOptions->bFastRecovery ? "fast recovery" : "legacy reconnect");
+    for (unsigned int i = 0; i < nEventsStarted; i++) {
+        const sim_event_t *pScript = &pSimOptions->aEvents[i];
+        hub_event_t *pEvent = &aEvents[i];
+        hub_samples_t *pSamples = &pEvent->recoverySamples;
+        long long nSumMs = 0;
+        for (size_t n = 0; n < pSamples->nCount; n++) {
+            nSumMs += pSamples->anValues[n];
+        }
+        nTotalMs += nSumMs;
+        nTotalSamples += pSamples->nCount;
+        nTotalUnrecovered += pEvent->nUnrecovered;
+        if (pSamples->nCount > 0) {
+            qsort(pSamples->anValues, pSamples->nCount, sizeof(*pSamples->anValues), compareSamples);
+        }
+        printf("  %-7s %3u s at %3u s: %6u/%-6u mean %6lld ms  median %6lld ms  p95 %6lld ms  max %6lld ms,"
+            " %u connections (peak %zu/s)\n", acstrSimEventNames[pScript->event], pScript->nLengthSeconds, pScript->nAtSeconds,
+            pEvent->nAffected - pEvent->nUnrecovered, pEvent->nAffected, (pSamples->nCount > 0) ? nSumMs / (long long)pSamples->nCount : 0,
+            percentile(pSamples, 50), percentile(pSamples, 95), percentile(pSamples, 100),
+            pEvent->nAccepted, peakPerSecond(&pEvent->acceptSamples));
+    }
+    printf("  mean time to recover %lld ms over %zu device recoveries", (nTotalSamples > 0) ? nTotalMs / (long long)nTotalSamples : 0, nTotalSamples);
+    if (nTotalUnrecovered > 0) {
+        printf(", at least: %u did not recover before the next failure or the end and count until then", nTotalUnrecovered);
+    }
+    printf("\n");
+}
+
+static void printReport(void)
+{
+    double fSeconds = pSimOptions->nDurationSeconds;
+    unsigned int nPeakEvents = 0;
+    for (size_t i = 0; i < nEventSeconds; i++) {
+        if (anEventsPerSecond[i] > nPeakEvents) {
+            nPeakEvents = anEventsPerSecond[i];
+        }
+    }
+
+    printf("\n%u devices, %u s, telemetry every %u ms\n", pSimOptions->nDevices, pSimOptions->nDurationSeconds, pSimOptions->nTelemetryPeriodMs);
+    printf("messages: %llu (%.1f msg/s, peak %u msg/s), %u connections accepted, %u hub writes failed\n",
+        aTopicStats[HUB_TOPIC_EVENTS].nMessages, (double)aTopicStats[HUB_TOPIC_EVENTS].nMessages / fSeconds,
+        nPeakEvents, nAccepted, nWriteFailures);
+    for (int i = 0; i < HUB_TOPIC_COUNT; i++) {
+        printf("  %-40s %10llu msgs %12llu bytes\n", acstrTopicNames[i], aTopicStats[i].nMessages, aTopicStats[i].nBytes);
+    }
+
+    printf("latencies:\n");
+    printSamples("initial connect", &connectSamples, pSimOptions->nDevices);
+    printSamples("twin patch -> reported", &twinSamples, nTwinsSent);
+    printSamples("method -> response", &methodSamples, nMethodsSent);
+    printf("  %u fan-outs, %u device round trips missed\n", nFanOuts, nFanOutMissed);
+
+    printRecovery();
+
+    hub_samples_t privateSamples = {0}, heapSamples = {0};
+    unsigned long long nConfirmed = 0;
+    for (size_t i = 0; i < nResults; i++) {
+        addSample(&privateSamples, (long long)aResults[i].nPrivateKb);
+        addSample(&heapSamples, (long long)aResults[i].nHeapBytes);
+        nConfirmed += aResults[i].nConfirmed;
+    }
+    if (nResults > 0) {
+        qsort(privateSamples.anValues, privateSamples.nCount, sizeof(long long), compareSamples);
+        qsort(heapSamples.anValues, heapSamples.nCount, sizeof(long long), compareSamples);
+    }
+    printf("per instance (%zu results): private memory median %lld kB max %lld kB, heap median %lld bytes max %lld bytes\n",
+        nResults, percentile(&privateSamples, 50), percentile(&privateSamples, 100),
+        percentile(&heapSamples, 50), percentile(&heapSamples, 100));
+    printf("telemetry confirmed on the devices: %llu\n", nConfirmed);
+    free(privateSamples.anValues);
+    free(heapSamples.anValues);
+}
+
+
+int SimHub_Run(const sim_options_t *pOptions, int fdListen, const pid_t *apidDevices, int fdResult)
+{
+    pSimOptions = pOptions;
+    apidSimDevices = apidDevices;
+    fdHubListen = fdListen;
+    nEventSeconds = pOptions->nDurationSeconds + SIM_HUB_GRACE_MS / 1000 + 1;
+    aDevices = calloc(pOptions->nDevices, sizeof(*aDevices));
+    aResults = calloc(pOptions->nDevices, sizeof(*aResults));
+    anEventsPerSecond = calloc(nEventSeconds, sizeof(*anEventsPerSecond));
+    if ((aDevices == NULL) || (aResults == NULL) || (anEventsPerSecond == NULL)) {
+        Log_Debug(MODULE "ERROR: out of memory.\n");
+        return EXIT_FAILURE;
+    }
+    for (unsigned int i = 0; i < pOptions->nDevices; i++) {
+        aDevices[i].nDevice = i;
+        aDevices[i].nConnectedMs = -1;
+        aDevices[i].iRecoveringEvent = -1;
+    }
+
+    static const struct timespec tsTick = { 0, 100 * 1000 * 1000 };
+    fdHubEpoll = CreateEpollFd();
+    if ((fdHubEpoll < 0)
+        || (RegisterEventHandlerToEpoll(fdHubEpoll, fdListen, &evtdataListen, EPOLLIN) != 0)
+        || (RegisterEventHandlerToEpoll(fdHubEpoll, fdResult, &evtdataResult, EPOLLIN) != 0)
+        || (CreateTimerFdAndAddToEpoll(fdHubEpoll, &tsTick, &evtdataTick, EPOLLIN) < 0)) {
+        return EXIT_FAILURE;
+    }
+
+    nStartMs = Sim_NowMs();
+    nNextFanOutMs = (long long)pOptions->nFanOutPeriodSeconds * 1000;
+    long long nEndMs = nStartMs + (long long)pOptions->nDurationSeconds * 1000 + SIM_HUB_GRACE_MS;
+    while ((Sim_NowMs() < nEndMs) && (nResults < pOptions->nDevices)) {
+        WaitForEventAndCallHandler(fdHubEpoll);
+    }
+    censorRecoveries(nStartMs + (long long)pOptions->nDurationSeconds * 1000);
+
+    printReport();
+    for (unsigned int i = 0; i < pOptions->nDevices; i++) {
+        closeConnection(&aDevices[i]);
+    }
+    if (fdHubListen >= 0) {
+        close(fdHubListen);
+        unlink(pOptions->cstrSocketPath);
+    }
+    return (nResults == pOptions->nDevices) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,56 @@
+/**
+* @brief Linux implementations of the few Azure Sphere functions the AvnetSK2 IoT modules use
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <fcntl.h>
+
+#include <applibs/log.h>
+#include <applibs/networking.h>
+#include <applibs/application.h>
+#include <applibs/storage.h>
+#include <azureiot/azure_sphere_provisioning.h>
+
+#include "simulator.h"
+
+extern bool bSimVerbose;
+
+int Log_DebugVarArgs(const char *fmt, va_list args)
+{
+    return bSimVerbose ? vfprintf(stderr, fmt, args) : 0;
+}
+
+int Log_Debug(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int iResult = Log_DebugVarArgs(fmt, args);
+    va_end(args);
+    return iResult;
+}
+
+int Networking_IsNetworkingReady(bool *outIsNetworkingReady)
+{
+    *outIsNetworkingReady = (pbSimNetworkDown == NULL) || !*pbSimNetworkDown;
+    return 0;
+}
+
+/// @brief no device certificate on Linux, only transports without provisioning connect
+int Application_IsDeviceAuthReady(bool *outIsReady)
+{
+    *outIsReady = false;
+    return 0;
+}
+
+int Storage_OpenFileInImagePackage(const char *relativePath)
+{
+    return open(relativePath, O_RDONLY);
+}
+
+IOTHUB_DEVICE_CLIENT_LL_HANDLE IoTHubDeviceClient_LL_CreateWithAzureSphereFromDeviceAuth(const char *iothubUri,
+    IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol)
+{
+    return NULL;
+}
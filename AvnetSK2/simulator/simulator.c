@@ -0,0 +1,170 @@
+/**
+* @brief Fleet load simulator, see simulator.h
+*
+*   simulator [-n devices] [-d seconds] [-t telemetry ms] [-o outage at s] [-l outage length s]
+*             [-p failure script] [-m fast|legacy] [-f fan-out period s] [-s socket path] [-v]
+*
+*   e.g. "simulator -n 500 -d 120 -o 40 -l 15" runs 500 devices for two minutes and takes the hub
+*   down for 15 s after 40 s. The failure script "-p 20:outage:10,40:drop,50:netloss:3,60:reject:5" plays
+*   a hub outage, dropped connections, a device network loss and rejected credentials instead; "-m legacy" runs the devices
+*   without fast recovery for comparison. The report lists the aggregate message rate, the traffic per
+*   IoT Hub topic, connect and fan-out latencies, the time to recover from each failure and the
+*   memory per device instance.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "simulator.h"
+
+/// @brief Log_Debug of the device instances is only printed with -v
+bool bSimVerbose = false;
+
+volatile bool *pbSimNetworkDown = NULL;
+
+const char *const acstrSimEventNames[SIM_EVENT_COUNT] = { "outage", "drop", "netloss", "reject" };
+
+static void usage(const char *cstrProgram)
+{
+    fprintf(stderr, "usage: %s [-n devices] [-d seconds] [-t telemetry ms] [-o outage at s] [-l outage length s]"
+        " [-p <at s>:<outage|drop|netloss|reject>[:<length s>],...] [-m fast|legacy] [-f fan-out period s] [-s socket path] [-v]\n",
+        cstrProgram);
+}
+
+/**
+* @brief    Appends one failure to the script
+* @return   false if the script is full or the failure overlaps the previous one
+*/
+static bool addEvent(sim_options_t *pOptions, SIM_EVENT event, unsigned int nAtSeconds, unsigned int nLengthSeconds)
+{
+    if (pOptions->nEvents >= SIM_MAX_EVENTS) {
+        return false;
+    }
+    if (pOptions->nEvents > 0) {
+        const sim_event_t *pPrevious = &pOptions->aEvents[pOptions->nEvents - 1];
+        if (nAtSeconds <= pPrevious->nAtSeconds + pPrevious->nLengthSeconds) {
+            return false;
+        }
+    }
+    pOptions->aEvents[pOptions->nEvents++] = (sim_event_t){ .event = event, .nAtSeconds = nAtSeconds, .nLengthSeconds = nLengthSeconds };
+    return true;
+}
+
+/**
+* @brief    Parses "<at s>:<outage|drop|netloss|reject>[:<length s>],..." into the failure script
+*/
+static bool parseScript(sim_options_t *pOptions, char *strScript)
+{
+    char *pSave = NULL;
+    for (char *pEntry = strtok_r(strScript, ",", &pSave); pEntry != NULL; pEntry = strtok_r(NULL, ",", &pSave)) {
+        unsigned int nAtSeconds = 0, nLengthSeconds = 0;
+        char strName[16];
+        int nFields = sscanf(pEntry, "%u:%15[a-z]:%u", &nAtSeconds, strName, &nLengthSeconds);
+        int iEvent = SIM_EVENT_COUNT;
+        for (int i = 0; (nFields >= 2) && (i < SIM_EVENT_COUNT); i++) {
+            if (strcmp(strName, acstrSimEventNames[i]) == 0) {
+                iEvent = i;
+            }
+        }
+        if ((iEvent == SIM_EVENT_COUNT) || (nAtSeconds == 0) || ((nFields == 3) != (iEvent != SIM_EVENT_DROP))
+            || !addEvent(pOptions, (SIM_EVENT)iEvent, nAtSeconds, nLengthSeconds)) {
+            fprintf(stderr, "invalid failure '%s': ascending, not overlapping, all but drop need a length\n", pEntry);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    sim_options_t options = {
+        .nDevices = 100,
+        .nDurationSeconds = 60,
+        .nTelemetryPeriodMs = 1000,
+        .nFanOutPeriodSeconds = 15,
+        .cstrSocketPath = "/tmp/avnetsk2-sim.sock",
+        .bFastRecovery = true,
+        .bVerbose = false
+    };
+    unsigned int nOutageAtSeconds = 20;
+    unsigned int nOutageSeconds = 10;
+    char *strScript = NULL;
+
+    int iOption;
+    while ((iOption = getopt(argc, argv, "n:d:t:o:l:p:m:f:s:v")) != -1) {
+        switch (iOption) {
+        case 'n': options.nDevices = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'd': options.nDurationSeconds = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 't': options.nTelemetryPeriodMs = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'o': nOutageAtSeconds = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'l': nOutageSeconds = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'p': strScript = optarg; break;
+        case 'm': options.bFastRecovery = (strcmp(optarg, "legacy") != 0); break;
+        case 'f': options.nFanOutPeriodSeconds = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 's': options.cstrSocketPath = optarg; break;
+        case 'v': options.bVerbose = true; break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if ((options.nDevices == 0) || (options.nDurationSeconds == 0) || (options.nTelemetryPeriodMs == 0)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    // without a script -o/-l give a single outage
+    if ((strScript != NULL) ? !parseScript(&options, strScript)
+        : ((nOutageAtSeconds > 0) && !addEvent(&options, SIM_EVENT_OUTAGE, nOutageAtSeconds, nOutageSeconds))) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    bSimVerbose = options.bVerbose;
+
+    // the network flag is shared with the device processes forked below
+    pbSimNetworkDown = mmap(NULL, sizeof(*pbSimNetworkDown), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (pbSimNetworkDown == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    *pbSimNetworkDown = false;
+
+    // writes to a connection the hub dropped fail with EPIPE instead of killing the device
+    signal(SIGPIPE, SIG_IGN);
+
+    int fdListen = SimHub_Listen(options.cstrSocketPath);
+    int afdResult[2];
+    pid_t *apidDevices = calloc(options.nDevices, sizeof(*apidDevices));
+    if ((fdListen < 0) || (pipe(afdResult) != 0) || (apidDevices == NULL)) {
+        perror("simulator");
+        return EXIT_FAILURE;
+    }
+
+    for (unsigned int i = 0; i < options.nDevices; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fdListen);
+            close(afdResult[0]);
+            _exit(SimDevice_Run(i, &options, afdResult[1]));
+        }
+        if (pid < 0) {
+            perror("fork");
+            options.nDevices = i;
+            break;
+        }
+        apidDevices[i] = pid;
+    }
+    close(afdResult[1]);
+
+    int iResult = SimHub_Run(&options, fdListen, apidDevices, afdResult[0]);
+
+    for (unsigned int i = 0; i < options.nDevices; i++) {
+        kill(apidDevices[i], SIGTERM);
+        waitpid(apidDevices[i], NULL, 0);
+    }
+    free(apidDevices);
+    return iResult;
+}
@@ -0,0 +1,93 @@
+/**
+* @file simulator.h
+* @brief Fleet load simulator for Linux. Every simulated device is a process running the AvnetSK2
+*   IoT stack (azure_iot*.c, DPS/hub state machine, PnP batching and reported property cache) over
+*   the local transport (azure_iot_transport.h). The parent process is the stand-in IoT Hub: it
+*   accepts the device connections on a Unix socket, accounts their traffic by IoT Hub MQTT topic,
+*   fans out twin patches and direct methods, and plays a script of failures (hub outage, dropped
+*   connections, device network loss) to measure the reconnect storm and the time to recover.
+*/
+#pragma once
+#ifndef _SIMULATOR_H_
+#define _SIMULATOR_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/// @brief max number of scripted failures per run
+#define SIM_MAX_EVENTS (16)
+
+/// @brief scripted failures
+typedef enum {
+    SIM_EVENT_OUTAGE = 0,               ///< hub sends "disconnect", closes all connections and stops listening
+    SIM_EVENT_DROP,                     ///< hub closes all connections but keeps listening
+    SIM_EVENT_NETLOSS,                  ///< networking of all devices reports not ready, connections stay
+    SIM_EVENT_REJECT,                   ///< hub rejects the credential of every device (re)connecting
+    SIM_EVENT_COUNT
+} SIM_EVENT;
+
+typedef struct {
+    SIM_EVENT event;
+    unsigned int nAtSeconds;
+    unsigned int nLengthSeconds;        ///< 0 for a drop
+} sim_event_t;
+
+/// @brief run parameters, see usage in simulator.c
+typedef struct {
+    unsigned int nDevices;
+    unsigned int nDurationSeconds;
+    unsigned int nTelemetryPeriodMs;    ///< per device
+    sim_event_t aEvents[SIM_MAX_EVENTS];///< ascending by nAtSeconds, must not overlap
+    unsigned int nEvents;
+    unsigned int nFanOutPeriodSeconds;  ///< twin patch and direct method to all devices, 0: none
+    const char *cstrSocketPath;
+    bool bFastRecovery;                 ///< see AzureIoT_DPS_SetFastRecovery()
+    bool bVerbose;                      ///< device Log_Debug output
+} sim_options_t;
+
+/// @brief names of SIM_EVENT in the failure script
+extern const char *const acstrSimEventNames[SIM_EVENT_COUNT];
+
+/// @brief shared with all device processes: set by the hub during SIM_EVENT_NETLOSS, read by
+/// Networking_IsNetworkingReady()
+extern volatile bool *pbSimNetworkDown;
+
+/// @brief result of one device process, written to the result pipe when it ends
+typedef struct {
+    unsigned int nDevice;
+    unsigned int nConfirmed;            ///< telemetry messages confirmed
+    unsigned int nConnects;             ///< AUTHENTICATED status changes
+    size_t nPrivateKb;                  ///< private memory (not shared with the other instances)
+    size_t nHeapBytes;                  ///< heap in use
+} sim_device_result_t;
+
+/**
+* @brief    Runs one device until the duration has passed, then writes its result to fdResult
+* @param    nDevice     device index, used for the telemetry phase and the result
+* @param    pOptions    run parameters
+* @param    fdResult    write end of the result pipe
+* @return   process exit code
+*/
+int SimDevice_Run(unsigned int nDevice, const sim_options_t *pOptions, int fdResult);
+
+/**
+* @brief    Runs the stand-in IoT Hub for the devices in apidDevices until the duration has passed
+*           plus a grace period, collects the device results from fdResult and prints the report
+* @param    pOptions    run parameters
+* @param    fdListen    bound and listening Unix socket
+* @param    apidDevices process id per device index, connections are matched by peer credentials
+* @param    fdResult    read end of the result pipe
+* @return   process exit code
+*/
+int SimHub_Run(const sim_options_t *pOptions, int fdListen, const pid_t *apidDevices, int fdResult);
+
+/**
+* @brief    Creates the listening Unix socket of the stand-in IoT Hub
+* @return   socket, -1 on failure
+*/
+int SimHub_Listen(const char *cstrSocketPath);
+
+/// @brief monotonic clock in milliseconds
+long long Sim_NowMs(void);
+
+#endif
@@ -0,0 +1,491 @@
+/**
+* @brief Host test of the DPS assignment cache in azure_iot_dps.c. The provisioning and IoT Hub clients
+*   of the SDK are replaced by stubs: DPS assigns the IoT Hub of the test case on its first poll and an
+*   IoT Hub client authenticates on its first DoWork, or rejects the device with BAD_CREDENTIAL.
+*   Each device start runs in a child process, so the module starts from scratch like after a reboot
+*   while the assignment storage file is kept.
+*
+*   test_dps [-v]
+*
+*   -v prints the log of the IoT modules. Returns EXIT_FAILURE if a check fails.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <azureiot/iothub_device_client_ll.h>
+#include <azureiot/azure_sphere_provisioning.h>
+#include <azure_prov_client/prov_device_ll_client.h>
+#include <azure_prov_client/prov_security_factory.h>
+#include <azure_prov_client/prov_transport_mqtt_client.h>
+#include <azure_prov_client/iothub_security_factory.h>
+
+#include <applibs/log.h>
+#include <applibs/networking.h>
+#include <applibs/application.h>
+#include <applibs/storage.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "azure_iot.h"
+#include "azure_iot_dps.h"
+
+#define TEST_SCOPE_ID       "0ne000A0001"
+#define TEST_OTHER_SCOPE_ID "0ne000A0002"
+#define TEST_HUB            "iotc-a.azure-devices.net"
+#define TEST_OTHER_HUB      "iotc-b.azure-devices.net"
+
+/// @brief limit of a device start, DPS polls once per second
+#define TEST_START_TIMEOUT_SECONDS (10)
+
+static bool bVerbose = false;
+static unsigned int nChecks = 0;
+static unsigned int nFailures = 0;
+
+/// @brief a device start: the setup by the test case and the outcome reported by the child process
+typedef struct {
+    const char *cstrScopeId;
+    const char *cstrDpsHub;         ///< IoT Hub the DPS stub assigns
+    const char *cstrRejectingHub;   ///< IoT Hub rejecting the device with BAD_CREDENTIAL, NULL for none
+    bool bFastRecovery;
+
+    bool bRestored;                 ///< result of AzureIoT_DPS_InitializeAssignmentStorage()
+    bool bConnected;
+    int nDpsRegistrations;
+    int nHubClients;
+    char strHubUri[64];             ///< IoT Hub of the last client
+} device_start_t;
+
+/// @brief shared with the child process of the current device start
+static device_start_t *pStart = NULL;
+static int fdStorage = -1;
+
+#define CHECK(condition) check((condition), #condition, __func__, __LINE__)
+
+static void check(bool bCondition, const char *cstrCondition, const char *cstrTest, int nLine)
+{
+    nChecks++;
+    if (!bCondition) {
+        nFailures++;
+        printf("  FAILED %s:%d: %s\n", cstrTest, nLine, cstrCondition);
+    }
+}
+
+/*****************************************************************************
+ *   platform and SDK stubs
+ *****************************************************************************/
+
+int Log_DebugVarArgs(const char *fmt, va_list args)
+{
+    return bVerbose ? vfprintf(stderr, fmt, args) : 0;
+}
+
+int Log_Debug(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int nResult = Log_DebugVarArgs(fmt, args);
+    va_end(args);
+    return nResult;
+}
+
+int Networking_IsNetworkingReady(bool *outIsNetworkingReady)
+{
+    *outIsNetworkingReady = true;
+    return 0;
+}
+
+int Application_IsDeviceAuthReady(bool *outIsReady)
+{
+    *outIsReady = true;
+    return 0;
+}
+
+int Storage_OpenFileInImagePackage(const char *relativePath)
+{
+    return -1;
+}
+
+static PROV_DEVICE_CLIENT_REGISTER_DEVICE_CALLBACK fnDpsRegistered = NULL;
+static void *pDpsContext = NULL;
+
+static IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK fnHubStatus = NULL;
+static void *pHubStatusContext = NULL;
+static bool bHubAnswered = false;
+
+int prov_dev_security_init(SECURE_DEVICE_TYPE hsm_type)
+{
+    return 0;
+}
+
+const PROV_DEVICE_TRANSPORT_PROVIDER *Prov_Device_MQTT_Protocol(void)
+{
+    return NULL;
+}
+
+PROV_DEVICE_LL_HANDLE Prov_Device_LL_Create(const char *uri, const char *scope_id, PROV_DEVICE_TRANSPORT_PROVIDER_FUNCTION protocol)
+{
+    return (PROV_DEVICE_LL_HANDLE)&fnDpsRegistered;
+}
+
+void Prov_Device_LL_Destroy(PROV_DEVICE_LL_HANDLE handle)
+{
+    fnDpsRegistered = NULL;
+}
+
+PROV_DEVICE_RESULT Prov_Device_LL_SetOption(PROV_DEVICE_LL_HANDLE handle, const char *optionName, const void *value)
+{
+    return PROV_DEVICE_RESULT_OK;
+}
+
+PROV_DEVICE_RESULT Prov_Device_LL_Set_Provisioning_Payload(PROV_DEVICE_LL_HANDLE handle, const char *json)
+{
+    return PROV_DEVICE_RESULT_OK;
+}
+
+PROV_DEVICE_RESULT Prov_Device_LL_Register_Device(PROV_DEVICE_LL_HANDLE handle, PROV_DEVICE_CLIENT_REGISTER_DEVICE_CALLBACK register_callback,
+    void *user_context, PROV_DEVICE_CLIENT_REGISTER_STATUS_CALLBACK reg_status_cb, void *status_user_ctext)
+{
+    pStart->nDpsRegistrations++;
+    fnDpsRegistered = register_callback;
+    pDpsContext = user_context;
+    return PROV_DEVICE_RESULT_OK;
+}
+
+/// @brief assigns the IoT Hub of the test case on the first poll
+void Prov_Device_LL_DoWork(PROV_DEVICE_LL_HANDLE handle)
+{
+    if (fnDpsRegistered != NULL) {
+        PROV_DEVICE_CLIENT_REGISTER_DEVICE_CALLBACK fnRegistered = fnDpsRegistered;
+        fnDpsRegistered = NULL;
+        fnRegistered(PROV_DEVICE_RESULT_OK, pStart->cstrDpsHub, "sk2-test", pDpsContext);
+    }
+}
+
+const TRANSPORT_PROVIDER *MQTT_Protocol(void)
+{
+    return NULL;
+}
+
+int IoTHub_Init(void)
+{
+    return 0;
+}
+
+void IoTHub_Deinit(void)
+{
+}
+
+int iothub_security_init(IOTHUB_SECURITY_TYPE sec_type)
+{
+    return 0;
+}
+
+void iothub_security_deinit(void)
+{
+}
+
+IOTHUB_DEVICE_CLIENT_LL_HANDLE IoTHubDeviceClient_LL_CreateWithAzureSphereFromDeviceAuth(const char *iothubUri,
+    IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol)
+{
+    pStart->nHubClients++;
+    snprintf(pStart->strHubUri, sizeof(pStart->strHubUri), "%s", iothubUri);
+    bHubAnswered = false;
+    return (IOTHUB_DEVICE_CLIENT_LL_HANDLE)&fnHubStatus;
+}
+
+void IoTHubDeviceClient_LL_Destroy(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle)
+{
+    fnHubStatus = NULL;
+}
+
+/// @brief authenticates on the first call, or rejects the device at the rejecting IoT Hub
+void IoTHubDeviceClient_LL_DoWork(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle)
+{
+    if (bHubAnswered || (fnHubStatus == NULL)) {
+        return;
+    }
+    bHubAnswered = true;
+    if ((pStart->cstrRejectingHub != NULL) && (strcmp(pStart->strHubUri, pStart->cstrRejectingHub) == 0)) {
+        fnHubStatus(IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED, IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL, pHubStatusContext);
+    } else {
+        fnHubStatus(IOTHUB_CLIENT_CONNECTION_AUTHENTICATED, IOTHUB_CLIENT_CONNECTION_OK, pHubStatusContext);
+    }
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetConnectionStatusCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle,
+    IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK connectionStatusCallback, void *userContextCallback)
+{
+    fnHubStatus = connectionStatusCallback;
+    pHubStatusContext = userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetOption(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle, const char *optionName, const void *value)
+{
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetRetryPolicy(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle, IOTHUB_CLIENT_RETRY_POLICY retryPolicy,
+    size_t retryTimeoutLimitInSeconds)
+{
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetMessageCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle,
+    IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC messageCallback, void *userContextCallback)
+{
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetDeviceMethodCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle,
+    IOTHUB_CLIENT_DEVICE_METHOD_CALLBACK_ASYNC deviceMethodCallback, void *userContextCallback)
+{
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetDeviceTwinCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle,
+    IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK deviceTwinCallback, void *userContextCallback)
+{
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SendEventAsync(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle, IOTHUB_MESSAGE_HANDLE eventMessageHandle,
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventConfirmationCallback, void *userContextCallback)
+{
+    return IOTHUB_CLIENT_ERROR;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SendReportedState(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle, const unsigned char *reportedState,
+    size_t size, IOTHUB_CLIENT_REPORTED_STATE_CALLBACK reportedStateCallback, void *userContextCallback)
+{
+    return IOTHUB_CLIENT_ERROR;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_GetSendStatus(IOTHUB_DEVICE_CLIENT_LL_HANDLE iotHubClientHandle, IOTHUB_CLIENT_STATUS *iotHubClientStatus)
+{
+    *iotHubClientStatus = IOTHUB_CLIENT_SEND_STATUS_IDLE;
+    return IOTHUB_CLIENT_OK;
+}
+
+/// @brief no messages are sent in this test, creating one fails
+IOTHUB_MESSAGE_HANDLE IoTHubMessage_CreateFromString(const char *source)
+{
+    return NULL;
+}
+
+void IoTHubMessage_Destroy(IOTHUB_MESSAGE_HANDLE iotHubMessageHandle)
+{
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_GetByteArray(IOTHUB_MESSAGE_HANDLE iotHubMessageHandle, const unsigned char **buffer, size_t *size)
+{
+    return IOTHUB_MESSAGE_ERROR;
+}
+
+const char *IoTHubMessage_GetString(IOTHUB_MESSAGE_HANDLE iotHubMessageHandle)
+{
+    return NULL;
+}
+
+const char *IoTHubMessage_GetMessageId(IOTHUB_MESSAGE_HANDLE iotHubMessageHandle)
+{
+    return NULL;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_SetMessageId(IOTHUB_MESSAGE_HANDLE iotHubMessageHandle, const char *messageId)
+{
+    return IOTHUB_MESSAGE_ERROR;
+}
+
+const char *IoTHubMessage_GetProperty(IOTHUB_MESSAGE_HANDLE msg_handle, const char *key)
+{
+    return NULL;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_SetProperty(IOTHUB_MESSAGE_HANDLE msg_handle, const char *key, const char *value)
+{
+    return IOTHUB_MESSAGE_ERROR;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_SetContentTypeSystemProperty(IOTHUB_MESSAGE_HANDLE iotHubMessageHandle, const char *contentType)
+{
+    return IOTHUB_MESSAGE_ERROR;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_SetContentEncodingSystemProperty(IOTHUB_MESSAGE_HANDLE iotHubMessageHandle, const char *contentEncoding)
+{
+    return IOTHUB_MESSAGE_ERROR;
+}
+
+/*****************************************************************************
+ *   device starts
+ *****************************************************************************/
+
+static void connectionStatusChanged(bool bConnected, const char *cstrReason)
+{
+    pStart->bConnected = bConnected;
+}
+
+/// @brief the device side of a start, runs in the child process until the IoT Hub authenticates
+static void runDevice(void)
+{
+    AzureIoT_DPS_SetScopeID(pStart->cstrScopeId);
+    AzureIoT_DPS_SetFastRecovery(pStart->bFastRecovery);
+    AzureIoT_SetConnectionStatusCallback(&connectionStatusChanged);
+    pStart->bRestored = AzureIoT_DPS_InitializeAssignmentStorage(fdStorage, 0, 4096);
+
+    int fdEpoll = CreateEpollFd();
+    if ((fdEpoll < 0) || (AzureIoT_DPS_Initialize(fdEpoll, "dtmi:avnet:mt3620starterkit;1") != 0)) {
+        exit(EXIT_FAILURE);
+    }
+    AzureIoT_DPS_StartConnection();
+
+    struct timespec tsStart, tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsStart);
+    do {
+        WaitForEventAndCallHandler(fdEpoll);
+        clock_gettime(CLOCK_MONOTONIC, &tsNow);
+    } while (!pStart->bConnected && (tsNow.tv_sec - tsStart.tv_sec < TEST_START_TIMEOUT_SECONDS));
+    exit(EXIT_SUCCESS);
+}
+
+/// @brief starts the device with the assignment storage kept from the previous start
+static device_start_t *startDevice(const char *cstrScopeId, const char *cstrDpsHub, const char *cstrRejectingHub, bool bFastRecovery)
+{
+    memset(pStart, 0, sizeof(*pStart));
+    pStart->cstrScopeId = cstrScopeId;
+    pStart->cstrDpsHub = cstrDpsHub;
+    pStart->cstrRejectingHub = cstrRejectingHub;
+    pStart->bFastRecovery = bFastRecovery;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        runDevice();
+    }
+    int nStatus = 0;
+    CHECK((pid > 0) && (waitpid(pid, &nStatus, 0) == pid) && WIFEXITED(nStatus) && (WEXITSTATUS(nStatus) == EXIT_SUCCESS));
+    return pStart;
+}
+
+/// @brief a fresh storage file, the first start registers through DPS and stores the assignment
+static void provisionDevice(const char *cstrScopeId, const char *cstrHub)
+{
+    if (fdStorage >= 0) {
+        close(fdStorage);
+    }
+    char strPath[] = "/tmp/dps_assignment_XXXXXX";
+    fdStorage = mkstemp(strPath);
+    CHECK(fdStorage >= 0);
+    unlink(strPath);
+
+    device_start_t *pFirst = startDevice(cstrScopeId, cstrHub, NULL, true);
+    CHECK(!pFirst->bRestored);
+    CHECK(pFirst->bConnected);
+    CHECK(pFirst->nDpsRegistrations == 1);
+}
+
+/*****************************************************************************
+ *   test cases
+ *****************************************************************************/
+
+static void testCacheHit(void)
+{
+    provisionDevice(TEST_SCOPE_ID, TEST_HUB);
+
+    // DPS would assign another IoT Hub now, the cached one is used without asking
+    device_start_t *pStart = startDevice(TEST_SCOPE_ID, TEST_OTHER_HUB, NULL, true);
+    CHECK(pStart->bRestored);
+    CHECK(pStart->bConnected);
+    CHECK(pStart->nDpsRegistrations == 0);
+    CHECK(pStart->nHubClients == 1);
+    CHECK(strcmp(pStart->strHubUri, TEST_HUB) == 0);
+}
+
+static void testScopeIdChange(void)
+{
+    provisionDevice(TEST_SCOPE_ID, TEST_HUB);
+
+    device_start_t *pStart = startDevice(TEST_OTHER_SCOPE_ID, TEST_OTHER_HUB, NULL, true);
+    CHECK(!pStart->bRestored);
+    CHECK(pStart->bConnected);
+    CHECK(pStart->nDpsRegistrations == 1);
+    CHECK(strcmp(pStart->strHubUri, TEST_OTHER_HUB) == 0);
+
+    // the new assignment is cached for the new Scope Id
+    pStart = startDevice(TEST_OTHER_SCOPE_ID, TEST_HUB, NULL, true);
+    CHECK(pStart->bRestored);
+    CHECK(pStart->nDpsRegistrations == 0);
+    CHECK(strcmp(pStart->strHubUri, TEST_OTHER_HUB) == 0);
+}
+
+static void testExpiry(void)
+{
+    provisionDevice(TEST_SCOPE_ID, TEST_HUB);
+
+    // the test target shortens AZURE_IOT_DPS_ASSIGNMENT_MAX_AGE_SECONDS
+    sleep(AZURE_IOT_DPS_ASSIGNMENT_MAX_AGE_SECONDS + 1);
+
+    device_start_t *pStart = startDevice(TEST_SCOPE_ID, TEST_OTHER_HUB, NULL, true);
+    CHECK(!pStart->bRestored);
+    CHECK(pStart->bConnected);
+    CHECK(pStart->nDpsRegistrations == 1);
+    CHECK(strcmp(pStart->strHubUri, TEST_OTHER_HUB) == 0);
+}
+
+static void testBadCredentialFallback(void)
+{
+    provisionDevice(TEST_SCOPE_ID, TEST_HUB);
+
+    // the cached IoT Hub rejects the device: the assignment is invalidated and DPS assigns another one,
+    // without fast recovery the first retry is immediate instead of after the 5 s credential backoff
+    device_start_t *pStart = startDevice(TEST_SCOPE_ID, TEST_OTHER_HUB, TEST_HUB, false);
+    CHECK(pStart->bRestored);
+    CHECK(pStart->bConnected);
+    CHECK(pStart->nDpsRegistrations == 1);
+    CHECK(pStart->nHubClients == 2);
+    CHECK(strcmp(pStart->strHubUri, TEST_OTHER_HUB) == 0);
+
+    // the next start uses the new assignment
+    pStart = startDevice(TEST_SCOPE_ID, TEST_HUB, TEST_HUB, true);
+    CHECK(pStart->bRestored);
+    CHECK(pStart->bConnected);
+    CHECK(pStart->nDpsRegistrations == 0);
+    CHECK(strcmp(pStart->strHubUri, TEST_OTHER_HUB) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+    bVerbose = (argc > 1) && (strcmp(argv[1], "-v") == 0);
+
+    pStart = mmap(NULL, sizeof(*pStart), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (pStart == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    static const struct {
+        const char *cstrName;
+        void (*fnTest)(void);
+    } aTests[] = {
+        { "cache hit", testCacheHit },
+        { "Scope Id change", testScopeIdChange },
+        { "expiry", testExpiry },
+        { "BAD_CREDENTIAL fallback", testBadCredentialFallback }
+    };
+
+    for (size_t i = 0; i < sizeof(aTests) / sizeof(aTests[0]); i++) {
+        unsigned int nFailuresBefore = nFailures;
+        aTests[i].fnTest();
+        printf("%-30s %s\n", aTests[i].cstrName, (nFailures == nFailuresBefore) ? "ok" : "FAILED");
+    }
+    printf("%u checks, %u failed\n", nChecks, nFailures);
+    return (nFailures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
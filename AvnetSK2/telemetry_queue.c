@@ -0,0 +1,300 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <applibs/log.h>
+
+#include "telemetry_queue.h"
+
+#define MODULE "[QUEUE] "
+
+#define RECORD_MAGIC        (0x5146)
+#define RECORD_CONSUMED     (0x00)
+#define RECORD_PENDING      (0x01)
+#define RECORD_HEADER_SIZE  (24)
+
+/// @brief record slot, identical in RAM and storage. nState is not covered by the CRC, so a
+///        record is marked consumed by rewriting a single byte.
+typedef struct {
+    uint32_t nCrc;
+    uint32_t nSequence;
+    int64_t  tCapture;
+    uint16_t nMagic;
+    uint16_t nPayloadSize;
+    uint8_t  nComponentSize;
+    uint8_t  nState;
+    uint16_t nReserved;
+    char     abData[TELEMETRY_QUEUE_SLOT_SIZE - RECORD_HEADER_SIZE];  ///< component name, then payload
+} queue_record_t;
+
+_Static_assert(sizeof(queue_record_t) == TELEMETRY_QUEUE_SLOT_SIZE, "queue_record_t must fill exactly one slot");
+
+/// @brief RAM ring, records spill from nRamHead (oldest) to storage
+static queue_record_t aRamRecords[TELEMETRY_QUEUE_RAM_RECORDS];
+static size_t nRamHead = 0;
+static size_t nRamCount = 0;
+
+/// @brief storage ring, records between nReadSlot (oldest) and nWriteSlot
+static int fdStorage = -1;
+static off_t nStorageOffset = 0;
+static size_t nSlots = 0;
+static size_t nReadSlot = 0;
+static size_t nWriteSlot = 0;
+static size_t nStoredCount = 0;
+static uint32_t nNextSequence = 0;
+
+static size_t nDroppedCount = 0;
+
+/// @brief buffers handing zero terminated strings of a record to the send function
+static queue_record_t recDrain;
+static char strDrainComponent[256];
+static char strDrainPayload[sizeof(recDrain.abData) + 1];
+
+
+/**
+* @brief    CRC-32 (IEEE 802.3), bitwise to keep the table out of the 256 KB application memory
+*/
+static uint32_t crc32Update(uint32_t nCrc, const void *pData, size_t nSize)
+{
+    const uint8_t *pb = (const uint8_t *)pData;
+    while (nSize--) {
+        nCrc ^= *pb++;
+        for (int nBit = 0; nBit < 8; nBit++) {
+            nCrc = (nCrc >> 1) ^ (0xEDB88320u & (0u - (nCrc & 1u)));
+        }
+    }
+    return nCrc;
+}
+
+/**
+* @brief    CRC over sequence, capture time, magic, sizes and data (everything but nCrc and nState)
+*/
+static uint32_t recordCrc(const queue_record_t *pRecord)
+{
+    uint32_t nCrc = crc32Update(0xFFFFFFFFu, &pRecord->nSequence,
+        offsetof(queue_record_t, nState) - offsetof(queue_record_t, nSequence));
+    nCrc = crc32Update(nCrc, pRecord->abData, (size_t)pRecord->nComponentSize + pRecord->nPayloadSize);
+    return ~nCrc;
+}
+
+static bool isValidRecord(const queue_record_t *pRecord)
+{
+    return (pRecord->nMagic == RECORD_MAGIC)
+        && ((size_t)pRecord->nComponentSize + pRecord->nPayloadSize <= sizeof(pRecord->abData))
+        && (pRecord->nCrc == recordCrc(pRecord));
+}
+
+static off_t slotOffset(size_t nSlot)
+{
+    return nStorageOffset + (off_t)(nSlot * TELEMETRY_QUEUE_SLOT_SIZE);
+}
+
+/**
+* @brief    Reads a slot. Slots are only written up to their used size, so the last slot of
+*           the file may be short.
+*/
+static bool readSlot(size_t nSlot, queue_record_t *pRecord)
+{
+    if (lseek(fdStorage, slotOffset(nSlot), SEEK_SET) < 0) {
+        return false;
+    }
+    ssize_t nRead = read(fdStorage, pRecord, sizeof(*pRecord));
+    return (nRead >= RECORD_HEADER_SIZE)
+        && ((size_t)nRead >= RECORD_HEADER_SIZE + (size_t)pRecord->nComponentSize + pRecord->nPayloadSize);
+}
+
+/**
+* @brief    Writes header and used data only, the rest of the slot is never read
+*/
+static bool writeSlot(size_t nSlot, const queue_record_t *pRecord)
+{
+    size_t nSize = RECORD_HEADER_SIZE + pRecord->nComponentSize + pRecord->nPayloadSize;
+    return (lseek(fdStorage, slotOffset(nSlot), SEEK_SET) >= 0)
+        && (write(fdStorage, pRecord, nSize) == (ssize_t)nSize);
+}
+
+static void markSlotConsumed(size_t nSlot)
+{
+    const uint8_t nState = RECORD_CONSUMED;
+    if ((lseek(fdStorage, slotOffset(nSlot) + (off_t)offsetof(queue_record_t, nState), SEEK_SET) < 0)
+        || (write(fdStorage, &nState, 1) != 1)) {
+        Log_Debug(MODULE "WARNING: cannot mark slot %u as consumed.\n", (unsigned int)nSlot);
+    }
+}
+
+/**
+* @brief    Moves the oldest RAM record to the next storage slot, overwriting the oldest stored
+*           record if the ring is full. Without storage the RAM record is dropped.
+*/
+static void spillOldestRamRecord(void)
+{
+    queue_record_t *pRecord = &aRamRecords[nRamHead];
+    nRamHead = (nRamHead + 1) % TELEMETRY_QUEUE_RAM_RECORDS;
+    nRamCount--;
+
+    if (nSlots == 0) {
+        nDroppedCount++;
+        return;
+    }
+
+    pRecord->nSequence = nNextSequence++;
+    pRecord->nState = RECORD_PENDING;
+    pRecord->nCrc = recordCrc(pRecord);
+    if (!writeSlot(nWriteSlot, pRecord)) {
+        Log_Debug(MODULE "ERROR: cannot write slot %u, record dropped.\n", (unsigned int)nWriteSlot);
+        nDroppedCount++;
+        return;
+    }
+
+    if (nStoredCount == nSlots) {
+        // ring full: the oldest record was just overwritten
+        nReadSlot = (nReadSlot + 1) % nSlots;
+        nDroppedCount++;
+    } else {
+        nStoredCount++;
+    }
+    nWriteSlot = (nWriteSlot + 1) % nSlots;
+}
+
+/**
+* @brief    Hands a record as zero terminated strings to the send function
+*/
+static bool sendRecord(const queue_record_t *pRecord, TelemetryQueueSendFnType fnSend)
+{
+    memcpy(strDrainComponent, pRecord->abData, pRecord->nComponentSize);
+    strDrainComponent[pRecord->nComponentSize] = '\0';
+    memcpy(strDrainPayload, pRecord->abData + pRecord->nComponentSize, pRecord->nPayloadSize);
+    strDrainPayload[pRecord->nPayloadSize] = '\0';
+
+    return fnSend(strDrainComponent, strDrainPayload, (time_t)pRecord->tCapture);
+}
+
+
+size_t TelemetryQueue_Initialize(int fd, off_t nOffset, size_t nSize)
+{
+    fdStorage = fd;
+    nStorageOffset = nOffset;
+    nSlots = (fd >= 0) ? (nSize / TELEMETRY_QUEUE_SLOT_SIZE) : 0;
+    nRamHead = nRamCount = 0;
+    nReadSlot = nWriteSlot = nStoredCount = 0;
+    nNextSequence = 0;
+    nDroppedCount = 0;
+
+    // find the newest record (continues the ring) and the oldest pending record (next to drain)
+    bool bFoundRecord = false;
+    bool bFoundPending = false;
+    uint32_t nNewestSequence = 0;
+    uint32_t nOldestPendingSequence = 0;
+    size_t nPending = 0;
+    for (size_t nSlot = 0; nSlot < nSlots; nSlot++) {
+        if (!readSlot(nSlot, &recDrain) || !isValidRecord(&recDrain)) {
+            continue;
+        }
+        if (!bFoundRecord || ((int32_t)(recDrain.nSequence - nNewestSequence) > 0)) {
+            nNewestSequence = recDrain.nSequence;
+            nWriteSlot = (nSlot + 1) % nSlots;
+            bFoundRecord = true;
+        }
+        if (recDrain.nState == RECORD_PENDING) {
+            if (!bFoundPending || ((int32_t)(recDrain.nSequence - nOldestPendingSequence) < 0)) {
+                nOldestPendingSequence = recDrain.nSequence;
+                nReadSlot = nSlot;
+                bFoundPending = true;
+            }
+            nPending++;
+        }
+    }
+
+    if (bFoundRecord) {
+        nNextSequence = nNewestSequence + 1;
+    }
+    if (bFoundPending) {
+        // pending records form one run from the read to the write position, invalid slots in between are skipped on drain
+        nStoredCount = (nWriteSlot + nSlots - nReadSlot) % nSlots;
+        if (nStoredCount == 0) {
+            nStoredCount = nSlots;
+        }
+    } else {
+        nReadSlot = nWriteSlot;
+    }
+
+    Log_Debug(MODULE "INFO: %u slots, %u pending records recovered.\n", (unsigned int)nSlots, (unsigned int)nPending);
+    return nPending;
+}
+
+
+bool TelemetryQueue_Push(const char *cstrComponent, const char *pbPayload, size_t nPayloadSize, time_t tCapture)
+{
+    size_t nComponentSize = strlen(cstrComponent);
+    if ((nComponentSize > UINT8_MAX) || (nComponentSize + nPayloadSize > sizeof(aRamRecords[0].abData))) {
+        Log_Debug(MODULE "WARNING: record of '%s' exceeds slot size, dropped.\n", cstrComponent);
+        nDroppedCount++;
+        return false;
+    }
+
+    if (nRamCount == TELEMETRY_QUEUE_RAM_RECORDS) {
+        spillOldestRamRecord();
+    }
+
+    queue_record_t *pRecord = &aRamRecords[(nRamHead + nRamCount) % TELEMETRY_QUEUE_RAM_RECORDS];
+    pRecord->nMagic = RECORD_MAGIC;
+    pRecord->tCapture = (int64_t)tCapture;
+    pRecord->nComponentSize = (uint8_t)nComponentSize;
+    pRecord->nPayloadSize = (uint16_t)nPayloadSize;
+    pRecord->nReserved = 0;
+    memcpy(pRecord->abData, cstrComponent, nComponentSize);
+    memcpy(pRecord->abData + nComponentSize, pbPayload, nPayloadSize);
+    nRamCount++;
+    return true;
+}
+
+
+size_t TelemetryQueue_Drain(size_t nMaxRecords, TelemetryQueueSendFnType fnSend)
+{
+    size_t nDrained = 0;
+
+    while (nDrained < nMaxRecords) {
+        if (nStoredCount > 0) {
+            // stored records are older than every RAM record
+            if (readSlot(nReadSlot, &recDrain) && isValidRecord(&recDrain) && (recDrain.nState == RECORD_PENDING)) {
+                if (!sendRecord(&recDrain, fnSend)) {
+                    break;
+                }
+                markSlotConsumed(nReadSlot);
+                nDrained++;
+            }
+            nReadSlot = (nReadSlot + 1) % nSlots;
+            nStoredCount--;
+        } else if (nRamCount > 0) {
+            if (!sendRecord(&aRamRecords[nRamHead], fnSend)) {
+                break;
+            }
+            nRamHead = (nRamHead + 1) % TELEMETRY_QUEUE_RAM_RECORDS;
+            nRamCount--;
+            nDrained++;
+        } else {
+            break;
+        }
+    }
+    return nDrained;
+}
+
+
+void TelemetryQueue_Flush(void)
+{
+    while ((nRamCount > 0) && (nSlots > 0)) {
+        spillOldestRamRecord();
+    }
+}
+
+
+size_t TelemetryQueue_GetCount(void)
+{
+    return nStoredCount + nRamCount;
+}
+
+
+size_t TelemetryQueue_GetDroppedCount(void)
+{
+    return nDroppedCount;
+}
@@ -0,0 +1,81 @@
+/**
+* @file telemetry_queue.h
+* @brief Bounded store-and-forward queue for telemetry captured while the IoT Hub is not connected.
+*   Records (component, json payload, capture time) are kept in RAM first. When the RAM queue is
+*   full the oldest record spills to a ring of fixed size slots in a region of the mutable storage
+*   file, so storage only sees sequential appends. Every slot carries a sequence number and a CRC32;
+*   on start the ring is scanned and all valid pending records are recovered. When the ring is full
+*   the oldest record is overwritten.
+*   Storage access is plain lseek/read/write on a file descriptor, so any Linux file can stand in
+*   for Storage_OpenMutableFile() when testing the queue off-device.
+*/
+#pragma once
+#ifndef _TELEMETRY_QUEUE_H_
+#define _TELEMETRY_QUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+/// @brief size of a record slot in RAM and storage (header, component name and payload)
+#ifndef TELEMETRY_QUEUE_SLOT_SIZE
+#define TELEMETRY_QUEUE_SLOT_SIZE (256)
+#endif
+
+/// @brief number of records kept in RAM before spilling to storage
+#ifndef TELEMETRY_QUEUE_RAM_RECORDS
+#define TELEMETRY_QUEUE_RAM_RECORDS (8)
+#endif
+
+/**
+* @brief    Type of the function sending a dequeued record.
+* @param    cstrComponent   PnP component name
+* @param    pszPayload      zero terminated json payload
+* @param    tCapture        capture time of the record
+* @return   true if the record was handed over and can be removed from the queue
+*/
+typedef bool (*TelemetryQueueSendFnType)(const char *cstrComponent, const char *pszPayload, time_t tCapture);
+
+/**
+* @brief    Sets up the queue and recovers pending records from storage.
+* @param    fdStorage       read/write file descriptor (e.g. Storage_OpenMutableFile()), -1 for RAM only
+* @param    nOffset         start of the queue region in the file
+* @param    nSize           size of the queue region, rounded down to whole slots
+* @return   number of records recovered from storage
+*/
+size_t TelemetryQueue_Initialize(int fdStorage, off_t nOffset, size_t nSize);
+
+/**
+* @brief    Appends a record. The oldest record is dropped if RAM and storage are full.
+* @param    cstrComponent   PnP component name
+* @param    pbPayload       json payload (not necessarily zero terminated)
+* @param    nPayloadSize    payload size in bytes
+* @param    tCapture        capture time of the record
+* @return   false if component name and payload do not fit into one slot
+*/
+bool TelemetryQueue_Push(const char *cstrComponent, const char *pbPayload, size_t nPayloadSize, time_t tCapture);
+
+/**
+* @brief    Hands up to nMaxRecords of the oldest records to fnSend. Stops at the first record
+*           fnSend does not accept, that record stays queued.
+* @return   number of records removed from the queue
+*/
+size_t TelemetryQueue_Drain(size_t nMaxRecords, TelemetryQueueSendFnType fnSend);
+
+/**
+* @brief    Spills all RAM records to storage, e.g. before the application exits.
+*/
+void TelemetryQueue_Flush(void);
+
+/**
+* @brief    Returns the number of queued records (RAM and storage).
+*/
+size_t TelemetryQueue_GetCount(void);
+
+/**
+* @brief    Returns the number of records dropped because the queue was full.
+*/
+size_t TelemetryQueue_GetDroppedCount(void);
+
+#endif // _TELEMETRY_QUEUE_H_
@@ -55,9 +55,9 @@
 
 #define SIZEOF_TOKEN(a) (sizeof(a) - 1)
 #define SKIP_CHAR(str) ((*str)++)
-#define SKIP_WHITESPACES(str)                 \
-    while (isspace((unsigned char)(**str))) { \
-        SKIP_CHAR(str);                       \
+#define SKIP_WHITESPACES(str)                     \
+    while (isspace((unsigned char)PEEK_CHAR(str))) { \
+        SKIP_CHAR(str);                           \
     }
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
@@ -67,6 +67,16 @@
 static JSON_Malloc_Function parson_malloc = malloc;
 static JSON_Free_Function parson_free = free;
 
+/* [JSchwert] Begin: length bounded parsing (json_parse_buffer) */
+/* end of the buffer parsed by json_parse_buffer(), NULL while parsing '\0' terminated strings */
+static const char *parson_parse_end = NULL;
+
+/* current parser character, the end of a bounded buffer reads as '\0' */
+#define PEEK_CHAR(str) ((parson_parse_end != NULL && *(str) >= parson_parse_end) ? '\0' : **(str))
+/* number of characters left in a bounded buffer */
+#define REMAINING(ptr) ((parson_parse_end != NULL) ? (size_t)(parson_parse_end - (ptr)) : (size_t)-1)
+/* [JSchwert] End */
+
 #define IS_CONT(b) (((unsigned char)(b)&0xC0) == 0x80) /* is utf-8 continuation byte */
 
 /* Type definitions */
@@ -186,6 +196,9 @@ static int hex_char_to_int(char c)
 static int parse_utf16_hex(const char *s, unsigned int *result)
 {
     int x1, x2, x3, x4;
+    if (REMAINING(s) < 4) {
+        return 0;
+    }
     if (s[0] == '\0' || s[1] == '\0' || s[2] == '\0' || s[3] == '\0') {
         return 0;
     }
@@ -545,16 +558,16 @@ static JSON_Value *json_value_init_string_no_copy(char *string)
 /* Parser */
 static JSON_Status skip_quotes(const char **string)
 {
-    if (**string != '\"') {
+    if (PEEK_CHAR(string) != '\"') {
         return JSONFailure;
     }
     SKIP_CHAR(string);
-    while (**string != '\"') {
-        if (**string == '\0') {
+    while (PEEK_CHAR(string) != '\"') {
+        if (PEEK_CHAR(string) == '\0') {
             return JSONFailure;
-        } else if (**string == '\\') {
+        } else if (PEEK_CHAR(string) == '\\') {
             SKIP_CHAR(string);
-            if (**string == '\0') {
+            if (PEEK_CHAR(string) == '\0') {
                 return JSONFailure;
             }
         }
@@ -707,7 +720,7 @@ static JSON_Value *parse_value(const char **string, size_t nesting)
         return NULL;
     }
     SKIP_WHITESPACES(string);
-    switch (**string) {
+    switch (PEEK_CHAR(string)) {
     case '{':
         return parse_object_value(string, nesting + 1);
     case '[':
@@ -745,25 +758,25 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
     if (output_value == NULL) {
         return NULL;
     }
-    if (**string != '{') {
+    if (PEEK_CHAR(string) != '{') {
         json_value_free(output_value);
         return NULL;
     }
     output_object = json_value_get_object(output_value);
     SKIP_CHAR(string);
     SKIP_WHITESPACES(string);
-    if (**string == '}') { /* empty object */
+    if (PEEK_CHAR(string) == '}') { /* empty object */
         SKIP_CHAR(string);
         return output_value;
     }
-    while (**string != '\0') {
+    while (PEEK_CHAR(string) != '\0') {
         new_key = get_quoted_string(string);
         if (new_key == NULL) {
             json_value_free(output_value);
             return NULL;
         }
         SKIP_WHITESPACES(string);
-        if (**string != ':') {
+        if (PEEK_CHAR(string) != ':') {
             parson_free(new_key);
             json_value_free(output_value);
             return NULL;
@@ -783,14 +796,14 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
         }
         parson_free(new_key);
         SKIP_WHITESPACES(string);
-        if (**string != ',') {
+        if (PEEK_CHAR(string) != ',') {
             break;
         }
         SKIP_CHAR(string);
         SKIP_WHITESPACES(string);
     }
     SKIP_WHITESPACES(string);
-    if (**string != '}' || /* Trim object after parsing is over */
+    if (PEEK_CHAR(string) != '}' || /* Trim object after parsing is over */
         json_object_resize(output_object, json_object_get_count(output_object)) == JSONFailure) {
         json_value_free(output_value);
         return NULL;
@@ -807,18 +820,18 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
     if (output_value == NULL) {
         return NULL;
     }
-    if (**string != '[') {
+    if (PEEK_CHAR(string) != '[') {
         json_value_free(output_value);
         return NULL;
     }
     output_array = json_value_get_array(output_value);
     SKIP_CHAR(string);
     SKIP_WHITESPACES(string);
-    if (**string == ']') { /* empty array */
+    if (PEEK_CHAR(string) == ']') { /* empty array */
         SKIP_CHAR(string);
         return output_value;
     }
-    while (**string != '\0') {
+    while (PEEK_CHAR(string) != '\0') {
         new_array_value = parse_value(string, nesting);
         if (new_array_value == NULL) {
             json_value_free(output_value);
@@ -830,14 +843,14 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
             return NULL;
         }
         SKIP_WHITESPACES(string);
-        if (**string != ',') {
+        if (PEEK_CHAR(string) != ',') {
             break;
         }
         SKIP_CHAR(string);
         SKIP_WHITESPACES(string);
     }
     SKIP_WHITESPACES(string);
-    if (**string != ']' || /* Trim array after parsing is over */
+    if (PEEK_CHAR(string) != ']' || /* Trim array after parsing is over */
         json_array_resize(output_array, json_array_get_count(output_array)) == JSONFailure) {
         json_value_free(output_value);
         return NULL;
@@ -865,10 +878,11 @@ static JSON_Value *parse_boolean_value(const char **string)
 {
     size_t true_token_size = SIZEOF_TOKEN("true");
     size_t false_token_size = SIZEOF_TOKEN("false");
-    if (strncmp("true", *string, true_token_size) == 0) {
+    if (REMAINING(*string) >= true_token_size && strncmp("true", *string, true_token_size) == 0) {
         *string += true_token_size;
         return json_value_init_boolean(1);
-    } else if (strncmp("false", *string, false_token_size) == 0) {
+    } else if (REMAINING(*string) >= false_token_size &&
+               strncmp("false", *string, false_token_size) == 0) {
         *string += false_token_size;
         return json_value_init_boolean(0);
     }
@@ -879,19 +893,45 @@ static JSON_Value *parse_number_value(const char **string)
 {
     char *end;
     double number = 0;
+    const char *number_string = *string;
+    char num_buf[NUM_BUF_SIZE];
+    char *copy = NULL;
+    int decimal = 0;
+    int number_errno = 0;
+    if (parson_parse_end != NULL) {
+        /* [JSchwert] strtod() needs a terminated string. Copy every character it could read (digits,
+           sign, '.', exponent, hex, inf/nan), so strtod() and is_decimal() see what they see in a string */
+        size_t len = 0;
+        while (len < REMAINING(*string) && (*string)[len] != '\0' &&
+               (isalnum((unsigned char)(*string)[len]) || strchr("+-._()", (*string)[len]) != NULL)) {
+            len++;
+        }
+        copy = (len < sizeof(num_buf)) ? num_buf : (char *)parson_malloc(len + 1);
+        if (copy == NULL) {
+            return NULL;
+        }
+        memcpy(copy, *string, len);
+        copy[len] = '\0';
+        number_string = copy;
+    }
     errno = 0;
-    number = strtod(*string, &end);
-    if (errno || !is_decimal(*string, (size_t)(end - *string))) {
+    number = strtod(number_string, &end);
+    number_errno = errno;
+    decimal = is_decimal(number_string, (size_t)(end - number_string));
+    if (copy != NULL && copy != num_buf) {
+        parson_free(copy);
+    }
+    if (number_errno || !decimal) {
         return NULL;
     }
-    *string = end;
+    *string += end - number_string;
     return json_value_init_number(number);
 }
 
 static JSON_Value *parse_null_value(const char **string)
 {
     size_t token_size = SIZEOF_TOKEN("null");
-    if (strncmp("null", *string, token_size) == 0) {
+    if (REMAINING(*string) >= token_size && strncmp("null", *string, token_size) == 0) {
         *string += token_size;
         return json_value_init_null();
     }
@@ -1225,6 +1265,24 @@ JSON_Value *json_parse_string(const char *string)
     return parse_value((const char **)&string, 0);
 }
 
+/* [JSchwert] Begin: length bounded parsing */
+JSON_Value *json_parse_buffer(const char *buffer, size_t buffer_len)
+{
+    JSON_Value *result = NULL;
+    if (buffer == NULL) {
+        return NULL;
+    }
+    if (buffer_len >= 3 && buffer[0] == '\xEF' && buffer[1] == '\xBB' && buffer[2] == '\xBF') {
+        buffer = buffer + 3; /* Support for UTF-8 BOM */
+        buffer_len -= 3;
+    }
+    parson_parse_end = buffer + buffer_len;
+    result = parse_value(&buffer, 0);
+    parson_parse_end = NULL;
+    return result;
+}
+/* [JSchwert] End */
+
 JSON_Value *json_parse_string_with_comments(const char *string)
 {
     JSON_Value *result = NULL;
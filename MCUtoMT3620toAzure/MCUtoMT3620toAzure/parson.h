@@ -70,6 +70,10 @@ JSON_Value *json_parse_string(const char *string);
     returns NULL in case of error */
 JSON_Value *json_parse_string_with_comments(const char *string);
 
+/* [JSchwert] Parses first JSON value in a buffer of given length which doesn't need to be
+   null terminated (e.g. IoT Hub payloads). The buffer is parsed in place without copying. */
+JSON_Value *json_parse_buffer(const char *buffer, size_t buffer_len);
+
 /* Serialization */
 size_t json_serialization_size(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
@@ -1,4 +1,5 @@
 ﻿#include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <time.h>
@@ -32,6 +33,20 @@ static DeviceTwinDeliveryConfirmationFnType fnDeviceTwinConfirmationHandler = 0;
 /// </summary>
 static MethodRegistration* pRegisteredMethods = NULL;
 
+/// <summary>
+///     Slot of the open addressing hash index over pRegisteredMethods.
+/// </summary>
+typedef struct MethodIndexEntryTag {
+    uint32_t nHash;
+    const MethodRegistration* pMethod;
+} MethodIndexEntry;
+
+/// <summary>
+///     Hash index built on registration, size is a power of 2 and at least twice the method count.
+/// </summary>
+static MethodIndexEntry* pMethodIndex = NULL;
+static size_t nMethodIndexMask = 0;
+
 /// <summary>
 ///     Function invoked whenever a Direct Method call is received from the IoT Hub.
 /// </summary>
@@ -69,6 +84,14 @@ static IOTHUB_DEVICE_CLIENT_LL_HANDLE hIoTHubClient = NULL;
 /// </summary>
 static bool bIoTHubAuthenticated = false;
 
+/// <summary>
+///     Messages and reported property updates handed to the IoT Hub client and not confirmed yet,
+///     and whether the last DoWork invoked a callback. See AzureIoT_IsWorkPending().
+/// </summary>
+static size_t nPendingMessages = 0;
+static size_t nPendingTwinReports = 0;
+static bool bCallbackInvoked = false;
+
 /// <summary>
 ///     Used to set the keepalive period over MQTT to 20 seconds.
 /// </summary>
@@ -319,20 +342,10 @@ static char *getAzureSphereProvisioningResultString(
 /// <returns>The pointer to the heap allocated json value.</returns>
 static JSON_Value* getJsonFromPayload(const unsigned char* pbPayload, size_t nPayloadSize)
 {
-    char* pszPayloadString = malloc(nPayloadSize + 1); // +1 to store null char at the end.
-    if (pszPayloadString == NULL) {
-        LogMessage("ERROR: Not enough memory");
-        abort();
-    }
-    memcpy(pszPayloadString, pbPayload, nPayloadSize);
-    pszPayloadString[nPayloadSize] = '\0'; // Null terminated string.
-
-    Log_Debug("Payload received %s\n",pszPayloadString);
+    // payload is not NULL terminated: log and parse it in place instead of copying
+    Log_Debug("Payload received %.*s\n", (int)nPayloadSize, (const char*)pbPayload);
 
-    JSON_Value* jsonRootValue = json_parse_string(pszPayloadString);
-    free(pszPayloadString);
-
-    return jsonRootValue;
+    return json_parse_buffer((const char*)pbPayload, nPayloadSize);
 }
 
 ///<summary>
@@ -461,6 +474,8 @@ void AzureIoT_DestroyClient(void)
         IoTHubDeviceClient_LL_Destroy(hIoTHubClient);
         hIoTHubClient = NULL;
     }
+    nPendingMessages = 0;
+    nPendingTwinReports = 0;
 }
 
 /// <summary>
@@ -506,10 +521,27 @@ void AzureIoT_DoPeriodicTasks(void)
 
         // DoWork - send some of the buffered events to the IoT Hub, and receive some of the
         // buffered events from the IoT Hub.
+        bCallbackInvoked = false;
         IoTHubDeviceClient_LL_DoWork(hIoTHubClient);
     }
 }
 
+/// <summary>
+///     True while the IoT Hub client has outbound work: queued or unconfirmed messages, unconfirmed
+///     reported properties, or a callback ran in the last DoWork (e.g. a method response is on its way).
+/// </summary>
+bool AzureIoT_IsWorkPending(void)
+{
+    if (bCallbackInvoked || (nPendingMessages > 0) || (nPendingTwinReports > 0)) {
+        return true;
+    }
+
+    IOTHUB_CLIENT_STATUS sendStatus = IOTHUB_CLIENT_SEND_STATUS_IDLE;
+    return (hIoTHubClient != NULL)
+        && (IoTHubDeviceClient_LL_GetSendStatus(hIoTHubClient, &sendStatus) == IOTHUB_CLIENT_OK)
+        && (sendStatus == IOTHUB_CLIENT_SEND_STATUS_BUSY);
+}
+
 /// <summary>
 ///     Creates and enqueues a plain text message to be delivered to the IoT Hub. The message is not actually
 ///     sent immediately, but it is sent on the next invocation of AzureIoT_DoPeriodicTasks().
@@ -549,6 +581,7 @@ void AzureIoT_SendMessageWithContentType(const char* messagePayload, const char
     }
     else {
         LogMessage("INFO: IoTHubClient accepted the message for delivery\n");
+        nPendingMessages++;
     }
 
     IoTHubMessage_Destroy(messageHandle);
@@ -603,6 +636,9 @@ static void reportStatusCallback(int result, void *context)
 {
     LogMessage("INFO: Device Twin reported properties update result: HTTP status code %d\n",
                result);
+    if (nPendingTwinReports > 0) {
+        nPendingTwinReports--;
+    }
     if (fnDeviceTwinConfirmationHandler)
         fnDeviceTwinConfirmationHandler(result);
 }
@@ -637,6 +673,7 @@ IOTHUB_CLIENT_RESULT AzureIoT_TwinReportState(
     }
     else {
         LogMessage("INFO: reported properties %s\n", pszProperties);
+        nPendingTwinReports++;
     }
 
     return result;
@@ -708,6 +745,9 @@ static void sendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *
 {
     
     LogMessage("INFO: Message received by IoT Hub. Result is: %d\n", result);
+    if (nPendingMessages > 0) {
+        nPendingMessages--;
+    }
     if (fnMessageDeliveryConfirmationHandler)
         fnMessageDeliveryConfirmationHandler(result == IOTHUB_CLIENT_CONFIRMATION_OK);
 }
@@ -731,6 +771,8 @@ static IOTHUBMESSAGE_DISPOSITION_RESULT receiveMessageCallback(IOTHUB_MESSAGE_HA
         return result;
     }
 
+    bCallbackInvoked = true;
+
     // 'buffer' is not zero terminated.
     unsigned char *str_msg = (unsigned char *)malloc(size + 1);
     if (str_msg == NULL) {
@@ -763,6 +805,83 @@ void AzureIoT_SetDirectMethodCallback(DirectMethodCallFnType callback)
 }
 
 
+/// <summary>
+///     FNV-1a hash of the full method name (e.g. "component*command").
+/// </summary>
+static uint32_t hashMethodName(const char* methodName)
+{
+    uint32_t nHash = 2166136261u;
+    while (*methodName != '\0') {
+        nHash ^= (unsigned char)*methodName++;
+        nHash *= 16777619u;
+    }
+    return nHash;
+}
+
+/// <summary>
+///     Builds the hash index over the registered methods. Duplicate names keep the first entry.
+/// </summary>
+static void buildMethodIndex(const MethodRegistration* methods)
+{
+    free(pMethodIndex);
+    pMethodIndex = NULL;
+    nMethodIndexMask = 0;
+
+    size_t nCount = 0;
+    while ((methods != NULL) && (methods[nCount].MethodName != NULL) && (methods[nCount].MethodHandler != NULL)) {
+        nCount++;
+    }
+    if (nCount == 0) {
+        return;
+    }
+
+    size_t nSlots = 4;
+    while (nSlots < 2 * nCount) {
+        nSlots <<= 1;
+    }
+    if ((pMethodIndex = (MethodIndexEntry*)calloc(nSlots, sizeof(MethodIndexEntry))) == NULL) {
+        LogMessage("ERROR: not enough memory.\n");
+        abort();
+    }
+    nMethodIndexMask = nSlots - 1;
+
+    for (const MethodRegistration* pMethod = methods; pMethod < methods + nCount; pMethod++) {
+        uint32_t nHash = hashMethodName(pMethod->MethodName);
+        size_t nSlot = nHash & nMethodIndexMask;
+        while (pMethodIndex[nSlot].pMethod != NULL) {
+            if ((pMethodIndex[nSlot].nHash == nHash) && (strcmp(pMethodIndex[nSlot].pMethod->MethodName, pMethod->MethodName) == 0)) {
+                LogMessage("WARNING: Method '%s' registered twice, ignoring duplicate\n", pMethod->MethodName);
+                break;
+            }
+            nSlot = (nSlot + 1) & nMethodIndexMask;
+        }
+        if (pMethodIndex[nSlot].pMethod == NULL) {
+            pMethodIndex[nSlot].nHash = nHash;
+            pMethodIndex[nSlot].pMethod = pMethod;
+        }
+    }
+}
+
+/// <summary>
+///     Looks up a method by its full name, O(1) independent of the number of registered methods.
+/// </summary>
+/// <returns>registration or NULL if not found</returns>
+static const MethodRegistration* findMethod(const char* methodName)
+{
+    if (pMethodIndex == NULL) {
+        return NULL;
+    }
+    uint32_t nHash = hashMethodName(methodName);
+    size_t nSlot = nHash & nMethodIndexMask;
+    while (pMethodIndex[nSlot].pMethod != NULL) {
+        if ((pMethodIndex[nSlot].nHash == nHash) && (strcmp(pMethodIndex[nSlot].pMethod->MethodName, methodName) == 0)) {
+            return pMethodIndex[nSlot].pMethod;
+        }
+        nSlot = (nSlot + 1) & nMethodIndexMask;
+    }
+    return NULL;
+}
+
 /// <summary>
 ///     Registers an array of Direct Method handlers. Superseded by <seealso cref="AzureIoT_SetDirectMethodCallback">AzureIoT_SetDirectMethodCallback</seealso>
 /// </summary>
@@ -770,6 +889,7 @@ void AzureIoT_SetDirectMethodCallback(DirectMethodCallFnType callback)
 void AzureIoT_RegisterDirectMethodHandlers(const MethodRegistration * methods)
 {
     pRegisteredMethods = (MethodRegistration*) methods;
+    buildMethodIndex(methods);
 }
 
 
@@ -792,6 +912,7 @@ static int directMethodCallback(const char *methodName, const unsigned char *pay
                                 void *userContextCallback)
 {
     LogMessage("INFO: Trying to invoke method %s\n", methodName);
+    bCallbackInvoked = true;
 
     *responseSize = 0;
     *response = NULL;
@@ -802,31 +923,22 @@ static int directMethodCallback(const char *methodName, const unsigned char *pay
         return fnDirectMethodHandler(methodName, payload, payloadSize, response, responseSize);
     } 
     
-    // if method handlers are registered, loop through list of registered methods
-    if ((pRegisteredMethods != NULL))
-    {
-        MethodRegistration* pMethod = pRegisteredMethods;
-        size_t nSize = strlen(methodName);
-
-        while ((pMethod->MethodName != NULL) && (pMethod->MethodHandler != NULL))
-        {
-            if (strncmp(methodName, pMethod->MethodName, nSize) == 0) {
-                JSON_Value* jsonParameters = getJsonFromPayload(payload, payloadSize);
-                JSON_Value* jsonResponse = NULL;
-
-                result = pMethod->MethodHandler(jsonParameters, &jsonResponse);
-                if (jsonParameters != NULL) {
-                    json_value_free(jsonParameters);
-                }
-                if (jsonResponse != NULL) {
-                    setPayloadFromJson(jsonResponse, (char **)response, responseSize);
-                    LogMessage("Command Response HTTP: %d '%s' (%d bytes)\n", result, *response, *responseSize);
-                    json_value_free(jsonResponse);
-                }
-                return result;
-            }
-            pMethod++;
+    // if method handlers are registered, look up the full method name in the hash index
+    const MethodRegistration* pMethod = findMethod(methodName);
+    if (pMethod != NULL) {
+        JSON_Value* jsonParameters = getJsonFromPayload(payload, payloadSize);
+        JSON_Value* jsonResponse = NULL;
+
+        result = pMethod->MethodHandler(jsonParameters, &jsonResponse);
+        if (jsonParameters != NULL) {
+            json_value_free(jsonParameters);
+        }
+        if (jsonResponse != NULL) {
+            setPayloadFromJson(jsonResponse, (char **)response, responseSize);
+            LogMessage("Command Response HTTP: %d '%s' (%d bytes)\n", result, *response, *responseSize);
+            json_value_free(jsonResponse);
         }
+        return result;
     }
 
     LogMessage("INFO: Method '%s' not found\n", methodName);
@@ -849,6 +961,7 @@ static int directMethodCallback(const char *methodName, const unsigned char *pay
 static void twinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payLoad,
                          size_t payLoadSize, void *userContextCallback)
 {
+    bCallbackInvoked = true;
     if (fnTwinUpdateHandler == NULL) {
         LogMessage("WARNING: Received device twin update but no handler available.");
         return;
@@ -896,6 +1009,8 @@ static void hubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
         fnConnectionStatusChangedHandler(bIoTHubAuthenticated, reasonString);
     }
     if (!bIoTHubAuthenticated) {
+        // reported property confirmations of the previous connection will not arrive
+        nPendingTwinReports = 0;
         LogMessage("INFO: IoT Hub connection is down (%s), retrying connection...\n", reasonString);
     } else {
         LogMessage("INFO: connection to the IoT Hub has been established (%s).\n", reasonString);
@@ -112,6 +112,14 @@ void AzureIoT_SendJsonMessage(JSON_Value* jsonPayload);
 /// </remarks>
 void AzureIoT_DoPeriodicTasks(void);
 
+/// <summary>
+///     Checks whether the IoT Hub client has outbound work (queued or unconfirmed messages and
+///     reported properties, or a method response following the last AzureIoT_DoPeriodicTasks()).
+///     While true AzureIoT_DoPeriodicTasks() should be invoked at a fast cadence.
+/// </summary>
+/// <returns>'true' while work is pending</returns>
+bool AzureIoT_IsWorkPending(void);
+
 /// <summary>
 ///     Type of the function callback invoked whenever a message is received from IoT Hub.
 /// </summary>
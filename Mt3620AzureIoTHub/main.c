@@ -98,6 +98,11 @@ static const int AzureIoTMaxReconnectPeriodSeconds = 10 * 60;
 
 static int azureIoTPollPeriodSeconds = -1;
 
+// DoWork cadence while connected: AzureIoTFastPollPeriodMs while work is pending, backing off
+// to AzureIoTDefaultPollPeriodSeconds when idle
+static const long AzureIoTFastPollPeriodMs = 100;
+static long azureIoTWorkerPeriodMs = -1;
+
 static const char cstrErrorOutOfMemory[] = "ERROR: Out of memory.\n";
 
 // telemetry events
@@ -159,6 +164,7 @@ void Led2UpdateHandler(EventData* eventData);
 void AzureIoTDoWorkHandler(EventData* eventData);
 void TelemetryTimerHandler(EventData* eventData);
 void ResetTimerHandler(EventData* eventData);
+static void RequestAzureIoTDoWork(void);
 
 // event handler data structures. Only the event handler field needs to be populated.
 static EventData evtdataButtonPollTimer = { .eventHandler = &ButtonPollTimerHandler };
@@ -292,6 +298,7 @@ static void SetLedRate(const struct timespec * pBlinkRate)
 
         // Report the current state to the Device Twin on the IoT Hub.
         AzureIoT_TwinReportStateJson(jsonRoot);
+        RequestAzureIoTDoWork();
 
         json_value_free(jsonRoot);
     }
@@ -312,6 +319,7 @@ static void SendEventMessage(const char * cstrEvent, const char * cstrMessage)
 
 		// Send a message
 		AzureIoT_SendJsonMessage(jsonRoot);
+        RequestAzureIoTDoWork();
 
         json_value_free(jsonRoot);
 
@@ -333,6 +341,7 @@ static void SendTelemetryMessage(void)
     if (connectedToIoTHub) {
 		
         AzureIoT_SendTextMessage("Hello from Azure Sphere");
+        RequestAzureIoTDoWork();
 
 		// Set the send/receive LED2 to blink once immediately to indicate 
 		// the message has been queued.
@@ -613,6 +622,31 @@ void ButtonPollTimerHandler(EventData *eventData)
     }
 }
 
+/// <summary>
+///     Re-arms the Azure IoT worker timer if the period changes.
+/// </summary>
+/// <param name="periodMs">new period in milliseconds</param>
+static void SetAzureIoTWorkerPeriod(long periodMs)
+{
+    if (periodMs == azureIoTWorkerPeriodMs) {
+        return;
+    }
+    azureIoTWorkerPeriodMs = periodMs;
+    struct timespec azureWorkerPeriod = {periodMs / 1000, (periodMs % 1000) * 1000 * 1000};
+    SetTimerFdToPeriod(fdAzureIoTWorkerTimer, &azureWorkerPeriod);
+}
+
+/// <summary>
+///     Switches DoWork to the fast cadence after a message or report has been handed to the IoT Hub
+///     client. A timer already running fast is left alone, re-arming it would postpone DoWork.
+/// </summary>
+static void RequestAzureIoTDoWork(void)
+{
+    if (connectedToIoTHub && (azureIoTWorkerPeriodMs > AzureIoTFastPollPeriodMs)) {
+        SetAzureIoTWorkerPeriod(AzureIoTFastPollPeriodMs);
+    }
+}
+
 /// <summary>
 ///     Hand over control periodically to the Azure IoT SDK's DoWork.
 /// </summary>
@@ -627,8 +661,7 @@ void AzureIoTDoWorkHandler(EventData *eventData)
     if (!bNetworkReady)
     {
         azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
-        struct timespec azureTelemetryPeriod = { azureIoTPollPeriodSeconds, 0 };
-        SetTimerFdToPeriod(fdAzureIoTWorkerTimer, &azureTelemetryPeriod);
+        SetAzureIoTWorkerPeriod(azureIoTPollPeriodSeconds * 1000L);
         return;
     }
 
@@ -636,16 +669,21 @@ void AzureIoTDoWorkHandler(EventData *eventData)
     // Notes it is safe to call this function even if the client has already been set up, as in
     //   this case it would have no effect
     if (AzureIoT_SetupClient()) {
-        if (azureIoTPollPeriodSeconds != AzureIoTDefaultPollPeriodSeconds) {
-            azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
-
-            struct timespec azureTelemetryPeriod = {azureIoTPollPeriodSeconds, 0};
-            SetTimerFdToPeriod(fdAzureIoTWorkerTimer, &azureTelemetryPeriod);
-        }
+        azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
 
         // AzureIoT_DoPeriodicTasks() needs to be called frequently in order to keep active
         // the flow of data with the Azure IoT Hub
         AzureIoT_DoPeriodicTasks();
+
+        // fast cadence while work is pending, when idle double the period up to the default poll period
+        long periodMs = AzureIoTFastPollPeriodMs;
+        if (!AzureIoT_IsWorkPending()) {
+            periodMs = azureIoTWorkerPeriodMs * 2;
+            if (periodMs > azureIoTPollPeriodSeconds * 1000L) {
+                periodMs = azureIoTPollPeriodSeconds * 1000L;
+            }
+        }
+        SetAzureIoTWorkerPeriod(periodMs);
     } else {
         // If we fail to connect, reduce the polling frequency, starting at
         // AzureIoTMinReconnectPeriodSeconds and with a backoff up to
@@ -659,8 +697,7 @@ void AzureIoTDoWorkHandler(EventData *eventData)
             }
         }
 
-        struct timespec azureTelemetryPeriod = {azureIoTPollPeriodSeconds, 0};
-        SetTimerFdToPeriod(fdAzureIoTWorkerTimer, &azureTelemetryPeriod);
+        SetAzureIoTWorkerPeriod(azureIoTPollPeriodSeconds * 1000L);
 
         Log_Debug("ERROR: Failed to connect to IoT Hub; will retry in %i seconds\n",
                   azureIoTPollPeriodSeconds);
@@ -781,6 +818,7 @@ static int InitPeripheralsAndHandlers(void)
 
     // Set up a timer for Azure IoT SDK DoWork execution.
     azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
+    azureIoTWorkerPeriodMs = azureIoTPollPeriodSeconds * 1000L;
     struct timespec tsAzureIoTWorkerInterval = {azureIoTPollPeriodSeconds, 0};
     fdAzureIoTWorkerTimer =
         CreateTimerFdAndAddToEpoll(fdEpoll, &tsAzureIoTWorkerInterval, &evtdataAzureIoTWorker, EPOLLIN);
@@ -329,20 +329,10 @@ static char *getAzureSphereProvisioningResultString(
 /// <returns>The pointer to the heap allocated json value.</returns>
 static JSON_Value* getJsonFromPayload(const unsigned char* pbPayload, size_t nPayloadSize)
 {
-    char* pszPayloadString = malloc(nPayloadSize + 1); // +1 to store null char at the end.
-    if (pszPayloadString == NULL) {
-        LogMessage("ERROR: Not enough memory");
-        abort();
-    }
-    memcpy(pszPayloadString, pbPayload, nPayloadSize);
-    pszPayloadString[nPayloadSize] = '\0'; // Null terminated string.
-
-    Log_Debug("Payload received %s\n",pszPayloadString);
-
-    JSON_Value* jsonRootValue = json_parse_string(pszPayloadString);
-    free(pszPayloadString);
+    // payload is not NULL terminated: log and parse it in place instead of copying
+    Log_Debug("Payload received %.*s\n", (int)nPayloadSize, (const char*)pbPayload);
 
-    return jsonRootValue;
+    return json_parse_buffer((const char*)pbPayload, nPayloadSize);
 }
 
 ///<summary>
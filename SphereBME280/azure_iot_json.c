@@ -127,20 +127,10 @@ static IOTHUBMESSAGE_DISPOSITION_RESULT jsonMessageReceivedCallback(IOTHUB_MESSA
 
 JSON_Value* AzureIoTJson_FromPayload(const unsigned char* pbPayload, size_t nPayloadSize)
 {
-    char* pszPayloadString = malloc(nPayloadSize + 1); // +1 to store null char at the end.
-    if (pszPayloadString == NULL) {
-        Log_Debug( MODULE "ERROR: Not enough memory\n");
-        abort();
-    }
-    memcpy(pszPayloadString, pbPayload, nPayloadSize);
-    pszPayloadString[nPayloadSize] = '\0'; // Null terminated string.
-
-    Log_Debug( MODULE "Payload received %s\n",pszPayloadString);
-
-    JSON_Value* jsonRootValue = json_parse_string(pszPayloadString);
-    free(pszPayloadString);
+    // payload is not NULL terminated: log and parse it in place instead of copying
+    Log_Debug( MODULE "Payload received %.*s\n", (int)nPayloadSize, (const char*)pbPayload);
 
-    return jsonRootValue;
+    return json_parse_buffer((const char*)pbPayload, nPayloadSize);
 }
 
 IOTHUB_CLIENT_RESULT AzureIoTJson_ToPayload(const JSON_Value* jsonValue, char** ppbResponse, size_t* pnResponseSize)
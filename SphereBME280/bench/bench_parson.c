@@ -0,0 +1,164 @@
+/**
+* @brief Host benchmark of the parson copy on device twin documents: parse time per document and
+*   the name lookups the twin handlers of main.c do (desired blink rate, color, reset timer,
+*   $version) plus a lookup of every reported property and its $metadata entry.
+*
+*   bench_parson [-i parse iterations] [-l lookup iterations] [twin.json ...]
+*
+*   Without files the twins of the twins directory are used. Build the previous parson.c the same
+*   way to compare.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "parson.h"
+
+#ifndef BENCH_TWIN_DIR
+#define BENCH_TWIN_DIR "twins"
+#endif
+
+static const char *acstrDefaultTwins[] = {
+    BENCH_TWIN_DIR "/sphere_bme280.json",
+    BENCH_TWIN_DIR "/many_settings.json"
+};
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/// @brief reads a whole file into a '\0' terminated buffer, NULL on failure
+static char *readFile(const char *cstrPath, size_t *pnSize)
+{
+    FILE *pFile = fopen(cstrPath, "rb");
+    char *pszContent = NULL;
+    long nSize = 0;
+
+    if ((pFile == NULL) || (fseek(pFile, 0, SEEK_END) != 0) || ((nSize = ftell(pFile)) < 0)) {
+        if (pFile != NULL) {
+            fclose(pFile);
+        }
+        return NULL;
+    }
+    rewind(pFile);
+    pszContent = malloc((size_t)nSize + 1);
+    if ((pszContent != NULL) && (fread(pszContent, 1, (size_t)nSize, pFile) != (size_t)nSize)) {
+        free(pszContent);
+        pszContent = NULL;
+    }
+    fclose(pFile);
+    if (pszContent != NULL) {
+        pszContent[nSize] = '\0';
+        *pnSize = (size_t)nSize;
+    }
+    return pszContent;
+}
+
+/// @brief the lookups of the twin handlers in main.c
+static double lookupHandlerProperties(const JSON_Object *jsonDesired)
+{
+    return json_object_dotget_number(jsonDesired, "rgbLed.blinkRateProperty")
+        + json_object_get_number(jsonDesired, "$version")
+        + (double)(json_object_get_string(jsonDesired, "color") != NULL)
+        + json_object_get_number(jsonDesired, "resetTimer");
+}
+
+/// @brief looks up every reported property and its $metadata entry by name
+static size_t lookupReportedProperties(const JSON_Object *jsonReported)
+{
+    const JSON_Object *jsonMetadata = json_object_get_object(jsonReported, "$metadata");
+    size_t nFound = 0;
+
+    for (size_t i = 0; i < json_object_get_count(jsonReported); i++) {
+        const char *cstrName = json_object_get_name(jsonReported, i);
+        nFound += (json_object_get_value(jsonReported, cstrName) != NULL);
+        nFound += (json_object_get_value(jsonMetadata, cstrName) != NULL);
+    }
+    return nFound;
+}
+
+static int benchTwin(const char *cstrPath, unsigned int nParseIterations, unsigned int nLookupIterations)
+{
+    size_t nSize = 0;
+    char *pszTwin = readFile(cstrPath, &nSize);
+    if (pszTwin == NULL) {
+        fprintf(stderr, "cannot read %s\n", cstrPath);
+        return -1;
+    }
+
+    JSON_Value *jsonRoot = NULL;
+    double fStart = nowSeconds();
+    for (unsigned int i = 0; i < nParseIterations; i++) {
+        json_value_free(jsonRoot);
+        jsonRoot = json_parse_string(pszTwin);
+    }
+    double fParseSeconds = (nowSeconds() - fStart) / nParseIterations;
+    if (jsonRoot == NULL) {
+        fprintf(stderr, "%s is not valid JSON\n", cstrPath);
+        free(pszTwin);
+        return -1;
+    }
+
+    const JSON_Object *jsonDesired = json_object_get_object(json_object(jsonRoot), "desired");
+    const JSON_Object *jsonReported = json_object_get_object(json_object(jsonRoot), "reported");
+    size_t nReportedLookups = 2 * json_object_get_count(jsonReported);
+    volatile double fSink = 0;
+
+    fStart = nowSeconds();
+    for (unsigned int i = 0; i < nLookupIterations; i++) {
+        fSink += lookupHandlerProperties(jsonDesired);
+    }
+    double fHandlerSeconds = (nowSeconds() - fStart) / nLookupIterations;
+
+    fStart = nowSeconds();
+    for (unsigned int i = 0; i < nLookupIterations; i++) {
+        fSink += (double)lookupReportedProperties(jsonReported);
+    }
+    double fReportedSeconds = (nowSeconds() - fStart) / nLookupIterations / (double)(nReportedLookups ? nReportedLookups : 1);
+
+    printf("%-40s %6zu bytes  parse %8.1f us (%6.1f MB/s)  handler lookups %6.1f ns  reported lookup %6.1f ns (%zu names)\n",
+        cstrPath, nSize, fParseSeconds * 1e6, (double)nSize / fParseSeconds / 1e6,
+        fHandlerSeconds * 1e9, fReportedSeconds * 1e9, nReportedLookups / 2);
+    (void)fSink;
+
+    json_value_free(jsonRoot);
+    free(pszTwin);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int nParseIterations = 2000;
+    unsigned int nLookupIterations = 200000;
+    int iOption;
+    int iResult = EXIT_SUCCESS;
+
+    while ((iOption = getopt(argc, argv, "i:l:")) != -1) {
+        switch (iOption) {
+        case 'i': nParseIterations = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'l': nLookupIterations = (unsigned int)strtoul(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "usage: %s [-i parse iterations] [-l lookup iterations] [twin.json ...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if ((nParseIterations == 0) || (nLookupIterations == 0)) {
+        return EXIT_FAILURE;
+    }
+
+    if (optind == argc) {
+        for (size_t i = 0; i < sizeof(acstrDefaultTwins) / sizeof(acstrDefaultTwins[0]); i++) {
+            iResult |= (benchTwin(acstrDefaultTwins[i], nParseIterations, nLookupIterations) != 0);
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        iResult |= (benchTwin(argv[i], nParseIterations, nLookupIterations) != 0);
+    }
+    return iResult;
+}
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <applibs/log.h>
+
+#include "parson.h"
+#include "json_arena.h"
+
+#define MODULE "[ARENA] "
+
+/// @brief all allocations are aligned to 8 bytes (double values in JSON_Value)
+#define ARENA_ALIGNMENT (8)
+#define ARENA_ALIGN(n) (((n) + (ARENA_ALIGNMENT - 1)) & ~((size_t)ARENA_ALIGNMENT - 1))
+
+/// @brief minimum payload size of heap allocated overflow blocks
+#define ARENA_OVERFLOW_BLOCK_SIZE (1024)
+
+/// @brief arena block header. First block is static, overflow blocks are heap allocated
+typedef struct arena_block_s {
+    struct arena_block_s *pNext;
+    size_t nSize;
+    size_t nUsed;
+    unsigned char *pData;
+} arena_block_t;
+
+/// @brief static memory for the first block
+static _Alignas(ARENA_ALIGNMENT) unsigned char abArenaMemory[JSON_ARENA_SIZE];
+
+static arena_block_t blkStatic = { .pNext = NULL, .nSize = JSON_ARENA_SIZE, .nUsed = 0, .pData = abArenaMemory };
+
+/// @brief block currently used for allocations
+static arena_block_t *pCurrentBlock = &blkStatic;
+
+/// @brief last allocation can be rolled back on free (parson frees temporaries in LIFO order)
+static void *pLastAllocation = NULL;
+
+/// @brief scope nesting level
+static unsigned int nScopeDepth = 0;
+
+/// @brief bytes used in the current scope (all blocks)
+static size_t nScopeUsage = 0;
+
+static size_t nPeakUsage = 0;
+static size_t nOverflowCount = 0;
+
+
+/**
+* @brief    checks if pointer belongs to one of the arena blocks
+*/
+static arena_block_t *findBlock(const void *ptr)
+{
+    for (arena_block_t *pBlock = &blkStatic; pBlock != NULL; pBlock = pBlock->pNext) {
+        if (((const unsigned char *)ptr >= pBlock->pData) &&
+            ((const unsigned char *)ptr < pBlock->pData + pBlock->nSize)) {
+            return pBlock;
+        }
+    }
+    return NULL;
+}
+
+/**
+* @brief    parson malloc replacement: bumps the current block, chains a heap block on overflow
+*/
+static void *arenaMalloc(size_t nSize)
+{
+    size_t nAligned = ARENA_ALIGN(nSize == 0 ? 1 : nSize);
+
+    if (pCurrentBlock->nSize - pCurrentBlock->nUsed < nAligned) {
+        size_t nBlockSize = (nAligned > ARENA_OVERFLOW_BLOCK_SIZE) ? nAligned : ARENA_OVERFLOW_BLOCK_SIZE;
+        arena_block_t *pBlock = (arena_block_t *)malloc(ARENA_ALIGN(sizeof(arena_block_t)) + nBlockSize);
+        if (pBlock == NULL) {
+            Log_Debug(MODULE "ERROR: out of memory.\n");
+            return NULL;
+        }
+        pBlock->pNext = NULL;
+        pBlock->nSize = nBlockSize;
+        pBlock->nUsed = 0;
+        pBlock->pData = (unsigned char *)pBlock + ARENA_ALIGN(sizeof(arena_block_t));
+        pCurrentBlock->pNext = pBlock;
+        pCurrentBlock = pBlock;
+        nOverflowCount++;
+    }
+
+    void *ptr = pCurrentBlock->pData + pCurrentBlock->nUsed;
+    pCurrentBlock->nUsed += nAligned;
+    nScopeUsage += nAligned;
+    pLastAllocation = ptr;
+    return ptr;
+}
+
+/**
+* @brief    parson free replacement: no-op for arena memory except for rolling back the last
+*           allocation. Memory allocated before the scope was opened goes back to the heap.
+*/
+static void arenaFree(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    arena_block_t *pBlock = findBlock(ptr);
+    if (pBlock == NULL) {
+        free(ptr);
+        return;
+    }
+
+    if (ptr == pLastAllocation && pBlock == pCurrentBlock) {
+        size_t nReleased = pBlock->nUsed - (size_t)((unsigned char *)ptr - pBlock->pData);
+        pBlock->nUsed -= nReleased;
+        nScopeUsage -= nReleased;
+        pLastAllocation = NULL;
+    }
+}
+
+
+void JsonArena_Begin(void)
+{
+    if (nScopeDepth++ == 0) {
+        json_set_allocation_functions(arenaMalloc, arenaFree);
+    }
+}
+
+
+void JsonArena_End(void)
+{
+    if (nScopeDepth == 0) {
+        Log_Debug(MODULE "WARNING: JsonArena_End() without JsonArena_Begin().\n");
+        return;
+    }
+    if (--nScopeDepth > 0) {
+        return;
+    }
+
+    json_set_allocation_functions(malloc, free);
+
+    if (nScopeUsage > nPeakUsage) {
+        nPeakUsage = nScopeUsage;
+        Log_Debug(MODULE "INFO: new peak usage %u of %u bytes (%u overflows).\n",
+            (unsigned int)nPeakUsage, (unsigned int)JSON_ARENA_SIZE, (unsigned int)nOverflowCount);
+    }
+
+    // release overflow blocks and rewind static block
+    arena_block_t *pBlock = blkStatic.pNext;
+    while (pBlock != NULL) {
+        arena_block_t *pNext = pBlock->pNext;
+        free(pBlock);
+        pBlock = pNext;
+    }
+    blkStatic.pNext = NULL;
+    blkStatic.nUsed = 0;
+    pCurrentBlock = &blkStatic;
+    pLastAllocation = NULL;
+    nScopeUsage = 0;
+}
+
+
+size_t JsonArena_GetPeakUsage(void)
+{
+    return nPeakUsage;
+}
+
+
+size_t JsonArena_GetOverflowCount(void)
+{
+    return nOverflowCount;
+}
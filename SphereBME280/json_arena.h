@@ -0,0 +1,48 @@
+/**
+* @file json_arena.h
+* @brief Bump allocator for parson JSON trees that only live for one telemetry cycle.
+*   Between JsonArena_Begin() and JsonArena_End() all parson allocations are served from
+*   a static block (plus heap overflow blocks if needed) and parson's free is a no-op.
+*   JsonArena_End() releases every JSON_Value built in the scope in O(1), so trees created
+*   inside the scope do not need json_value_free().
+* @note  JSON values created inside a scope MUST NOT be used after JsonArena_End() and values
+*   created outside a scope MUST NOT be attached to a tree created inside.
+*/
+#pragma once
+#ifndef _JSON_ARENA_H_
+#define _JSON_ARENA_H_
+
+#include <stddef.h>
+
+/// @brief size of the static arena block. Overflow is served by additional heap blocks.
+#ifndef JSON_ARENA_SIZE
+#define JSON_ARENA_SIZE (4096)
+#endif
+
+/**
+* @brief    Opens an arena scope and installs the arena allocator into parson.
+*           Scopes may be nested, only the outermost JsonArena_End() releases memory.
+*/
+void JsonArena_Begin(void);
+
+/**
+* @brief    Closes an arena scope. The outermost call resets the arena in O(1), frees overflow
+*           blocks and restores malloc/free as parson allocation functions.
+*/
+void JsonArena_End(void);
+
+/**
+* @brief    Returns the highest number of bytes used within a single arena scope since start.
+*           Use this to size JSON_ARENA_SIZE against the user-mode memory budget.
+* @return   peak arena usage in bytes (including alignment padding)
+*/
+size_t JsonArena_GetPeakUsage(void);
+
+/**
+* @brief    Returns how often a scope needed heap overflow blocks because JSON_ARENA_SIZE
+*           was too small.
+* @return   number of overflow block allocations since start
+*/
+size_t JsonArena_GetOverflowCount(void);
+
+#endif // _JSON_ARENA_H_
@@ -83,6 +83,7 @@
 #include "azure_iot_json.h"
 #include "azure_iot_pnp.h"
 #include "azure_iot_central.h"
+#include "json_arena.h"
 
 
 
@@ -415,6 +416,7 @@ static void SendEventMessage(const char * cstrComponent, const char * cstrEvent,
 	if (connectedToIoTHub) {
 		Log_Debug("[Send] Component '%s' event '%s' is '%s'\n", cstrComponent, cstrEvent, cstrMessage);
 
+        JsonArena_Begin();
         JSON_Value  *jsonRootValue = json_value_init_object();
         JSON_Object *jsonRootObject = json_value_get_object( jsonRootValue );
 
@@ -423,7 +425,8 @@ static void SendEventMessage(const char * cstrComponent, const char * cstrEvent,
 		// Send a message
 		AzureIoT_PnP_SendJsonMessage(jsonRootValue, cstrComponent);
 
-        json_value_free(jsonRootValue);
+        // releases jsonRootValue
+        JsonArena_End();
 
 		// Set the send/receive LED2 to blink once immediately to indicate 
 		// the message has been queued.
@@ -436,10 +439,13 @@ static void SendEventMessage(const char * cstrComponent, const char * cstrEvent,
 }
 
 /// @brief Sends a telemetry message to Azure IoT Central.
+/// All JSON trees are built in one arena scope and released together by JsonArena_End().
 /// 
 static void SendTelemetryMessage(void)
 {
     if (connectedToIoTHub) {
+        JsonArena_Begin();
+
         // initialize root object
         JSON_Value * jsonRootValue = json_value_init_object();
         JSON_Object * jsonRootObject = json_value_get_object( jsonRootValue );
@@ -471,8 +477,6 @@ static void SendTelemetryMessage(void)
             AzureIoT_PnP_SendJsonMessage(jsonRootValue, cstrBMP280Component);
         }
 #endif
-        json_value_free( jsonRootValue );
-
 
         size_t nTotalMemUsed = Applications_GetTotalMemoryUsageInKB();
         size_t nUserMemUsed = Applications_GetUserModeMemoryUsageInKB();
@@ -489,9 +493,11 @@ static void SendTelemetryMessage(void)
             json_object_set_number(jsonRootObject, cstrDevHealthUserMemoryUsed, (double) (nUserMemUsed * 1024));
     
             AzureIoT_PnP_SendJsonMessage(jsonRootValue, cstrDevHealthComponent);
-            json_value_free(jsonRootValue);
         }
 
+        // releases all JSON trees of this telemetry cycle at once
+        JsonArena_End();
+
 	    BlinkLed2Once( RgbLedUtility_Colors_Green );
 
     } else {
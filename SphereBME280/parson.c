@@ -47,6 +47,12 @@
 #define sscanf THINK_TWICE_ABOUT_USING_SSCANF
 
 #define STARTING_CAPACITY 16
+
+/* [JSchwert] objects with at least this many names get a lazily built hash index for lookups */
+#ifndef PARSON_OBJECT_INDEX_THRESHOLD
+#define PARSON_OBJECT_INDEX_THRESHOLD 16
+#endif
+#define OBJECT_INVALID_IX ((size_t)-1)
 #define MAX_NESTING 2048
 
 #define FLOAT_FORMAT "%1.17g" /* do not increase precision without incresing NUM_BUF_SIZE */
@@ -55,9 +61,9 @@
 
 #define SIZEOF_TOKEN(a) (sizeof(a) - 1)
 #define SKIP_CHAR(str) ((*str)++)
-#define SKIP_WHITESPACES(str)                 \
-    while (isspace((unsigned char)(**str))) { \
-        SKIP_CHAR(str);                       \
+#define SKIP_WHITESPACES(str)                     \
+    while (isspace((unsigned char)PEEK_CHAR(str))) { \
+        SKIP_CHAR(str);                           \
     }
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
@@ -67,6 +73,16 @@
 static JSON_Malloc_Function parson_malloc = malloc;
 static JSON_Free_Function parson_free = free;
 
+/* [JSchwert] Begin: length bounded parsing (json_parse_buffer) */
+/* end of the buffer parsed by json_parse_buffer(), NULL while parsing '\0' terminated strings */
+static const char *parson_parse_end = NULL;
+
+/* current parser character, the end of a bounded buffer reads as '\0' */
+#define PEEK_CHAR(str) ((parson_parse_end != NULL && *(str) >= parson_parse_end) ? '\0' : **(str))
+/* number of characters left in a bounded buffer */
+#define REMAINING(ptr) ((parson_parse_end != NULL) ? (size_t)(parson_parse_end - (ptr)) : (size_t)-1)
+/* [JSchwert] End */
+
 #define IS_CONT(b) (((unsigned char)(b)&0xC0) == 0x80) /* is utf-8 continuation byte */
 
 /* Type definitions */
@@ -85,12 +101,20 @@ struct json_value_t {
     JSON_Value_Value value;
 };
 
+/* [JSchwert] open addressing hash index slot, item is the name index + 1 (0 marks an empty slot) */
+typedef struct json_object_index_slot {
+    unsigned long hash;
+    size_t item;
+} JSON_Object_Index_Slot;
+
 struct json_object_t {
     JSON_Value *wrapping_value;
     char **names;
     JSON_Value **values;
     size_t count;
     size_t capacity;
+    JSON_Object_Index_Slot *index; /* NULL until first lookup with count >= threshold */
+    size_t index_capacity;         /* power of 2, at least twice the count */
 };
 
 struct json_array_t {
@@ -117,6 +141,11 @@ static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_V
 static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_t name_len,
                                     JSON_Value *value);
 static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity);
+static unsigned long hash_string(const char *string, size_t n);
+static void json_object_index_drop(JSON_Object *object);
+static int json_object_index_insert(JSON_Object *object, size_t item);
+static int json_object_index_build(JSON_Object *object);
+static size_t json_object_getn_ix(const JSON_Object *object, const char *name, size_t name_len);
 static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
                                           size_t name_len);
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
@@ -186,6 +215,9 @@ static int hex_char_to_int(char c)
 static int parse_utf16_hex(const char *s, unsigned int *result)
 {
     int x1, x2, x3, x4;
+    if (REMAINING(s) < 4) {
+        return 0;
+    }
     if (s[0] == '\0' || s[1] == '\0' || s[2] == '\0' || s[3] == '\0') {
         return 0;
     }
@@ -334,6 +366,8 @@ static JSON_Object *json_object_init(JSON_Value *wrapping_value)
     new_obj->values = (JSON_Value **)NULL;
     new_obj->capacity = 0;
     new_obj->count = 0;
+    new_obj->index = NULL;
+    new_obj->index_capacity = 0;
     return new_obj;
 }
 
@@ -352,7 +386,7 @@ static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_
     if (object == NULL || name == NULL || value == NULL) {
         return JSONFailure;
     }
-    if (json_object_getn_value(object, name, name_len) != NULL) {
+    if (json_object_getn_ix(object, name, name_len) != OBJECT_INVALID_IX) {
         return JSONFailure;
     }
     if (object->count >= object->capacity) {
@@ -369,6 +403,9 @@ static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_
     value->parent = json_object_get_wrapping_value(object);
     object->values[index] = value;
     object->count++;
+    if (object->index != NULL && !json_object_index_insert(object, index)) {
+        json_object_index_drop(object); /* rebuilt on next lookup */
+    }
     return JSONSuccess;
 }
 
@@ -402,45 +439,130 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
     return JSONSuccess;
 }
 
-static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
-                                          size_t name_len)
+/* [JSchwert] Begin: hash index for objects with many names */
+static unsigned long hash_string(const char *string, size_t n)
 {
-    size_t i, name_length;
-    for (i = 0; i < json_object_get_count(object); i++) {
-        name_length = strlen(object->names[i]);
-        if (name_length != name_len) {
+    unsigned long hash = 5381;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        hash = ((hash << 5) + hash) + (unsigned char)string[i]; /* hash * 33 + c */
+    }
+    return hash;
+}
+
+static void json_object_index_drop(JSON_Object *object)
+{
+    parson_free(object->index);
+    object->index = NULL;
+    object->index_capacity = 0;
+}
+
+/* Adds names[item] to the index, fails if the index would get more than half full */
+static int json_object_index_insert(JSON_Object *object, size_t item)
+{
+    size_t mask = object->index_capacity - 1;
+    unsigned long hash = 0;
+    size_t slot = 0;
+    if (2 * object->count > object->index_capacity) {
+        return 0;
+    }
+    hash = hash_string(object->names[item], strlen(object->names[item]));
+    slot = hash & mask;
+    while (object->index[slot].item != 0) {
+        slot = (slot + 1) & mask;
+    }
+    object->index[slot].hash = hash;
+    object->index[slot].item = item + 1;
+    return 1;
+}
+
+static int json_object_index_build(JSON_Object *object)
+{
+    size_t capacity = 2 * STARTING_CAPACITY, i;
+    while (capacity < 2 * object->count) {
+        capacity *= 2;
+    }
+    object->index = (JSON_Object_Index_Slot *)parson_malloc(capacity * sizeof(JSON_Object_Index_Slot));
+    if (object->index == NULL) {
+        return 0;
+    }
+    memset(object->index, 0, capacity * sizeof(JSON_Object_Index_Slot));
+    object->index_capacity = capacity;
+    for (i = 0; i < object->count; i++) {
+        json_object_index_insert(object, i);
+    }
+    return 1;
+}
+
+/* Returns the position of name in names or OBJECT_INVALID_IX, uses the index if present */
+static size_t json_object_getn_ix(const JSON_Object *object, const char *name, size_t name_len)
+{
+    size_t i;
+    if (object == NULL) {
+        return OBJECT_INVALID_IX;
+    }
+    if (object->index != NULL) {
+        size_t mask = object->index_capacity - 1;
+        unsigned long hash = hash_string(name, name_len);
+        size_t slot = hash & mask;
+        while (object->index[slot].item != 0) {
+            i = object->index[slot].item - 1;
+            if (object->index[slot].hash == hash && strncmp(object->names[i], name, name_len) == 0 &&
+                object->names[i][name_len] == '\0') {
+                return i;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return OBJECT_INVALID_IX;
+    }
+    for (i = 0; i < object->count; i++) {
+        if (strlen(object->names[i]) != name_len) {
             continue;
         }
         if (strncmp(object->names[i], name, name_len) == 0) {
-            return object->values[i];
+            return i;
         }
     }
-    return NULL;
+    return OBJECT_INVALID_IX;
+}
+/* [JSchwert] End */
+
+/* Lookups build the index lazily (not the duplicate check while parsing). It is a cache, so it is
+   built on const objects too; without memory for it the lookup stays linear. */
+static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
+                                          size_t name_len)
+{
+    size_t i;
+    if (object != NULL && object->index == NULL && object->count >= PARSON_OBJECT_INDEX_THRESHOLD) {
+        json_object_index_build((JSON_Object *)object);
+    }
+    i = json_object_getn_ix(object, name, name_len);
+    return (i != OBJECT_INVALID_IX) ? object->values[i] : NULL;
 }
 
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
                                                int free_value)
 {
     size_t i = 0, last_item_index = 0;
-    if (object == NULL || json_object_get_value(object, name) == NULL) {
+    if (object == NULL || name == NULL) {
+        return JSONFailure;
+    }
+    i = json_object_getn_ix(object, name, strlen(name));
+    if (i == OBJECT_INVALID_IX) {
         return JSONFailure;
     }
     last_item_index = json_object_get_count(object) - 1;
-    for (i = 0; i < json_object_get_count(object); i++) {
-        if (strcmp(object->names[i], name) == 0) {
-            parson_free(object->names[i]);
-            if (free_value) {
-                json_value_free(object->values[i]);
-            }
-            if (i != last_item_index) { /* Replace key value pair with one from the end */
-                object->names[i] = object->names[last_item_index];
-                object->values[i] = object->values[last_item_index];
-            }
-            object->count -= 1;
-            return JSONSuccess;
-        }
+    parson_free(object->names[i]);
+    if (free_value) {
+        json_value_free(object->values[i]);
+    }
+    if (i != last_item_index) { /* Replace key value pair with one from the end */
+        object->names[i] = object->names[last_item_index];
+        object->values[i] = object->values[last_item_index];
     }
-    return JSONFailure; /* No execution path should end here */
+    object->count -= 1;
+    json_object_index_drop(object); /* positions changed, rebuilt on next lookup */
+    return JSONSuccess;
 }
 
 static JSON_Status json_object_dotremove_internal(JSON_Object *object, const char *name,
@@ -469,6 +591,7 @@ static void json_object_free(JSON_Object *object)
     }
     parson_free(object->names);
     parson_free(object->values);
+    parson_free(object->index);
     parson_free(object);
 }
 
@@ -545,16 +668,16 @@ static JSON_Value *json_value_init_string_no_copy(char *string)
 /* Parser */
 static JSON_Status skip_quotes(const char **string)
 {
-    if (**string != '\"') {
+    if (PEEK_CHAR(string) != '\"') {
         return JSONFailure;
     }
     SKIP_CHAR(string);
-    while (**string != '\"') {
-        if (**string == '\0') {
+    while (PEEK_CHAR(string) != '\"') {
+        if (PEEK_CHAR(string) == '\0') {
             return JSONFailure;
-        } else if (**string == '\\') {
+        } else if (PEEK_CHAR(string) == '\\') {
             SKIP_CHAR(string);
-            if (**string == '\0') {
+            if (PEEK_CHAR(string) == '\0') {
                 return JSONFailure;
             }
         }
@@ -707,7 +830,7 @@ static JSON_Value *parse_value(const char **string, size_t nesting)
         return NULL;
     }
     SKIP_WHITESPACES(string);
-    switch (**string) {
+    switch (PEEK_CHAR(string)) {
     case '{':
         return parse_object_value(string, nesting + 1);
     case '[':
@@ -745,25 +868,25 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
     if (output_value == NULL) {
         return NULL;
     }
-    if (**string != '{') {
+    if (PEEK_CHAR(string) != '{') {
         json_value_free(output_value);
         return NULL;
     }
     output_object = json_value_get_object(output_value);
     SKIP_CHAR(string);
     SKIP_WHITESPACES(string);
-    if (**string == '}') { /* empty object */
+    if (PEEK_CHAR(string) == '}') { /* empty object */
         SKIP_CHAR(string);
         return output_value;
     }
-    while (**string != '\0') {
+    while (PEEK_CHAR(string) != '\0') {
         new_key = get_quoted_string(string);
         if (new_key == NULL) {
             json_value_free(output_value);
             return NULL;
         }
         SKIP_WHITESPACES(string);
-        if (**string != ':') {
+        if (PEEK_CHAR(string) != ':') {
             parson_free(new_key);
             json_value_free(output_value);
             return NULL;
@@ -783,14 +906,14 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
         }
         parson_free(new_key);
         SKIP_WHITESPACES(string);
-        if (**string != ',') {
+        if (PEEK_CHAR(string) != ',') {
             break;
         }
         SKIP_CHAR(string);
         SKIP_WHITESPACES(string);
     }
     SKIP_WHITESPACES(string);
-    if (**string != '}' || /* Trim object after parsing is over */
+    if (PEEK_CHAR(string) != '}' || /* Trim object after parsing is over */
         json_object_resize(output_object, json_object_get_count(output_object)) == JSONFailure) {
         json_value_free(output_value);
         return NULL;
@@ -807,18 +930,18 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
     if (output_value == NULL) {
         return NULL;
     }
-    if (**string != '[') {
+    if (PEEK_CHAR(string) != '[') {
         json_value_free(output_value);
         return NULL;
     }
     output_array = json_value_get_array(output_value);
     SKIP_CHAR(string);
     SKIP_WHITESPACES(string);
-    if (**string == ']') { /* empty array */
+    if (PEEK_CHAR(string) == ']') { /* empty array */
         SKIP_CHAR(string);
         return output_value;
     }
-    while (**string != '\0') {
+    while (PEEK_CHAR(string) != '\0') {
         new_array_value = parse_value(string, nesting);
         if (new_array_value == NULL) {
             json_value_free(output_value);
@@ -830,14 +953,14 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
             return NULL;
         }
         SKIP_WHITESPACES(string);
-        if (**string != ',') {
+        if (PEEK_CHAR(string) != ',') {
             break;
         }
         SKIP_CHAR(string);
         SKIP_WHITESPACES(string);
     }
     SKIP_WHITESPACES(string);
-    if (**string != ']' || /* Trim array after parsing is over */
+    if (PEEK_CHAR(string) != ']' || /* Trim array after parsing is over */
         json_array_resize(output_array, json_array_get_count(output_array)) == JSONFailure) {
         json_value_free(output_value);
         return NULL;
@@ -865,10 +988,11 @@ static JSON_Value *parse_boolean_value(const char **string)
 {
     size_t true_token_size = SIZEOF_TOKEN("true");
     size_t false_token_size = SIZEOF_TOKEN("false");
-    if (strncmp("true", *string, true_token_size) == 0) {
+    if (REMAINING(*string) >= true_token_size && strncmp("true", *string, true_token_size) == 0) {
         *string += true_token_size;
         return json_value_init_boolean(1);
-    } else if (strncmp("false", *string, false_token_size) == 0) {
+    } else if (REMAINING(*string) >= false_token_size &&
+               strncmp("false", *string, false_token_size) == 0) {
         *string += false_token_size;
         return json_value_init_boolean(0);
     }
@@ -879,19 +1003,45 @@ static JSON_Value *parse_number_value(const char **string)
 {
     char *end;
     double number = 0;
+    const char *number_string = *string;
+    char num_buf[NUM_BUF_SIZE];
+    char *copy = NULL;
+    int decimal = 0;
+    int number_errno = 0;
+    if (parson_parse_end != NULL) {
+        /* [JSchwert] strtod() needs a terminated string. Copy every character it could read (digits,
+           sign, '.', exponent, hex, inf/nan), so strtod() and is_decimal() see what they see in a string */
+        size_t len = 0;
+        while (len < REMAINING(*string) && (*string)[len] != '\0' &&
+               (isalnum((unsigned char)(*string)[len]) || strchr("+-._()", (*string)[len]) != NULL)) {
+            len++;
+        }
+        copy = (len < sizeof(num_buf)) ? num_buf : (char *)parson_malloc(len + 1);
+        if (copy == NULL) {
+            return NULL;
+        }
+        memcpy(copy, *string, len);
+        copy[len] = '\0';
+        number_string = copy;
+    }
     errno = 0;
-    number = strtod(*string, &end);
-    if (errno || !is_decimal(*string, (size_t)(end - *string))) {
+    number = strtod(number_string, &end);
+    number_errno = errno;
+    decimal = is_decimal(number_string, (size_t)(end - number_string));
+    if (copy != NULL && copy != num_buf) {
+        parson_free(copy);
+    }
+    if (number_errno || !decimal) {
         return NULL;
     }
-    *string = end;
+    *string += end - number_string;
     return json_value_init_number(number);
 }
 
 static JSON_Value *parse_null_value(const char **string)
 {
     size_t token_size = SIZEOF_TOKEN("null");
-    if (strncmp("null", *string, token_size) == 0) {
+    if (REMAINING(*string) >= token_size && strncmp("null", *string, token_size) == 0) {
         *string += token_size;
         return json_value_init_null();
     }
@@ -1225,6 +1375,24 @@ JSON_Value *json_parse_string(const char *string)
     return parse_value((const char **)&string, 0);
 }
 
+/* [JSchwert] Begin: length bounded parsing */
+JSON_Value *json_parse_buffer(const char *buffer, size_t buffer_len)
+{
+    JSON_Value *result = NULL;
+    if (buffer == NULL) {
+        return NULL;
+    }
+    if (buffer_len >= 3 && buffer[0] == '\xEF' && buffer[1] == '\xBB' && buffer[2] == '\xBF') {
+        buffer = buffer + 3; /* Support for UTF-8 BOM */
+        buffer_len -= 3;
+    }
+    parson_parse_end = buffer + buffer_len;
+    result = parse_value(&buffer, 0);
+    parson_parse_end = NULL;
+    return result;
+}
+/* [JSchwert] End */
+
 JSON_Value *json_parse_string_with_comments(const char *string)
 {
     JSON_Value *result = NULL;
@@ -1880,16 +2048,13 @@ JSON_Status json_object_set_value(JSON_Object *object, const char *name, JSON_Va
     if (object == NULL || name == NULL || value == NULL || value->parent != NULL) {
         return JSONFailure;
     }
-    old_value = json_object_get_value(object, name);
-    if (old_value != NULL) { /* free and overwrite old value */
+    i = json_object_getn_ix(object, name, strlen(name));
+    if (i != OBJECT_INVALID_IX) { /* free and overwrite old value */
+        old_value = object->values[i];
         json_value_free(old_value);
-        for (i = 0; i < json_object_get_count(object); i++) {
-            if (strcmp(object->names[i], name) == 0) {
-                value->parent = json_object_get_wrapping_value(object);
-                object->values[i] = value;
-                return JSONSuccess;
-            }
-        }
+        value->parent = json_object_get_wrapping_value(object);
+        object->values[i] = value;
+        return JSONSuccess;
     }
     /* add new key value pair */
     return json_object_add(object, name, value);
@@ -2032,6 +2197,7 @@ JSON_Status json_object_clear(JSON_Object *object)
         json_value_free(object->values[i]);
     }
     object->count = 0;
+    json_object_index_drop(object);
     return JSONSuccess;
 }
 